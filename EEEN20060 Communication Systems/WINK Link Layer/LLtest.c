@@ -7,12 +7,16 @@
 typedef unsigned char byte;
 
 #include <stdio.h>  // standard input-output library
+#ifdef _WIN32
 #include <windows.h>  // needed for sleep function
+#else
+#include <unistd.h>   // for usleep function
+#define Sleep(ms) usleep((ms) * 1000)  // same as Windows version
+#endif
 #include "linklayer.h"  // link layer functions
 
 #define DEBUG 1 // flag to make link layer functions print more
-#define BLK_SIZE 50  // max data block size in bytes
-// this value is small for testing - can increase
+// block size is chosen by the link layer, to suit the line
 
 // Function prototypes
 int sendFile(char *fName, int debug);
@@ -24,10 +28,11 @@ int main()
     char fName[80];  // string to hold filename
     int retVal;     // return value from functions
     FILE *fpi, *fpo;  // file handles for input and output files
-    byte dataSend[BLK_SIZE+2];  // array of bytes to send
-    byte dataReceive[BLK_SIZE+2];  // bytes received
+    static byte dataSend[MAX_BLK];  // array of bytes to send
+    static byte dataReceive[MAX_BLK];  // bytes received
     int nByte, nRx, nWrite;  // byte counts
     long SendCount = 0, RxCount = 0; // more byte counters
+    static LL_context link;  // state of the link - large, so not on stack
 
     printf("Link Layer Test Program\n");  // welcome message
 
@@ -56,7 +61,8 @@ int main()
 
     // Ask link layer to connect to other computer
     printf("Main: Connecting...\n");
-    retVal = LL_connect(DEBUG);  // try to connect
+    LL_init(&link, 1);  // set up link state, to use port 1
+    retVal = LL_connect(&link, DEBUG);  // try to connect
     if (retVal < 0)  // problem connecting
     {
         fclose(fpi);     // close input file
@@ -67,8 +73,8 @@ int main()
     // Send the contents of the file, one block at a time
     do  // loop block by block
     {
-        // read bytes from file, store in array
-        nByte = (int) fread(dataSend, 1, BLK_SIZE, fpi);
+        // read bytes from file, as many as suit the line now
+        nByte = (int) fread(dataSend, 1, LL_blockSize(&link), fpi);
         if (ferror(fpi))  // check for error
         {
             perror("Main: Error reading input file");
@@ -78,13 +84,13 @@ int main()
         SendCount += nByte;  // add to byte count
 
         // send bytes to link layer
-        retVal = LL_send(dataSend, nByte, DEBUG);  // retVal is 0 if succeeded
+        retVal = LL_send(&link, dataSend, nByte, DEBUG);  // 0 if succeeded
         if (retVal != 0) break; // need to get out of loop
 
         Sleep(10);  // Short delay to allow progress to be seen
 
         // receive bytes from link layer, up to size of array
-        nRx = LL_receive(dataReceive, BLK_SIZE+2, DEBUG);
+        nRx = LL_receive(&link, dataReceive, MAX_BLK, DEBUG);
         // nRx will be number of bytes received, or negative if error
         if (nRx < 0 ) printf("Main: Error receiving data, code %d\n",nRx);
         else if (nRx == 0) printf("Main: Zero bytes received\n");
@@ -114,7 +120,8 @@ int main()
 
     fclose(fpi);    // close input file
     fclose(fpo);    // close output file
-    LL_discon(DEBUG);  // disconnect
+    LL_flush(&link, DEBUG);   // wait for last frames to be acknowledged
+    LL_discon(&link, DEBUG);  // disconnect
     return 0;
 
 }  // end of receiveFile
@@ -0,0 +1,344 @@
+/* EEEN20060 Communication Systems, bonded link test
+   This program sends blocks through a bond of links, each on its own
+   pair of ports of the loopback physical layer (loop-physical.c):
+   the sending end uses ports 1, 3, 5..., and the receiving end
+   2, 4, 6...  One thread sends on bond A while another receives on
+   bond B.  It is repeated with 1 link, then 2, up to the number
+   given, so the goodput can be compared - with the same line on
+   every link, it should grow in proportion to the number of links.
+   One link can be made to fail part way through: from then on, its
+   line is all errors, in both directions, so the link gives up after
+   MAX_TRIES, and its blocks go on the other links.  The re-transmit
+   time is limited to TEST_TXWAIT, so this is found sooner.
+   The loopback runs in virtual time, so the times shown are the
+   times the transfer would take on the lines.
+   Optional arguments: largest number of links, number of blocks,
+   block size, bit rate, one-way latency in ms, link to fail (1 for
+   the first, 0 for none), number of blocks to send before it fails. */
+
+typedef unsigned char byte;
+
+#include <stdio.h>  // standard input-output library
+#include <stdlib.h>  // for atoi
+#ifdef _WIN32
+#include <windows.h>  // for thread functions
+#define THREAD_RESULT DWORD WINAPI  // type of thread function
+#else
+#include <pthread.h>  // for thread functions
+#define THREAD_RESULT void *  // type of thread function
+#endif
+#include "linklayer.h"  // link layer functions
+#include "linkbond.h"  // bonded link functions
+#include "physical.h"  // physical layer functions
+#include "loop-physical.h"  // to set the latency
+
+#define BLOCK_SIZE 200  // default data bytes in each block
+#define TEST_BLOCKS 400  // default number of blocks to send
+#define TEST_LATENCY 20  // default one-way latency, ms
+#define TEST_RATE 9600  // default bit rate, bit/s
+#define TEST_SEED 1  // seed for simulated errors
+#define TEST_TXWAIT 1.0  // longest re-transmit time, seconds
+#define FAIL_ERR 0.5  // probability of bit error on a failed line
+
+/* Settings and results for one transfer, shared by the two threads */
+typedef struct BondTest
+{
+    int nLinks;         // links in each bond
+    int nBlocks;        // number of blocks to send
+    int blockSize;      // data bytes in each block
+    int bitRate;        // bit rate, bit/s
+    long latency;       // one-way latency, us
+    int failLink;       // link to fail, from 1, or 0 for none
+    int failAt;         // blocks sent before it fails
+    volatile int sendDone;  // set when the sender has finished
+    int sendResult;     // 0 if all blocks were sent, negative otherwise
+    int nGot, nBad;     // blocks received, and received wrong
+    long long nMoved;   // blocks sent again after their link failed
+    int linksLeft;      // links working at the end
+    long long startTime;    // simulated time sending started, us
+    long long endTime;      // simulated time last block arrived, us
+    LL_bond *bondA;     // sending end
+    LL_bond *bondB;     // receiving end
+} BondTest;
+
+// Function prototypes
+THREAD_RESULT sender(void *arg);
+THREAD_RESULT receiver(void *arg);
+int runTest(BondTest *test);
+int setupBond(BondTest *test, LL_bond *bond, unsigned long seed);
+void failLine(BondTest *test);
+void fillBlock(byte *block, int nByte, long offset);
+
+static LL_context linksA[BOND_MAXLINKS], linksB[BOND_MAXLINKS];  // large
+static LL_bond bondA, bondB;  // large, so not on stack
+
+
+int main(int argc, char *argv[])
+{
+    BondTest test;  // settings and results
+    double seconds;  // simulated time for transfer
+    double goodput, single = 0.0;  // goodput, and with one link
+    int maxLinks;  // largest number of links to try
+    int n, failed = 0;  // for use in loop, and count of failures
+
+    maxLinks = (argc > 1) ? atoi(argv[1]) : BOND_MAXLINKS;
+    test.nBlocks = (argc > 2) ? atoi(argv[2]) : TEST_BLOCKS;
+    test.blockSize = (argc > 3) ? atoi(argv[3]) : BLOCK_SIZE;
+    test.bitRate = (argc > 4) ? atoi(argv[4]) : TEST_RATE;
+    test.latency = 1000L * ((argc > 5) ? atoi(argv[5]) : TEST_LATENCY);
+    test.failLink = (argc > 6) ? atoi(argv[6]) : 0;
+    test.failAt = (argc > 7) ? atoi(argv[7]) : test.nBlocks / 2;
+    if ((maxLinks < 1) || (maxLinks > BOND_MAXLINKS) || (test.nBlocks < 1)
+        || (test.blockSize < 1) || (test.blockSize > MAX_BLK - BOND_HDR)
+        || (test.bitRate < 1) || (test.latency < 0)
+        || (test.failLink < 0) || (test.failLink > maxLinks))
+    {
+        printf("Arguments: links 1 to %d, blocks, block size up to %d, "
+               "bit rate, latency ms, link to fail, blocks before it "
+               "fails\n", BOND_MAXLINKS, MAX_BLK - BOND_HDR);
+        return 1;
+    }
+
+    printf("Bonded Link Test: %d blocks of %d bytes, latency %ld ms, "
+           "%d bit/s per link", test.nBlocks, test.blockSize,
+           test.latency / 1000, test.bitRate);
+    if (test.failLink) printf(", link %d fails after %d blocks",
+                              test.failLink, test.failAt);
+    printf("\n\nlinks  line_s   goodput_bit_s  scaling  moved  left  "
+           "result\n");
+
+    for (n = 1; n <= maxLinks; n++)
+    {
+        test.nLinks = n;
+        if (runTest(&test) < 0) failed++;
+        seconds = (double) (test.endTime - test.startTime) / 1.0E6;
+        if (seconds <= 0.0) seconds = 1.0E-6;
+        goodput = 8.0 * test.nGot * test.blockSize / seconds;
+        if (n == 1) single = goodput;
+
+        printf("%5d %7.1f %15.0f %8.2f %6lld %5d  %s\n", n, seconds,
+               goodput, (single > 0.0) ? goodput / single : 0.0,
+               test.nMoved, test.linksLeft,
+               (test.sendResult < 0) ? "link failed" :
+               (test.nBad > 0) || (test.nGot < test.nBlocks) ?
+                   "data wrong" : "ok");
+    }
+    return (failed > 0) ? 1 : 0;
+}
+
+
+/* Function to do one transfer, with a thread for each end.
+   Each thread connects its own bond, as the two ends must agree
+   the settings of each link.  The virtual clock is held until the
+   first two ports are open - a thread that is between ports still
+   keeps the clock from moving, so neither end can time out before
+   the other opens its next port.
+   Argument: settings, also used for results.
+   Return value is 0 if all blocks were received correctly,
+   negative otherwise.  */
+int runTest(BondTest *test)
+{
+    LL_context *listA[BOND_MAXLINKS], *listB[BOND_MAXLINKS];  // links
+    int i;  // for use in loop
+#ifdef _WIN32
+    HANDLE threads[2];  // sender and receiver threads
+#else
+    pthread_t threads[2];  // sender and receiver threads
+#endif
+
+    test->sendDone = 0;
+    test->sendResult = 0;
+    test->nGot = 0;
+    test->nBad = 0;
+    test->nMoved = 0;
+    test->linksLeft = 0;
+    test->startTime = 0;
+    test->endTime = 0;
+    test->bondA = &bondA;
+    test->bondB = &bondB;
+
+    for (i = 0; i < test->nLinks; i++)
+    {
+        LL_init(&linksA[i], 2*i + 1);
+        LL_init(&linksB[i], 2*i + 2);
+        listA[i] = &linksA[i];
+        listB[i] = &linksB[i];
+        if ((LL_setLine(&linksA[i], test->bitRate, 0.0, 0) < 0)
+            || (LL_setLine(&linksB[i], test->bitRate, 0.0, 0) < 0)
+            || (LL_setTimeouts(&linksA[i], TEST_TXWAIT, RX_WAIT, 1, 0) < 0)
+            || (LL_setTimeouts(&linksB[i], TEST_TXWAIT, RX_WAIT, 1, 0) < 0))
+        {
+            printf("Test: Could not set up links\n");
+            test->sendResult = -1;
+            return -1;
+        }
+    }
+    if ((LL_bondInit(&bondA, listA, test->nLinks) < 0)
+        || (LL_bondInit(&bondB, listB, test->nLinks) < 0))
+    {
+        test->sendResult = -1;
+        return -1;
+    }
+    PHY_expectPorts(2);  // hold the clock until the first pair is open -
+                         // the links connect one pair at a time
+
+#ifdef _WIN32
+    threads[0] = CreateThread(NULL, 0, sender, test, 0, NULL);
+    threads[1] = CreateThread(NULL, 0, receiver, test, 0, NULL);
+    if ((threads[0] == NULL) || (threads[1] == NULL))
+    {
+        printf("Test: Could not start threads\n");
+        return -1;
+    }
+    WaitForMultipleObjects(2, threads, TRUE, INFINITE);
+    CloseHandle(threads[0]);
+    CloseHandle(threads[1]);
+#else
+    if ((pthread_create(&threads[0], NULL, sender, test) != 0)
+        || (pthread_create(&threads[1], NULL, receiver, test) != 0))
+    {
+        printf("Test: Could not start threads\n");
+        return -1;
+    }
+    pthread_join(threads[0], NULL);
+    pthread_join(threads[1], NULL);
+#endif
+
+    if ((test->sendResult < 0) || (test->nBad > 0)
+        || (test->nGot < test->nBlocks)) return -1;
+    return 0;
+}
+
+
+/* Thread function to send all the blocks on bond A, failing a line
+   part way through, if asked for.
+   Argument: pointer to the test settings.  */
+THREAD_RESULT sender(void *arg)
+{
+    BondTest *test = arg;  // settings and results
+    byte dataSend[MAX_BLK];  // block to send
+    int n;  // number of blocks sent so far
+    int retVal = 0;  // return value from functions
+
+    retVal = setupBond(test, test->bondA, TEST_SEED);
+    test->startTime = PHY_time();
+    for (n = 0; (n < test->nBlocks) && (retVal >= 0); n++)
+    {
+        if ((n == test->failAt) && (test->failLink > 0)
+            && (test->failLink <= test->nLinks)) failLine(test);
+        fillBlock(dataSend, test->blockSize, (long) n * test->blockSize);
+        retVal = LL_bondSend(test->bondA, dataSend, test->blockSize, 0);
+    }
+    if (retVal >= 0) retVal = LL_bondFlush(test->bondA, 0);
+
+    test->sendResult = (retVal < 0) ? retVal : 0;
+    test->nMoved = test->bondA->txMoved;
+    test->linksLeft = LL_bondLinks(test->bondA);
+    test->sendDone = 1;
+    LL_bondDiscon(test->bondA, 0);
+    return 0;
+}
+
+
+/* Thread function to receive and check the blocks on bond B.
+   After the last block, it keeps the links going until the sender
+   has finished, so any acknowledgements that were lost can be
+   repeated.
+   Argument: pointer to the test settings.  */
+THREAD_RESULT receiver(void *arg)
+{
+    BondTest *test = arg;  // settings and results
+    byte dataReceive[MAX_BLK];  // block received
+    byte expected[MAX_BLK];  // block that should have been received
+    int i, retVal = 0;  // for use in loop, and return value from functions
+
+    retVal = setupBond(test, test->bondB, TEST_SEED + 1);
+    if (retVal < 0) test->sendResult = retVal;  // no link, nothing received
+    while ((retVal >= 0) && (test->nGot < test->nBlocks))
+    {
+        retVal = LL_bondReceive(test->bondB, dataReceive, MAX_BLK, 0);
+        if (retVal < 0) break;  // every link has failed
+        fillBlock(expected, test->blockSize,
+                  (long) test->nGot * test->blockSize);
+        if (retVal != test->blockSize) test->nBad++;
+        else
+        {
+            for (i = 0; i < retVal; i++)
+                if (dataReceive[i] != expected[i]) break;
+            if (i < retVal) test->nBad++;  // block is not right
+        }
+        test->nGot++;
+    }
+    test->endTime = PHY_time();  // not counting the wait for the sender
+
+    if (retVal >= 0)
+        while (!test->sendDone)  // answer any repeated frames
+            LL_bondReceive(test->bondB, dataReceive, MAX_BLK, 0);
+
+    LL_bondDiscon(test->bondB, 0);
+    return 0;
+}
+
+
+/* Function to connect one end, and set up the simulated line from
+   each of its ports: latency, and the seed for the errors.
+   Arguments: settings, bond to connect, seed for its errors.
+   Return value is 0 on success, negative on failure.  */
+int setupBond(BondTest *test, LL_bond *bond, unsigned long seed)
+{
+    int i;  // for use in loop
+
+    if (LL_bondConnect(bond, 0) < 0)
+    {
+        printf("Test: Could not connect bond\n");
+        return -1;
+    }
+    for (i = 0; i < bond->nLinks; i++)
+    {
+        if (!bond->link[i]->connected) continue;
+        if (PHY_setLatency(bond->link[i]->phy, test->latency) < 0)
+        {
+            printf("Test: Could not set up link on port %d\n",
+                   bond->link[i]->portNum);
+            return -1;
+        }
+        PHY_setSeed(bond->link[i]->phy, seed + i);
+    }
+    return 0;
+}
+
+
+/* Function to make the line of one link all errors, in both
+   directions, from now on - a burst that starts at once, and in
+   practice never ends.
+   Argument: settings, giving the link to fail.  */
+void failLine(BondTest *test)
+{
+    LL_context *ends[2];  // the two ends of the link
+    int i;  // for use in loop
+
+    ends[0] = test->bondA->link[test->failLink - 1];
+    ends[1] = test->bondB->link[test->failLink - 1];
+    printf("Test: Line of link %d fails\n", test->failLink);
+    for (i = 0; i < 2; i++)
+        if (ends[i]->connected)
+            PHY_setBurst(ends[i]->phy, 1.0, 1.0E-12, FAIL_ERR);
+}
+
+
+/* Function to fill a block with bytes that depend on their position
+   in the data sent, so the receiver can check them.  Each byte is a
+   hash of its position.
+   Arguments: block, number of bytes, position of first byte.  */
+void fillBlock(byte *block, int nByte, long offset)
+{
+    unsigned long x;  // hash of position
+    int i;  // for use in loop
+
+    for (i = 0; i < nByte; i++)
+    {
+        x = ((unsigned long) (offset + i) * 2654435761UL) & 0xFFFFFFFFUL;
+        x ^= x >> 15;
+        block[i] = (byte) (x >> 8);
+    }
+}
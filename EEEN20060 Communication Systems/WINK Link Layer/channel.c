@@ -0,0 +1,153 @@
+/*  Simulated line errors, for the physical layer.
+       chanInit     sets up a channel with independent bit errors
+       chanSeed     starts the random numbers again from a given seed
+       chanBurst    changes to the Gilbert-Elliott burst error model
+       chanApply    adds errors to a block of received bytes
+       chanRandom   gives the next random number
+    The random number generator is PCG32 (O'Neill, 2014): a 64-bit
+    linear congruential step, with a permutation of the output.
+    Bits are counted from the least significant bit of each byte,
+    as a UART sends them.  */
+
+typedef unsigned char byte;
+
+#include <stdio.h>    // for printf
+#include <time.h>     // for time function, used as default seed
+#include <math.h>     // for log and log1p
+#include "channel.h"  // these functions
+
+#define NEVER INT64_MAX  // distance to an event that will not happen
+
+//===================================================================
+/* Function to give the next random number, from 0 to 2^32 - 1.  */
+uint32_t chanRandom(ErrChannel *ch)
+{
+    uint64_t old = ch->rngState;  // state before this step
+    uint32_t shifted;  // high bits mixed down
+    int rot;  // amount to rotate by, from top bits
+
+    ch->rngState = old * 6364136223846793005ULL + ch->rngInc;
+    shifted = (uint32_t) (((old >> 18) ^ old) >> 27);
+    rot = (int) (old >> 59);
+    return (shifted >> rot) | (shifted << ((-rot) & 31));
+}
+
+//===================================================================
+/* Function to find the number of bits before an event that has
+   probability p on each bit.  Uses the inverse of the geometric
+   distribution, with one random number.  */
+static int64_t geometric(ErrChannel *ch, double p)
+{
+    double u;  // uniform random number, 0 < u <= 1
+
+    if (p <= 0.0) return NEVER;
+    if (p >= 1.0) return 0;
+    u = ((double) chanRandom(ch) + 1.0) / 4294967296.0;
+    return (int64_t) (log(u) / log1p(-p));
+}
+
+//===================================================================
+/* Function to set up a channel with independent bit errors, seeding
+   the random numbers from the time.
+   Arguments: pointer to channel, probability of bit error.  */
+void chanInit(ErrChannel *ch, double probErr)
+{
+    if ((probErr < 0.0) || (probErr > 1.0)) probErr = 0.0;  // not valid
+    ch->probErr[0] = probErr;
+    ch->probErr[1] = probErr;
+    ch->probLeave[0] = 0.0;  // stay in good state
+    ch->probLeave[1] = 1.0;
+    ch->nErrors = 0;
+    chanSeed(ch, 0);
+}
+
+//===================================================================
+/* Function to start the random numbers again from a given seed,
+   and start again in the good state.
+   Arguments: pointer to channel, seed - 0 to use the time.  */
+void chanSeed(ErrChannel *ch, unsigned long seed)
+{
+    uint64_t init = seed;  // starting value
+
+    if (seed == 0)  // use the address too, so ports opened together differ
+    {
+        init = (uint64_t) time(NULL);
+        ch->rngInc = ((uint64_t) (size_t) ch << 1) | 1;
+    }
+    else ch->rngInc = 1442695040888963407ULL;  // same stream every run
+    ch->rngState = 0;
+    chanRandom(ch);
+    ch->rngState += init;
+    chanRandom(ch);
+
+    ch->bad = 0;
+    ch->toError = geometric(ch, ch->probErr[0]);
+    ch->toSwitch = geometric(ch, ch->probLeave[0]);
+}
+
+//===================================================================
+/* Function to change to the burst error model.  The probability of
+   error given to chanInit applies in the good state.
+   Arguments: pointer to channel, probability per bit of going from
+              good to bad state, and from bad to good state,
+              probability of bit error in the bad state.
+   Returns 0, or negative if any probability is not valid.  */
+int chanBurst(ErrChannel *ch, double probGoodBad, double probBadGood,
+              double probErrBad)
+{
+    if ((probGoodBad < 0.0) || (probGoodBad > 1.0) || (probBadGood <= 0.0)
+        || (probBadGood > 1.0) || (probErrBad < 0.0) || (probErrBad > 1.0))
+    {
+        printf("CHAN: Invalid burst probabilities %g, %g, %g\n",
+               probGoodBad, probBadGood, probErrBad);
+        return -1;
+    }
+    ch->probLeave[0] = probGoodBad;
+    ch->probLeave[1] = probBadGood;
+    ch->probErr[1] = probErrBad;
+    ch->bad = 0;  // start in good state
+    ch->toError = geometric(ch, ch->probErr[0]);
+    ch->toSwitch = geometric(ch, ch->probLeave[0]);
+    return 0;
+}
+
+//===================================================================
+/* Function to add errors to a block of bytes, as they are received.
+   Jumps from one event to the next - an error or a change of state -
+   so the work depends on the number of errors, not of bytes.
+   Arguments: pointer to channel, pointer to bytes, number of bytes.
+   Returns the number of bits changed.  */
+int chanApply(ErrChannel *ch, byte *data, int nBytes)
+{
+    int64_t nBits = 8 * (int64_t) nBytes;  // bits in this block
+    int64_t pos = 0;  // bit position in block
+    int nChanged = 0;  // number of bits changed
+
+    while (pos < nBits)
+    {
+        if (ch->toError < ch->toSwitch)  // next error comes first
+        {
+            if (ch->toError >= nBits - pos) break;  // not in this block
+            pos += ch->toError;
+            if (ch->toSwitch != NEVER) ch->toSwitch -= ch->toError + 1;
+            data[pos / 8] ^= (byte) (1 << (pos % 8));  // invert the bit
+            nChanged++;
+            pos++;
+            ch->toError = geometric(ch, ch->probErr[ch->bad]);
+        }
+        else  // line changes state first
+        {
+            if (ch->toSwitch >= nBits - pos) break;  // not in this block
+            pos += ch->toSwitch;
+            ch->bad = !ch->bad;
+            ch->toSwitch = geometric(ch, ch->probLeave[ch->bad]);
+            ch->toError = geometric(ch, ch->probErr[ch->bad]);
+        }
+    }
+
+    // The rest of the block passes without an event
+    if (ch->toError != NEVER) ch->toError -= nBits - pos;
+    if (ch->toSwitch != NEVER) ch->toSwitch -= nBits - pos;
+    ch->nErrors += nChanged;
+    return nChanged;
+}
@@ -0,0 +1,60 @@
+#ifndef CHANNEL_H_INCLUDED
+#define CHANNEL_H_INCLUDED
+
+/*  Simulated line errors, for the physical layer.
+       chanInit     sets up a channel with independent bit errors
+       chanSeed     starts the random numbers again from a given seed
+       chanBurst    changes to the Gilbert-Elliott burst error model
+       chanApply    adds errors to a block of received bytes
+       chanRandom   gives the next random number
+    Random numbers come from PCG32, which is fast, and gives the same
+    sequence on every system for a given seed, unlike rand().
+    Instead of a random number for every bit or byte, the number of
+    good bits before the next error is drawn from the geometric
+    distribution, so a block with no errors costs almost nothing.
+    In the burst model, the line moves between a good state and a bad
+    state, each with its own probability of bit error, and the number
+    of bits spent in each state is also geometric.  */
+
+#include <stdint.h>  // for fixed size integer types
+
+typedef struct ErrChannel
+{
+    uint64_t rngState;      // state of random number generator
+    uint64_t rngInc;        // stream of random number generator, odd
+    double probErr[2];      // probability of bit error, good and bad state
+    double probLeave[2];    // probability per bit of leaving each state
+    int bad;                // 1 in bad state, 0 in good state
+    int64_t toError;        // good bits before the next error
+    int64_t toSwitch;       // bits before the next change of state
+    long nErrors;           // number of bits changed so far
+} ErrChannel;
+
+/* Function to set up a channel with independent bit errors, seeding
+   the random numbers from the time.
+   Arguments: pointer to channel, probability of bit error.  */
+void chanInit(ErrChannel *ch, double probErr);
+
+/* Function to start the random numbers again from a given seed,
+   so that the same errors happen in the same places every run.
+   Arguments: pointer to channel, seed - 0 to use the time.  */
+void chanSeed(ErrChannel *ch, unsigned long seed);
+
+/* Function to change to the burst error model.  The probability of
+   error given to chanInit applies in the good state.
+   Arguments: pointer to channel, probability per bit of going from
+              good to bad state, and from bad to good state,
+              probability of bit error in the bad state.
+   Returns 0, or negative if any probability is not valid.  */
+int chanBurst(ErrChannel *ch, double probGoodBad, double probBadGood,
+              double probErrBad);
+
+/* Function to add errors to a block of bytes, as they are received.
+   Arguments: pointer to channel, pointer to bytes, number of bytes.
+   Returns the number of bits changed.  */
+int chanApply(ErrChannel *ch, byte *data, int nBytes);
+
+/* Function to give the next random number, from 0 to 2^32 - 1.  */
+uint32_t chanRandom(ErrChannel *ch);
+
+#endif // CHANNEL_H_INCLUDED
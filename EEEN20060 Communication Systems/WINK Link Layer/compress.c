@@ -0,0 +1,262 @@
+/*  Compression functions for the link layer.
+       compInit    sets up one direction of a link, with no history
+       compBlock   compresses a block to be sent
+       compExpand  puts a block received after the history, expanding
+                   it if it was compressed
+       compAccept  adds the block last expanded to the history
+    The history and the next block are kept together in one buffer,
+    so a match can run from the history into the block without any
+    special case.  Once there is more than 2*COMP_HISTORY bytes of
+    history, all but the last COMP_HISTORY bytes are dropped, so the
+    buffer is moved once for every COMP_HISTORY bytes or so, not for
+    every block.  Both ends drop history at the same points, as they
+    see the same blocks, but matches are limited to COMP_HISTORY bytes
+    back in any case, so that does not matter for the coding.
+    A match may overlap the bytes it is copied to, so it is copied a
+    byte at a time - a run of one byte is a match with offset 1.
+    The compressor gives up as soon as the result would be as long as
+    the block, so incompressible data cost little time, and are sent
+    as they are.  The expander checks every length and offset, so a
+    bad block cannot make it write outside the buffer.  */
+
+typedef unsigned char byte;
+
+#include <string.h>     // for memcpy and memmove
+#include "compress.h"   // these functions
+
+#define COMP_NOPOS (-1)  // table entry with no position
+
+//===================================================================
+/* Function to find the hash of COMP_MINMATCH bytes, for the table
+   of positions - multiplying spreads the bits, and the top bits
+   depend on all the bytes.  */
+static int hash4(const byte *p)
+{
+    unsigned long v = ((unsigned long) p[0] << 24) | (p[1] << 16)
+                      | (p[2] << 8) | p[3];
+
+    return (int) (((v * 2654435761UL) & 0xFFFFFFFFUL)
+                  >> (32 - COMP_HASHBITS));
+}
+
+//===================================================================
+/* Function to drop old history, if needed to make room for the
+   next block, and move the table positions to match.  */
+static void makeRoom(CompStream *cs)
+{
+    int drop;  // bytes of history to drop
+    int i;  // for use in loop
+
+    if (cs->nHist <= 2*COMP_HISTORY) return;  // still room
+    drop = cs->nHist - COMP_HISTORY;
+    memmove(cs->buf, cs->buf + drop, COMP_HISTORY);
+    cs->nHist = COMP_HISTORY;
+    for (i = 0; i < (1 << COMP_HASHBITS); i++)
+        cs->table[i] = (cs->table[i] >= drop) ? cs->table[i] - drop
+                                              : COMP_NOPOS;
+}
+
+//===================================================================
+/* Function to add a length to the output - the part that did not
+   fit in the token, as bytes of 255 then the rest.
+   Arguments: output array, position in it, room in it, length.
+   Returns the new position, or -1 if there is no room.  */
+static int putLength(byte *out, int n, int room, int len)
+{
+    while (len >= 255)
+    {
+        if (n >= room) return -1;
+        out[n++] = 255;
+        len -= 255;
+    }
+    if (n >= room) return -1;
+    out[n++] = (byte) len;
+    return n;
+}
+
+//===================================================================
+/* Function to add one sequence to the output: literals, then a match
+   if the length is not 0.
+   Arguments: output array, position in it, room in it,
+              literal bytes, number of literals, match offset,
+              match length, or 0 for the last sequence.
+   Returns the new position, or -1 if there is no room.  */
+static int putSequence(byte *out, int n, int room, const byte *lit,
+                       int nLit, int offset, int len)
+{
+    int litCode = (nLit < 15) ? nLit : 15;  // literals in token
+    int lenCode = 0;  // match length in token
+
+    if (len > 0)
+        lenCode = (len - COMP_MINMATCH < 15) ? len - COMP_MINMATCH : 15;
+    if (n >= room) return -1;
+    out[n++] = (byte) ((litCode << 4) | lenCode);
+    if (litCode == 15)
+    {
+        n = putLength(out, n, room, nLit - 15);
+        if (n < 0) return -1;
+    }
+    if (nLit > room - n) return -1;
+    memcpy(out + n, lit, nLit);
+    n += nLit;
+    if (len == 0) return n;  // last sequence
+
+    if (n + 2 > room) return -1;
+    out[n++] = (byte) (offset >> 8);  // high byte first
+    out[n++] = (byte) offset;
+    if (lenCode == 15) n = putLength(out, n, room, len - COMP_MINMATCH - 15);
+    return n;
+}
+
+//===================================================================
+/* Function to read a length, the part that did not fit in the token.
+   Arguments: input array, pointer to position in it, bytes in it,
+              length from the token.
+   Returns the length, or -1 if the input ends first.  */
+static int getLength(const byte *in, int *i, int nIn, int len)
+{
+    byte b;  // next byte of length
+
+    if (len < 15) return len;
+    do
+    {
+        if (*i >= nIn) return -1;
+        b = in[(*i)++];
+        len += b;
+    }
+    while (b == 255);
+    return len;
+}
+
+//===================================================================
+/* Function to set up one direction of a link, with no history.
+   Arguments: pointer to stream, storage for COMP_STORE(maxBlk) bytes,
+              largest block.  */
+void compInit(CompStream *cs, byte *store, int maxBlk)
+{
+    int i;  // for use in loop
+
+    cs->buf = store;
+    cs->maxBlk = maxBlk;
+    cs->nHist = 0;
+    for (i = 0; i < (1 << COMP_HASHBITS); i++) cs->table[i] = COMP_NOPOS;
+}
+
+//===================================================================
+/* Function to compress a block to be sent, which is then added to
+   the history.  Each position is looked up in the table, and the
+   longest match there is taken; positions inside a match are added
+   to the table, so later blocks can find them.
+   Arguments: pointer to stream, array for the result, room for
+              nData bytes, bytes of the block, number of bytes.
+   Returns the number of bytes in the result, or -1 if compressing
+   would not make the block shorter, so it should be sent as it is.  */
+int compBlock(CompStream *cs, byte *dataOut, const byte *dataIn, int nData)
+{
+    byte *buf;  // history, then the block
+    int start, end;  // positions of block in buf
+    int pos, anchor;  // position now, and start of literals
+    int cand;  // earlier position with the same hash
+    int len;  // length of match
+    int k;  // for use in loop
+    int n = 0;  // bytes of result
+    int room = nData - 1;  // result must be shorter than the block
+
+    if ((nData < 1) || (nData > cs->maxBlk)) return -1;
+    makeRoom(cs);
+    buf = cs->buf;
+    start = cs->nHist;
+    end = start + nData;
+    memcpy(buf + start, dataIn, nData);
+    cs->nHist = end;  // the block is history from now on
+
+    pos = start;
+    anchor = start;
+    while ((n >= 0) && (pos + COMP_MINMATCH <= end))
+    {
+        k = hash4(buf + pos);
+        cand = cs->table[k];
+        cs->table[k] = pos;
+        if ((cand == COMP_NOPOS) || (pos - cand > COMP_HISTORY)
+            || (memcmp(buf + cand, buf + pos, COMP_MINMATCH) != 0))
+        {
+            pos++;  // no match here
+            continue;
+        }
+
+        len = COMP_MINMATCH;
+        while ((pos + len < end) && (buf[cand + len] == buf[pos + len]))
+            len++;
+        n = putSequence(dataOut, n, room, buf + anchor, pos - anchor,
+                        pos - cand, len);
+        for (k = pos + 1; (k < pos + len) && (k + COMP_MINMATCH <= end); k++)
+            cs->table[hash4(buf + k)] = k;
+        pos += len;
+        anchor = pos;
+    }
+    if ((n >= 0) && (anchor < end))  // the rest are literals
+        n = putSequence(dataOut, n, room, buf + anchor, end - anchor, 0, 0);
+    return n;  // -1 if there was no room
+}
+
+//===================================================================
+/* Function to put a block received after the history, expanding it
+   if it was compressed.  It is not in the history until compAccept()
+   is called, so a block that cannot be used yet can be given again.
+   Arguments: pointer to stream, pointer to pointer which is set to
+              the start of the block, bytes received, number of bytes,
+              1 if compressed, 0 if sent as it is.
+   Returns the number of bytes in the block, or -1 if the compressed
+   bytes are not valid, or the block is too large.  The block stays
+   valid until the next call to compExpand().  */
+int compExpand(CompStream *cs, byte **dataOut, const byte *dataIn,
+               int nIn, int coded)
+{
+    byte *out;  // where the block goes, after the history
+    int room = cs->maxBlk;  // largest block
+    int n = 0;  // bytes of block so far
+    int i = 0;  // position in input
+    int token;  // first byte of sequence
+    int nLit, len, offset;  // literals, match length and offset
+    int k;  // for use in loop
+
+    makeRoom(cs);
+    out = cs->buf + cs->nHist;
+    *dataOut = out;
+    if (!coded)  // sent as it is - only needs to be in the history
+    {
+        if (nIn > room) return -1;
+        memcpy(out, dataIn, nIn);
+        return nIn;
+    }
+
+    while (i < nIn)
+    {
+        token = dataIn[i++];
+        nLit = getLength(dataIn, &i, nIn, token >> 4);
+        if ((nLit < 0) || (nLit > nIn - i) || (nLit > room - n)) return -1;
+        memcpy(out + n, dataIn + i, nLit);
+        i += nLit;
+        n += nLit;
+        if (i == nIn) break;  // last sequence has no match
+
+        if (i + 2 > nIn) return -1;
+        offset = (dataIn[i] << 8) | dataIn[i+1];
+        i += 2;
+        len = getLength(dataIn, &i, nIn, token & 15);
+        if (len < 0) return -1;
+        len += COMP_MINMATCH;
+        if ((offset == 0) || (offset > COMP_HISTORY)
+            || (offset > cs->nHist + n) || (len > room - n)) return -1;
+        for (k = 0; k < len; k++, n++) out[n] = out[n - offset];
+    }
+    return n;
+}
+
+//===================================================================
+/* Function to add the block last given by compExpand() to the history.
+   Arguments: pointer to stream, number of bytes in the block.  */
+void compAccept(CompStream *cs, int nData)
+{
+    cs->nHist += nData;
+}
@@ -0,0 +1,74 @@
+#ifndef COMPRESS_H_INCLUDED
+#define COMPRESS_H_INCLUDED
+
+/*  Compression functions for the link layer.
+       compInit    sets up one direction of a link, with no history
+       compBlock   compresses a block to be sent
+       compExpand  puts a block received after the history, expanding
+                   it if it was compressed
+       compAccept  adds the block last expanded to the history
+    Each direction of a link has its own stream, with a history of
+    the blocks sent or accepted before, so a block can refer to text
+    in earlier blocks as well as in itself.  This matters, as blocks
+    on a slow line are short, and say much the same as the last few.
+    The sender adds each block to its history as it is compressed,
+    and the receiver adds each block accepted in sequence, so both
+    histories hold the same bytes - a frame sent again carries the
+    same compressed block, so it still matches.
+    The coding is LZ77, laid out much as in the LZ4 block format: a
+    sequence of literal bytes, then a match - an offset back into the
+    data, up to COMP_HISTORY bytes, and a length of at least
+    COMP_MINMATCH.  Each sequence starts with a token byte, with the
+    number of literals in the top 4 bits and the match length, less
+    COMP_MINMATCH, in the bottom 4.  If either is 15, more bytes
+    follow, each added to it, until one that is not 255.  Then come
+    the literals, then the offset, 2 bytes, high byte first, then
+    the extra bytes of the match length.  The last sequence in a
+    block has literals only, and ends with the block.
+    Matches are found using a table of the last position seen for
+    each hash of COMP_MINMATCH bytes, so the cost of compressing is
+    a few steps per byte, and expanding is little more than a copy.  */
+
+#define COMP_HISTORY 4096   // bytes back a match can refer to
+#define COMP_MINMATCH 4     // shortest match coded
+#define COMP_HASHBITS 12    // bits in hash, for table of positions
+#define COMP_STORE(maxBlk) (2*COMP_HISTORY + (maxBlk))  // storage needed
+
+typedef struct CompStream
+{
+    byte *buf;          // history, then room for the next block
+    int maxBlk;         // largest block, room needed after the history
+    int nHist;          // bytes of history at the start of buf
+    int table[1 << COMP_HASHBITS];  // last position of each hash, or -1
+} CompStream;
+
+/* Function to set up one direction of a link, with no history.
+   Arguments: pointer to stream, storage for COMP_STORE(maxBlk) bytes,
+              largest block.  */
+void compInit(CompStream *cs, byte *store, int maxBlk);
+
+/* Function to compress a block to be sent, which is then added to
+   the history.
+   Arguments: pointer to stream, array for the result, room for
+              nData bytes, bytes of the block, number of bytes.
+   Returns the number of bytes in the result, or -1 if compressing
+   would not make the block shorter, so it should be sent as it is.  */
+int compBlock(CompStream *cs, byte *dataOut, const byte *dataIn, int nData);
+
+/* Function to put a block received after the history, expanding it
+   if it was compressed.  It is not in the history until compAccept()
+   is called, so a block that cannot be used yet can be given again.
+   Arguments: pointer to stream, pointer to pointer which is set to
+              the start of the block, bytes received, number of bytes,
+              1 if compressed, 0 if sent as it is.
+   Returns the number of bytes in the block, or -1 if the compressed
+   bytes are not valid, or the block is too large.  The block stays
+   valid until the next call to compExpand().  */
+int compExpand(CompStream *cs, byte **dataOut, const byte *dataIn,
+               int nIn, int coded);
+
+/* Function to add the block last given by compExpand() to the history.
+   Arguments: pointer to stream, number of bytes in the block.  */
+void compAccept(CompStream *cs, int nData);
+
+#endif // COMPRESS_H_INCLUDED
@@ -0,0 +1,195 @@
+/*  Frame check sequence functions for the link layer.
+       fcsSize      gives the number of bytes in the check sequence
+       fcsCompute   calculates the check sequence over a block of bytes
+       fcsPut       writes a check sequence value into a frame
+       fcsGet       reads a check sequence value from a frame
+    CRC-16-CCITT is calculated most significant bit first, starting
+    from 0xFFFF.  CRC-32 is calculated least significant bit first,
+    starting from and finally inverted with 0xFFFFFFFF, as in Ethernet.
+    Both use lookup tables.  The first table gives the effect of one
+    byte on the CRC.  Each further table gives the effect of a byte
+    followed by one more zero byte, so several bytes can be combined
+    in one step (slicing), using one table for each byte position.  */
+
+typedef unsigned char byte;
+
+#include "fcs.h"  // these functions
+
+#define CRC16_POLY 0x1021      // CRC-16-CCITT generator, MSB first
+#define CRC32_POLY 0xEDB88320  // CRC-32 generator, bit-reversed for LSB first
+
+/* Tables are shared by the functions in this file only.  */
+static uint16_t crc16Table[4][256];  // slice-by-4 tables for CRC-16
+static uint32_t crc32Table[8][256];  // slice-by-8 tables for CRC-32
+static int tablesReady = 0;          // set to 1 once tables are built
+
+//===================================================================
+/* Function to build the lookup tables, the first time needed.  */
+static void buildTables(void)
+{
+    int i, j, k;  // for use in loops
+    uint16_t c16;  // CRC-16 value being calculated
+    uint32_t c32;  // CRC-32 value being calculated
+
+    for (i = 0; i < 256; i++)
+    {
+        // Effect of one byte, one bit at a time
+        c16 = (uint16_t) (i << 8);
+        c32 = (uint32_t) i;
+        for (j = 0; j < 8; j++)
+        {
+            c16 = (c16 & 0x8000) ? (uint16_t) ((c16 << 1) ^ CRC16_POLY)
+                                 : (uint16_t) (c16 << 1);
+            c32 = (c32 & 1) ? (c32 >> 1) ^ CRC32_POLY : (c32 >> 1);
+        }
+        crc16Table[0][i] = c16;
+        crc32Table[0][i] = c32;
+    }
+
+    // Each further table adds one zero byte after the first table
+    for (k = 1; k < 4; k++)
+        for (i = 0; i < 256; i++)
+        {
+            c16 = crc16Table[k-1][i];
+            crc16Table[k][i] = (uint16_t) ((c16 << 8) ^ crc16Table[0][c16 >> 8]);
+        }
+    for (k = 1; k < 8; k++)
+        for (i = 0; i < 256; i++)
+        {
+            c32 = crc32Table[k-1][i];
+            crc32Table[k][i] = (c32 >> 8) ^ crc32Table[0][c32 & 0xFF];
+        }
+
+    tablesReady = 1;
+}
+
+//===================================================================
+/* Function to build the lookup tables in advance.  The tables are
+   built the first time they are needed anyway, but if several threads
+   might need them at once, this should be called before the threads
+   start.  Calling it again does nothing.  */
+void fcsInit(void)
+{
+    if (!tablesReady) buildTables();
+}
+
+//===================================================================
+/* Function to calculate CRC-16-CCITT, 4 bytes per step.
+   Arguments: pointer to bytes, number of bytes.
+   Returns the CRC value.  */
+uint16_t crc16(const byte *data, int nBytes)
+{
+    uint16_t crc = 0xFFFF;  // initial value
+
+    if (!tablesReady) buildTables();
+
+    // Main loop - first two bytes are combined with the CRC
+    while (nBytes >= 4)
+    {
+        crc ^= (uint16_t) ((data[0] << 8) | data[1]);
+        crc = crc16Table[3][crc >> 8] ^ crc16Table[2][crc & 0xFF]
+            ^ crc16Table[1][data[2]] ^ crc16Table[0][data[3]];
+        data += 4;
+        nBytes -= 4;
+    }
+
+    // Remaining bytes, one at a time
+    while (nBytes-- > 0)
+        crc = (uint16_t) ((crc << 8) ^ crc16Table[0][(crc >> 8) ^ *data++]);
+
+    return crc;
+}
+
+//===================================================================
+/* Function to calculate CRC-32, 8 bytes per step.
+   Arguments: pointer to bytes, number of bytes.
+   Returns the CRC value.  */
+uint32_t crc32(const byte *data, int nBytes)
+{
+    uint32_t crc = 0xFFFFFFFF;  // initial value
+
+    if (!tablesReady) buildTables();
+
+    // Main loop - first four bytes are combined with the CRC
+    while (nBytes >= 8)
+    {
+        crc ^= (uint32_t) data[0] | ((uint32_t) data[1] << 8)
+             | ((uint32_t) data[2] << 16) | ((uint32_t) data[3] << 24);
+        crc = crc32Table[7][crc & 0xFF] ^ crc32Table[6][(crc >> 8) & 0xFF]
+            ^ crc32Table[5][(crc >> 16) & 0xFF] ^ crc32Table[4][crc >> 24]
+            ^ crc32Table[3][data[4]] ^ crc32Table[2][data[5]]
+            ^ crc32Table[1][data[6]] ^ crc32Table[0][data[7]];
+        data += 8;
+        nBytes -= 8;
+    }
+
+    // Remaining bytes, one at a time
+    while (nBytes-- > 0)
+        crc = (crc >> 8) ^ crc32Table[0][(crc ^ *data++) & 0xFF];
+
+    return crc ^ 0xFFFFFFFF;  // final inversion
+}
+
+//===================================================================
+/* Function to give the size of a check sequence, in bytes.
+   Returns 0 if the type is not valid.  */
+int fcsSize(int type)
+{
+    switch (type)
+    {
+        case FCS_SUM:   return 1;
+        case FCS_CRC16: return 2;
+        case FCS_CRC32: return 4;
+        default:        return 0;
+    }
+}
+
+//===================================================================
+/* Function to calculate a check sequence over a block of bytes.
+   The additive checksum is the value that makes the sum of the
+   bytes and the checksum a multiple of 256.
+   Arguments: check sequence type, pointer to bytes, number of bytes.
+   Returns the check sequence value.  */
+uint32_t fcsCompute(int type, const byte *data, int nBytes)
+{
+    int i;  // for use in loop
+    int checkSum = 0;
+
+    switch (type)
+    {
+        case FCS_CRC16: return crc16(data, nBytes);
+        case FCS_CRC32: return crc32(data, nBytes);
+        default:  // additive checksum
+            for (i = 0; i < nBytes; i++) checkSum += data[i];
+            return (uint32_t) ((256 - (checkSum%256))%256);
+    }
+}
+
+//===================================================================
+/* Function to put a check sequence value into a frame,
+   most significant byte first.  Returns number of bytes written.  */
+int fcsPut(int type, byte *frame, uint32_t value)
+{
+    int n = fcsSize(type);  // number of bytes
+    int i;  // for use in loop
+
+    for (i = n-1; i >= 0; i--)
+    {
+        frame[i] = (byte) (value & 0xFF);
+        value >>= 8;
+    }
+    return n;
+}
+
+//===================================================================
+/* Function to get a check sequence value from a frame,
+   most significant byte first.  */
+uint32_t fcsGet(int type, const byte *frame)
+{
+    int n = fcsSize(type);  // number of bytes
+    int i;  // for use in loop
+    uint32_t value = 0;
+
+    for (i = 0; i < n; i++) value = (value << 8) | frame[i];
+    return value;
+}
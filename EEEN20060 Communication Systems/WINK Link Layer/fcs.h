@@ -0,0 +1,46 @@
+#ifndef FCS_H_INCLUDED
+#define FCS_H_INCLUDED
+
+/*  Frame check sequence functions for the link layer.
+       fcsInit      builds the lookup tables, before threads start
+       fcsSize      gives the number of bytes in the check sequence
+       fcsCompute   calculates the check sequence over a block of bytes
+       fcsPut       writes a check sequence value into a frame
+       fcsGet       reads a check sequence value from a frame
+    The CRC functions use lookup tables, built the first time any
+    of these functions is used, and process several bytes per step. */
+
+#include <stdint.h>  // for fixed size integer types
+
+// Frame check sequence types
+#define FCS_SUM 0       // additive checksum, mod 256, 1 byte
+#define FCS_CRC16 1     // CRC-16-CCITT, polynomial 0x1021, 2 bytes
+#define FCS_CRC32 2     // CRC-32 (as Ethernet), polynomial 0x04C11DB7, 4 bytes
+#define FCS_MAXSIZE 4   // largest check sequence, in bytes
+
+/* Function to build the lookup tables in advance, so that
+   links in several threads do not build them at the same time.  */
+void fcsInit(void);
+
+/* Function to give the size of a check sequence, in bytes.
+   Returns 0 if the type is not valid.  */
+int fcsSize(int type);
+
+/* Function to calculate a check sequence over a block of bytes.
+   Arguments: check sequence type, pointer to bytes, number of bytes.
+   Returns the check sequence value.  */
+uint32_t fcsCompute(int type, const byte *data, int nBytes);
+
+/* Function to put a check sequence value into a frame,
+   most significant byte first.  Returns number of bytes written.  */
+int fcsPut(int type, byte *frame, uint32_t value);
+
+/* Function to get a check sequence value from a frame,
+   most significant byte first.  */
+uint32_t fcsGet(int type, const byte *frame);
+
+/* Functions to calculate the CRCs directly.  */
+uint16_t crc16(const byte *data, int nBytes);   // CRC-16-CCITT, slice-by-4
+uint32_t crc32(const byte *data, int nBytes);   // CRC-32, slice-by-8
+
+#endif // FCS_H_INCLUDED
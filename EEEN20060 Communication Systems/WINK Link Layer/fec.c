@@ -0,0 +1,294 @@
+/*  Forward error correction functions for the link layer.
+       fecSize      gives the number of bytes after adding parity
+       fecDataSize  gives the number of bytes before adding parity
+       fecEncode    adds Reed-Solomon parity to a block of bytes
+       fecDecode    corrects errors in a block, and removes the parity
+    The code is Reed-Solomon over GF(256), with field polynomial
+    x^8 + x^4 + x^3 + x^2 + 1 (0x11D) and primitive element a = 2.
+    With P parity bytes, the generator polynomial has roots
+    a^0 ... a^(P-1).  A codeword is written highest power first,
+    so the bytes of the block come first, then the parity.
+    Decoding finds the syndromes, then the error locator polynomial
+    by Berlekamp-Massey, its roots by Chien search, and the error
+    values by Forney's formula.  If the number of roots found is not
+    the degree of the locator, there are too many errors to correct.
+    A codeword with all syndromes zero needs no more work, so a block
+    without errors costs about the same to check as to encode.  */
+
+typedef unsigned char byte;
+
+#include <string.h>  // for memcpy and memmove
+#include "fec.h"     // these functions
+
+#define FEC_POLY 0x11D  // field polynomial, with the x^8 bit
+
+/* Tables are shared by the functions in this file only.  */
+static byte gfExp[2*FEC_CODEWORD];  // a^i, doubled so sums of logs fit
+static int gfLog[256];              // i such that a^i = x, for x > 0
+static byte genPoly[FEC_MAXPARITY+1][FEC_MAXPARITY+1];  // generators,
+                                    // highest power first, for each P
+static int genLog[FEC_MAXPARITY+1][FEC_MAXPARITY+1];  // their logs
+static int tablesReady = 0;         // set to 1 once tables are built
+
+//===================================================================
+/* Function to multiply two elements of GF(256).  */
+static byte gfMul(byte a, byte b)
+{
+    if ((a == 0) || (b == 0)) return 0;
+    return gfExp[gfLog[a] + gfLog[b]];
+}
+
+//===================================================================
+/* Function to divide two elements of GF(256), b not zero.  */
+static byte gfDiv(byte a, byte b)
+{
+    if (a == 0) return 0;
+    return gfExp[gfLog[a] + FEC_CODEWORD - gfLog[b]];
+}
+
+//===================================================================
+/* Function to build the lookup tables, the first time needed.
+   Each generator is the last one times (x - a^(P-1)).  */
+static void buildTables(void)
+{
+    int i, p;  // for use in loops
+    int x = 1;  // a^i, being calculated
+
+    for (i = 0; i < FEC_CODEWORD; i++)
+    {
+        gfExp[i] = (byte) x;
+        gfExp[i + FEC_CODEWORD] = (byte) x;
+        gfLog[x] = i;
+        x <<= 1;
+        if (x & 0x100) x ^= FEC_POLY;
+    }
+    gfLog[0] = 0;  // not used
+
+    genPoly[0][0] = 1;
+    for (p = 1; p <= FEC_MAXPARITY; p++)
+    {
+        genPoly[p][0] = 1;
+        for (i = 1; i < p; i++)
+            genPoly[p][i] = genPoly[p-1][i]
+                            ^ gfMul(genPoly[p-1][i-1], gfExp[p-1]);
+        genPoly[p][p] = gfMul(genPoly[p-1][p-1], gfExp[p-1]);
+        for (i = 0; i <= p; i++)  // no term is zero, for these roots
+            genLog[p][i] = gfLog[genPoly[p][i]];
+    }
+
+    tablesReady = 1;
+}
+
+//===================================================================
+/* Function to build the lookup tables in advance.  The tables are
+   built the first time they are needed anyway, but if several threads
+   might need them at once, this should be called before the threads
+   start.  Calling it again does nothing.  */
+void fecInit(void)
+{
+    if (!tablesReady) buildTables();
+}
+
+//===================================================================
+/* Function to give the number of bytes in a block after the parity
+   is added: one set of parity for each codeword started.  */
+int fecSize(int nData, int nParity)
+{
+    int perWord = FEC_CODEWORD - nParity;  // block bytes per codeword
+
+    return nData + (nData + perWord - 1) / perWord * nParity;
+}
+
+//===================================================================
+/* Function to give the number of bytes in a block before the parity
+   was added.  Every codeword is full length except the last, which
+   must have at least one byte of the block.
+   Returns -1 if no block gives that size.  */
+int fecDataSize(int nCoded, int nParity)
+{
+    int nWords = (nCoded + FEC_CODEWORD - 1) / FEC_CODEWORD;  // codewords
+    int nLast = nCoded - (nWords - 1) * FEC_CODEWORD;  // size of last one
+
+    if ((nCoded <= 0) || (nLast <= nParity)) return -1;
+    return nCoded - nWords * nParity;
+}
+
+//===================================================================
+/* Function to add parity to a block of bytes.  The parity of each
+   codeword is the remainder after dividing by the generator, worked
+   out one byte at a time, as in a CRC.
+   Arguments: array for the result, room for fecSize() bytes,
+              bytes of the block, number of bytes in block,
+              parity bytes in each codeword.
+   Returns the number of bytes put in the output array.  */
+int fecEncode(byte *dataOut, const byte *dataIn, int nData, int nParity)
+{
+    const int *gen = genLog[nParity];  // generator for this parity, logs
+    int perWord = FEC_CODEWORD - nParity;  // block bytes per codeword
+    int nOut = 0;  // bytes put in output so far
+    int nWord;  // block bytes in this codeword
+    byte *par;  // parity of this codeword, in the output
+    byte fb;  // feedback - next byte less the top of the remainder
+    int logFb;  // log of feedback
+    int i, j;  // for use in loops
+
+    if (!tablesReady) buildTables();
+
+    while (nData > 0)
+    {
+        nWord = (nData < perWord) ? nData : perWord;
+        memcpy(dataOut + nOut, dataIn, nWord);
+        par = dataOut + nOut + nWord;
+        for (j = 0; j < nParity; j++) par[j] = 0;
+
+        for (i = 0; i < nWord; i++)
+        {
+            fb = dataIn[i] ^ par[0];
+            if (fb == 0)  // remainder just moves up
+            {
+                memmove(par, par + 1, nParity - 1);
+                par[nParity-1] = 0;
+                continue;
+            }
+            logFb = gfLog[fb];
+            for (j = 0; j < nParity - 1; j++)
+                par[j] = par[j+1] ^ gfExp[logFb + gen[j+1]];
+            par[nParity-1] = gfExp[logFb + gen[nParity]];
+        }
+
+        dataIn += nWord;
+        nData -= nWord;
+        nOut += nWord + nParity;
+    }
+    return nOut;
+}
+
+//===================================================================
+/* Function to correct the errors in one codeword, in place.
+   Arguments: bytes of codeword, number of bytes, parity bytes.
+   Returns the number of bytes corrected, or -1 if too many.  */
+static int decodeWord(byte *word, int n, int nParity)
+{
+    byte synd[FEC_MAXPARITY];  // syndromes, S_i = c(a^i)
+    byte lambda[FEC_MAXPARITY+1];  // error locator, lowest power first
+    byte prev[FEC_MAXPARITY+1];  // locator before the last length change
+    byte temp[FEC_MAXPARITY+1];  // copy of locator, while updating
+    byte omega[FEC_MAXPARITY];  // error evaluator, S(x).lambda(x) mod x^P
+    int nErr = 0;  // degree of locator - number of errors
+    int gap = 1;  // steps since prev was saved
+    byte lastDisc = 1;  // discrepancy when prev was saved
+    byte disc;  // discrepancy at this step
+    byte xInv;  // a^-e, for error at power e
+    byte num, den;  // parts of Forney's formula
+    byte sum;  // value being calculated
+    int found = 0;  // roots of locator found
+    int any = 0;  // 1 if any syndrome is not zero
+    int i, j, k;  // for use in loops
+
+    // Syndromes, by Horner's rule - all zero if there are no errors
+    for (i = 0; i < nParity; i++)
+    {
+        sum = 0;
+        for (j = 0; j < n; j++)
+            sum = (sum ? gfExp[gfLog[sum] + i] : 0) ^ word[j];
+        synd[i] = sum;
+        any |= sum;
+    }
+    if (!any) return 0;
+
+    // Berlekamp-Massey, to find the shortest locator for the syndromes
+    memset(lambda, 0, sizeof(lambda));
+    memset(prev, 0, sizeof(prev));
+    lambda[0] = 1;
+    prev[0] = 1;
+    for (k = 0; k < nParity; k++)
+    {
+        disc = synd[k];
+        for (i = 1; i <= nErr; i++) disc ^= gfMul(lambda[i], synd[k-i]);
+        if (disc == 0)
+        {
+            gap++;
+            continue;
+        }
+        memcpy(temp, lambda, sizeof(lambda));
+        for (i = 0; i + gap <= nParity; i++)
+            lambda[i + gap] ^= gfMul(gfDiv(disc, lastDisc), prev[i]);
+        if (2 * nErr <= k)
+        {
+            nErr = k + 1 - nErr;
+            memcpy(prev, temp, sizeof(prev));
+            lastDisc = disc;
+            gap = 1;
+        }
+        else gap++;
+    }
+    if (2 * nErr > nParity) return -1;  // more errors than can be found
+
+    // Error evaluator, only the powers below nParity are needed
+    for (i = 0; i < nParity; i++)
+    {
+        sum = 0;
+        for (j = 0; (j <= i) && (j <= nErr); j++)
+            sum ^= gfMul(lambda[j], synd[i-j]);
+        omega[i] = sum;
+    }
+
+    // Chien search - try every position in the codeword.  The byte
+    // at position j is the coefficient of x^e, with e = n - 1 - j
+    for (j = 0; j < n; j++)
+    {
+        xInv = gfExp[(FEC_CODEWORD - (n - 1 - j)) % FEC_CODEWORD];
+        sum = 0;
+        for (i = nErr; i >= 0; i--) sum = gfMul(sum, xInv) ^ lambda[i];
+        if (sum != 0) continue;  // no error here
+
+        // Forney: error value = X.omega(1/X) / lambda'(1/X),
+        // where lambda' has only the odd powers of lambda
+        num = 0;
+        for (i = nParity - 1; i >= 0; i--) num = gfMul(num, xInv) ^ omega[i];
+        den = 0;
+        for (i = nErr - (!(nErr & 1)); i >= 1; i -= 2)
+            den = gfMul(den, gfMul(xInv, xInv)) ^ lambda[i];
+        if (den == 0) return -1;  // repeated root - not a real error
+        word[j] ^= gfDiv(num, gfMul(den, xInv));
+        found++;
+    }
+    if (found != nErr) return -1;  // roots outside the codeword
+    return found;
+}
+
+//===================================================================
+/* Function to correct errors in a block with parity, in place.
+   Each codeword is corrected, then its block bytes are moved down
+   to follow those of the last codeword.  If a codeword has too many
+   errors, the block is left part corrected.
+   Arguments: bytes with parity, number of bytes with parity,
+              parity bytes in each codeword,
+              pointer to number of bytes corrected, set on return.
+   Returns the number of bytes in the block, or -1 if a codeword
+   has too many errors to correct.  */
+int fecDecode(byte *data, int nCoded, int nParity, int *nFixed)
+{
+    int nData = fecDataSize(nCoded, nParity);  // block size, if valid
+    int nIn = 0;  // position of this codeword
+    int nOut = 0;  // block bytes kept so far
+    int nWord;  // bytes in this codeword
+    int retVal;  // return value from decodeWord
+
+    *nFixed = 0;
+    if (nData < 0) return -1;
+    if (!tablesReady) buildTables();
+
+    while (nIn < nCoded)
+    {
+        nWord = nCoded - nIn;
+        if (nWord > FEC_CODEWORD) nWord = FEC_CODEWORD;
+        retVal = decodeWord(data + nIn, nWord, nParity);
+        if (retVal < 0) return -1;
+        *nFixed += retVal;
+        memmove(data + nOut, data + nIn, nWord - nParity);
+        nOut += nWord - nParity;
+        nIn += nWord;
+    }
+    return nOut;
+}
@@ -0,0 +1,52 @@
+#ifndef FEC_H_INCLUDED
+#define FEC_H_INCLUDED
+
+/*  Forward error correction functions for the link layer.
+       fecInit      builds the lookup tables, before threads start
+       fecSize      gives the number of bytes after adding parity
+       fecDataSize  gives the number of bytes before adding parity
+       fecEncode    adds Reed-Solomon parity to a block of bytes
+       fecDecode    corrects errors in a block, and removes the parity
+    The block is cut into codewords of up to FEC_CODEWORD bytes: each
+    has up to FEC_CODEWORD - nParity bytes of the block, unchanged,
+    followed by nParity parity bytes.  The last codeword is shorter,
+    with fewer bytes of the block.  Each codeword can correct up to
+    nParity/2 bytes with errors, however many bits are wrong in each.
+    Arithmetic is in GF(256), using tables of logarithms and powers.  */
+
+#include <stdint.h>  // for fixed size integer types
+
+#define FEC_CODEWORD 255   // largest codeword, in bytes
+#define FEC_MAXPARITY 32   // most parity bytes in each codeword
+
+/* Function to build the lookup tables in advance, so that
+   links in several threads do not build them at the same time.  */
+void fecInit(void);
+
+/* Function to give the number of bytes in a block after the parity
+   is added.  Arguments: number of bytes in block, parity bytes in
+   each codeword, 1 to FEC_MAXPARITY.  */
+int fecSize(int nData, int nParity);
+
+/* Function to give the number of bytes in a block before the parity
+   was added.  Arguments: number of bytes with parity, parity bytes
+   in each codeword.  Returns -1 if no block gives that size.  */
+int fecDataSize(int nCoded, int nParity);
+
+/* Function to add parity to a block of bytes.
+   Arguments: array for the result, room for fecSize() bytes,
+              bytes of the block, number of bytes in block,
+              parity bytes in each codeword.
+   Returns the number of bytes put in the output array.  */
+int fecEncode(byte *dataOut, const byte *dataIn, int nData, int nParity);
+
+/* Function to correct errors in a block with parity, in place.
+   The parity is then removed, leaving the block at the start.
+   Arguments: bytes with parity, number of bytes with parity,
+              parity bytes in each codeword,
+              pointer to number of bytes corrected, set on return.
+   Returns the number of bytes in the block, or -1 if a codeword
+   has too many errors to correct.  */
+int fecDecode(byte *data, int nCoded, int nParity, int *nFixed);
+
+#endif // FEC_H_INCLUDED
@@ -0,0 +1,270 @@
+/* EEEN20060 Communication Systems, file transfer test
+   This program sends a file from link A to link B, through the
+   loopback physical layer (loop-physical.c), on ports 1 and 2, using
+   LL_sendFile() and LL_receiveFile(), with a thread for each end.
+   The file is written to output.txt, for checking against the input.
+   The loopback runs in virtual time, so the time shown is the time
+   the transfer would take on the line.
+   Optional arguments: name of file to send, fastest bit rate,
+   probability of bit error, one-way latency in ms, window size,
+   receive threads - 0 for none, 1 at the receiving end, 2 at both,
+   1 to compress the blocks, name to start a trace file for each end,
+   which adds its port number and .trc - see tracereplay.c, or "" for
+   none, number of runs.  With more than one run, and no errors, each
+   run must take about the same time on the line as the first, within
+   TEST_SPREAD, as the threads should not change the result, beyond
+   when the receive thread's polls happen to end.  (With errors, the
+   ends do not agree their settings the same way every run, as the
+   errors are only the same once the link is connected.)  */
+
+typedef unsigned char byte;
+
+#include <stdio.h>  // standard input-output library
+#include <stdlib.h>  // for atoi, atof and llabs
+#ifdef _WIN32
+#include <windows.h>  // for thread functions
+#define THREAD_RESULT DWORD WINAPI  // type of thread function
+#else
+#include <pthread.h>  // for thread functions
+#define THREAD_RESULT void *  // type of thread function
+#endif
+#include "linklayer.h"  // link layer functions
+#include "linkfile.h"  // file transfer functions
+#include "rxthread.h"  // receive thread functions
+#include "linktrace.h"  // to trace the links
+#include "physical.h"  // physical layer functions
+#include "loop-physical.h"  // to set the latency, and share the ports
+
+#define TEST_FILE "test.txt"  // default file to send
+#define TEST_RATE 38400  // default bit rate, bit/s
+#define TEST_LATENCY 20  // default one-way latency, ms
+#define TEST_SEED 1  // seed for simulated errors
+#define TEST_RUNS 1  // default number of runs
+#define TEST_SPREAD 0.1  // part of the first run's time a run may differ
+
+/* Settings and results for the transfer, shared by the two threads */
+typedef struct FileTest
+{
+    const char *fName;  // name of file to send
+    int bitRate;        // bit rate, bit/s
+    double probErr;     // probability of bit error
+    long latency;       // one-way latency, us
+    int window;         // window size
+    int rxThreads;      // ends with a receive thread, 0 to 2
+    int compress;       // 1 to compress the blocks
+    const char *trace;  // start of trace file names, NULL for none
+    long long nSent;    // bytes sent, or negative on failure
+    long long nGot;     // bytes received, or negative on failure
+    long long startTime;    // simulated time sending started, us
+    long long endTime;      // simulated time last block was acknowledged
+} FileTest;
+
+// Function prototypes
+THREAD_RESULT sender(void *arg);
+THREAD_RESULT receiver(void *arg);
+int setupLink(FileTest *test, LL_context *link, unsigned long seed,
+              int rxThread);
+int startTrace(FileTest *test, LL_context *link);
+int runTest(FileTest *test);
+
+static LL_context linkA, linkB;  // large, so not on stack
+
+
+int main(int argc, char *argv[])
+{
+    FileTest test;  // settings and results
+    double seconds;  // simulated time for transfer
+    long long lineTime = -1;  // time on the line of the first run, us
+    int runs;  // number of runs
+    int i;  // for use in loop
+
+    test.fName = (argc > 1) ? argv[1] : TEST_FILE;
+    test.bitRate = (argc > 2) ? atoi(argv[2]) : TEST_RATE;
+    test.probErr = (argc > 3) ? atof(argv[3]) : 0.0;
+    test.latency = 1000L * ((argc > 4) ? atoi(argv[4]) : TEST_LATENCY);
+    test.window = (argc > 5) ? atoi(argv[5]) : WINDOW_SIZE;
+    test.rxThreads = (argc > 6) ? atoi(argv[6]) : 0;
+    test.compress = (argc > 7) ? atoi(argv[7]) : 0;
+    test.trace = ((argc > 8) && (argv[8][0] != '\0')) ? argv[8] : NULL;
+    runs = (argc > 9) ? atoi(argv[9]) : TEST_RUNS;
+    printf("File Transfer Test: %s, %d bit/s, error %g, latency %ld ms, "
+           "window %d, receive threads %d, compression %d\n", test.fName,
+           test.bitRate, test.probErr, test.latency / 1000, test.window,
+           test.rxThreads, test.compress);
+
+    LL_setRxHooks(PHY_share, PHY_pause);  // the clock waits for them too
+    for (i = 0; i < runs; i++)
+    {
+        if (runTest(&test) < 0) return 1;
+        seconds = (double) (test.endTime - test.startTime) / 1.0E6;
+        if (seconds <= 0.0) seconds = 1.0E-6;
+        printf("Sent %lld bytes in %.1f s on the line, %.0f bit/s\n",
+               test.nSent, seconds, 8.0 * test.nSent / seconds);
+        if (lineTime < 0) lineTime = test.endTime - test.startTime;
+        else if ((test.probErr == 0.0)
+                 && (llabs(test.endTime - test.startTime - lineTime)
+                     > TEST_SPREAD * lineTime))
+        {
+            printf("Test: Run %d took %lld us on the line, first run %lld\n",
+                   i + 1, test.endTime - test.startTime, lineTime);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+
+/* Function to run one transfer, with a thread for each end.
+   Argument: pointer to the test settings, which also gets the results.
+   Return value is 0 on success, negative on failure.  */
+int runTest(FileTest *test)
+{
+#ifdef _WIN32
+    HANDLE threads[2];  // sender and receiver threads
+#else
+    pthread_t threads[2];  // sender and receiver threads
+#endif
+
+    test->nSent = -1;
+    test->nGot = -1;
+    test->startTime = 0;
+    test->endTime = 0;
+    LL_init(&linkA, 1);
+    LL_init(&linkB, 2);
+    if ((LL_setLine(&linkA, test->bitRate, test->probErr, 0) < 0)
+        || (LL_setLine(&linkB, test->bitRate, test->probErr, 0) < 0)
+        || (LL_setWindow(&linkA, test->window, 0) < 0)
+        || (LL_setWindow(&linkB, test->window, 0) < 0)
+        || (LL_setCompress(&linkA, test->compress, 0) < 0)
+        || (LL_setCompress(&linkB, test->compress, 0) < 0)
+        || (startTrace(test, &linkA) < 0) || (startTrace(test, &linkB) < 0))
+    {
+        printf("Test: Could not set up links\n");
+        return -1;
+    }
+    PHY_expectPorts(2);  // hold the clock until both ends connect
+
+#ifdef _WIN32
+    threads[0] = CreateThread(NULL, 0, sender, test, 0, NULL);
+    threads[1] = CreateThread(NULL, 0, receiver, test, 0, NULL);
+    if ((threads[0] == NULL) || (threads[1] == NULL))
+    {
+        printf("Test: Could not start threads\n");
+        return -1;
+    }
+    WaitForMultipleObjects(2, threads, TRUE, INFINITE);
+    CloseHandle(threads[0]);
+    CloseHandle(threads[1]);
+#else
+    if ((pthread_create(&threads[0], NULL, sender, test) != 0)
+        || (pthread_create(&threads[1], NULL, receiver, test) != 0))
+    {
+        printf("Test: Could not start threads\n");
+        return -1;
+    }
+    pthread_join(threads[0], NULL);
+    pthread_join(threads[1], NULL);
+#endif
+    LL_traceStop(&linkA, 1);
+    LL_traceStop(&linkB, 1);
+
+    if ((test->nSent < 0) || (test->nGot != test->nSent))
+    {
+        printf("Test: Transfer failed, sent %lld bytes, received %lld\n",
+               test->nSent, test->nGot);
+        return -1;
+    }
+    return 0;
+}
+
+
+/* Thread function to send the file on link A, port 1.
+   Argument: pointer to the test settings.  */
+THREAD_RESULT sender(void *arg)
+{
+    FileTest *test = arg;  // settings and results
+    FILE *fpi;  // file to send
+
+    fpi = fopen(test->fName, "rb");  // open for binary read
+    if (fpi == NULL)
+    {
+        perror("Test: Error opening input file");
+        PHY_expectPorts(0);  // the other end must not wait for this one
+        return 0;
+    }
+    if (setupLink(test, &linkA, TEST_SEED, test->rxThreads > 1) == 0)
+    {
+        test->startTime = PHY_time();
+        test->nSent = LL_sendFile(&linkA, fpi, 0);
+        test->endTime = PHY_time();
+        LL_discon(&linkA, 0);
+    }
+    fclose(fpi);
+    return 0;
+}
+
+
+/* Thread function to receive the file on link B, port 2.
+   Argument: pointer to the test settings.  */
+THREAD_RESULT receiver(void *arg)
+{
+    FileTest *test = arg;  // settings and results
+    FILE *fpo;  // file to write
+
+    fpo = fopen("output.txt", "wb");  // open for binary write
+    if (fpo == NULL)
+    {
+        perror("Test: Error opening output file");
+        PHY_expectPorts(0);  // the other end must not wait for this one
+        return 0;
+    }
+    if (setupLink(test, &linkB, TEST_SEED + 1, test->rxThreads > 0) == 0)
+    {
+        test->nGot = LL_receiveFile(&linkB, fpo, 0);
+        LL_discon(&linkB, 0);
+    }
+    fclose(fpo);
+    return 0;
+}
+
+
+/* Function to connect one end, and set up the simulated line from
+   its port: latency, and the seed for the errors, so the same errors
+   happen every run once the link is connected.  Then it starts the
+   receive thread, if wanted.
+   Arguments: settings, link to connect, seed for its errors,
+              1 to start a receive thread.
+   Return value is 0 on success, negative on failure.  */
+int setupLink(FileTest *test, LL_context *link, unsigned long seed,
+              int rxThread)
+{
+    if ((LL_connect(link, 0) < 0)
+        || (PHY_setLatency(link->phy, test->latency) < 0))
+    {
+        printf("Test: Could not set up link on port %d\n", link->portNum);
+        return -1;
+    }
+    PHY_setSeed(link->phy, seed);  // before the thread takes any bytes
+    if (rxThread && (LL_startRxThread(link, 0) < 0))
+    {
+        printf("Test: Could not start receive thread on port %d\n",
+               link->portNum);
+        return -1;
+    }
+    return 0;
+}
+
+
+/* Function to start the trace of one end, if asked for, before it
+   connects, so the settings agreed are in the trace.
+   Arguments: settings, link to trace.
+   Return value is 0 on success, or if no trace is wanted, negative
+   on failure.  */
+int startTrace(FileTest *test, LL_context *link)
+{
+    char fName[FILENAME_MAX];  // name of the trace file
+
+    if (test->trace == NULL) return 0;
+    snprintf(fName, sizeof(fName), "%s%d.trc", test->trace, link->portNum);
+    return LL_traceStart(link, fName, 1);
+}
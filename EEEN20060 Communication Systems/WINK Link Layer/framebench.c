@@ -0,0 +1,291 @@
+/* EEEN20060 Communication Systems, frame parsing benchmark
+   This program feeds frames from memory to the receiving functions
+   of the link layer - getFrame(), decodeFrame(), checkFrame() and
+   processFrame() - with no physical layer in use.  The bytes are put
+   straight into the receive buffer, and getFrame() is called with no
+   time to wait, so it never asks the physical layer for more.
+   First, for every block size from 0 to MAX_BLK, it builds a data
+   frame, checks that the block comes back as it was sent, then damages
+   the frame - cut short, bits changed, or replaced by junk between
+   the markers - and checks that the damaged frame is rejected, or
+   corrected by the parity.  It does this with and without error
+   correction.  Built with -fsanitize=address, any access outside a
+   frame stops the program at once, so this also tests that the
+   functions do not trust the bytes received.
+   Then it measures the time each function takes per frame, for a
+   range of block sizes, for good frames and for damaged frames.
+   Optional argument: seed for the random data and damage.
+   Returns 0 if every block came back and no damaged frame was taken
+   as good, 1 otherwise.  */
+
+typedef unsigned char byte;
+
+#include <stdio.h>  // standard input-output library
+#include <stdlib.h>  // for random number functions and strtoul
+#include <string.h>  // for memcpy and memcmp
+#include <time.h>  // for timing functions
+#include "linklayer.h"  // link layer functions
+#include "logging.h"  // to turn off messages about bad frames
+
+#define BENCH_BYTES 20000000L  // bytes to process for each measurement
+#define BENCH_SEED 1  // default seed for random data
+#define BENCH_PARITY 16  // parity bytes, when error correction is used
+#define DAMAGE_TRIES 4  // damaged frames of each kind, for each size
+
+// Ways a frame can be damaged - see damageFrame()
+#define DAMAGE_CUT 0  // cut short, then an end marker
+#define DAMAGE_BITS 1  // a few bits changed
+#define DAMAGE_JUNK 2  // random bytes between the markers
+#define DAMAGE_KINDS 3
+
+// Results of the checks, for one setting of the parity
+typedef struct Checks
+{
+    long good;       // frames sent whole, block came back as it was
+    long lost;       // frames sent whole, block did not come back
+    long rejected;   // damaged frames that were rejected
+    long corrected;  // damaged frames that gave the right block
+    long wrong;      // damaged frames that gave a wrong block
+} Checks;
+
+// Function prototypes
+void feedBytes(LL_context *ll, byte *stream, int nStream);
+int receiveBlock(LL_context *ll, byte *stream, int nStream, byte **data);
+int damageFrame(byte *stream, int nStream, int kind);
+void checkSizes(LL_context *ll, Checks *checks);
+void timeStages(LL_context *ll, int nData);
+double nsPerFrame(clock_t start, long nFrames);
+
+static LL_context link;  // large, so not on stack
+static byte block[MAX_BLK];  // data to send
+static byte frameTx[MAX_STUFFED];  // frame as sent, after stuffing
+static byte damaged[MAX_STUFFED];  // copy of frame, to be damaged
+static byte saved[MAX_FRAME];  // copy of frame as received
+
+
+int main(int argc, char *argv[])
+{
+    static const int sizes[] = {0, 16, 64, 255, 1024, MAX_BLK};
+    static const int parity[] = {0, BENCH_PARITY};
+    int nSizes = sizeof(sizes) / sizeof(sizes[0]);
+    unsigned long seed = BENCH_SEED;  // seed for random data
+    Checks checks;  // results of the checks
+    int failed = 0;  // 1 if any check failed
+    int p, s, i;  // for use in loops
+
+    printf("Frame Parsing Benchmark\n\n");
+    if (argc > 1) seed = strtoul(argv[1], NULL, 10);
+    srand((unsigned int) seed);
+    for (i = 0; i < MAX_BLK; i++) block[i] = (byte) (rand() % 256);
+    logSetLevel(LOG_ERROR);  // bad frames are expected here
+    LL_init(&link, 1);
+
+    // First check every size, with and without parity
+    for (p = 0; p < 2; p++)
+    {
+        link.fecParity = parity[p];
+        checkSizes(&link, &checks);
+        printf("Parity %2d: sizes 0 to %d, %ld good, %ld lost, "
+               "%ld damaged rejected, %ld corrected, %ld wrong\n",
+               parity[p], MAX_BLK, checks.good, checks.lost,
+               checks.rejected, checks.corrected, checks.wrong);
+        if ((checks.lost > 0) || (checks.wrong > 0)) failed = 1;
+    }
+
+    // Then measure the time for each function
+    printf("\nparity,block_bytes,frame,getFrame_ns,decode_check_ns,"
+           "processFrame_ns,total_ns\n");
+    for (p = 0; p < 2; p++)
+    {
+        link.fecParity = parity[p];
+        for (s = 0; s < nSizes; s++) timeStages(&link, sizes[s]);
+    }
+
+    printf("\n%s\n", failed ? "Checks FAILED" : "Checks passed");
+    return failed;
+}
+
+
+/* Function to put bytes in the receive buffer, as if they had just
+   come from the physical layer, with no part frame left from before.
+   Arguments: link state, bytes as received, number of bytes.  */
+void feedBytes(LL_context *ll, byte *stream, int nStream)
+{
+    memcpy(ll->rxBuf, stream, nStream);
+    ll->rxHead = 0;
+    ll->rxCount = nStream;
+    ll->rxLen = 0;
+    ll->rxStuffed = 0;
+}
+
+
+/* Function to put a frame in the receive buffer and take it through
+   the same steps as serviceLink(), up to finding the block.
+   Arguments: link state, bytes as received, number of bytes,
+              pointer to pointer which is set to the block.
+   Returns the number of bytes in the block, or -1 if the frame
+   was rejected at any step.  */
+int receiveBlock(LL_context *ll, byte *stream, int nStream, byte **data)
+{
+    int nFrame;  // bytes in frame, after de-stuffing
+    int seqNum;  // sequence number of frame
+
+    feedBytes(ll, stream, nStream);
+    nFrame = getFrame(ll, ll->rxFrame, MAX_FRAME, 0.0);
+    if (nFrame <= 0) return -1;
+    nFrame = decodeFrame(ll, ll->rxFrame, nFrame);
+    if ((nFrame == 0) || (checkFrame(ll, ll->rxFrame, nFrame) == 0)
+        || (ll->rxFrame[TYPEPOS] != DATA)) return -1;
+    return processFrame(ll, ll->rxFrame, nFrame, data, &seqNum);
+}
+
+
+/* Function to damage a frame, after stuffing.  The start marker is
+   kept, so the frame is always taken to the checks.
+   Arguments: bytes of frame, number of bytes, way to damage it.
+   Returns the number of bytes in the damaged frame.  */
+int damageFrame(byte *stream, int nStream, int kind)
+{
+    int n = nStream;  // bytes in damaged frame
+    int i, nBits;  // for use in loops
+
+    if (kind == DAMAGE_CUT)  // cut anywhere after the start marker
+    {
+        n = 1 + rand() % (nStream - 1);
+        stream[n++] = ENDBYTE;
+    }
+    else if (kind == DAMAGE_BITS)  // change 1 to 8 bits
+    {
+        nBits = 1 + rand() % 8;
+        for (i = 0; i < nBits; i++)
+            stream[1 + rand() % (nStream - 2)] ^= (byte) (1 << (rand() % 8));
+    }
+    else  // junk of any length that fits, perhaps with markers in it
+    {
+        n = 2 + rand() % (MAX_STUFFED - 1);
+        for (i = 1; i < n - 1; i++) stream[i] = (byte) (rand() % 256);
+        stream[n - 1] = ENDBYTE;
+    }
+    return n;
+}
+
+
+/* Function to check every block size, with the parity set in the
+   link state: each block must come back as it was sent, and each
+   damaged frame must be rejected, or give the same block.
+   Arguments: link state, results of the checks.  */
+void checkSizes(LL_context *ll, Checks *checks)
+{
+    byte *data;  // block found in the frame
+    int nStream, nDamaged;  // bytes in frame, and in damaged copy
+    int nData, nGot;  // bytes in block sent, and received
+    int kind, t;  // for use in loops
+
+    memset(checks, 0, sizeof(Checks));
+    for (nData = 0; nData <= MAX_BLK; nData++)
+    {
+        nStream = buildFrame(ll, frameTx, block, nData, nData % MOD_SEQNUM,
+                             DATA);
+        nGot = receiveBlock(ll, frameTx, nStream, &data);
+        if ((nGot == nData) && (memcmp(data, block, nData) == 0))
+            checks->good++;
+        else
+        {
+            printf("Block of %d bytes did not come back\n", nData);
+            checks->lost++;
+        }
+
+        for (kind = 0; kind < DAMAGE_KINDS; kind++)
+            for (t = 0; t < DAMAGE_TRIES; t++)
+            {
+                memcpy(damaged, frameTx, nStream);
+                nDamaged = damageFrame(damaged, nStream, kind);
+                nGot = receiveBlock(ll, damaged, nDamaged, &data);
+                if (nGot < 0) checks->rejected++;
+                else if ((nGot == nData) && (memcmp(data, block, nData) == 0))
+                    checks->corrected++;
+                else
+                {
+                    printf("Damaged frame of %d bytes taken as a block of "
+                           "%d bytes\n", nData, nGot);
+                    checks->wrong++;
+                }
+            }
+    }
+}
+
+
+/* Function to measure the time per frame of each step, for one block
+   size, for a good frame and for one with a bit changed in the block,
+   and print a line of results for each.  decodeFrame() changes the
+   frame it corrects, so the frame is copied back before each call,
+   and the time of the copy is included.
+   Arguments: link state, number of bytes in block.  */
+void timeStages(LL_context *ll, int nData)
+{
+    static const char *names[2] = {"good", "damaged"};
+    byte *data;  // block found in the frame
+    int nStream, nFrame;  // bytes in frame, before and after de-stuffing
+    int nPlain;  // bytes in frame, after correction
+    int seqNum;  // sequence number of frame
+    long nFrames = BENCH_BYTES / (nData + HEADERSIZE + TRAILERSIZE);
+    long n;  // for use in loop
+    long result = 0;  // combined results, so no work is optimised away
+    double tGet, tCheck, tProcess, tTotal;  // times per frame, ns
+    clock_t start;  // time at start of measurement
+    int d;  // 1 for a damaged frame
+
+    for (d = 0; d < 2; d++)
+    {
+        nStream = buildFrame(ll, frameTx, block, nData, 0, DATA);
+        if (d && (nData > 0))  // change a bit in the middle of the block
+            frameTx[nStream / 2] ^= 0x01;
+
+        start = clock();
+        for (n = 0; n < nFrames; n++)
+        {
+            feedBytes(ll, frameTx, nStream);
+            result += getFrame(ll, ll->rxFrame, MAX_FRAME, 0.0);
+        }
+        tGet = nsPerFrame(start, nFrames);
+        feedBytes(ll, frameTx, nStream);  // once more, to keep the frame
+        nFrame = getFrame(ll, ll->rxFrame, MAX_FRAME, 0.0);
+        if (nFrame <= 0) nFrame = 1;  // damage hit a marker - time the rest
+        memcpy(saved, ll->rxFrame, nFrame);
+
+        start = clock();
+        for (n = 0; n < nFrames; n++)
+        {
+            memcpy(ll->rxFrame, saved, nFrame);
+            nPlain = decodeFrame(ll, ll->rxFrame, nFrame);
+            result += (nPlain > 0) && checkFrame(ll, ll->rxFrame, nPlain);
+        }
+        tCheck = nsPerFrame(start, nFrames);
+
+        nPlain = decodeFrame(ll, ll->rxFrame, nFrame);
+        start = clock();
+        for (n = 0; n < nFrames; n++)
+            result += processFrame(ll, ll->rxFrame, nPlain, &data, &seqNum);
+        tProcess = nsPerFrame(start, nFrames);
+
+        start = clock();
+        for (n = 0; n < nFrames; n++)
+            result += receiveBlock(ll, frameTx, nStream, &data);
+        tTotal = nsPerFrame(start, nFrames);
+
+        printf("%d,%d,%s,%.1f,%.1f,%.1f,%.1f\n", ll->fecParity, nData,
+               names[d], tGet, tCheck, tProcess, tTotal);
+    }
+    if (result == 0) printf("(no frames)\n");  // keeps the work
+}
+
+
+/* Function to give the time per frame since the start of a
+   measurement, in ns.  */
+double nsPerFrame(clock_t start, long nFrames)
+{
+    double seconds = (double) (clock() - start) / CLOCKS_PER_SEC;
+
+    if (seconds <= 0.0) seconds = 1.0 / CLOCKS_PER_SEC;
+    return seconds * 1.0E9 / nFrames;
+}
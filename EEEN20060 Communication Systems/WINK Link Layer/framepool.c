@@ -0,0 +1,114 @@
+/*  Frame pool functions for the link layer.
+       poolInit      sets up a pool, using storage given by the caller
+       poolAcquire   takes a free frame buffer from the pool
+       poolHold      records another user of a frame buffer
+       poolRelease   gives up one use of a frame buffer
+    The link layer keeps a copy of every frame sent until it is
+    acknowledged, and a frame may still be in the physical layer
+    send queue after that, so a buffer can have several users.
+    Buffers are numbered by their position in the storage, so the
+    number can be found from the pointer without searching.  */
+
+typedef unsigned char byte;
+
+#include <stdio.h>      // for printf
+#include "framepool.h"  // these functions
+
+//===================================================================
+/* Function to find the number of a buffer from its pointer.
+   Returns the buffer number, or -1 if not a buffer in this pool.  */
+static int frameNum(FramePool *pool, byte *frame)
+{
+    int offset;  // position of buffer in storage, in bytes
+
+    if ((frame < pool->store)
+        || (frame >= pool->store + pool->nFrames * pool->frameSize))
+        return -1;  // not from this pool
+    offset = (int) (frame - pool->store);
+    if (offset % pool->frameSize != 0) return -1;  // not start of buffer
+    return offset / pool->frameSize;
+}
+
+//===================================================================
+/* Function to set up a pool, with all buffers free.
+   Arguments: pointer to pool, storage for nFrames buffers,
+              size of each buffer, number of buffers.
+   Returns 0, or negative if too many buffers.  */
+int poolInit(FramePool *pool, byte *store, int frameSize, int nFrames)
+{
+    int i;  // for use in loop
+
+    if ((nFrames < 1) || (nFrames > POOL_MAXFRAMES))
+    {
+        printf("POOL: Invalid number of buffers %d, max %d\n",
+               nFrames, POOL_MAXFRAMES);
+        return -1;
+    }
+    pool->store = store;
+    pool->frameSize = frameSize;
+    pool->nFrames = nFrames;
+    for (i = 0; i < nFrames; i++)
+    {
+        pool->freeList[i] = nFrames - 1 - i;  // buffer 0 is used first
+        pool->users[i] = 0;
+    }
+    pool->nFree = nFrames;
+    pool->highWater = 0;
+    pool->exhausted = 0;
+    return 0;
+}
+
+//===================================================================
+/* Function to take a free buffer from the pool, with one user.
+   Returns pointer to the buffer, or NULL if none free.  */
+byte *poolAcquire(FramePool *pool)
+{
+    int n;  // number of buffer taken
+    int inUse;  // number of buffers in use
+
+    if (pool->nFree == 0)  // none left
+    {
+        pool->exhausted++;
+        return NULL;
+    }
+    n = pool->freeList[--pool->nFree];  // take from top of stack
+    pool->users[n] = 1;
+
+    inUse = pool->nFrames - pool->nFree;
+    if (inUse > pool->highWater) pool->highWater = inUse;
+    return pool->store + n * pool->frameSize;
+}
+
+//===================================================================
+/* Function to record another user of a buffer, e.g. a send in progress.
+   Returns 0, or negative if the buffer is not in use from this pool.  */
+int poolHold(FramePool *pool, byte *frame)
+{
+    int n = frameNum(pool, frame);  // number of this buffer
+
+    if ((n < 0) || (pool->users[n] == 0)) return -1;  // not in use
+    pool->users[n]++;
+    return 0;
+}
+
+//===================================================================
+/* Function to give up one use of a buffer, freeing it after the last.
+   Returns 0, or negative if the buffer is not in use from this pool,
+   so it is safe to call with buffers from somewhere else.  */
+int poolRelease(FramePool *pool, byte *frame)
+{
+    int n = frameNum(pool, frame);  // number of this buffer
+
+    if ((n < 0) || (pool->users[n] == 0)) return -1;  // not in use
+    pool->users[n]--;
+    if (pool->users[n] == 0)  // last user - put on top of stack
+        pool->freeList[pool->nFree++] = n;
+    return 0;
+}
+
+//===================================================================
+/* Function to give the number of free buffers.  */
+int poolFree(FramePool *pool)
+{
+    return pool->nFree;
+}
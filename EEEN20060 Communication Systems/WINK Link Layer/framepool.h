@@ -0,0 +1,52 @@
+#ifndef FRAMEPOOL_H_INCLUDED
+#define FRAMEPOOL_H_INCLUDED
+
+/*  Frame pool functions for the link layer.
+       poolInit      sets up a pool, using storage given by the caller
+       poolAcquire   takes a free frame buffer from the pool
+       poolHold      records another user of a frame buffer
+       poolRelease   gives up one use of a frame buffer
+    All frame buffers are the same size, and the storage is fixed
+    when the pool is set up, so there is no malloc after that.
+    Free buffers are kept on a stack, so taking one or giving one
+    back is a single step, however big the pool is.
+    Each buffer has a count of users - it goes back on the free
+    stack when the last user releases it.  */
+
+#define POOL_MAXFRAMES 32  // largest number of buffers in a pool
+
+typedef struct FramePool
+{
+    byte *store;        // storage for all buffers, nFrames * frameSize
+    int frameSize;      // size of each buffer, in bytes
+    int nFrames;        // number of buffers in the pool
+    int freeList[POOL_MAXFRAMES];  // stack of free buffer numbers
+    int nFree;          // number of buffers on the free stack
+    int users[POOL_MAXFRAMES];     // number of users of each buffer
+    int highWater;      // most buffers in use at once
+    int exhausted;      // number of times no buffer was free
+} FramePool;
+
+/* Function to set up a pool, with all buffers free.
+   Arguments: pointer to pool, storage for nFrames buffers,
+              size of each buffer, number of buffers.
+   Returns 0, or negative if too many buffers.  */
+int poolInit(FramePool *pool, byte *store, int frameSize, int nFrames);
+
+/* Function to take a free buffer from the pool, with one user.
+   Returns pointer to the buffer, or NULL if none free.  */
+byte *poolAcquire(FramePool *pool);
+
+/* Function to record another user of a buffer, e.g. a send in progress.
+   Returns 0, or negative if the buffer is not in use from this pool.  */
+int poolHold(FramePool *pool, byte *frame);
+
+/* Function to give up one use of a buffer, freeing it after the last.
+   Returns 0, or negative if the buffer is not in use from this pool,
+   so it is safe to call with buffers from somewhere else.  */
+int poolRelease(FramePool *pool, byte *frame);
+
+/* Function to give the number of free buffers.  */
+int poolFree(FramePool *pool);
+
+#endif // FRAMEPOOL_H_INCLUDED
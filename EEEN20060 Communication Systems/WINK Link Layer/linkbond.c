@@ -0,0 +1,473 @@
+/*  Bonded links - see linkbond.h.
+       LL_bondInit      sets up a bond of links
+       LL_bondConnect   connects each link in turn
+       LL_bondDiscon    waits for blocks in flight, then disconnects
+       LL_bondSend      sends a block on whichever link is free
+       LL_bondReceive   waits for the next block, in order
+       LL_bondFlush     waits until all blocks have been acknowledged
+       LL_bondMaxBlock  gives the largest block that can be sent now
+       LL_bondLinks     gives the number of links still working
+    Bond sequence numbers are counted in full here, and only the low
+    16 bits are sent, so the receiver finds how far ahead a block is
+    from the difference, mod 2^16, as the link layer does with its
+    own sequence numbers.
+    The blocks in flight on each link are listed oldest first.  A
+    link acknowledges its frames in order, so whenever the link has
+    fewer frames waiting than the list, the oldest blocks in the list
+    have been acknowledged.  Every new block, and every block from a
+    link that failed, goes through the queue, and is taken from there
+    by the next link with room in its window.  */
+
+typedef unsigned char byte;
+
+#include <stdio.h>      // for printf
+#include <string.h>     // for memcpy
+#include "linklayer.h"  // link layer functions
+#include "linkbond.h"   // these functions
+#include "framepool.h"  // to check for a free frame buffer
+#include "rxthread.h"   // for the lock, if a receive thread runs
+
+#define BOND_MOD (1U << (8*BOND_HDR))  // modulus of sequence numbers sent
+
+//===================================================================
+/* Function to take a failed link out of the bond.  Its blocks not yet
+   counted as acknowledged go back in the queue, oldest first, to be
+   sent on the other links - some may have arrived, but the receiver
+   throws away any it already has.
+   Arguments: pointer to bond state, link number, error code.  */
+static void dropLink(LL_bond *bd, int i, int code)
+{
+    unsigned int seq;  // bond sequence number of block in flight
+
+    bd->alive[i] = 0;
+    bd->nAlive--;
+    bd->failCode = code;
+    printf("LLB: Link on port %d failed, error %d - %d links left, "
+           "%d blocks to send again\n", bd->link[i]->portNum, code,
+           bd->nAlive, bd->nSentOn[i]);
+    while (bd->nSentOn[i] > 0)
+    {
+        seq = bd->sentOn[i][bd->sentFirst[i]];
+        bd->sentFirst[i] = (bd->sentFirst[i] + 1) % MOD_SEQNUM;
+        bd->nSentOn[i]--;
+        bd->txQueue[(bd->queueFirst + bd->nQueued) % BOND_REORDER] = seq;
+        bd->nQueued++;
+        bd->txMoved++;
+    }
+}
+
+//===================================================================
+/* Function to mark the blocks a link has acknowledged, then move on
+   the oldest block not acknowledged.
+   Arguments: pointer to bond state, link number.  */
+static void noteAcks(LL_bond *bd, int i)
+{
+    while (bd->nSentOn[i] > bd->link[i]->nOutstanding)
+    {
+        bd->txAcked[bd->sentOn[i][bd->sentFirst[i]] % BOND_REORDER] = 1;
+        bd->sentFirst[i] = (bd->sentFirst[i] + 1) % MOD_SEQNUM;
+        bd->nSentOn[i]--;
+    }
+    while ((bd->txOldest != bd->txSeq)
+           && bd->txAcked[bd->txOldest % BOND_REORDER])
+        bd->txOldest++;
+}
+
+//===================================================================
+/* Function to give each link up to BOND_POLL to process a frame, so
+   acknowledgements are taken and frames re-sent.  Blocks that arrive
+   meanwhile are kept by the link, for LL_bondReceive().
+   Return value is 0, or negative if every link has failed.  */
+static int serviceAll(LL_bond *bd, int debug)
+{
+    LL_context *ll;  // link being served
+    int retVal;  // return value from serviceLink
+    int i;  // for use in loop
+
+    for (i = 0; i < bd->nLinks; i++)
+    {
+        if (!bd->alive[i]) continue;
+        ll = bd->link[i];
+        rxLock(ll);
+        retVal = serviceLink(ll, NULL, NULL, BOND_POLL, debug);
+        rxUnlock(ll);
+        if (retVal < 0) dropLink(bd, i, retVal);  // frames were given up
+        else noteAcks(bd, i);
+    }
+    if (bd->nAlive == 0)
+    {
+        printf("LLB: All links of the bond have failed\n");
+        return (bd->failCode < 0) ? bd->failCode : -13;
+    }
+    return 0;
+}
+
+//===================================================================
+/* Function to choose the link for the next block: of the links with
+   room in the window, a free frame buffer and a large enough block
+   size, the one with the fewest frames waiting, looking first after
+   the link used last, so links with the same load take turns.
+   Arguments: pointer to bond state, bytes in the block.
+   Returns the link number, or -1 if none has room.  */
+static int pickLink(LL_bond *bd, int nData)
+{
+    LL_context *ll;  // link being looked at
+    int best = -1;  // link chosen so far
+    int i, k;  // for use in loop
+
+    for (k = 0; k < bd->nLinks; k++)
+    {
+        i = (bd->nextLink + k) % bd->nLinks;
+        ll = bd->link[i];
+        if (!bd->alive[i] || (ll->nOutstanding >= ll->winSize)
+            || ((ll->txNext == NULL) && (poolFree(&ll->txPool) == 0))
+            || (ll->txMaxBlk < BOND_HDR + nData)) continue;
+        if ((best < 0) || (ll->nOutstanding < bd->link[best]->nOutstanding))
+            best = i;
+    }
+    return best;
+}
+
+//===================================================================
+/* Function to send the blocks in the queue, each on the link chosen
+   by pickLink(), serving the links while none has room.  The bond
+   sequence number goes in front of the block, in the frame.
+   Return value is 0 once the queue is empty, negative if every link
+   has failed.  */
+static int sendQueued(LL_bond *bd, int debug)
+{
+    LL_context *ll;  // link chosen
+    byte *payload;  // where the block goes in the frame
+    unsigned int seq;  // bond sequence number of block
+    int slot;  // where the copy of the block is
+    int i;  // link chosen
+    int retVal;  // return value from other functions
+
+    while (bd->nQueued > 0)
+    {
+        seq = bd->txQueue[bd->queueFirst];
+        slot = seq % BOND_REORDER;
+        i = pickLink(bd, bd->txSize[slot]);
+        if (i < 0)  // all busy - wait for acks, and try again
+        {
+            retVal = serviceAll(bd, debug);
+            if (retVal < 0) return retVal;
+            continue;
+        }
+
+        ll = bd->link[i];
+        retVal = LL_sendReserve(ll, &payload, debug);  // has room
+        if (retVal >= 0)
+        {
+            payload[0] = (byte) (seq >> 8);  // low 16 bits, high first
+            payload[1] = (byte) seq;
+            memcpy(payload + BOND_HDR, bd->txData[slot], bd->txSize[slot]);
+            retVal = LL_sendCommit(ll, BOND_HDR + bd->txSize[slot], debug);
+        }
+        if (retVal < 0)  // block stays in the queue, for another link
+        {
+            dropLink(bd, i, retVal);
+            if (bd->nAlive == 0) return retVal;
+            continue;
+        }
+
+        bd->sentOn[i][(bd->sentFirst[i] + bd->nSentOn[i]) % MOD_SEQNUM]
+            = seq;
+        bd->nSentOn[i]++;
+        bd->queueFirst = (bd->queueFirst + 1) % BOND_REORDER;
+        bd->nQueued--;
+        bd->nextLink = (i + 1) % bd->nLinks;
+        if (debug) printf("LLB: Block %u sent on port %d\n", seq,
+                          ll->portNum);
+    }
+    return 0;
+}
+
+//===================================================================
+/* Function to put a block received in the reorder buffer, or throw
+   it away if it is a block already received.
+   Arguments: pointer to bond state, link number, block with the bond
+              sequence number in front, number of bytes.
+   Returns 1 if done, 0 if the block is too far ahead to fit yet.  */
+static int placeBlock(LL_bond *bd, int i, byte *data, int nData)
+{
+    unsigned int dist;  // how far the block is after the one due
+    int slot;  // where the block goes
+
+    if (nData < BOND_HDR)
+    {
+        printf("LLB: Block of %d bytes on port %d has no sequence number\n",
+               nData, bd->link[i]->portNum);
+        return 1;  // not from a bond - nothing to do with it
+    }
+    dist = (((unsigned int) data[0] << 8) + data[1] - bd->rxSeq) % BOND_MOD;
+    slot = (bd->rxSeq + dist) % BOND_REORDER;
+    if ((dist >= BOND_MOD/2)
+        || ((dist < BOND_REORDER) && (bd->rxSize[slot] >= 0)))
+    {
+        bd->rxDuplicates++;  // already had it
+        return 1;
+    }
+    if (dist >= BOND_REORDER) return 0;  // too far ahead
+
+    memcpy(bd->rxData[slot], data + BOND_HDR, nData - BOND_HDR);
+    bd->rxSize[slot] = nData - BOND_HDR;
+    if (dist > 0) bd->rxEarly++;
+    return 1;
+}
+//===================================================================
+/* Function to take the next block from a link, if one arrives within
+   BOND_POLL, and put it with the others.  A block that arrived while
+   the link was sending is taken first.  If the link fails, it is
+   taken out of the bond - blocks it had not delivered are sent again
+   on the other links by the sender.
+   Arguments: pointer to bond state, link number, debug.
+   Returns 1 if a block was taken, 0 if not.  */
+static int takeBlock(LL_bond *bd, int i, int debug)
+{
+    LL_context *ll = bd->link[i];  // link to take from
+    byte *view;  // where the block is in the link state
+    int nData;  // size of block, with the bond sequence number
+    int retVal;  // return value from serviceLink
+
+    if (ll->rxPendingSize >= 0)
+    {
+        nData = ll->rxPendingSize;
+        ll->rxPendingSize = -1;  // block has been used
+        view = ll->rxPending;
+    }
+    else
+    {
+        rxLock(ll);
+        retVal = serviceLink(ll, &view, &nData, BOND_POLL, debug);
+        rxUnlock(ll);
+        if (retVal < 0)
+        {
+            bd->alive[i] = 0;
+            bd->nAlive--;
+            bd->failCode = retVal;
+            printf("LLB: Link on port %d failed, error %d - %d links left\n",
+                   ll->portNum, retVal, bd->nAlive);
+            return 0;
+        }
+        if (retVal == 0) return 0;  // nothing yet
+    }
+    noteAcks(bd, i);  // data frames carry acks, for the other direction
+    if (!placeBlock(bd, i, view, nData))  // no room - wait in the link
+    {
+        memcpy(bd->parked[i], view, nData);
+        bd->parkedSize[i] = nData;
+    }
+    return 1;
+}
+
+//===================================================================
+/* Function to set up a bond of links, before connecting.
+   Return value is 0 on success, negative on failure.  */
+int LL_bondInit(LL_bond *bd, LL_context **links, int nLinks)
+{
+    int i;  // for use in loop
+
+    if ((nLinks < 1) || (nLinks > BOND_MAXLINKS))
+    {
+        printf("LLB: Bond must have 1 to %d links, not %d\n",
+               BOND_MAXLINKS, nLinks);
+        return -11;  // error code
+    }
+    memset(bd, 0, sizeof(LL_bond));  // counters start at zero
+    bd->nLinks = nLinks;
+    for (i = 0; i < nLinks; i++) bd->link[i] = links[i];
+    bd->rxWait = links[0]->rxWait;
+    for (i = 0; i < BOND_REORDER; i++) bd->rxSize[i] = -1;  // none yet
+    for (i = 0; i < BOND_MAXLINKS; i++) bd->parkedSize[i] = -1;
+    return 0;
+}
+
+//===================================================================
+/* Function to connect each link of the bond in turn.  A link that
+   cannot connect is left out.
+   Return value is 0 if at least one link connected, negative if not.  */
+int LL_bondConnect(LL_bond *bd, int debug)
+{
+    int i;  // for use in loop
+    int retVal;  // return value from LL_connect
+
+    bd->nAlive = 0;
+    for (i = 0; i < bd->nLinks; i++)
+    {
+        retVal = LL_connect(bd->link[i], debug);
+        bd->alive[i] = (retVal == 0);
+        if (retVal == 0) bd->nAlive++;
+        else
+        {
+            printf("LLB: Link on port %d left out of the bond\n",
+                   bd->link[i]->portNum);
+            bd->failCode = retVal;
+        }
+    }
+    if (bd->nAlive == 0)
+    {
+        printf("LLB: Failed to connect, no link connected\n");
+        return (bd->failCode < 0) ? bd->failCode : -1;
+    }
+    if (debug) printf("LLB: Connected %d of %d links, largest block %d\n",
+                      bd->nAlive, bd->nLinks, LL_bondMaxBlock(bd));
+    return 0;
+}
+
+//===================================================================
+/* Function to wait for blocks in flight, then disconnect every link.
+   Return value is 0 on success, negative if blocks in flight were
+   not acknowledged, or a link could not be closed.  */
+int LL_bondDiscon(LL_bond *bd, int debug)
+{
+    int flushCode = 0;  // return value from LL_bondFlush
+    int retVal = 0;  // return value from LL_discon
+    int i;  // for use in loop
+
+    if ((bd->nQueued > 0) || (bd->txOldest != bd->txSeq))
+        flushCode = LL_bondFlush(bd, debug);
+    for (i = 0; i < bd->nLinks; i++)
+        if (bd->link[i]->connected && (LL_discon(bd->link[i], debug) < 0))
+            retVal = -1;
+    if (debug)
+        printf("LLB: Disconnected.  Sent %lld blocks, %lld again after a "
+               "link failed, received %lld early, %lld twice, "
+               "%d of %d links working\n", bd->txBlocks, bd->txMoved,
+               bd->rxEarly, bd->rxDuplicates, bd->nAlive, bd->nLinks);
+    return (flushCode < 0) ? flushCode : retVal;
+}
+
+//===================================================================
+/* Function to send a block on whichever link is free.  The block is
+   copied and queued, then the queue is sent - see sendQueued().
+   Return value is 0 on success, negative if every link has failed,
+   or the block is too large.  */
+int LL_bondSend(LL_bond *bd, byte *dataTx, int nData, int debug)
+{
+    int slot;  // where the copy goes
+    int retVal;  // return value from other functions
+
+    if ((nData < 0) || (nData > LL_bondMaxBlock(bd)))
+    {
+        printf("LLB: Cannot send block of %d bytes, max %d\n",
+               nData, LL_bondMaxBlock(bd));
+        return -11;  // error code
+    }
+
+    // Wait until the receiver has room for the block, however far
+    // the oldest block not acknowledged is from being delivered.
+    // If a link fails meanwhile, its blocks must be sent again first.
+    while (bd->txSeq - bd->txOldest >= BOND_REORDER)
+    {
+        if (bd->nQueued > 0) retVal = sendQueued(bd, debug);
+        else retVal = serviceAll(bd, debug);
+        if (retVal < 0) return retVal;
+    }
+
+    slot = bd->txSeq % BOND_REORDER;
+    memcpy(bd->txData[slot], dataTx, nData);
+    bd->txSize[slot] = nData;
+    bd->txAcked[slot] = 0;
+    bd->txQueue[(bd->queueFirst + bd->nQueued) % BOND_REORDER] = bd->txSeq;
+    bd->nQueued++;
+    bd->txSeq++;
+    bd->txBlocks++;
+    return sendQueued(bd, debug);
+}
+
+//===================================================================
+/* Function to wait for the next block in order, from any link.
+   Each link in turn is given up to BOND_POLL to deliver a block,
+   except a link whose last block is parked until there is room.
+   Return value is the size of the block, or negative on timeout, or
+   if every link has failed.  */
+int LL_bondReceive(LL_bond *bd, byte *dataRx, int maxData, int debug)
+{
+    long long timerWait = timeSet(bd->rxWait);  // limit for the block
+    int slot;  // where the next block due is kept
+    int nData;  // size of the block
+    int i, k;  // for use in loops
+
+    while (1)
+    {
+        // Deliver the next block, if it is here
+        slot = bd->rxSeq % BOND_REORDER;
+        if (bd->rxSize[slot] >= 0)
+        {
+            nData = bd->rxSize[slot];
+            if (nData > maxData) nData = maxData;  // safety check
+            memcpy(dataRx, bd->rxData[slot], nData);
+            bd->rxSize[slot] = -1;
+            bd->rxSeq++;
+
+            // A parked block may fit now, so its link can go on
+            for (i = 0; i < bd->nLinks; i++)
+                if ((bd->parkedSize[i] >= 0)
+                    && placeBlock(bd, i, bd->parked[i], bd->parkedSize[i]))
+                    bd->parkedSize[i] = -1;
+            if (debug) printf("LLB: Returning block with %d data bytes\n",
+                              nData);
+            return nData;
+        }
+
+        if (bd->nAlive == 0)
+        {
+            printf("LLB: Attempt to receive with no link working\n");
+            return (bd->failCode < 0) ? bd->failCode : -10;
+        }
+        if (timeUp(timerWait))
+        {
+            printf("LLB: Timeout trying to receive block %u\n", bd->rxSeq);
+            return -5;  // error code, as LL_receive
+        }
+
+        // Give each link a turn, starting after the last one used
+        for (k = 0; k < bd->nLinks; k++)
+        {
+            i = (bd->nextLink + k) % bd->nLinks;
+            if (bd->alive[i] && (bd->parkedSize[i] < 0))
+                takeBlock(bd, i, debug);
+        }
+        bd->nextLink = (bd->nextLink + 1) % bd->nLinks;
+    }
+}
+
+//===================================================================
+/* Function to wait until all blocks sent have been acknowledged.
+   Return value is 0 on success, negative if every link has failed.  */
+int LL_bondFlush(LL_bond *bd, int debug)
+{
+    int retVal;  // return value from other functions
+
+    while ((bd->nQueued > 0) || (bd->txOldest != bd->txSeq))
+    {
+        retVal = sendQueued(bd, debug);
+        if ((retVal >= 0) && (bd->txOldest != bd->txSeq))
+            retVal = serviceAll(bd, debug);
+        if (retVal < 0) return retVal;
+    }
+    if (debug) printf("LLB: All blocks acknowledged\n");
+    return 0;
+}
+
+//===================================================================
+/* Function to give the largest block LL_bondSend() can take now.  */
+int LL_bondMaxBlock(LL_bond *bd)
+{
+    int maxBlk = MAX_BLK;  // smallest limit found so far
+    int i;  // for use in loop
+
+    for (i = 0; i < bd->nLinks; i++)
+        if (bd->alive[i] && (bd->link[i]->txMaxBlk < maxBlk))
+            maxBlk = bd->link[i]->txMaxBlk;
+    return maxBlk - BOND_HDR;
+}
+
+//===================================================================
+/* Function to give the number of links still working.  */
+int LL_bondLinks(LL_bond *bd)
+{
+    return bd->nAlive;
+}
+
@@ -0,0 +1,132 @@
+#ifndef LINKBOND_H_INCLUDED
+#define LINKBOND_H_INCLUDED
+
+/*  Bonded links - several links between the same two computers,
+    used together as one, so the blocks sent share all the lines.
+       LL_bondInit      sets up a bond of links, already set up
+                        with LL_init() and the LL_set functions
+       LL_bondConnect   connects each link in turn
+       LL_bondDiscon    waits for blocks in flight, then disconnects
+       LL_bondSend      sends a block on whichever link is free
+       LL_bondReceive   waits for the next block, in order
+       LL_bondFlush     waits until all blocks have been acknowledged
+       LL_bondMaxBlock  gives the largest block that can be sent now
+       LL_bondLinks     gives the number of links still working
+    Each link keeps its own sequence numbers, window and timers, so
+    it recovers from errors on its own line as usual.  Each block
+    also gets a bond sequence number, the first BOND_HDR bytes of the
+    block in the frame, high byte first, so the receiver can put
+    the blocks from all the links back in order.  Blocks that arrive
+    early wait in a reorder buffer of BOND_REORDER blocks.
+    The sender gives each block to the link with the fewest frames
+    waiting for acknowledgement, of those with room in their window,
+    so a faster line takes more of the blocks.  It keeps a copy of
+    each block until its link has acknowledged it: if a link fails,
+    it is taken out of the bond, and its blocks not acknowledged are
+    sent again on the others, so the transfer goes on.  The receiver
+    throws away any block it already has.
+    The sender never gets more than BOND_REORDER blocks ahead of the
+    oldest one not acknowledged, so every block fits in the reorder
+    buffer, or waits in its link until the receiver has room.
+    One thread serves all the links, giving each up to BOND_POLL to
+    deliver its next frame in turn.  The links must not have receive
+    threads.  Both ends must list their links in the same order, as
+    LL_bondConnect() connects them one at a time.  */
+
+#include "linklayer.h"  // for the link state
+
+#define BOND_MAXLINKS 4     // largest number of links in a bond
+#define BOND_HDR 2          // bytes of bond sequence number in each block
+#define BOND_REORDER (BOND_MAXLINKS*MOD_SEQNUM)  // blocks in flight
+#define BOND_POLL 0.001     // time to wait on each link in turn, seconds
+
+#if (BOND_REORDER < 1) || (2*BOND_REORDER > (1 << (8*BOND_HDR)))
+#error "BOND_REORDER must be less than half the bond sequence numbers"
+#endif
+
+/* State of a bond of links, for both directions.  */
+typedef struct LL_bond
+{
+    LL_context *link[BOND_MAXLINKS];  // links, set up by the caller
+    int nLinks;             // number of links in the bond
+    int alive[BOND_MAXLINKS];   // 1 while the link is used
+    int nAlive;             // number of links still used
+    int failCode;           // error code of the last link to fail
+    float rxWait;           // receiver waiting time, from the first link
+    int nextLink;           // link to look at first, to share them out
+
+    // Sending side
+    unsigned int txSeq;     // bond sequence number of the next new block
+    unsigned int txOldest;  // oldest block not acknowledged by its link
+    byte txData[BOND_REORDER][MAX_BLK];  // copies of blocks in flight
+    int txSize[BOND_REORDER];   // size of each copy
+    int txAcked[BOND_REORDER];  // 1 once its link has acknowledged it
+    unsigned int txQueue[BOND_REORDER];  // blocks waiting for a link
+    int queueFirst, nQueued;    // first block in the queue, and number
+    unsigned int sentOn[BOND_MAXLINKS][MOD_SEQNUM];  // blocks in flight
+                                // on each link, oldest first
+    int sentFirst[BOND_MAXLINKS], nSentOn[BOND_MAXLINKS];
+
+    // Receiving side
+    unsigned int rxSeq;     // bond sequence number of the next block due
+    byte rxData[BOND_REORDER][MAX_BLK];  // blocks that arrived early
+    int rxSize[BOND_REORDER];   // size of each, -1 if not arrived
+    byte parked[BOND_MAXLINKS][MAX_BLK]; // block too far ahead to fit,
+                                // the link waits until it does
+    int parkedSize[BOND_MAXLINKS];  // size of each, -1 if none
+
+    // Counters
+    long long txBlocks;     // blocks given to LL_bondSend
+    long long txMoved;      // blocks sent again after their link failed
+    long long rxEarly;      // blocks that waited for an earlier one
+    long long rxDuplicates; // blocks received twice, thrown away
+} LL_bond;
+
+/* Function to set up a bond of links, before connecting.
+   Each link must already be set up by LL_init() - with its own port
+   number - and any LL_set functions.
+   Arguments: pointer to bond state, array of pointers to links,
+              number of links, 1 to BOND_MAXLINKS.
+   Return value is 0 on success, negative on failure.  */
+int LL_bondInit(LL_bond *bd, LL_context **links, int nLinks);
+
+/* Function to connect each link of the bond in turn.  A link that
+   cannot connect is left out.
+   Return value is 0 if at least one link connected, negative if not.  */
+int LL_bondConnect(LL_bond *bd, int debug);
+
+/* Function to wait for blocks in flight, then disconnect every link.
+   Return value is 0 on success, negative if blocks in flight were
+   not acknowledged, or a link could not be closed.  */
+int LL_bondDiscon(LL_bond *bd, int debug);
+
+/* Function to send a block on whichever link is free.  It returns
+   once the block has been given to a link - it does not wait for
+   the acknowledgement, but keeps a copy until then.
+   Arguments: pointer to bond state, data block, number of bytes,
+              up to LL_bondMaxBlock(), debug.
+   Return value is 0 on success, negative if every link has failed,
+   or the block is too large.  */
+int LL_bondSend(LL_bond *bd, byte *dataTx, int nData, int debug);
+
+/* Function to wait for the next block in order, from any link, up to
+   the receiver waiting time of the first link.
+   Arguments: pointer to bond state, array for the block, size of
+              array, debug.
+   Return value is the size of the block, or negative on timeout, or
+   if every link has failed.  */
+int LL_bondReceive(LL_bond *bd, byte *dataRx, int maxData, int debug);
+
+/* Function to wait until all blocks sent have been acknowledged,
+   sending again on other links any blocks from a link that fails.
+   Return value is 0 on success, negative if every link has failed.  */
+int LL_bondFlush(LL_bond *bd, int debug);
+
+/* Function to give the largest block LL_bondSend() can take now,
+   the smallest of the links still working, less BOND_HDR.  */
+int LL_bondMaxBlock(LL_bond *bd);
+
+/* Function to give the number of links still working.  */
+int LL_bondLinks(LL_bond *bd);
+
+#endif // LINKBOND_H_INCLUDED
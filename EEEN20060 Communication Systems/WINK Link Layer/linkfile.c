@@ -0,0 +1,370 @@
+/*  File transfer functions, using the link layer.
+       LL_sendFile     sends the contents of a file, then an empty block
+       LL_receiveFile  receives blocks and writes them to a file
+    Each transfer has a FileStream, with two chunks, used in turn.
+    A chunk belongs to the file thread while its full flag is 0 when
+    reading, or 1 when writing, and to the link the rest of the time.
+    Only the owner changes a chunk, and the flag is changed last, with
+    release order, so the other side sees the finished chunk - as the
+    ring buffer in logging.c, there is no lock.  Both sleep while they
+    wait, and the link first deals with the frames that have arrived,
+    but does not wait for the line - so with the loopback's virtual
+    clock, no time passes on the line while the file is read or
+    written.  */
+
+typedef unsigned char byte;
+
+#include <stdio.h>     // for fread, fwrite and printf
+#include <stdlib.h>    // for calloc and free
+#include <string.h>    // for memcpy
+#ifdef _WIN32
+#include <windows.h>   // for thread and Sleep functions
+#else
+#include <pthread.h>   // for thread functions
+#include <unistd.h>    // for usleep function
+#define Sleep(ms) usleep((ms) * 1000)  // same as Windows version
+#endif
+#include "linklayer.h" // link layer functions
+#include "linkfile.h"  // these functions
+#include "rxthread.h"  // for the lock, if the receive thread runs
+
+/* One chunk of the file, on its way to or from the link.  */
+typedef struct FileChunk
+{
+    byte data[FILE_CHUNK];  // bytes of the file
+    int nBytes;             // number of bytes in the chunk
+    int last;               // 1 if nothing follows this chunk
+    atomic_int full;        // 1 when ready for the link to send, or
+                            // for the file thread to write
+} FileChunk;
+
+/* State of one transfer, shared by the link and the file thread.  */
+typedef struct FileStream
+{
+    FILE *fp;               // file being read or written
+    FileChunk chunk[2];     // chunks, used in turn
+    atomic_int stop;        // set by the link to stop the file thread
+    atomic_int failed;      // set by the file thread if the file failed
+#ifdef _WIN32
+    HANDLE thread;          // thread that reads or writes the file
+#else
+    pthread_t thread;       // thread that reads or writes the file
+#endif
+} FileStream;
+
+//===================================================================
+/* Function for the file thread when sending - reads each chunk in
+   turn, as soon as the link has finished with it.  At the end of
+   the file, or on an error, the last chunk is marked.  */
+#ifdef _WIN32
+static DWORD WINAPI readMain(void *arg)
+#else
+static void *readMain(void *arg)
+#endif
+{
+    FileStream *fs = arg;  // state of this transfer
+    FileChunk *ck;  // chunk to fill
+    int i = 0;  // number of chunk to fill
+
+    while (1)
+    {
+        ck = &fs->chunk[i];
+        while (atomic_load_explicit(&ck->full, memory_order_acquire))
+        {
+            if (atomic_load(&fs->stop)) return 0;  // link has failed
+            Sleep(1);  // link still sending from it
+        }
+        ck->nBytes = (int) fread(ck->data, 1, FILE_CHUNK, fs->fp);
+        if (ferror(fs->fp)) atomic_store(&fs->failed, 1);
+        ck->last = (ck->nBytes < FILE_CHUNK);  // end of file, or error
+        atomic_store_explicit(&ck->full, 1, memory_order_release);
+        if (ck->last) return 0;
+        i = 1 - i;
+    }
+}
+
+//===================================================================
+/* Function for the file thread when receiving - writes each chunk
+   in turn, as soon as the link has filled it.  After an error, the
+   chunks are still taken, so the link is not held up.  */
+#ifdef _WIN32
+static DWORD WINAPI writeMain(void *arg)
+#else
+static void *writeMain(void *arg)
+#endif
+{
+    FileStream *fs = arg;  // state of this transfer
+    FileChunk *ck;  // chunk to write
+    int last;  // 1 if this is the last chunk
+    int i = 0;  // number of chunk to write
+
+    while (1)
+    {
+        ck = &fs->chunk[i];
+        while (!atomic_load_explicit(&ck->full, memory_order_acquire))
+        {
+            if (atomic_load(&fs->stop)) return 0;  // link has failed
+            Sleep(1);  // link still filling it
+        }
+        if (!atomic_load(&fs->failed)
+            && (fwrite(ck->data, 1, ck->nBytes, fs->fp)
+                != (size_t) ck->nBytes)) atomic_store(&fs->failed, 1);
+        last = ck->last;  // chunk is not ours once handed back
+        atomic_store_explicit(&ck->full, 0, memory_order_release);
+        if (last) return 0;
+        i = 1 - i;
+    }
+}
+
+//===================================================================
+/* Function to set up a transfer, and start its file thread.
+   Arguments: file, 1 to read it or 0 to write it.
+   Returns pointer to the transfer state, or NULL on failure.  */
+static FileStream *streamStart(FILE *fp, int reading)
+{
+    FileStream *fs = calloc(1, sizeof(FileStream));  // chunks all empty
+
+    if (fs == NULL)
+    {
+        printf("LLF: No memory for file transfer\n");
+        return NULL;
+    }
+    fs->fp = fp;
+
+#ifdef _WIN32
+    fs->thread = CreateThread(NULL, 0, reading ? readMain : writeMain,
+                              fs, 0, NULL);
+    if (fs->thread == NULL)
+#else
+    if (pthread_create(&fs->thread, NULL, reading ? readMain : writeMain,
+                       fs) != 0)
+#endif
+    {
+        printf("LLF: Could not start file thread\n");
+        free(fs);
+        return NULL;
+    }
+    return fs;
+}
+
+//===================================================================
+/* Function to stop the file thread, if still running, and free the
+   transfer state.
+   Returns 0, or negative if the file failed.  */
+static int streamStop(FileStream *fs)
+{
+    int failed;  // 1 if the file failed
+
+    atomic_store(&fs->stop, 1);
+#ifdef _WIN32
+    WaitForSingleObject(fs->thread, INFINITE);
+    CloseHandle(fs->thread);
+#else
+    pthread_join(fs->thread, NULL);
+#endif
+    failed = atomic_load(&fs->failed);
+    free(fs);
+    return failed ? -16 : 0;
+}
+
+//===================================================================
+/* Function to wait until a chunk's full flag has a given value,
+   dealing with frames that have arrived on the link meanwhile.
+   Arguments: pointer to link state, chunk, value to wait for, debug.
+   Returns 0, or negative if the link failed.  */
+static int waitChunk(LL_context *ll, FileChunk *ck, int full, int debug)
+{
+    int retVal;  // return value from other functions
+
+    while (atomic_load_explicit(&ck->full, memory_order_acquire) != full)
+    {
+        rxLock(ll);
+        retVal = fillRxBuffer(ll, 0);  // bytes waiting, if any
+        if (retVal >= 0) retVal = serviceLink(ll, NULL, NULL, 0.0, debug);
+        rxUnlock(ll);
+        if (retVal < 0) return retVal;
+        if (atomic_load_explicit(&ck->full, memory_order_acquire) == full)
+            break;
+        Sleep(FILE_POLL);
+    }
+    return 0;
+}
+
+
+// ===========================================================================
+/* Function to send the rest of a file, then an empty block to mark
+   the end.  Each block is the size suggested by LL_blockSize(), and
+   is built in place by LL_sendReserve() and LL_sendCommit().  A block
+   at the end of a chunk takes the rest from the next chunk, waiting
+   for it to be read if need be, so the blocks sent do not depend on
+   how fast the file thread reads.
+   Arguments: pointer to link state, file opened for binary read,
+              debug.
+   Returns the number of bytes sent, or negative on failure.  */
+long long LL_sendFile(LL_context *ll, FILE *fp, int debug)
+{
+    FileStream *fs;  // state of this transfer
+    FileChunk *ck;  // chunk being sent
+    int i = 0;  // number of that chunk
+    int pos = 0;  // position of next byte to send in chunk
+    byte *payload;  // where the data go in the frame
+    int nBlk;  // size of block to send
+    int n;  // bytes in block so far
+    int nTake;  // bytes to take from this chunk
+    long long nSent = 0;  // bytes sent so far
+    int retVal = 0;  // return value from other functions
+
+    if (ll->connected == 0)
+    {
+        printf("LLF: Attempt to send file while not connected\n");
+        return -10;  // error code
+    }
+    fs = streamStart(fp, 1);
+    if (fs == NULL) return -16;  // error code
+    ck = &fs->chunk[0];
+
+    while (1)
+    {
+        // Wait for the file thread to read this chunk
+        retVal = waitChunk(ll, ck, 1, debug);
+        if (retVal < 0) break;
+        if (pos == ck->nBytes)  // nothing left in it
+        {
+            if (ck->last) break;  // end of file
+            atomic_store_explicit(&ck->full, 0, memory_order_release);
+            i = 1 - i;
+            ck = &fs->chunk[i];
+            pos = 0;
+            continue;
+        }
+
+        retVal = LL_sendReserve(ll, &payload, debug);
+        if (retVal < 0) break;
+        nBlk = LL_blockSize(ll);
+
+        // Fill the block from this chunk, and the next if needed
+        n = 0;
+        while (1)
+        {
+            nTake = ck->nBytes - pos;
+            if (nTake > nBlk - n) nTake = nBlk - n;
+            memcpy(payload + n, ck->data + pos, nTake);
+            n += nTake;
+            pos += nTake;
+            if ((n == nBlk) || ck->last) break;
+            atomic_store_explicit(&ck->full, 0, memory_order_release);
+            i = 1 - i;  // chunk used up - on to the next one
+            ck = &fs->chunk[i];
+            pos = 0;
+            retVal = waitChunk(ll, ck, 1, debug);
+            if (retVal < 0) break;
+        }
+        if (retVal < 0) break;
+
+        retVal = LL_sendCommit(ll, n, debug);
+        if (retVal < 0) break;
+        nSent += n;
+    }
+
+    // Mark the end, unless the file could not be read
+    if ((retVal >= 0) && !atomic_load(&fs->failed))
+    {
+        retVal = LL_sendReserve(ll, &payload, debug);
+        if (retVal >= 0) retVal = LL_sendCommit(ll, 0, debug);
+        if (retVal >= 0) retVal = LL_flush(ll, debug);
+    }
+    if (streamStop(fs) < 0)
+    {
+        printf("LLF: Error reading file, after %lld bytes\n", nSent);
+        return -16;  // error code
+    }
+    if (retVal < 0) return retVal;
+    if (debug) printf("LLF: Sent file of %lld bytes\n", nSent);
+    return nSent;
+}  // end of LL_sendFile
+
+
+// ===========================================================================
+/* Function to receive blocks and write them to a file, until an empty
+   block arrives.  Each block is received straight into a chunk, which
+   is handed to the file thread when there is not room for another
+   block of MAX_BLK bytes.  After the empty block, frames are still
+   answered until the line has been quiet for the sender waiting time,
+   so the sender can finish even if the last acknowledgement was lost.
+   Arguments: pointer to link state, file opened for binary write,
+              debug.
+   Returns the number of bytes written, or negative on failure.  */
+long long LL_receiveFile(LL_context *ll, FILE *fp, int debug)
+{
+    FileStream *fs;  // state of this transfer
+    FileChunk *ck;  // chunk being filled
+    int i = 0;  // number of that chunk
+    long long nGot = 0;  // bytes received so far
+    long long rxBytes;  // bytes taken from the line, to see it is quiet
+    long long quiet;  // time limit for the line to stay quiet
+    int nRx;  // bytes in block received
+    int failed = 0;  // 1 if the link failed, after the file arrived
+    int retVal = 0;  // return value from other functions
+
+    if (ll->connected == 0)
+    {
+        printf("LLF: Attempt to receive file while not connected\n");
+        return -10;  // error code
+    }
+    fs = streamStart(fp, 0);
+    if (fs == NULL) return -16;  // error code
+    ck = &fs->chunk[0];
+
+    while (1)
+    {
+        // If no room for another block, give this chunk to be written
+        if (FILE_CHUNK - ck->nBytes < MAX_BLK)
+        {
+            ck->last = 0;
+            atomic_store_explicit(&ck->full, 1, memory_order_release);
+            i = 1 - i;
+            ck = &fs->chunk[i];
+            retVal = waitChunk(ll, ck, 0, debug);  // last one written
+            if (retVal < 0) break;
+            ck->nBytes = 0;
+        }
+
+        nRx = LL_receive(ll, ck->data + ck->nBytes, MAX_BLK, debug);
+        if (nRx < 0)
+        {
+            retVal = nRx;
+            break;
+        }
+        if (nRx == 0) break;  // end of file
+        ck->nBytes += nRx;
+        nGot += nRx;
+    }
+
+    // Write what has arrived, even if the link failed
+    ck->last = 1;
+    atomic_store_explicit(&ck->full, 1, memory_order_release);
+
+    // Answer any repeated frames, until the line is quiet - timed
+    // here, as serviceLink() returns early for its own timers
+    // - the file is complete, whatever happens then
+    quiet = timeSet(ll->txWait);
+    while ((retVal >= 0) && !failed && !timeUp(quiet))
+    {
+        rxBytes = atomic_load(&ll->count.rxBytes);
+        rxLock(ll);
+        failed = serviceLink(ll, NULL, NULL, timeLeft(quiet), debug) < 0;
+        rxUnlock(ll);
+        if (atomic_load(&ll->count.rxBytes) != rxBytes)
+            quiet = timeSet(ll->txWait);  // not quiet yet
+    }
+
+    // The file thread writes the last chunk, then stops
+    if (streamStop(fs) < 0)
+    {
+        printf("LLF: Error writing file, after %lld bytes\n", nGot);
+        return -16;  // error code
+    }
+    if (retVal < 0) return retVal;
+    if (debug) printf("LLF: Received file of %lld bytes\n", nGot);
+    return nGot;
+}  // end of LL_receiveFile
@@ -0,0 +1,41 @@
+#ifndef LINKFILE_H_INCLUDED
+#define LINKFILE_H_INCLUDED
+
+/*  File transfer functions, using the link layer.
+       LL_sendFile     sends the contents of a file, then an empty
+                       block to mark the end
+       LL_receiveFile  receives blocks and writes them to a file,
+                       until the empty block
+    Each function has a second thread for the file, with two chunks
+    of FILE_CHUNK bytes: while the link sends from one chunk, the
+    thread reads the next one, and while the link receives into one
+    chunk, the thread writes the last one.  So the file is read and
+    written in large pieces, and the line is kept busy while that
+    happens - if the link has to wait for the file, it goes on
+    dealing with acknowledgements and re-sends meanwhile.
+    The link itself is only used by the caller's thread.  */
+
+#include <stdio.h>  // for FILE
+#include "linklayer.h"  // for the link state
+
+#define FILE_CHUNK 32768  // bytes read or written at a time
+#define FILE_POLL 1       // ms to sleep, waiting for the file thread
+
+/* Function to send the rest of a file, from its present position,
+   in blocks of the size suggested by LL_blockSize(), followed by an
+   empty block.  It waits until all blocks have been acknowledged.
+   Arguments: pointer to link state, file opened for binary read,
+              debug.
+   Returns the number of bytes sent, or negative on failure.  */
+long long LL_sendFile(LL_context *ll, FILE *fp, int debug);
+
+/* Function to receive blocks and write them to a file, until an
+   empty block arrives.  It then goes on answering frames until the
+   line has been quiet for the sender waiting time, in case the
+   acknowledgement of the empty block was lost.
+   Arguments: pointer to link state, file opened for binary write,
+              debug.
+   Returns the number of bytes written, or negative on failure.  */
+long long LL_receiveFile(LL_context *ll, FILE *fp, int debug);
+
+#endif // LINKFILE_H_INCLUDED
@@ -1,36 +1,353 @@
 #ifndef LINKLAYER_H_INCLUDED
 #define LINKLAYER_H_INCLUDED
 
-// Link Layer Protocol definitions - adjust all these to match your design
-#define MAX_BLK 255 // largest number of data bytes allowed in a block
+#include "fcs.h"  // frame check sequence types
+#include "fec.h"  // forward error correction limits
+#include "framepool.h"  // frame buffer pool
+#include "compress.h"  // compression of data blocks
+#include <stdatomic.h>  // for counters read by other threads
+
+// Link Layer Protocol definitions - adjust all these to match your design.
+// Each can also be set for one build, with -D on the compiler command
+// line, or in the #defines of a build target, so several versions can
+// be built from the same files.  MOD_SEQNUM and BASE_BLK must be the
+// same at both ends.  The checks below stop the build if they do not
+// fit together.
+#ifndef MAX_BLK
+#define MAX_BLK 2048 // largest number of data bytes this end can receive
+#endif
+#ifndef BASE_BLK
+#define BASE_BLK 255 // largest block sent until the link has connected
+#endif
+#ifndef MOD_SEQNUM
 #define MOD_SEQNUM 16 // modulo for sequence numbers
+#endif
+#ifndef WINDOW_SIZE
+#define WINDOW_SIZE 4 // default sender window, 1 for stop-and-wait
+#endif
+#ifndef POOL_FRAMES
+#define POOL_FRAMES (2*WINDOW_SIZE) // frame buffers kept for re-sending
+#endif
 
 // Frame marker byte values
 #define STARTBYTE 206     // start of frame marker
 #define ENDBYTE 204     // end of frame marker
 #define STUFFBYTE 220   // stuff byte
+#define STUFFXOR 0x20   // bits inverted in byte after stuff byte
 
 // Frame header byte positions
-#define SEQNUMPOS 2     // position of sequence number
-#define BYTECOUNTPOS 1 // position of byte count
+#define BYTECOUNTPOS 1  // position of byte count, 2 bytes, high byte first
+#define SEQNUMPOS 3     // position of sequence number
+#define TYPEPOS 4       // position of frame type
+#define ACKPOS 5        // position of ack carried by data frame - next
+                        // sequence number expected, 0 in other frames
 
 // Header and trailer size
-#define HEADERSIZE 3		// number of bytes in frame header
-#define TRAILERSIZE 2	// number of bytes in frame trailer
+#define HEADERSIZE 6		// number of bytes in frame header
+#define TRAILERSIZE (FCS_MAXSIZE+1)	// max number of bytes in frame trailer
+
+// Frame sizes - every byte between the markers may need stuffing,
+// and error correction adds parity to each codeword
+#define FEC_ROOM (((HEADERSIZE+MAX_BLK+TRAILERSIZE) \
+                   / (FEC_CODEWORD-FEC_MAXPARITY) + 1) * FEC_MAXPARITY)
+#define MAX_FRAME (HEADERSIZE+MAX_BLK+TRAILERSIZE+FEC_ROOM) // before stuffing
+#define MAX_STUFFED (2*MAX_FRAME-2)  // max frame, after stuffing
+#define HOLD_FRAMES (MOD_SEQNUM/2)   // frames held after a gap, at most
+
+// Error detection and correction, and compression - defaults, which
+// can also be set for one build, as above
+#ifndef FCS_TYPE
+#define FCS_TYPE FCS_CRC16  // default frame check sequence type
+#endif
+#ifndef FEC_PARITY
+#define FEC_PARITY 0        // default parity bytes per codeword, 0 for none
+#endif
+#ifndef COMPRESS
+#define COMPRESS 0          // default, 1 to compress blocks if both ends ask
+#endif
+#ifndef SELECTIVE
+#define SELECTIVE 1         // default, 1 to re-send only frames lost (Selective
+                            // Repeat) if both ends ask, 0 for Go-Back-N
+#endif
 
-// Acknowledgement values
+// Frame type and acknowledgement values
+#define DATA 68         // type is data frame
+#define ZDATA 90        // type is data frame, with the block compressed
 #define GOOD 1          // type is good - positive ack
 #define BAD 26          // type is bad, nak
-#define ACK_SIZE 5      // number of bytes in ack frame
+#define PARAM 80        // type is parameters, to agree link settings
+#define SACK_SIZE ((MOD_SEQNUM/2+7)/8)  // bytes of bitmap of frames held,
+                                        // carried by acks, see sendAck()
+#define ACK_SIZE (HEADERSIZE+SACK_SIZE+TRAILERSIZE+FEC_MAXPARITY) // max in ack
 
-// Time limits
-#define TX_WAIT 5.0   // sender waiting time in seconds
+// Parameter frame - data byte positions, each value high byte first
+#define PARAM_BLK 0     // largest block this end receives, 2 bytes
+#define PARAM_MAXRATE 2 // fastest bit rate this end will try, /100, 2 bytes
+#define PARAM_RATE 4    // bit rate this frame was sent at, /100, 2 bytes
+#define PARAM_WIN 6     // largest window this end uses
+#define PARAM_FCS 7     // frame check sequence type this end asks for
+#define PARAM_FCSMASK 8 // bit for each check sequence type this end has
+#define PARAM_SERIAL 9  // serial number of these parameters, 1 to 255
+#define PARAM_HEARD 10  // serial number of the other end's parameters
+                        // heard at this bit rate, 0 if none
+#define PARAM_FEC 11    // parity bytes per codeword this end asks for
+#define PARAM_COMP 12   // 1 if this end asks for compression, 0 if not
+#define PARAM_SEL 13    // 1 if this end asks for selective repeat, 0 if not
+#define PARAM_SIZE 14   // data bytes in parameter frame
+#define PARAM_CHECK FCS_CRC16  // check sequence for parameter frames
+#define PARAM_DROP 2    // in place of sequence number: lower the bit rate
+
+// Time limits - defaults, can be changed by LL_setTimeouts()
+#define TX_WAIT 5.0   // sender waiting time in seconds, max re-transmit time
 #define RX_WAIT 20.0  // receiver waiting time in seconds
 #define MAX_TRIES 6   // number of times to re-try (either end)
+#define GIVEUP_PROB 1.0E-6  // chance of giving up on a working link
+#define GIVEUP_LOSS 0.75    // highest frame loss assumed, for giving up
+#define RTO_MIN 0.001 // shortest re-transmit time in seconds, if adaptive
+#define PARAM_RETRY 1.0 // time between parameter frames, while agreeing
+#define STEP_WAIT 4.0  // time to agree each faster bit rate, or drop back
+#define ACK_DELAY 0.02 // longest time an ack is held, for data to carry it
 
-// Simulated errors
+// Line settings - defaults, can be changed by LL_setLine()
+#define BASE_RATE 1200   // bit rate for agreeing settings, every end has it
+#define BIT_RATE 38400   // fastest bit rate to try, in bit/s
 #define PROB_ERR 3.0E-4  // probability of simulated error on receive
 
+// Adaptive block size and bit rate - see adaptLink()
+#define ADAPT_FRAMES 32  // data frames sent in each period measured
+#define ADAPT_LOSSES 4   // NAKs that end a period early
+#define ADAPT_START 64   // block size suggested at first
+#define ADAPT_MINBLK 16  // smallest block size suggested
+#define ADAPT_STEP 1.25  // ratio between block sizes tried
+#define ADAPT_GAIN 0.25  // gain for smoothing the bit error estimate
+#define RATE_DROP 1.0    // frames re-sent per new frame, to lower bit rate
+#define ADAPT_TIME 0.5   // part of txWait a full window may take to send
+#define LINE_BITS 10     // bits on the line per byte, with start and stop
+
+// Receive buffer size - larger than any frame
+#define RXBUFSIZE (2*MAX_STUFFED)
+
+// Checks that the settings above fit together - the build stops if not
+#if BASE_BLK < PARAM_SIZE
+#error "BASE_BLK must be large enough for a parameter frame"
+#endif
+#if (MAX_BLK < BASE_BLK) || (MAX_BLK > 65535 - HEADERSIZE - TRAILERSIZE)
+#error "MAX_BLK must be at least BASE_BLK, with frame size in 16 bits"
+#endif
+#if (BYTECOUNTPOS < 1) || (BYTECOUNTPOS + 1 >= HEADERSIZE) \
+    || (SEQNUMPOS < 1) || (SEQNUMPOS >= HEADERSIZE) \
+    || (TYPEPOS < 1) || (TYPEPOS >= HEADERSIZE) \
+    || (ACKPOS < 1) || (ACKPOS >= HEADERSIZE)
+#error "Header positions must be after the start marker, within HEADERSIZE"
+#endif
+#if (SEQNUMPOS == BYTECOUNTPOS) || (SEQNUMPOS == BYTECOUNTPOS + 1) \
+    || (TYPEPOS == BYTECOUNTPOS) || (TYPEPOS == BYTECOUNTPOS + 1) \
+    || (ACKPOS == BYTECOUNTPOS) || (ACKPOS == BYTECOUNTPOS + 1) \
+    || (SEQNUMPOS == TYPEPOS) || (ACKPOS == SEQNUMPOS) || (ACKPOS == TYPEPOS)
+#error "Header positions must not overlap"
+#endif
+#if (MOD_SEQNUM < 2) || (MOD_SEQNUM > 256)
+#error "MOD_SEQNUM must be 2 to 256, as sequence numbers are one byte"
+#endif
+#if (WINDOW_SIZE < 1) || (WINDOW_SIZE >= MOD_SEQNUM)
+#error "WINDOW_SIZE must be 1 to MOD_SEQNUM - 1"
+#endif
+#if (POOL_FRAMES < 1) || (POOL_FRAMES > POOL_MAXFRAMES)
+#error "POOL_FRAMES must be 1 to POOL_MAXFRAMES"
+#endif
+#if (FCS_TYPE < FCS_SUM) || (FCS_TYPE > FCS_CRC32)
+#error "FCS_TYPE must be one of the types in fcs.h"
+#endif
+#if (FEC_PARITY < 0) || (FEC_PARITY > FEC_MAXPARITY)
+#error "FEC_PARITY must be 0 to FEC_MAXPARITY"
+#endif
+#if (COMPRESS != 0) && (COMPRESS != 1)
+#error "COMPRESS must be 0 or 1"
+#endif
+#if (SELECTIVE != 0) && (SELECTIVE != 1)
+#error "SELECTIVE must be 0 or 1"
+#endif
+#if (ADAPT_MINBLK < 1) || (ADAPT_START < ADAPT_MINBLK)
+#error "ADAPT_START must be at least ADAPT_MINBLK, which must be above 0"
+#endif
+
+// Round trip time histogram - bin 0 is under 1 ms, bin i is from
+// 2^(i-1) to 2^i ms, and the last bin has everything longer
+#define LL_RTT_BINS 16
+
+
+/* Counters kept while a link is running.  Each is atomic, so another
+   thread can read them at any time using LL_getStats(), and adding
+   to one costs little more than an ordinary increment.  */
+typedef struct LL_counters
+{
+    atomic_llong txFrames;      // data frames sent, not counting re-sends
+    atomic_llong txResent;      // data frames re-sent
+    atomic_llong txAcks;        // acknowledgements sent, positive or negative
+    atomic_llong txAcksSaved;   // acks not sent, carried by data or later ack
+    atomic_llong txBytes;       // bytes put on the line, after stuffing
+    atomic_llong txData;        // data bytes sent, not counting re-sends
+    atomic_llong txCoded;       // bytes those took in frames, if compressed
+    atomic_llong txRaw;         // blocks sent as they were, not compressible
+    atomic_llong txTimeouts;    // re-transmit timer expired
+    atomic_llong rxFrames;      // good frames received, data or ack
+    atomic_llong rxAcks;        // good acknowledgements received
+    atomic_llong rxBytes;       // bytes taken from the line
+    atomic_llong rxData;        // data bytes accepted, in sequence
+    atomic_llong rxDuplicates;  // good data frames received before
+    atomic_llong rxGaps;        // good data frames after a gap in sequence
+    atomic_llong rxBadFcs;      // frames with frame check sequence wrong
+    atomic_llong rxBadMarker;   // frames with start or end marker wrong
+    atomic_llong rxBadCount;    // frames with byte count wrong
+    atomic_llong rxBadOther;    // frames too short, too long, or bad type
+    atomic_llong rxResync;      // bytes discarded, looking for a start marker
+    atomic_llong rxTimeouts;    // LL_receive gave up waiting for a block
+    atomic_llong rxFecFixed;    // bytes corrected by the error correction
+    atomic_llong rxFecFrames;   // frames with at least one byte corrected
+    atomic_llong rxFecFailed;   // frames with too many errors to correct
+    atomic_llong rttHist[LL_RTT_BINS];  // round trip times measured
+} LL_counters;
+
+/* Snapshot of the counters, given by LL_getStats().
+   See LL_counters for what each one counts.  */
+typedef struct LL_stats
+{
+    long long txFrames, txResent, txAcks, txBytes, txData, txTimeouts;
+    long long txAcksSaved, txCoded, txRaw;
+    long long rxFrames, rxAcks, rxBytes, rxData, rxDuplicates, rxGaps;
+    long long rxBadFcs, rxBadMarker, rxBadCount, rxBadOther;
+    long long rxResync, rxTimeouts;
+    long long rxFecFixed, rxFecFrames, rxFecFailed;
+    long long rttHist[LL_RTT_BINS];
+} LL_stats;
+
+
+/* One piece of data for LL_sendv() - the pieces in a list are sent
+   as one stream of bytes, cut into blocks to suit the line.  */
+typedef struct LL_iovec
+{
+    byte *data;                 // start of the piece
+    int len;                    // number of bytes in the piece
+} LL_iovec;
+
+
+/* State of one link - everything the protocol needs to remember.
+   Each link has its own state, so a program can use several ports
+   at once, or run each link in its own thread.
+   Set up by LL_init(), then passed to every link layer function.  */
+typedef struct LL_context
+{
+    struct PHY_context *phy;    // physical layer state for this link
+    int portNum;                // port number for this link
+    int bitRate;                // fastest bit rate to try, in bit/s
+    double probErr;             // probability of simulated error
+    int seqNumTx;               // transmit frame sequence number
+    int connected;              // keep track of state of connection
+    LL_counters count;          // counters, for LL_getStats()
+    long long timerRx;          // time value for timeouts
+    int fcsType;                // type of frame check sequence
+    int fecParity;              // parity bytes per codeword, 0 for none
+    int compress;               // 1 if blocks are compressed, both ways
+    int selective;              // 1 if only frames lost are re-sent, both ways
+
+    // Link settings - the limits of each end are exchanged when the
+    // link connects, and both ends use settings within both limits
+    int blkLimit;               // largest block this end wants to receive
+    int winLimit;               // largest window this end will use
+    int fcsWanted;              // check sequence type this end asks for
+    int fecWanted;              // parity bytes this end asks for
+    int compWanted;             // 1 if this end asks for compression
+    int selWanted;              // 1 if this end asks for selective repeat
+    int rateCap;                // fastest bit rate this end offers now
+    int peerBlk;                // other end's limit, 0 if not known yet
+    int peerWin;                // other end's largest window
+    int peerFcs;                // check sequence type other end asks for
+    int peerFcsMask;            // check sequence types other end has
+    int peerFec;                // parity bytes other end asks for
+    int peerComp;               // 1 if other end asks for compression
+    int peerSel;                // 1 if other end asks for selective repeat
+    int peerRate;               // fastest bit rate other end offers
+    int txMaxBlk;               // largest block that can be sent now
+    int rateNow;                // bit rate in use
+    int agreeing;               // 1 while the settings are being agreed
+    int nAgreed;                // times settings agreed, this connection
+    int nHeard;                 // frames received, good or bad
+    int paramSerial;            // serial number of this end's parameters
+    int peerSerial;             // serial of other end's, heard at rateNow
+    int peerHeard;              // serial of ours the other end has heard
+
+    // Adaptive block size - measured over periods of ADAPT_FRAMES
+    int adaptBlocks;            // 1 to suggest block sizes for the line
+    int adaptRate;              // 1 to lower the bit rate if too many re-sent
+    int txBlk;                  // block size suggested now
+    double bitErr;              // smoothed estimate of bit error probability
+    int nPeriods;               // periods measured so far
+    int periodFrames;           // new data frames sent in this period
+    int periodResent;           // data frames re-sent in this period
+    int periodLosses;           // NAKs received in this period
+    long long periodBits;       // bits in new data frames in this period
+
+    // Time limits, and estimate of round trip time, all in seconds
+    float txWait;               // sender waiting time, max re-transmit time
+    float rxWait;               // receiver waiting time
+    int adaptive;               // 1 if re-transmit time follows round trip
+    float rto;                  // re-transmit time for next frame sent
+    float srtt;                 // smoothed round trip time
+    float rttVar;               // mean deviation of round trip time
+    int rttValid;               // 1 once a round trip has been measured
+
+    // Receive buffer - bytes from the physical layer, waiting to be used
+    byte rxBuf[RXBUFSIZE];      // circular buffer of received bytes
+    int rxHead;                 // position of next byte to be used
+    int rxCount;                // number of bytes waiting in buffer
+    int rxLen;                  // bytes of part frame taken from buffer
+    int rxStuffed;              // 1 if part frame ends with STUFFBYTE
+
+    // Sender window - frames sent but not yet acknowledged
+    int winSize;                // max number of frames in flight
+    int seqBase;                // oldest unacknowledged sequence number
+    int nOutstanding;           // number of unacknowledged frames
+    byte txBuild[MAX_FRAME];    // next frame, being built, before stuffing
+    byte *txStore[MOD_SEQNUM];  // copy of each frame sent, from the pool
+    byte *txNext;               // pool buffer for next frame, if reserved
+    int txSize[MOD_SEQNUM];     // size of each stored frame
+    int txLen[MOD_SEQNUM];      // data bytes in each stored frame
+    int txAck[MOD_SEQNUM];      // ack carried by each stored frame
+    int txParity[MOD_SEQNUM];   // parity per codeword in each stored frame,
+                                // to recover it - see rebuildFrame()
+    long long txTimer[MOD_SEQNUM];   // re-transmit time limit for each frame
+    long long txSentAt[MOD_SEQNUM];  // time each frame left, last sent
+    long long lineFree;         // time all bytes sent will have left
+    int txTries[MOD_SEQNUM];    // number of times each frame was sent
+    int txSacked[MOD_SEQNUM];   // 1 if the receiver holds the frame, after
+                                // a gap, so it need not be sent again
+    CompStream txComp;          // history of blocks sent, for compression
+    byte txCompStore[COMP_STORE(MAX_BLK)];  // storage for that history
+    FramePool txPool;           // buffers for the copies of frames sent
+    byte txPoolStore[POOL_FRAMES][MAX_STUFFED];  // storage for the pool
+
+    // Receiver state
+    byte rxFrame[MAX_FRAME];    // last frame received, after de-stuffing
+    int seqNumRx;               // next sequence number expected
+    int nakSent;                // 1 if NAK already sent for seqNumRx
+    byte rxHeld[HOLD_FRAMES][MAX_FRAME];  // frames after a gap, held
+                                // until it fills, by sequence number
+                                // modulo HOLD_FRAMES, as all are within
+                                // half the sequence numbers ahead
+    int rxHeldSize[MOD_SEQNUM]; // size of each frame held, -1 if none
+    int nHeld;                  // number of frames held
+    float ackDelay;             // longest time to hold an ack, 0 for none
+    int ackHeld;                // blocks accepted, but not yet acknowledged
+    long long ackTimer;         // time limit for sending the held ack
+    CompStream rxComp;          // history of blocks accepted, to expand
+    byte rxCompStore[COMP_STORE(MAX_BLK)];  // storage for that history
+    byte rxPending[MAX_BLK];    // block that arrived while sending
+    int rxPendingSize;          // size of that block, -1 if none
+    struct RxThread *rxThread;  // receive thread, NULL if not running
+    struct LL_trace *trace;     // trace of bytes sent and received,
+                                // NULL if not tracing - see linktrace.h
+} LL_context;
+
 
 /* Functions to implement link layer protocol.
    All functions take a debug argument - if 1, they print
@@ -38,49 +355,254 @@
    Regardless of debug, functions print messages on errors.
    All functions return negative values on error or failure.  */
 
+// Function to initialise the state of a link, before it is used.
+void LL_init(LL_context *ll, int portNum);
+
 // Function to connect to another computer.
-int LL_connect(int debug);
+int LL_connect(LL_context *ll, int debug);
 
 // Function to disconnect from other computer.
-int LL_discon(int debug);
+int LL_discon(LL_context *ll, int debug);
 
 // Function to send a block of data in a frame.
-int LL_send(byte *dataTx, int nData, int debug);
+int LL_send(LL_context *ll, byte *dataTx, int nData, int debug);
 
 // Function to receive a frame and return a block of data.
-int LL_receive(byte *dataRx, int maxData, int debug);
+int LL_receive(LL_context *ll, byte *dataRx, int maxData, int debug);
+
+// Function to get space for the next block, to build it in place.
+int LL_sendReserve(LL_context *ll, byte **dataTx, int debug);
+
+// Function to send the block built in the space from LL_sendReserve.
+int LL_sendCommit(LL_context *ll, int nData, int debug);
+
+// Function to send a list of pieces of data, cut into blocks.
+int LL_sendv(LL_context *ll, const LL_iovec *iov, int nIov, int debug);
+
+// Function to receive a frame and give the location of the block of data.
+int LL_receiveView(LL_context *ll, byte **dataRx, int debug);
+
+// Function to wait until all frames sent have been acknowledged.
+int LL_flush(LL_context *ll, int debug);
+
+// Function to set the sender window size (1 for stop-and-wait).
+int LL_setWindow(LL_context *ll, int window, int debug);
+
+// Function to set the type of frame check sequence.
+int LL_setFcs(LL_context *ll, int type, int debug);
+
+// Function to set the number of parity bytes, to correct errors.
+int LL_setFec(LL_context *ll, int nParity, int debug);
+
+// Function to ask for compression of data blocks.
+int LL_setCompress(LL_context *ll, int on, int debug);
+
+// Function to ask for selective repeat, so only frames lost are re-sent.
+int LL_setSelective(LL_context *ll, int on, int debug);
+
+// Function to set the bit rate and simulated error probability.
+int LL_setLine(LL_context *ll, int bitRate, double probErr, int debug);
+
+// Function to set the time limits, and choose adaptive re-transmit time.
+int LL_setTimeouts(LL_context *ll, float txWait, float rxWait,
+                   int adaptive, int debug);
+
+// Function to set the largest block, offered to the other end on connect.
+int LL_setMaxBlock(LL_context *ll, int maxBlk, int debug);
+
+// Function to give the largest block that can be sent now.
+int LL_maxBlock(LL_context *ll);
+
+// Function to give the block size that suits the line now.
+int LL_blockSize(LL_context *ll);
+
+// Function to choose adaptive block size, and lower bit rate on errors.
+int LL_setAdapt(LL_context *ll, int blocks, int rate, int debug);
+
+// Function to set how long an ack may be held, to go with data.
+int LL_setAckDelay(LL_context *ll, float delay, int debug);
+
+// Function to take a snapshot of the counters - safe from any thread.
+void LL_getStats(LL_context *ll, LL_stats *stats);
+
+// Function to set all the counters to zero.
+void LL_resetStats(LL_context *ll);
+
+// Functions to serve links from an event loop, without waiting
+
+// Function to give a handle the system can wait on for bytes arriving.
+int LL_getHandle(LL_context *ll);
+
+// Function to give the time in ms until the link must be served.
+int LL_nextTimeout(LL_context *ll);
+
+// Function to serve the link, when bytes arrive or a timer is due.
+int LL_onReadable(LL_context *ll, byte **dataRx, int *nRx, int debug);
+
+// Function to check if a block can be sent without waiting.
+int LL_canSend(LL_context *ll);
+
+// Function to wait until any of a list of links must be served.
+int LL_waitAny(LL_context **links, int nLinks, int *ready, int timeLimit);
 
 
 // ==========================================================
-// Functions called by the four link layer functions above
+// Functions called by the link layer functions above
+
+// Function to get space for the next block - see LL_sendReserve.
+int reserveSpace(LL_context *ll, byte **dataTx, int debug);
+
+// Function to send the block built in place - see LL_sendCommit.
+int commitBlock(LL_context *ll, int nData, int debug);
+
+// Function to send a list of pieces of data - see LL_sendv.
+int sendBlocks(LL_context *ll, const LL_iovec *iov, int nIov, int debug);
+
+// Function to finish the frame for a block, and add it to the window.
+int storeBlock(LL_context *ll, int nData);
+
+// Function to process one received frame, or wait for a time limit.
+int serviceLink(LL_context *ll, byte **dataRx, int *nRx,
+                float timeLimit, int debug);
+
+// Function to process an acknowledgement - positive or negative.
+int processAck(LL_context *ll, int type, int seq, byte *sack, int debug);
+
+// Function to re-send frames if the re-transmit timer has expired.
+int checkTimers(LL_context *ll, int debug);
+
+// Function to give the frame whose re-transmit timer is due first.
+int firstTimer(LL_context *ll);
+
+// Function to re-send all frames in the window, except those held.
+int resendFrames(LL_context *ll, int debug);
+
+// Function to re-send the frames lost, with selective repeat.
+int resendLost(LL_context *ll, int debug);
+
+// Function to re-send one frame in the window.
+int resendFrame(LL_context *ll, int seq, int debug);
+
+// Function to give the number of times a frame may be sent.
+int triesAllowed(LL_context *ll, int nFrame);
+
+// Function to update the re-transmit time from a round trip time.
+void updateRto(LL_context *ll, float rtt);
+
+// Function to find when bytes given to the physical layer will leave.
+long long lineDone(LL_context *ll, int nBytes);
+
+// Function to start sending a frame from the re-transmission store.
+int startSend(LL_context *ll, int seq);
+
+// Function to start sending bytes from a buffer in the frame pool.
+int sendPooled(LL_context *ll, byte *frameTx, int nBytes);
+
+// Function to build a stored frame again, with the ack as it is now.
+int rebuildFrame(LL_context *ll, int seq);
+
+// Function to accept the next block in sequence, and acknowledge it.
+int acceptBlock(LL_context *ll, byte *frameRx, int nFrame,
+                byte **dataRx, int *nRx, int debug);
+
+// Function to check if a frame held is the next in sequence.
+int heldReady(LL_context *ll);
 
-// Function to build a frame from a block of data.
-int buildDataFrame(byte *frameTx, byte *dataTx, int nData, int seq);
+// Function to hold the ack for a block accepted, or send it now.
+int holdAck(LL_context *ll);
+
+// Function called by the physical layer when a send is done.
+void sendDone(void *link, byte *dataTx, int nBytesSent);
+
+// Function to build a frame of any type - data or ack.
+int buildFrame(LL_context *ll, byte *frameTx, byte *dataTx,
+               int nData, int seq, int type);
+
+// Function to finish a frame, with the data already in place.
+int finishFrame(LL_context *ll, byte *frameTx, byte *frame,
+                int nData, int seq, int type);
 
 // Function to get a frame from the received bytes.
-int getFrame(byte *frameRx, int maxSize, float timeLimit);
+int getFrame(LL_context *ll, byte *frameRx, int maxSize, float timeLimit);
+
+// Function to fill the receive buffer from the physical layer.
+int fillRxBuffer(LL_context *ll, int wait);
+
+// Function to correct errors in a received frame, using the parity.
+int decodeFrame(LL_context *ll, byte *frameRx, int nFrame);
 
 // Function to check a received frame for errors.
-int checkFrame(byte *frameRx, int nFrame);
+int checkFrame(LL_context *ll, byte *frameRx, int nFrame);
 
 // Function to process received frame.
-int processFrame(byte *frameRx, int nFrame,
-                 byte *dataRx, int maxData, int *seqNum);
+int processFrame(LL_context *ll, byte *frameRx, int nFrame,
+                 byte **dataRx, int *seqNum);
 
 // Function to send an acknowledgement - positive or negative.
-int sendAck(int type, int seq);
+int sendAck(LL_context *ll, int type, int seq);
+
+// Function to send this end's parameters to the other end.
+int sendParam(LL_context *ll, int ask);
+
+// Function to process the other end's parameters.
+int processParam(LL_context *ll, byte *frameRx, int nFrame, int debug);
+
+// Function to agree the link settings with the other end.
+int agreeParams(LL_context *ll, int debug);
+
+// Function to exchange parameters until both ends have heard each other.
+int syncParams(LL_context *ll, long long timeLimit, int debug);
+
+// Function to change the bit rate of the link.
+int setRate(LL_context *ll, int bitRate, int debug);
+
+// Function to choose the check sequence type, from both ends' choices.
+int chooseFcs(LL_context *ll);
+
+// Function to adapt the block size to the error rate, once each period.
+int adaptLink(LL_context *ll, int debug);
+
+// Function to find the block size giving the best goodput.
+int bestBlock(LL_context *ll, double bitErr);
+
+// Function to ask the other end to move to a lower bit rate.
+int dropRate(LL_context *ll, int debug);
+
+// Function to agree the link settings again, at BASE_RATE.
+int reagree(LL_context *ll, int debug);
 
 // ==========================================================
 // Helper functions used by various other functions
 
+// Function to give the number of bytes in the trailer of a frame type
+int trailerSize(LL_context *ll, int type);
+
+// Function to give the check sequence type for a frame type
+int frameFcs(LL_context *ll, int type);
+
+// Function to give the largest a data frame can be, for a block size
+int frameRoom(LL_context *ll, int nData);
+
+// Function to check if both ends have heard each other at this rate
+int paramsHeard(LL_context *ll);
+
+// Function to read the byte count from a frame header
+int frameLength(byte *frame);
+
 // Function to advance the sequence number
 int next(int seq);
 
+// Function to read the monotonic clock, in microseconds.
+long long timeMicros(void);
+
 // Function to set time limit at a point in the future.
-long timeSet(float limit);
+long long timeSet(float limit);
 
 // Function to check if time limit has elapsed.
-int timeUp(long timeLimit);
+int timeUp(long long timeLimit);
+
+// Function to find the time remaining before a time limit.
+float timeLeft(long long timeLimit);
 
 // Function to check if byte is a protocol byte.
 int special(byte b);
@@ -1,9 +1,120 @@
-/* Functions to implement link layer protocol - simple versions
-	can only detect errors, no acknowledgements or re-transmission:
-   LL_connect() connects to another computer;
-   LL_discon()  disconnects;
+/* Functions to implement link layer protocol, with a sliding window
+   automatic repeat request scheme for error recovery - Go-Back-N, or
+   Selective Repeat if both ends ask for it:
+   LL_init()    sets up the state of a link, before it is used;
+   LL_connect() connects to another computer, and agrees settings;
+   LL_discon()  waits for frames in flight, then disconnects;
    LL_send()    sends a block of data;
-   LL_receive() waits to receive a block of data.
+   LL_receive() waits to receive a block of data;
+   LL_sendReserve() and LL_sendCommit() send a block built in place;
+   LL_sendv()   sends a list of pieces of data, cut into blocks;
+   LL_receiveView() receives a block, without copying it;
+   LL_flush()   waits until all blocks sent have been acknowledged;
+   LL_setWindow() sets the number of frames that can be in flight;
+   LL_setFcs()  sets the type of frame check sequence;
+   LL_setFec()  sets the number of parity bytes, to correct errors;
+   LL_setCompress() asks for data blocks to be compressed;
+   LL_setSelective() asks for only the frames lost to be re-sent;
+   LL_setLine() sets the fastest bit rate and simulated error probability;
+   LL_setTimeouts() sets the time limits;
+   LL_setMaxBlock() sets the largest block, offered on connect;
+   LL_maxBlock() gives the largest block that can be sent now;
+   LL_blockSize() gives the block size that suits the line now;
+   LL_setAdapt() chooses adaptive block size, and lower bit rate;
+   LL_setAckDelay() sets how long an ack may be held, to go with data;
+   LL_getStats() gives a snapshot of the counters, from any thread;
+   LL_resetStats() sets the counters to zero;
+   LL_getHandle() gives a handle the system can wait on for bytes;
+   LL_nextTimeout() gives the time until the link must be served;
+   LL_onReadable() serves the link without waiting, when bytes
+   have arrived or a timer is due;
+   LL_canSend() says if a block can be sent without waiting;
+   LL_waitAny() waits until any of a list of links must be served.
+   LL_startRxThread() in rxthread.c starts a thread to serve the
+   link while the program is busy - the functions above then take
+   a lock on the link state, and LL_receive takes blocks from the
+   queue the thread fills.
+   LL_traceStart() in linktrace.c records every byte sent and
+   received in a file, to find out later why a link was slow.
+   The sender keeps a copy of each frame until it is acknowledged.
+   The receiver sends a cumulative positive acknowledgement, giving the
+   next sequence number it expects, or a negative acknowledgement
+   asking for the frames from that sequence number to be sent again.
+   A window size of 1 gives a simple stop-and-wait protocol.
+   If both ends ask for it with LL_setSelective() - the default - the
+   link uses Selective Repeat instead.  The receiver holds each frame
+   that arrives after a gap, in a slot for its sequence number, and
+   accepts the blocks held in order once the frames lost fill the
+   gap.  Every ack sent while frames are held carries a bitmap of
+   them, so the sender re-sends only the frames the receiver does not
+   have:  after a NAK, the oldest frame and any others before the
+   last frame held, and after a timeout, each frame whose own timer
+   has expired.  The window is then at most MOD_SEQNUM/2, so a frame
+   sent again can always be told from a new one.
+   Every data frame also carries a positive ack in its header, the
+   next sequence number its sender expects, so when both ends are
+   sending, most acks need no frame of their own.  The ack for a
+   block accepted is held for up to ACK_DELAY, in case data going the
+   other way can carry it, or a later ack can cover it.  It is sent
+   on its own after that time, or once half a window of blocks is
+   waiting for it.  Acks for duplicates, and NAKs, are sent at once.
+   A frame sent again is built again first if the ack it carries is
+   out of date, as the other end could not tell an old ack of one
+   sequence number from a new one.
+   The re-transmit time adapts to the measured round trip time, using
+   the Jacobson/Karels estimator, with TX_WAIT as the upper limit.
+   The byte count in the header has 16 bits, so frames can be much
+   larger than 255 bytes.
+   When the link connects, the two ends exchange parameter frames at
+   BASE_RATE, giving the largest block, window, fastest bit rate and
+   check sequence type each end will use.  Both then use the smaller
+   block and window, and the stronger check sequence.  The bit rate
+   is doubled, one step at a time, up to the slower end's limit, and
+   parameters are exchanged again at each step, so a rate the line
+   cannot carry is found.  If a step fails, both ends drop back to
+   BASE_RATE and agree again, without that rate.  Parameter frames
+   always use the PARAM_CHECK check sequence, and give the bit rate
+   they were sent at, so frames left over from another rate are
+   not counted.
+   While sending, the frame error rate is measured from the NAKs in
+   each period of ADAPT_FRAMES frames, and LL_blockSize() suggests
+   the block size that gives the best goodput at that error rate -
+   shorter blocks on a noisy line, longer on a clean one.
+   If LL_setAdapt() allows it, and too many frames are re-sent once
+   the blocks stop getting shorter, the sender asks the other end to
+   move to a lower bit rate, and both ends agree the settings again
+   from BASE_RATE.
+   Re-transmit timers start when a frame has left the line, not when
+   it was given to the physical layer, so the round trip time does
+   not depend on the number or length of frames waiting to be sent.
+   Frames are checked by a frame check sequence covering the header
+   and data - a CRC by default, see fcs.h, set by LL_setFcs().
+   If either end asks for it with LL_setFec(), Reed-Solomon parity is
+   added to each frame after the check sequence, and the receiver
+   corrects what errors it can before checking - see fec.h.  So a
+   few bits in error no longer cost a re-send, which takes a round
+   trip, and the check sequence still finds any frame not corrected.
+   Parameter frames never have parity, so they can be read before
+   the settings are agreed.
+   If both ends ask for it with LL_setCompress(), each block is
+   compressed before it is put in a frame, and expanded once the
+   frame is accepted - see compress.h.  Each direction keeps a
+   history of the blocks before, so a block can refer to text sent
+   earlier.  A block that would not get shorter is sent as it is,
+   in a DATA frame, and a compressed block in a ZDATA frame, so
+   compression never makes a frame longer.
+   Byte stuffing makes sure that the start and end markers only
+   appear at the start and end of a frame, see stuff.h.
+   The state of each link is kept in an LL_context, passed as the first
+   argument to every function, so several links can be used at once.
+   One thread can serve many links from an event loop, once they are
+   connected:  it waits on the handles from LL_getHandle(), with the
+   time limit from LL_nextTimeout(), or in LL_waitAny(), and calls
+   LL_onReadable() for each link that is ready.  That processes the
+   bytes that have arrived, and any timers due, but never waits, so
+   a link with nothing to do costs nothing.  Blocks are sent with
+   LL_send() once LL_canSend() says there is room, so it does not
+   wait either - unless the link must agree a lower bit rate.
    All functions take a debug argument - if 1, they print
    messages explaining what is happening.
    Regardless of debug, functions print messages on errors.
@@ -13,40 +124,164 @@
 typedef unsigned char byte;
 
 #include <stdio.h>      // input-output library: print & file operations
-#include <time.h>       // for timing functions
+#include <string.h>     // for memcpy
+#include <math.h>       // for log1p and expm1, to choose block size
 #include "physical.h"   // physical layer functions
 #include "linklayer.h"  // these functions
+#include "fcs.h"        // frame check sequence functions
+#include "fec.h"        // forward error correction functions
+#include "compress.h"   // compression functions
+#include "stuff.h"      // byte stuffing functions
+#include "framepool.h"  // frame buffer pool functions
+#include "logging.h"    // for messages on the receive path
+#include "rxthread.h"   // for the lock and queue of the receive thread
+#include "linktrace.h"  // for the trace of bytes sent and received
+
+// Add to one of the counters - relaxed, as each counter stands alone
+#define COUNT(ll, name, n) \
+    atomic_fetch_add_explicit(&(ll)->count.name, (n), memory_order_relaxed)
+
+// ===========================================================================
+/* Function to initialise the state of a link, before it is used.
+   Sets the default window size and frame check sequence, which can
+   then be changed by LL_setWindow(), LL_setFcs() and so on.
+   Call this before starting any threads, as it also builds the
+   tables used for the frame check sequence.
+   Arguments: pointer to link state, port number for this link.  */
+void LL_init(LL_context *ll, int portNum)
+{
+    memset(ll, 0, sizeof(LL_context));  // all counters start at zero
+    ll->portNum = portNum;
+    ll->bitRate = BIT_RATE;     // default line settings
+    ll->probErr = PROB_ERR;
+    ll->phy = NULL;             // physical layer not created yet
+    ll->winSize = WINDOW_SIZE;  // default window size
+    ll->fcsType = FCS_TYPE;     // default frame check sequence
+    ll->fecParity = 0;          // no parity until agreed
+    ll->compWanted = COMPRESS;  // compress only if asked for
+    ll->compress = 0;           // not until agreed
+    ll->selWanted = SELECTIVE;  // re-send only frames lost, if both ask
+    ll->selective = 0;          // not until agreed
+    ll->txWait = TX_WAIT;       // default time limits
+    ll->rxWait = RX_WAIT;
+    ll->adaptive = 1;           // re-transmit time follows round trip
+    ll->rto = TX_WAIT;          // until a round trip has been measured
+    ll->rxPendingSize = -1;     // no block waiting
+    ll->blkLimit = MAX_BLK;     // largest block, until LL_setMaxBlock()
+    ll->winLimit = WINDOW_SIZE; // limits offered to the other end
+    ll->fcsWanted = FCS_TYPE;
+    ll->fecWanted = FEC_PARITY;
+    ll->peerBlk = 0;            // other end's limit not known
+    ll->txMaxBlk = BASE_BLK;
+    ll->adaptBlocks = 1;        // suggest block sizes to suit the line
+    ll->ackDelay = ACK_DELAY;   // acks may wait for data to carry them
+    ll->adaptRate = 0;          // keep the agreed bit rate
+    ll->txBlk = ADAPT_START;
+    fcsInit();  // build the tables, if not done already
+    fecInit();
+}
 
-static int seqNumTx;        // transmit frame sequence number
-static int connected = 0;   // keep track of state of connection
-static int framesSent = 0;      // count of frames sent
-static int badFrames = 0;       // count of bad frames received
-static int goodFrames = 0;      // count of good frames received
-static int timeouts = 0;        // count of timeouts
-static long timerRx;            // time value for timeouts
 
 // ===========================================================================
 /* Function to connect to another computer.
-   It just calls PHY_open() and reports any error.
-   It also initialises counters for debug purposes.  */
-int LL_connect(int debug)
+   It creates the physical layer state for the link,
+   then calls PHY_open() at BASE_RATE and reports any error.
+   It also initialises counters for debug purposes.
+   Then it agrees the link settings with the other end - see
+   agreeParams() - waiting up to the receiver waiting time for the
+   other end to connect.  If that fails, the port is closed again.  */
+int LL_connect(LL_context *ll, int debug)
 {
-    // Try to connect - set suitable parameters here...
-    int retCode = PHY_open(1,4800,8,0,1000,50,PROB_ERR);
+    int i;  // for use in loop
+    int retCode;  // return value from PHY_open
+
+    // Create the physical layer state, if not done already
+    if (ll->phy == NULL) ll->phy = PHY_create();
+    if (ll->phy == NULL)
+    {
+        printf("LL: Failed to connect, no memory for physical layer\n");
+        return -1;
+    }
+
+    // Try to connect - start slowly, so any line will do...
+    retCode = PHY_open(ll->phy, ll->portNum, BASE_RATE, 8, 0, 1000, 50,
+                       ll->probErr);
     if (retCode == 0)   // check if succeeded
     {
-        connected = 1;      // record that we are connected
-        seqNumTx = 0;       // set first sequence number
-        framesSent = 0;     // initialise counters for debug
-        badFrames = 0;
-        goodFrames = 0;
-        timeouts = 0;
-        if (debug) printf("LL: Connected\n");
+        ll->connected = 1;      // record that we are connected
+        ll->seqNumTx = 0;       // set first sequence number
+        ll->seqBase = 0;        // nothing waiting for acknowledgement
+        ll->nOutstanding = 0;
+        ll->seqNumRx = 0;       // first sequence number expected
+        ll->nakSent = 0;
+        ll->ackHeld = 0;        // no ack waiting to be sent
+        ll->rxPendingSize = -1; // no block waiting
+        LL_resetStats(ll);      // counters start again for each connection
+        ll->rxHead = 0;         // receive buffer is empty
+        ll->rxCount = 0;
+        ll->rxLen = 0;          // no part frame received
+        ll->rxStuffed = 0;
+        ll->rttValid = 0;       // no round trip measured yet
+        ll->rto = ll->txWait;
+        ll->lineFree = 0;       // nothing sent yet
+        for (i = 0; i < MOD_SEQNUM; i++)
+        {
+            ll->txStore[i] = NULL;  // no frames kept
+            ll->txSacked[i] = 0;
+            ll->rxHeldSize[i] = -1; // no frames held
+        }
+        ll->nHeld = 0;
+        ll->txNext = NULL;
+        poolInit(&ll->txPool, ll->txPoolStore[0], MAX_STUFFED, POOL_FRAMES);
+        PHY_setSendCallback(ll->phy, sendDone, ll);  // to know sends done
+        ll->rateNow = BASE_RATE;
+        ll->rateCap = ll->bitRate;  // fastest rate to offer
+        ll->paramSerial = 1;
+        ll->peerSerial = 0;     // nothing heard from the other end yet
+        ll->peerHeard = 0;
+        ll->peerBlk = 0;
+        ll->peerFec = 0;
+        ll->peerComp = 0;
+        ll->peerSel = 0;
+        ll->fecParity = 0;      // parameter frames have no parity
+        ll->compress = 0;       // blocks sent as they are, until agreed
+        ll->selective = 0;      // Go-Back-N, until agreed
+        compInit(&ll->txComp, ll->txCompStore, MAX_BLK);  // no history
+        compInit(&ll->rxComp, ll->rxCompStore, MAX_BLK);
+        ll->nAgreed = 0;
+        ll->nHeard = 0;
+
+        // Agree the settings, or give up on this connection
+        retCode = agreeParams(ll, debug);
+        if (retCode < 0)
+        {
+            printf("LL: Failed to connect, settings not agreed\n");
+            PHY_close(ll->phy);
+            ll->connected = 0;
+            return retCode;
+        }
+
+        // Start with short blocks, which grow if the line is clean
+        ll->txBlk = (ADAPT_START < ll->txMaxBlk) ? ADAPT_START : ll->txMaxBlk;
+        ll->bitErr = 0.0;
+        ll->nPeriods = 0;
+        ll->periodFrames = 0;
+        ll->periodResent = 0;
+        ll->periodLosses = 0;
+        ll->periodBits = 0;
+
+        if (debug) printf("LL: Connected on port %d at %d bit/s, window %d, "
+                          "max block %d, check type %d, parity %d, "
+                          "compression %s, %s\n", ll->portNum,
+                          ll->rateNow, ll->winSize, ll->txMaxBlk,
+                          ll->fcsType, ll->fecParity,
+                          ll->compress ? "on" : "off",
+                          ll->selective ? "selective repeat" : "Go-Back-N");
         return 0;
     }
     else  // failed
     {
-        connected = 0;  // record lack of connection
+        ll->connected = 0;  // record lack of connection
         printf("LL: Failed to connect, PHY returned code %d\n",retCode);
         return -retCode;  // return negative error code
     }
@@ -55,20 +290,81 @@ int LL_connect(int debug)
 
 // ===========================================================================
 /* Function to disconnect from other computer.
-   It just calls PHY_close() and prints debug info.  */
-int LL_discon(int debug)
+   Frames still in flight are given the usual chances to be
+   acknowledged, and the last bytes sent are allowed to leave,
+   before it calls PHY_close().  It then prints debug info,
+   and frees the physical layer state.  A trace, if running, is
+   written out, but goes on until LL_traceStop().
+   The counters are kept, so LL_getStats() can still be used.
+   Return value is 0 on success, negative if the port could not be
+   closed, or if frames in flight were not acknowledged.  */
+int LL_discon(LL_context *ll, int debug)
 {
-    int retCode = PHY_close();  // try to disconnect
-    connected = 0;  // assume no longer connected
+    int retCode;  // return value from PHY_close
+    int flushCode = 0;  // return value from LL_flush
+    int nLeft = ll->nOutstanding;  // frames in flight
+    LL_stats st;  // snapshot of counters
+
+    // The receive thread must stop first, as the state is freed
+    if (ll->rxThread != NULL)
+    {
+        LL_stopRxThread(ll, debug);
+        nLeft = ll->nOutstanding;
+    }
+
+    // Graceful teardown - finish what has been sent
+    if (ll->connected && (nLeft > 0))
+    {
+        flushCode = LL_flush(ll, debug);
+        if (flushCode < 0)
+            printf("LL: Disconnecting with %d frames not acknowledged\n",
+                   nLeft);
+    }
+    // An ack still held goes now, as nothing else will carry it,
+    // then the last acks are allowed to leave
+    if (ll->connected)
+    {
+        if (ll->ackHeld > 0) sendAck(ll, GOOD, ll->seqNumRx);
+        PHY_sendPoll(ll->phy, 1);
+    }
+    LL_traceFlush(ll);  // so the trace file has the whole connection
+
+    retCode = PHY_close(ll->phy);  // try to disconnect
+    ll->connected = 0;  // assume no longer connected
+    PHY_destroy(ll->phy);
+    ll->phy = NULL;
     if (retCode == 0)   // check if succeeded
     {
         if (debug) // print all the counters
         {
-            printf("LL: Disconnected.  Sent %d data frames\n", framesSent);
-            printf("LL: Received %d good and %d bad frames, had %d timeouts\n",
-                   goodFrames, badFrames, timeouts);
+            LL_getStats(ll, &st);
+            printf("LL: Disconnected.  Sent %lld data frames, re-sent %lld\n",
+                   st.txFrames, st.txResent);
+            printf("LL: Sent %lld acks, %lld more carried by data or "
+                   "later acks\n", st.txAcks, st.txAcksSaved);
+            printf("LL: Received %lld good and %lld bad frames, "
+                   "had %lld timeouts\n", st.rxFrames,
+                   st.rxBadFcs + st.rxBadMarker + st.rxBadCount
+                   + st.rxBadOther + st.rxFecFailed, st.rxTimeouts);
+            if (ll->fecParity > 0)
+                printf("LL: Corrected %lld bytes in %lld frames, "
+                       "%lld frames could not be corrected\n",
+                       st.rxFecFixed, st.rxFecFrames, st.rxFecFailed);
+            if (ll->compress && (st.txCoded > 0))
+                printf("LL: Compressed %lld data bytes to %lld, %.2f "
+                       "times the throughput, %lld blocks sent raw\n",
+                       st.txData, st.txCoded,
+                       (double) st.txData / st.txCoded, st.txRaw);
+            if (ll->rttValid)
+                printf("LL: Round trip %.2f ms, re-transmit time %.2f ms\n",
+                       ll->srtt * 1000.0, ll->rto * 1000.0);
+            printf("LL: Pool of %d buffers, max %d used, ran out %d times\n",
+                   ll->txPool.nFrames, ll->txPool.highWater,
+                   ll->txPool.exhausted);
+            printf("LL: Block size %d suggested, bit error estimate %.2g\n",
+                   LL_blockSize(ll), ll->bitErr);
         }
-        return 0;
+        return flushCode;
 
     }
     else  // failed
@@ -84,379 +380,2821 @@ int LL_discon(int debug)
    Arguments:  Data block as array of bytes,
                number of bytes to send, debug.
    Return value is 0 on success, negative on failure.
-   If connected, builds a frame, then sends the frame using PHY_send.
-   This simple version does nothing else...  */
-int LL_send(byte *dataTx, int nData, int debug)
+   The data are copied into the frame being built, then sent by
+   LL_sendCommit() - see there for details.  To avoid the copy,
+   use LL_sendReserve() and LL_sendCommit() directly.  */
+int LL_send(LL_context *ll, byte *dataTx, int nData, int debug)
 {
-    byte frameTx[3*MAX_BLK];  // array large enough for frame
-    int nFrame = 0;           // size of frame
+    byte *payload;  // where the data go in the frame
     int retVal;  // return value from other functions
 
-    // First check if connected
-    if (connected == 0)
+    // Check block size first, so nothing is waited for if too big
+    if (nData > ll->txMaxBlk)
+    {
+        printf("LL: Cannot send block of %d bytes, max %d\n",
+               nData, ll->txMaxBlk);
+        return -11;  // error code
+    }
+
+    rxLock(ll);  // if the receive thread runs, it waits meanwhile
+    retVal = reserveSpace(ll, &payload, debug);
+    if (retVal >= 0)  // not connected, or link failed, if negative
+    {
+        memcpy(payload, dataTx, nData);
+        retVal = commitBlock(ll, nData, debug);
+    }
+    rxUnlock(ll);
+    return retVal;
+}  // end of LL_send
+
+
+// ===========================================================================
+/* Function to get space for the next block of data, in the frame
+   being built, so the caller can put the data there directly.
+   If connected, waits until there is space in the window, and a
+   buffer in the pool to keep the frame for re-transmission,
+   processing acknowledgements and re-transmitting frames as needed.
+   Arguments:  pointer to pointer which is set to the space for data,
+               debug.
+   Return value is the number of data bytes that can be put there,
+   or negative on failure.  The space can be used until the block is
+   sent by LL_sendCommit(), or the next call to LL_sendReserve().
+   At the end of each period of ADAPT_FRAMES frames (or sooner, if
+   there are ADAPT_LOSSES NAKs), the block size
+   suggested by LL_blockSize() is changed to suit the line - see
+   adaptLink() - but any block up to the returned size can be sent.
+   The work is done by reserveSpace(), holding the lock on the link
+   state if the receive thread is running.  */
+int LL_sendReserve(LL_context *ll, byte **dataTx, int debug)
+{
+    int retVal;  // return value from reserveSpace
+
+    rxLock(ll);
+    retVal = reserveSpace(ll, dataTx, debug);
+    rxUnlock(ll);
+    return retVal;
+}  // end of LL_sendReserve
+
+
+// ===========================================================================
+/* Function to get space for the next block of data - see
+   LL_sendReserve() for details.  The caller holds the lock.  */
+int reserveSpace(LL_context *ll, byte **dataTx, int debug)
+{
+    int retVal;  // return value from other functions
+
+    // First check if connected, and the receive thread has not failed
+    if (ll->connected == 0)
     {
         printf("LL: Attempt to send while not connected\n");
         return -10;  // error code
     }
+    retVal = rxFailed(ll);
+    if (retVal < 0) return retVal;
 
-    // Then check if block size OK - adjust limit for your design
-    if (nData > MAX_BLK)
+    // Adapt to the errors in the last period, if it is over
+    if ((ll->periodFrames >= ADAPT_FRAMES)
+        || (ll->periodLosses >= ADAPT_LOSSES))
     {
-        printf("LL: Cannot send block of %d bytes, max %d\n", nData, MAX_BLK);
-        return -11;  // error code
+        retVal = adaptLink(ll, debug);
+        if (retVal < 0) return retVal;  // link failed, changing bit rate
     }
 
-    // Build the frame
-    nFrame = buildDataFrame(frameTx, dataTx, nData, seqNumTx);
+    // Wait for space in the window
+    while (ll->nOutstanding >= ll->winSize)
+    {
+        retVal = serviceLink(ll, NULL, NULL, ll->txWait, debug);
+        if (retVal < 0) return retVal;  // link has failed
+    }
 
-    // Send the frame, then check for problems
-    retVal = PHY_send(frameTx, nFrame);  // send frame bytes
-    if (retVal != nFrame)  // problem!
+    // Take a buffer from the pool, unless already done
+    if (ll->txNext == NULL) ll->txNext = poolAcquire(&ll->txPool);
+    while (ll->txNext == NULL)  // all in use - wait for one to be freed
     {
-        printf("LL: Block %d, failed to send frame\n", seqNumTx);
-        return -12;  // error code
+        // Buffers of frames already acknowledged may still be sending
+        if (PHY_sendPoll(ll->phy, 1) < 0) return -12;
+        if (poolFree(&ll->txPool) == 0)  // still none - wait for acks
+        {
+            retVal = serviceLink(ll, NULL, NULL, ll->txWait, debug);
+            if (retVal < 0) return retVal;  // link has failed
+        }
+        if (poolFree(&ll->txPool) > 0) ll->txNext = poolAcquire(&ll->txPool);
     }
-    if (debug) printf("LL: Sent frame %d bytes, block %d\n",
-                      nFrame, seqNumTx);
 
-    framesSent++;  // increment frame counter (for debug)
-    seqNumTx = next(seqNumTx);  // increment sequence number
-    return 0;
+    *dataTx = ll->txBuild + HEADERSIZE;  // after the header
+    return ll->txMaxBlk;
+}  // end of reserveSpace
 
-}  // end of LL_send
+
+// ===========================================================================
+/* Function to send the block of data put in the space given by
+   LL_sendReserve().  Compresses the block, if agreed and it gets
+   shorter, then adds the header and trailer around the data,
+   keeps a copy of the frame for re-transmission, with byte stuffing,
+   and sends the frame using PHY_sendAsync, so the next frame can be
+   built while this one is being sent.  It does not wait for the
+   acknowledgement.
+   Arguments:  number of data bytes, debug.
+   Return value is 0 on success, negative on failure.
+   The work is done by commitBlock(), holding the lock on the link
+   state if the receive thread is running.  */
+int LL_sendCommit(LL_context *ll, int nData, int debug)
+{
+    int retVal;  // return value from commitBlock
+
+    rxLock(ll);
+    retVal = commitBlock(ll, nData, debug);
+    rxUnlock(ll);
+    return retVal;
+}  // end of LL_sendCommit
 
 
 // ===========================================================================
-/* Function to receive a frame and extract a block of data.
-   Arguments:  array to hold data block,
-               max size of data block.
-   Return value is actual size of data block, or negative on error.
-   If connected, tries to get frame from received bytes.
-   If frame found, check if good frame.
-   If good, extract data and return number of data bytes.
-   If bad, return with error code.  */
-int LL_receive(byte *dataRx, int maxData, int debug)
+/* Function to send the block of data put in the space given by
+   reserveSpace() - see LL_sendCommit() for details.
+   The caller holds the lock.  */
+int commitBlock(LL_context *ll, int nData, int debug)
 {
-    byte frameRx[3*MAX_BLK];  // create array to hold frame
-    int nData = 0;  // number of data bytes received
-    int nFrame = 0;  // number of bytes in frame received
-    int seqNumRx = 0;  // sequence number of received frame
-    int i;  // for use in loop
+    int nFrame = 0;           // size of frame
+    int seq = ll->seqNumTx;   // sequence number of this frame
+    int retVal;  // return value from other functions
 
     // First check if connected
-    if (connected == 0)
+    if (ll->connected == 0)
     {
-        printf("LL: Attempt to receive while not connected\n");
+        printf("LL: Attempt to send while not connected\n");
         return -10;  // error code
     }
 
-    // First get a frame, up to maximum size of array.
-    // Function returns number of bytes in frame, or negative if error
-    nFrame = getFrame(frameRx, 3*MAX_BLK, RX_WAIT);
-    if (nFrame < 0)  // some problem receiving
+    // Then check if block size OK - adjust limit for your design
+    if ((nData < 0) || (nData > ll->txMaxBlk))
     {
-        return -9;  // quit if error
+        printf("LL: Cannot send block of %d bytes, max %d\n",
+               nData, ll->txMaxBlk);
+        return -11;  // error code
     }
-    if (nFrame == 0)  // timeout
+
+    // Window and buffer must be ready - found by LL_sendReserve,
+    // which does not replace the data if called again here
+    if ((ll->nOutstanding >= ll->winSize) || (ll->txNext == NULL))
     {
-        printf("LL: Timeout trying to receive frame\n");
-        timeouts++; // increment timeout counter
-        return -5;  // report this as an error for now
+        printf("LL: Block sent without space from LL_sendReserve\n");
+        return -14;  // error code
     }
 
-    // If we get this far, we have received a frame
-    if (debug) printf("LL: Got frame, %d bytes\n", nFrame);
+    // Finish the frame, in the buffer kept for re-transmission,
+    // and add it to the window
+    ll->txStore[seq] = ll->txNext;
+    ll->txNext = NULL;
+    nFrame = storeBlock(ll, nData);
 
-    // Next step is to check it for errors
-    if (checkFrame(frameRx, nFrame) == 0 ) // frame is bad
+    // Start sending the frame, then check for problems
+    retVal = startSend(ll, seq);
+    if (retVal < 0)  // problem!
     {
-        if (debug) printf("LL: Bad frame received\n");
-        printFrame(frameRx, nFrame);
-        badFrames++;  // increment bad frame counter
-        for (i=0; i<10; i++) dataRx[i] = 35; // # symbol
-        return 10;  // return 10 dummy bytes for error
-    }
-    else  // we have a good frame - process it
-    {
-        if (debug) printf("LL: Good frame received\n");
-        goodFrames++;  // increment good frame counter
-        nData = processFrame(frameRx, nFrame,
-                             dataRx, maxData, &seqNumRx);
-        if (debug) printf("LL: Received block %d with %d data bytes\n",
-                          seqNumRx, nData);
-        return nData;   // return number of data bytes
-    }  // end of received frame processing
-}  // end of LL_receive
+        printf("LL: Block %d, failed to send frame\n", seq);
+        return retVal;  // error code
+    }
+    if (debug) printf("LL: Sent frame %d bytes, block %d\n", nFrame, seq);
+
+    // Start the re-transmit timer, from when the frame will have left
+    // the line
+    ll->txTimer[seq] = ll->txSentAt[seq] + (long long) (ll->rto * 1.0E6);
+    return 0;
+
+}  // end of commitBlock
 
 
 // ===========================================================================
-/* Function to build a frame from a block of data.
-   This function puts the header bytes into the frame,
-   then copies in the data bytes.  Then it adds the trailer bytes.
-   It keeps track of the total number of bytes in the frame,
-   and returns this value to the calling function.
-   Arguments: array to hold frame,
-              array of data,
-              number of data bytes to be sent,
-              sequence number to include in header.
-   Return value is number of bytes in the frame.  */
-int buildDataFrame(byte *frameTx, byte *dataTx, int nData, int seq)
+/* Function to send a list of pieces of data, as one stream of bytes,
+   cut into blocks of the size suggested by LL_blockSize().  The
+   block boundaries need not match the pieces, so the receiver gets
+   the same bytes in the same order, but not the same pieces.
+   As many frames as the window allows are built at once, and put
+   together in one buffer, so they go to the physical layer in one
+   send, rather than one for each block.  Each frame is also kept
+   on its own, to be sent again if needed.  It returns once the last
+   block has been sent, without waiting for the acknowledgements.
+   Arguments:  array of pieces, each a pointer and number of bytes,
+               number of pieces, debug.
+   Return value is 0 on success, negative on failure.  If there are
+   no bytes, nothing is sent - use LL_send() for an empty block.
+   The work is done by sendBlocks(), holding the lock on the link
+   state if the receive thread is running.  */
+int LL_sendv(LL_context *ll, const LL_iovec *iov, int nIov, int debug)
 {
-    int i = 0;  // for use in loop
+    int retVal;  // return value from sendBlocks
 
-    int checkSum = 0;
+    rxLock(ll);
+    retVal = sendBlocks(ll, iov, nIov, debug);
+    rxUnlock(ll);
+    return retVal;
+}  // end of LL_sendv
 
-    // Build the header
-    frameTx[0] = STARTBYTE;  // start of frame marker
-    frameTx[BYTECOUNTPOS] = (byte) (HEADERSIZE+nData+TRAILERSIZE);
-    frameTx[SEQNUMPOS] = (byte) seq;  // sequence number
 
+// ===========================================================================
+/* Function to send a list of pieces of data - see LL_sendv() for
+   details.  Each batch starts with reserveSpace(), which waits for
+   room in the window and a frame buffer, then frames are added while
+   there is room in the window, a buffer for each, and room in the
+   batch buffer for the largest frame the next block could make.
+   If no buffer is free for the batch, the frame is sent on its own.
+   The caller holds the lock.  */
+int sendBlocks(LL_context *ll, const LL_iovec *iov, int nIov, int debug)
+{
+    long long left = 0;  // bytes still to send
+    byte *batch;  // buffer holding the frames to send together
+    int nBatch;  // bytes in batch buffer
+    int nFrames;  // frames in this batch
+    int first;  // sequence number of first frame in batch
+    byte *data;  // where the next block goes
+    int nData;  // bytes in block
+    int nFrame;  // bytes in frame, after stuffing
+    int piece = 0, offset = 0;  // next byte to send, in the list
+    int n, k;  // for use in loops
+    int seq;  // for use in loops
+    int retVal;  // return value from other functions
 
-    // Copy data bytes into frame
-    for (i = 0; i < (nData); i++)
+    for (n = 0; n < nIov; n++)
     {
-        frameTx[i + HEADERSIZE] = dataTx[i];  // copy the data byte
-		checkSum += (int) dataTx[i];
+        if ((iov[n].len < 0) || ((iov[n].len > 0) && (iov[n].data == NULL)))
+        {
+            printf("LL: Invalid piece %d in list to send\n", n);
+            return -11;  // error code
+        }
+        left += iov[n].len;
     }
 
-	checkSum = (256 - (checkSum%256))%256;
-
-    frameTx[HEADERSIZE+nData] = (byte) checkSum;
+    while (left > 0)
+    {
+        retVal = reserveSpace(ll, &data, debug);  // window and buffer
+        if (retVal < 0) return retVal;  // link has failed
+        batch = poolAcquire(&ll->txPool);  // NULL if none left
+        first = ll->seqNumTx;
+        nBatch = 0;
+        nFrames = 0;
+
+        while (1)
+        {
+            // Gather the next block from the pieces
+            data = ll->txBuild + HEADERSIZE;
+            nData = LL_blockSize(ll);
+            if (nData > left) nData = (int) left;
+            for (n = 0; n < nData; n += k)
+            {
+                while (offset == iov[piece].len)  // next piece
+                {
+                    piece++;
+                    offset = 0;
+                }
+                k = iov[piece].len - offset;
+                if (k > nData - n) k = nData - n;
+                memcpy(data + n, iov[piece].data + offset, k);
+                offset += k;
+            }
+            left -= nData;
+
+            // Finish the frame in its own buffer, add it to the window,
+            // then to the batch
+            seq = ll->seqNumTx;
+            ll->txStore[seq] = ll->txNext;
+            ll->txNext = NULL;
+            nFrame = storeBlock(ll, nData);
+            nFrames++;
+            if (batch == NULL) break;  // sent on its own
+            memcpy(batch + nBatch, ll->txStore[seq], nFrame);
+            nBatch += nFrame;
+
+            // Stop at the end of the data, or when out of room
+            nData = LL_blockSize(ll);
+            if (nData > left) nData = (int) left;
+            if ((left == 0) || (ll->nOutstanding >= ll->winSize)
+                || (nBatch + frameRoom(ll, nData) > MAX_STUFFED)) break;
+            ll->txNext = poolAcquire(&ll->txPool);
+            if (ll->txNext == NULL) break;
+        }
 
+        if (batch == NULL) retVal = startSend(ll, first);
+        else
+        {
+            // The send holds the batch buffer until it is done
+            retVal = sendPooled(ll, batch, nBatch);
+            poolRelease(&ll->txPool, batch);
+            if (retVal == 0) COUNT(ll, txBytes, nBatch);
+
+            // Each frame leaves the line in turn, in the batch
+            for (n = 0, seq = first; (retVal == 0) && (n < nFrames);
+                 n++, seq = next(seq))
+                ll->txSentAt[seq] = lineDone(ll, ll->txSize[seq]);
+        }
+        if (retVal < 0)
+        {
+            printf("LL: Blocks %d to %d, failed to send frames\n",
+                   first, (first + nFrames - 1) % MOD_SEQNUM);
+            return retVal;  // error code
+        }
+        if (debug) printf("LL: Sent %d frames together, %d bytes, "
+                          "blocks %d to %d\n", nFrames,
+                          (batch == NULL) ? ll->txSize[first] : nBatch,
+                          first, (first + nFrames - 1) % MOD_SEQNUM);
+
+        // Start the re-transmit timers, from when each frame will have
+        // left the line
+        for (n = 0, seq = first; n < nFrames; n++, seq = next(seq))
+            ll->txTimer[seq] = ll->txSentAt[seq]
+                               + (long long) (ll->rto * 1.0E6);
+    }
+    return 0;
+}  // end of sendBlocks
 
 
-    // Build the trailer - just end marker for now
-    frameTx[HEADERSIZE+nData + 1] = ENDBYTE; // end of frame marker byte
+// ===========================================================================
+/* Function to finish the frame for the block in the space from
+   reserveSpace(), in the buffer already put in txStore for it, and
+   add it to the window.  The block is compressed first, if agreed
+   and it gets shorter.  The frame is not sent - the caller does that,
+   then starts its re-transmit timer.
+   Argument: number of data bytes.
+   Return value is number of bytes in the frame, after stuffing.  */
+int storeBlock(LL_context *ll, int nData)
+{
+    int seq = ll->seqNumTx;  // sequence number of this frame
+    byte *data = ll->txBuild + HEADERSIZE;  // the block
+    byte coded[MAX_BLK];  // the block, compressed
+    int nCoded = nData;  // bytes of block in the frame
+    int type = DATA;  // type of frame, ZDATA if compressed
+    int nFrame;  // size of frame
+    int retVal;  // return value from compBlock
+
+    // Compress the block in place, unless that would not shorten it -
+    // it goes in the history either way, as the receiver's does
+    if (ll->compress)
+    {
+        retVal = compBlock(&ll->txComp, coded, data, nData);
+        if (retVal >= 0)
+        {
+            nCoded = retVal;
+            memcpy(data, coded, nCoded);
+            type = ZDATA;
+        }
+        else COUNT(ll, txRaw, 1);
+    }
 
-    // Return the size of the frame
-    return HEADERSIZE+nData+TRAILERSIZE;
-}
+    nFrame = finishFrame(ll, ll->txStore[seq], ll->txBuild,
+                         nCoded, seq, type);
+    ll->txSize[seq] = nFrame;
+    ll->txLen[seq] = nCoded;
+    ll->txAck[seq] = ll->txBuild[ACKPOS];
+    ll->txParity[seq] = ll->fecParity;
+    ll->txTries[seq] = 1;
+    ll->txSacked[seq] = 0;
+    ll->nOutstanding++;
+
+    COUNT(ll, txFrames, 1);
+    COUNT(ll, txData, nData);
+    COUNT(ll, txCoded, nCoded);
+    ll->periodFrames++;  // for adaptLink
+    ll->periodBits += 8 * nFrame;
+    ll->seqNumTx = next(ll->seqNumTx);  // increment sequence number
+    return nFrame;
+}  // end of storeBlock
 
 
 // ===========================================================================
-/* Function to get a frame from the received bytes.
-   Arguments: pointer to array of bytes to hold frame,
-              maximum number of bytes to receive,
-              time limit for receiving those bytes.
-   Return value is number of bytes recovered, or negative if error. */
-int getFrame(byte *frameRx, int maxSize, float timeLimit)
+/* Function to receive a frame and extract a block of data.
+   Arguments:  array to hold data block,
+               max size of data block.
+   Return value is actual size of data block, or negative on error.
+   The block is found by LL_receiveView() - see there for details -
+   and copied to the array.  */
+int LL_receive(LL_context *ll, byte *dataRx, int maxData, int debug)
 {
-    int nRx = 0;  // number of bytes received so far
-    int retVal = 0;  // return value from other functions
-    int byteCount;
+    byte *view;  // where the block is in the link state
+    int nData = LL_receiveView(ll, &view, debug);
 
-    timerRx = timeSet(timeLimit);  // set time limit to wait for frame
-
-    // First search for the start of frame marker
-    do
-    {
-        retVal = PHY_get(frameRx, 1); // get one byte at a time
-        // Return value is number of bytes received, or negative for error
-        if (retVal < 0) return retVal;  // check for error and give up
-     }
-    while (((retVal < 1) || (frameRx[0] != STARTBYTE)) && !timeUp(timerRx));
-    // until we get a byte which is start of frame marker, or timeout
-
-    /*
-        Get one more byte to find out how many more bytes are needed.
-    */
-    retVal = PHY_get((frameRx + 1), 1); // get one byte at a time
-    // Return value is number of bytes received, or negative for error
-    if (retVal < 0) return retVal;  // check for error and give up
+    if (nData < 0) return nData;  // error
+    if (nData > maxData) nData = maxData;  // safety check
+    memcpy(dataRx, view, nData);
+    return nData;
+}  // end of LL_receive
 
-    byteCount = (int) frameRx[BYTECOUNTPOS];
 
+// ===========================================================================
+/* Function to receive a frame and give the location of the block of
+   data, without copying it.
+   Arguments:  pointer to pointer which is set to the start of the
+               data block, debug.
+   Return value is actual size of data block, or negative on error.
+   The block stays valid until the next call to a link layer function
+   for this link, so it should be used, or copied, before then.
+   If connected, processes received frames until the next block
+   in sequence arrives, or the time limit is reached.  Bad frames
+   and frames out of sequence are dealt with by serviceLink(),
+   which asks for them to be sent again.
+   If the receive thread is running, the next block is taken from
+   its queue, and frames are only processed here, holding the lock,
+   if the queue is empty - any block that arrives then also goes
+   through the queue, so blocks stay in order.  */
+int LL_receiveView(LL_context *ll, byte **dataRx, int debug)
+{
+    int nData = 0;  // number of data bytes received
+    int retVal;  // return value from other functions
+    long long timerWait;  // time limit for receiving a block
+    int nAgreed = ll->nAgreed;  // to know if settings are agreed again
+    int nHeard = ll->nHeard;  // to know if the other end is still there
 
-    // If we are out of time, return 0 - no useful bytes received
-    if (timeUp(timerRx))
+    // First check if connected
+    if (ll->connected == 0)
     {
-        printf("LLGF: Timeout with %d bytes received\n", nRx);
-        return 0;
+        printf("LL: Attempt to receive while not connected\n");
+        return -10;  // error code
     }
 
-    // If still within time limit, collect more bytes, until end marker
-    nRx = 2;  // got 1 byte already
+    // Process frames until we get the next block, or time runs out
+    timerWait = timeSet(ll->rxWait);
     do
     {
-            PHY_get((frameRx + nRx), 1);  // get one byte at a time
-        if (retVal < 0) return retVal;  // check for error and give up
-        else nRx += retVal;  // update the bytes received count
-     }
-    while ((nRx < byteCount) && !timeUp(timerRx));
-    // until we get end of frame marker or timeout
+        // Blocks from the receive thread, if running, come first
+        nData = rxPop(ll, dataRx);
+        if (nData >= 0)
+        {
+            if (debug) printf("LL: Returning block with %d data bytes "
+                              "from queue\n", nData);
+            return nData;
+        }
+        retVal = rxFailed(ll);
+        if (retVal < 0) return retVal;  // link failed in the thread
 
-    // If time up, no end marker, so bad frame, return 0
-    if (timeUp(timerRx))
-    {
-        printf("LLGF: Timeout with %d bytes received\n", nRx);
-        return 0;
-    }
+        // If a block arrived while we were sending, or agreeing new
+        // settings, return that first
+        if (ll->rxPendingSize >= 0)
+        {
+            nData = ll->rxPendingSize;
+            *dataRx = ll->rxPending;
+            ll->rxPendingSize = -1;  // block has been used
+            if (debug) printf("LL: Returning block with %d data bytes\n",
+                              nData);
+            return nData;
+        }
 
-    // Otherwise, we found the end marker
-    return nRx;  // return number of bytes in frame
-}  // end of getFrame
+        // Time spent agreeing a new bit rate does not count
+        if (ll->nAgreed != nAgreed)
+        {
+            nAgreed = ll->nAgreed;
+            timerWait = timeSet(ll->rxWait);
+        }
+
+        // Nor does time while frames arrive, even bad ones, as the
+        // other end is still trying - the limit is for a silent link
+        if (ll->nHeard != nHeard)
+        {
+            nHeard = ll->nHeard;
+            timerWait = timeSet(ll->rxWait);
+        }
+
+        rxLock(ll);
+        retVal = serviceLink(ll, dataRx, &nData, timeLeft(timerWait), debug);
+        rxUnlock(ll);
+        if (retVal < 0) return retVal;  // quit if error
+        if (retVal > 0) return nData;   // got the block we need
+    }
+    while (!timeUp(timerWait));
+
+    // The last frame processed may have put a block in the queue
+    nData = rxPop(ll, dataRx);
+    if (nData >= 0) return nData;
+
+    // It may also have filled the gap before blocks held - take the
+    // next of those, rather than leave it until the next call
+    rxLock(ll);
+    retVal = 0;
+    if (heldReady(ll))
+        retVal = serviceLink(ll, dataRx, &nData, 0.0, debug);
+    rxUnlock(ll);
+    if (retVal < 0) return retVal;  // quit if error
+    if (retVal > 0) return nData;   // got the held block
+    nData = rxPop(ll, dataRx);  // or it went to the queue
+    if (nData >= 0) return nData;
+
+    LOG(LOG_WARN, "LL: Timeout trying to receive frame\n");
+    COUNT(ll, rxTimeouts, 1);
+    return -5;  // report this as an error for now
+}  // end of LL_receiveView
 
 
 // ===========================================================================
-/* Function to check a received frame for errors.
-   Arguments: pointer to array of bytes holding frame,
-              number of bytes in frame.
-   As a minimum, should check error detecting code.
-   This example also checks start and end markers.
-   Returns 1 if frame is good, 0 otherwise.   */
-int checkFrame(byte *frameRx, int nFrame)
+/* Function to wait until all frames sent have been acknowledged.
+   Return value is 0 on success, negative on failure.  */
+int LL_flush(LL_context *ll, int debug)
 {
-    int i;
-    int nData = nFrame -(HEADERSIZE + TRAILERSIZE);
-    int checkSum = 0;
+    int retVal = 0;  // return value from other functions
+
+    rxLock(ll);  // if the receive thread runs, it waits meanwhile
+    while ((ll->nOutstanding > 0) && (retVal >= 0))
+        retVal = serviceLink(ll, NULL, NULL, ll->txWait, debug);
+    if ((retVal >= 0) && (PHY_sendPoll(ll->phy, 1) < 0))
+        retVal = -12;  // let any re-sends finish
+    rxUnlock(ll);
+    if (retVal >= 0) retVal = rxFailed(ll);  // window may have been lost
+    if (retVal < 0) return retVal;  // link has failed
+    if (debug) printf("LL: All frames acknowledged\n");
+    return 0;
+}  // end of LL_flush
 
 
-    if (frameRx[0] != STARTBYTE)  // check start merker
+// ===========================================================================
+/* Function to set the size of the sender window.
+   Window size 1 gives stop-and-wait.  The window must be smaller
+   than the sequence number modulus, so frames can be identified.
+   This is also the largest window offered to the other end when
+   connecting, and the smaller of the two is used - if already
+   connected, the window is no larger than the other end's limit,
+   nor MOD_SEQNUM/2 with selective repeat.
+   Can only be changed when no frames are waiting for acknowledgement.
+   Return value is 0 on success, negative on failure.  */
+int LL_setWindow(LL_context *ll, int window, int debug)
+{
+    if ((window < 1) || (window >= MOD_SEQNUM))
     {
-        printf("LLCF: Frame bad - start marker\n");
-        return 0;
+        printf("LL: Invalid window size %d, must be 1 to %d\n",
+               window, MOD_SEQNUM-1);
+        return -11;  // error code
     }
-
-    // Check the end-of-frame marker
-    if (frameRx[nFrame-1] != ENDBYTE)
+    rxLock(ll);
+    if (ll->nOutstanding > 0)
     {
-        printf("LLCF: Frame bad - end marker\n");
-        return 0;
+        printf("LL: Cannot change window with %d frames in flight\n",
+               ll->nOutstanding);
+        rxUnlock(ll);
+        return -14;  // error code
     }
-
-	// Need to check the error-detecting code here
-	// return 0 if the check fails...
-	for(i = HEADERSIZE; i < (HEADERSIZE + nData + 1); i++) {
-        checkSum += frameRx[i];
-	}
+    ll->winLimit = window;
+    ll->winSize = window;
+    if (ll->connected && (ll->peerWin < window)) ll->winSize = ll->peerWin;
+    if (ll->connected && ll->selective && (ll->winSize > MOD_SEQNUM/2))
+        ll->winSize = MOD_SEQNUM/2;
+    rxUnlock(ll);
+    if (debug) printf("LL: Window size set to %d\n", ll->winSize);
+    if (debug && (window > POOL_FRAMES))
+        printf("LL: Only %d frame buffers, may limit frames in flight\n",
+               POOL_FRAMES);
+    return 0;
+}  // end of LL_setWindow
 
 
+// ===========================================================================
+/* Function to set the type of frame check sequence.
+   This type is asked for when connecting, and the stronger of the
+   types the two ends ask for is used.  If changed while connected,
+   the other end must change to the same type.  Can only be changed
+   when no frames are waiting for acknowledgement.
+   Return value is 0 on success, negative on failure.  */
+int LL_setFcs(LL_context *ll, int type, int debug)
+{
+    if (fcsSize(type) == 0)
+    {
+        printf("LL: Invalid frame check sequence type %d\n", type);
+        return -11;  // error code
+    }
+    rxLock(ll);
+    if (ll->nOutstanding > 0)
+    {
+        printf("LL: Cannot change check sequence with %d frames in flight\n",
+               ll->nOutstanding);
+        rxUnlock(ll);
+        return -14;  // error code
+    }
+    ll->fcsWanted = type;
+    ll->fcsType = type;
+    rxUnlock(ll);
+    if (debug) printf("LL: Frame check sequence type %d, %d bytes\n",
+                      ll->fcsType, fcsSize(ll->fcsType));
+    return 0;
+}  // end of LL_setFcs
 
-	if((checkSum%256)  != 0) {
-        printf("LLCF: Frame bad - checksum failed\n");
-        return 0;
-	}
 
-	if(nFrame != frameRx[BYTECOUNTPOS]) {
-        printf("LLCF: Frame bad - byte count failed\n");
-        return 0;
+// ===========================================================================
+/* Function to set the number of parity bytes in each codeword, for
+   forward error correction - see fec.h.  Each codeword of up to
+   FEC_CODEWORD bytes can then have up to nParity/2 bytes corrected.
+   The number is asked for when connecting, and the larger of the
+   numbers the two ends ask for is used, so 0 (the default) only
+   turns it off if the other end also asks for 0.  This can only be
+   used before LL_connect(), or after LL_discon().
+   Return value is 0 on success, negative on failure.  */
+int LL_setFec(LL_context *ll, int nParity, int debug)
+{
+    if (ll->connected)
+    {
+        printf("LL: Cannot change error correction while connected\n");
+        return -14;  // error code
+    }
+    if ((nParity < 0) || (nParity > FEC_MAXPARITY))
+    {
+        printf("LL: Invalid parity %d, must be 0 to %d\n",
+               nParity, FEC_MAXPARITY);
+        return -11;  // error code
+    }
+    ll->fecWanted = nParity;
+    if (debug) printf("LL: Asking for %d parity bytes per codeword\n",
+                      nParity);
+    return 0;
+}  // end of LL_setFec
 
-	}
 
-    // If all tests passed, return 1
-    return 1;
-}  // end of checkFrame
+// ===========================================================================
+/* Function to ask for data blocks to be compressed, before they are
+   put in frames - see compress.h.  Compression is only used if both
+   ends ask for it when connecting, as both must keep a history of
+   the blocks.  It helps most with text, and other data with a lot
+   of repetition, on a slow line.  This can only be used before
+   LL_connect(), or after LL_discon().
+   Argument: 1 to ask for compression, 0 (the default) for none.
+   Return value is 0 on success, negative on failure.  */
+int LL_setCompress(LL_context *ll, int on, int debug)
+{
+    if (ll->connected)
+    {
+        printf("LL: Cannot change compression while connected\n");
+        return -14;  // error code
+    }
+    if ((on != 0) && (on != 1))
+    {
+        printf("LL: Invalid compression setting %d, must be 0 or 1\n", on);
+        return -11;  // error code
+    }
+    ll->compWanted = on;
+    if (debug) printf("LL: Compression %s\n",
+                      on ? "asked for" : "not asked for");
+    return 0;
+}  // end of LL_setCompress
 
 
 // ===========================================================================
-/* Function to process a received frame, to extract data.
-   Frame has already been checked for errors, so this simple
-   implementation assumes everything is where is should be.
-   Arguments: pointer to array holding frame,
-              number of bytes in the frame,
-              pointer to array to hold data bytes,
-              max number of bytes to extract,
-              pointer to sequence number.
-   Return value is number of bytes extracted. */
-int processFrame(byte *frameRx, int nFrame,
-                 byte *dataRx, int maxData, int *seqNum)
+/* Function to ask for Selective Repeat in place of Go-Back-N, so only
+   the frames lost are sent again.  The receiver holds the frames that
+   arrive after a gap, and says which in its acks, so the sender need
+   not send them again.  It is only used if both ends ask for it when
+   connecting, as both must know what the acks say, and the window is
+   then at most MOD_SEQNUM/2.  It saves most on a noisy line with a
+   large window.  This can only be used before LL_connect(), or after
+   LL_discon().
+   Argument: 1 to ask for selective repeat, 0 for Go-Back-N - the
+             default is SELECTIVE.
+   Return value is 0 on success, negative on failure.  */
+int LL_setSelective(LL_context *ll, int on, int debug)
 {
-    int i = 0;  // for use in loop
-    int nData;  // number of data bytes in frame
-
-    // First get sequence number from its place in header
-    *seqNum = frameRx[SEQNUMPOS];
+    if (ll->connected)
+    {
+        printf("LL: Cannot change selective repeat while connected\n");
+        return -14;  // error code
+    }
+    if ((on != 0) && (on != 1))
+    {
+        printf("LL: Invalid selective repeat setting %d, must be 0 or 1\n",
+               on);
+        return -11;  // error code
+    }
+    ll->selWanted = on;
+    if (debug) printf("LL: Selective repeat %s\n",
+                      on ? "asked for" : "not asked for");
+    return 0;
+}  // end of LL_setSelective
 
-    // Calculate number of data bytes, based on frame size
-    nData = nFrame - HEADERSIZE - TRAILERSIZE;
-    if (nData > maxData) nData = maxData;  // safety check
 
-    // Now copy data bytes from middle of frame
-    for (i = 0; i < nData; i++)
+// ===========================================================================
+/* Function to set the fastest bit rate to try, and the probability
+   of a simulated error in each bit received (0.0 for none).
+   The link connects at BASE_RATE, then steps up towards this rate -
+   the physical layer decides which rates it accepts.  Rates are sent
+   to the other end in units of 100 bit/s.  This can only be used
+   before LL_connect(), or after LL_discon().
+   Return value is 0 on success, negative on failure.  */
+int LL_setLine(LL_context *ll, int bitRate, double probErr, int debug)
+{
+    if (ll->connected)
     {
-        dataRx[i] = frameRx[HEADERSIZE + i];  // copy each byte
+        printf("LL: Cannot change line settings while connected\n");
+        return -14;  // error code
     }
-
-    return nData;  // return size of block extracted
-}  // end of processFrame
+    if ((bitRate < BASE_RATE) || (bitRate > 65535*100) || (bitRate % 100)
+        || (probErr < 0.0) || (probErr > 1.0))
+    {
+        printf("LL: Invalid line settings %d bit/s, error %g\n",
+               bitRate, probErr);
+        return -11;  // error code
+    }
+    ll->bitRate = bitRate;
+    ll->probErr = probErr;
+    if (debug) printf("LL: Line settings %d bit/s, error probability %g\n",
+                      bitRate, probErr);
+    return 0;
+}  // end of LL_setLine
 
 
 // ===========================================================================
-/* Function to send an acknowledgement - this version does nothing. */
-int sendAck(int type, int seq)
+/* Function to set the time limits.
+   Arguments: sender waiting time in seconds - how long to wait for
+              an acknowledgement before sending again, or the upper
+              limit on this if it is adaptive;
+              receiver waiting time in seconds - how long LL_receive
+              waits for a block;
+              1 to adapt the re-transmit time to the measured round
+              trip time, 0 to always use the sender waiting time.
+   Can be changed at any time - frames already sent keep their timers.
+   Return value is 0 on success, negative on failure.  */
+int LL_setTimeouts(LL_context *ll, float txWait, float rxWait,
+                   int adaptive, int debug)
 {
-        return 0;
-}
+    if ((txWait < RTO_MIN) || (rxWait <= 0.0))
+    {
+        printf("LL: Invalid time limits %.3f s, %.3f s\n", txWait, rxWait);
+        return -11;  // error code
+    }
+    rxLock(ll);
+    ll->txWait = txWait;
+    ll->rxWait = rxWait;
+    ll->adaptive = adaptive;
+    ll->rto = txWait;  // start again, with the new limit
+    if (adaptive && ll->rttValid)
+        updateRto(ll, ll->srtt);  // use what is known so far
+    rxUnlock(ll);
+    if (debug) printf("LL: Time limits %.3f s, %.3f s, %s re-transmit time\n",
+                      txWait, rxWait, adaptive ? "adaptive" : "fixed");
+    return 0;
+}  // end of LL_setTimeouts
+
 
 // ===========================================================================
-/* Function to advance the sequence number,
-   wrapping around at maximum value.  */
-int next(int seq)
+/* Function to set the largest block this end will send or receive.
+   The limit is offered to the other end by LL_connect(), so this
+   can only be used before connecting.  A smaller limit gives shorter
+   frames, which are less likely to be hit by errors on a noisy line.
+   Return value is 0 on success, negative on failure.  */
+int LL_setMaxBlock(LL_context *ll, int maxBlk, int debug)
 {
-    return ((seq + 1) % MOD_SEQNUM);
-}
+    if (ll->connected)
+    {
+        printf("LL: Cannot change block size while connected\n");
+        return -14;  // error code
+    }
+    if ((maxBlk < 1) || (maxBlk > MAX_BLK))
+    {
+        printf("LL: Invalid block size %d, must be 1 to %d\n",
+               maxBlk, MAX_BLK);
+        return -11;  // error code
+    }
+    ll->blkLimit = maxBlk;
+    if (debug) printf("LL: Largest block set to %d bytes\n", maxBlk);
+    return 0;
+}  // end of LL_setMaxBlock
 
 
 // ===========================================================================
-/* Function to set time limit at a point in the future.
-   limit   is time limit in seconds (from now)  */
-long timeSet(float limit)
+/* Function to give the largest block that can be sent now.
+   This is agreed by LL_connect(), and is BASE_BLK before that.  */
+int LL_maxBlock(LL_context *ll)
 {
-    long timeLimit = clock() + (long)(limit * CLOCKS_PER_SEC);
-    return timeLimit;
-}  // end of timeSet
+    return ll->txMaxBlk;
+}  // end of LL_maxBlock
 
 
 // ===========================================================================
-/* Function to check if time limit has elapsed.
-   timer  is timer variable to check
-   returns 1 if time has reached or exceeded limit,
-           0 if time has not yet reached limit.   */
-int timeUp(long timeLimit)
+/* Function to give the block size that suits the line now, for the
+   best goodput - see adaptLink().  Blocks of any size up to
+   LL_maxBlock() can still be sent.  If adaptive block size is off,
+   this is the same as LL_maxBlock().  */
+int LL_blockSize(LL_context *ll)
 {
-    if (clock() < timeLimit) return 0;  // still within limit
-    else return 1;  // time limit has been reached or exceeded
-}  // end of timeUP
+    if (!ll->adaptBlocks || (ll->txBlk > ll->txMaxBlk)) return ll->txMaxBlk;
+    return ll->txBlk;
+}  // end of LL_blockSize
 
 
 // ===========================================================================
-/* Function to print bytes of a frame, in groups of 10.
-   For small frames, print all the bytes,
-   for larger frames, just the start and end.  */
-void printFrame(byte *frame, int nByte)
+/* Function to choose how the link adapts to errors while sending.
+   Arguments: 1 to suggest block sizes to suit the error rate (the
+              default), 0 to always suggest the largest block;
+              1 to ask the other end for a lower bit rate if too many
+              frames are re-sent, 0 to keep the agreed rate (the
+              default - this only helps if the line has fewer errors
+              at lower rates).
+   Can be changed at any time.  Return value is 0.  */
+int LL_setAdapt(LL_context *ll, int blocks, int rate, int debug)
 {
-    int i, j;
+    ll->adaptBlocks = (blocks != 0);
+    ll->adaptRate = (rate != 0);
+    if (debug) printf("LL: Adaptive block size %s, bit rate %s\n",
+                      ll->adaptBlocks ? "on" : "off",
+                      ll->adaptRate ? "may be lowered" : "fixed");
+    return 0;
+}  // end of LL_setAdapt
+
 
-    if (nByte <= 50)  // small frame - print all the bytes
+// ===========================================================================
+/* Function to set how long the ack for a block accepted may be held,
+   so that a data frame going the other way, or the ack for a later
+   block, can carry it instead.  Holding acks saves frames, but the
+   sender waits longer to hear, so the delay should be well within
+   the sender waiting time.
+   Argument: longest time to hold an ack in seconds, 0 to send every
+             ack at once.  Can be changed at any time.
+   Return value is 0 on success, negative on failure.  */
+int LL_setAckDelay(LL_context *ll, float delay, int debug)
+{
+    if ((delay < 0.0) || (delay > ll->txWait / 2.0))
     {
-        for (i=0; i<nByte; i+=10)  // step in groups of 10 bytes
-        {
-            for (j=0; (j<10)&&(i+j<nByte); j++)
-            {
-                printf("%3d ", frame[i+j]);  // print as number
-            }
-            printf(":  ");  // separator
-            for (j=0; (j<10)&&(i+j<nByte); j++)
-            {
-                printf("%c", frame[i+j]);   // print as character
-            }
-            printf("\n");   // new line
-        }  // end for
+        printf("LL: Invalid ack delay %.3f s, max %.3f s\n",
+               delay, ll->txWait / 2.0);
+        return -11;  // error code
     }
-    else  // large frame - print start and end
+    rxLock(ll);
+    ll->ackDelay = delay;
+    rxUnlock(ll);
+    if (debug) printf("LL: Acks held for up to %.3f s\n", delay);
+    return 0;
+}  // end of LL_setAckDelay
+
+
+// ===========================================================================
+/* Function to take a snapshot of the counters.
+   The counters are atomic, so this can be called from any thread,
+   while the link is in use.  Each counter is read separately, so a
+   frame being processed may be in some of them and not yet in others.
+   Arguments: pointer to link state, pointer to snapshot to fill in.  */
+void LL_getStats(LL_context *ll, LL_stats *stats)
+{
+    int i;  // for use in loop
+
+#define READ(name) stats->name = \
+    atomic_load_explicit(&ll->count.name, memory_order_relaxed)
+    READ(txFrames);     READ(txResent);     READ(txAcks);
+    READ(txBytes);      READ(txData);       READ(txTimeouts);
+    READ(txAcksSaved);  READ(txCoded);      READ(txRaw);
+    READ(rxFrames);     READ(rxAcks);       READ(rxBytes);
+    READ(rxData);       READ(rxDuplicates); READ(rxGaps);
+    READ(rxBadFcs);     READ(rxBadMarker);  READ(rxBadCount);
+    READ(rxBadOther);   READ(rxResync);     READ(rxTimeouts);
+    READ(rxFecFixed);   READ(rxFecFrames);  READ(rxFecFailed);
+    for (i = 0; i < LL_RTT_BINS; i++) READ(rttHist[i]);
+#undef READ
+}  // end of LL_getStats
+
+
+// ===========================================================================
+/* Function to set all the counters to zero.  LL_connect() does this,
+   so the counters are for one connection, unless reset again.
+   Argument: pointer to link state.  */
+void LL_resetStats(LL_context *ll)
+{
+    int i;  // for use in loop
+
+#define ZERO(name) \
+    atomic_store_explicit(&ll->count.name, 0, memory_order_relaxed)
+    ZERO(txFrames);     ZERO(txResent);     ZERO(txAcks);
+    ZERO(txBytes);      ZERO(txData);       ZERO(txTimeouts);
+    ZERO(txAcksSaved);  ZERO(txCoded);      ZERO(txRaw);
+    ZERO(rxFrames);     ZERO(rxAcks);       ZERO(rxBytes);
+    ZERO(rxData);       ZERO(rxDuplicates); ZERO(rxGaps);
+    ZERO(rxBadFcs);     ZERO(rxBadMarker);  ZERO(rxBadCount);
+    ZERO(rxBadOther);   ZERO(rxResync);     ZERO(rxTimeouts);
+    ZERO(rxFecFixed);   ZERO(rxFecFrames);  ZERO(rxFecFailed);
+    for (i = 0; i < LL_RTT_BINS; i++) ZERO(rttHist[i]);
+#undef ZERO
+}  // end of LL_resetStats
+
+
+// ===========================================================================
+/* Function to give a handle the operating system can wait on for
+   bytes arriving on the link, for a program with its own event loop.
+   On POSIX systems this is the file descriptor of the port, for
+   poll(), select() or epoll - see PHY_handle().  The bytes must only
+   be read by LL_onReadable().
+   Return value is the handle, or -1 if not connected, or the physical
+   layer has no such handle - use LL_waitAny() then.  */
+int LL_getHandle(LL_context *ll)
+{
+    if (ll->connected == 0) return -1;
+    return PHY_handle(ll->phy);
+}  // end of LL_getHandle
+
+
+// ===========================================================================
+/* Function to give the time until the link must be served by
+   LL_onReadable(), if no bytes arrive before then:  the first
+   re-transmit timer due, or the time limit for a held ack.
+   Return value is the time in ms, rounded up, 0 if the link must be
+   served now - a timer is due, or bytes or a block are already
+   waiting in the link state, or held with the gap before it filled -
+   or -1 if there is no timer running.  */
+int LL_nextTimeout(LL_context *ll)
+{
+    int timed = 0;  // 1 if a timer is running
+    float wait = 0.0;  // time until the first timer is due, seconds
+    float t;  // time until one timer is due
+
+    if (ll->connected == 0) return -1;
+    if ((ll->rxCount > 0) || (ll->rxPendingSize >= 0) || heldReady(ll))
+        return 0;
+
+    // Not while agreeing settings, as serviceLink() does not re-send then
+    if ((ll->nOutstanding > 0) && !ll->agreeing)
+    {
+        wait = timeLeft(ll->txTimer[firstTimer(ll)]);
+        timed = 1;
+    }
+    if (ll->ackHeld > 0)
+    {
+        t = timeLeft(ll->ackTimer);
+        if (!timed || (t < wait)) wait = t;
+        timed = 1;
+    }
+    if (!timed) return -1;
+    if (wait <= 0.0) return 0;  // due now
+    return (int) (wait * 1000.0) + 1;  // so it is due once this has passed
+}  // end of LL_nextTimeout
+
+
+// ===========================================================================
+/* Function to serve the link, without waiting:  takes the bytes that
+   have arrived, re-sends frames and sends held acks if their timers
+   are due, and processes each frame received, until the next block
+   in sequence is found.  Call it when the handle from LL_getHandle()
+   is readable, or the time from LL_nextTimeout() has passed, and
+   again while it returns 1, as more frames may be waiting.
+   Not for use while the receive thread is running.
+   Arguments:  pointer to pointer which is set to the start of the
+               data block, pointer to number of bytes in block, debug.
+   The block stays valid until the next call to a link layer function
+   for this link, as for LL_receiveView().
+   Return value is 1 if a block was found, 0 if not, or negative
+   on failure.  */
+int LL_onReadable(LL_context *ll, byte **dataRx, int *nRx, int debug)
+{
+    int retVal;  // return value from other functions
+
+    // First check if connected, and served by this thread
+    if (ll->connected == 0)
+    {
+        printf("LL: Attempt to receive while not connected\n");
+        return -10;  // error code
+    }
+    if (ll->rxThread != NULL)
+    {
+        printf("LL: Receive thread is running - use LL_receive\n");
+        return -11;  // error code
+    }
+
+    // If a block arrived while we were sending, return that first
+    if (ll->rxPendingSize >= 0)
+    {
+        *dataRx = ll->rxPending;
+        *nRx = ll->rxPendingSize;
+        ll->rxPendingSize = -1;  // block has been used
+        if (debug) printf("LL: Returning block with %d data bytes\n", *nRx);
+        return 1;
+    }
+
+    // Take the bytes that have arrived, then deal with the timers and
+    // each frame in the buffer - getFrame() does not wait, with no time
+    retVal = fillRxBuffer(ll, 0);
+    if (retVal < 0) return -9;  // port failed
+    do
+    {
+        retVal = serviceLink(ll, dataRx, nRx, 0.0, debug);
+        if (retVal != 0) return retVal;  // block found, or link failed
+    }
+    while (ll->rxCount > 0);
+    return 0;
+}  // end of LL_onReadable
+
+
+// ===========================================================================
+/* Function to check if a block can be sent now without waiting - there
+   is room in the window, and a buffer in the pool to keep the frame.
+   Sends that have finished are collected first, to free their buffers.
+   Return value is 1 if LL_send() would not wait, 0 if it would,
+   or if not connected.  */
+int LL_canSend(LL_context *ll)
+{
+    if ((ll->connected == 0) || (ll->nOutstanding >= ll->winSize)) return 0;
+    if (ll->txNext != NULL) return 1;  // buffer already taken
+    if (poolFree(&ll->txPool) == 0) PHY_sendPoll(ll->phy, 0);
+    return (poolFree(&ll->txPool) > 0);
+}  // end of LL_canSend
+
+
+// ===========================================================================
+/* Function to wait, without using the processor, until any of a list
+   of links must be served by LL_onReadable():  bytes have arrived,
+   or the time from LL_nextTimeout() has passed.  For a program with
+   no event loop of its own, or when LL_getHandle() gives no handle.
+   Arguments:  array of pointers to links, all connected, number of
+               links, up to PHY_MAXWAIT, array set to 1 for each link
+               to serve, 0 for the others, longest time to wait in ms,
+               -1 for no limit.
+   Return value is the number of links to serve, 0 if the time limit
+   was reached first, or negative on failure.  */
+int LL_waitAny(LL_context **links, int nLinks, int *ready, int timeLimit)
+{
+    PHY_context *phys[PHY_MAXWAIT];  // ports of the links
+    int wait = timeLimit;  // time to wait, ms, -1 for no limit
+    int nReady = 0;  // number of links to serve
+    int retVal;  // return value from other functions
+    int i;  // for use in loops
+
+    if ((nLinks < 1) || (nLinks > PHY_MAXWAIT))
+    {
+        printf("LL: Cannot wait on %d links, max %d\n", nLinks, PHY_MAXWAIT);
+        return -11;  // error code
+    }
+
+    // Wait no longer than the first timer due on any link
+    for (i = 0; i < nLinks; i++)
+    {
+        if (links[i]->connected == 0)
+        {
+            printf("LL: Attempt to wait on link %d while not connected\n",
+                   links[i]->portNum);
+            return -10;  // error code
+        }
+        phys[i] = links[i]->phy;
+        retVal = LL_nextTimeout(links[i]);
+        if ((retVal >= 0) && ((wait < 0) || (retVal < wait))) wait = retVal;
+    }
+
+    retVal = PHY_waitAny(phys, nLinks, ready, wait);
+    if (retVal < 0) return -9;  // port failed
+
+    // Links with a timer due must be served too
+    for (i = 0; i < nLinks; i++)
+    {
+        if (!ready[i] && (LL_nextTimeout(links[i]) == 0)) ready[i] = 1;
+        nReady += ready[i];
+    }
+    return nReady;
+}  // end of LL_waitAny
+
+
+// ===========================================================================
+/* Function to process one received frame, or wait until a time limit.
+   This is the core of the protocol:  it re-transmits frames whose
+   timers have expired, sends an ack that has been held long enough,
+   processes acknowledgements, including those carried by data
+   frames, and deals with data frames - the next block in sequence
+   is expanded if compressed, accepted and acknowledged, perhaps
+   after a delay, anything else
+   is acknowledged again at once so the sender knows where we are.
+   With selective repeat, a frame after a gap is held until the gap
+   fills, and a block held is taken first, once it is next in
+   sequence, without waiting for a frame.  A NAK is sent for the
+   first frame after a gap, and for a bad frame, but only when
+   called from LL_receive, or the receive thread is running, and only
+   once for each sequence number.
+   Arguments: pointer to pointer which is set to the start of a
+              data block, or NULL if called while sending,
+              pointer to number of bytes in data block,
+              max time to wait for a frame, debug.
+   The data block is left in the received frame, in the link state.
+   If called with NULL, a data block is copied to rxPending (if empty).
+   A block may also be left in a frame held - see acceptBlock().
+   If the receive thread is running, every data block goes to its
+   queue instead, and the caller must hold the lock - see rxthread.h.
+   Return value is 1 if dataRx was set to a block, 0 if not,
+   or negative on error.  */
+int serviceLink(LL_context *ll, byte **dataRx, int *nRx,
+                float timeLimit, int debug)
+{
+    byte *frameRx = ll->rxFrame;  // received frame, kept in link state
+    int nFrame = 0;  // number of bytes in frame received
+    int nPlain;  // number of bytes in frame, after error correction
+    int seqNum;  // sequence number of received frame
+    int type;  // type of frame received
+    int dist;  // distance from expected sequence number
+    int nSack;  // number of data bytes in ack, for the bitmap
+    int retVal;  // return value from other functions
+    float txLeft;  // time until re-transmit timer expires
+
+    // Check the re-transmit timer first - but not while agreeing
+    // settings, as data frames cannot be sent then
+    if (!ll->agreeing)
+    {
+        retVal = checkTimers(ll, debug);
+        if (retVal < 0) return retVal;
+    }
+
+    // Send the held ack, if no data frame has carried it in time
+    if ((ll->ackHeld > 0) && timeUp(ll->ackTimer))
+    {
+        retVal = sendAck(ll, GOOD, ll->seqNumRx);
+        if (retVal < 0) return retVal;
+    }
+
+    // A block held, now the gap before it has filled, is taken first,
+    // if there is room for it - if not, frames are processed as usual
+    if (heldReady(ll) && ((dataRx != NULL) || (ll->rxPendingSize < 0)))
+    {
+        seqNum = ll->seqNumRx;
+        if (debug) printf("LL: Taking block %d, held\n", seqNum);
+        retVal = acceptBlock(ll, ll->rxHeld[seqNum % HOLD_FRAMES],
+                             ll->rxHeldSize[seqNum], dataRx, nRx, debug);
+        if ((retVal != 0) || (ll->seqNumRx != seqNum)) return retVal;
+    }
+
+    // Do not wait beyond the first re-transmit timer due,
+    // or the time limit for the held ack
+    if ((ll->nOutstanding > 0) && !ll->agreeing)
+    {
+        txLeft = timeLeft(ll->txTimer[firstTimer(ll)]);
+        if (txLeft < timeLimit) timeLimit = txLeft;
+    }
+    if (ll->ackHeld > 0)
+    {
+        txLeft = timeLeft(ll->ackTimer);
+        if (txLeft < timeLimit) timeLimit = txLeft;
+    }
+
+    // Get a frame, up to maximum size of array.
+    // Function returns number of bytes in frame, or negative if error
+    nFrame = getFrame(ll, frameRx, MAX_FRAME, timeLimit);
+    if (nFrame < 0) return -9;  // quit if error
+    if (nFrame == 0) return 0;  // nothing yet - caller checks its timer
+    ll->nHeard++;  // for LL_receiveView, good frame or not
+
+    // Correct what errors the parity allows, then check it for errors
+    nPlain = decodeFrame(ll, frameRx, nFrame);
+    if ((nPlain == 0) || (checkFrame(ll, frameRx, nPlain) == 0)) // bad
+    {
+        if (debug) printf("LL: Bad frame received\n");
+        if (logEnabled(LOG_INFO)) printFrame(frameRx, nFrame);
+        if (((dataRx != NULL) || (ll->rxThread != NULL))
+            && (ll->nakSent == 0))  // ask for it again
+        {
+            ll->nakSent = 1;
+            return sendAck(ll, BAD, ll->seqNumRx);
+        }
+        return 0;
+    }
+    nFrame = nPlain;
+    COUNT(ll, rxFrames, 1);
+    type = frameRx[TYPEPOS];
+    seqNum = frameRx[SEQNUMPOS];
+
+    // Parameters come while agreeing settings, or later if a reply
+    // to the other end was lost
+    if (type == PARAM) return processParam(ll, frameRx, nFrame, debug);
+
+    // Acknowledgements are for the sender side - with selective
+    // repeat, one may carry a bitmap of the frames the receiver holds
+    if ((type != DATA) && (type != ZDATA))
+    {
+        COUNT(ll, rxAcks, 1);
+        nSack = nFrame - HEADERSIZE - trailerSize(ll, type);
+        return processAck(ll, type, seqNum, (ll->selective
+                          && (nSack >= SACK_SIZE)) ? frameRx + HEADERSIZE
+                                                   : NULL, debug);
+    }
+
+    // Data frame - take the ack it carries first, as it is good even
+    // if the block is not wanted, unless it is no news
+    if (frameRx[ACKPOS] != ll->seqBase)
+    {
+        retVal = processAck(ll, GOOD, frameRx[ACKPOS], NULL, debug);
+        if (retVal < 0) return retVal;
+    }
+
+    // Then check if it is the one we expect
+    if (seqNum == ll->seqNumRx)
+        return acceptBlock(ll, frameRx, nFrame, dataRx, nRx, debug);
+
+    // Otherwise it is a duplicate, or there is a gap before it
+    dist = (seqNum - ll->seqNumRx + MOD_SEQNUM) % MOD_SEQNUM;
+    if (debug) printf("LL: Received block %d, expected %d\n",
+                      seqNum, ll->seqNumRx);
+    if ((dist >= MOD_SEQNUM/2)  // accepted before
+        || (ll->selective && (ll->rxHeldSize[seqNum] >= 0)))  // held
+    {
+        COUNT(ll, rxDuplicates, 1);
+        return sendAck(ll, GOOD, ll->seqNumRx);  // acknowledge again
+    }
+
+    // Frames lost - with selective repeat, hold this one until they
+    // fill the gap, and the acks from now on say it is held
+    COUNT(ll, rxGaps, 1);
+    if (ll->selective)
+    {
+        memcpy(ll->rxHeld[seqNum % HOLD_FRAMES], frameRx, nFrame);
+        ll->rxHeldSize[seqNum] = nFrame;
+        ll->nHeld++;
+    }
+    if (ll->nakSent == 0)  // ask for them again
+    {
+        ll->nakSent = 1;
+        return sendAck(ll, BAD, ll->seqNumRx);
+    }
+    return sendAck(ll, GOOD, ll->seqNumRx);  // so the sender knows
+}  // end of serviceLink
+
+
+// ===========================================================================
+/* Function to accept the next block in sequence, from the frame just
+   received, or from a frame held until the gap before it filled.
+   The block is expanded if compressed, accepted and acknowledged,
+   perhaps after a delay, and goes where serviceLink() puts it.
+   A frame held is then free for the next one with its sequence
+   number - that cannot arrive until MOD_SEQNUM/2 more blocks have
+   been accepted, so the block stays valid as long as one left in
+   the received frame.
+   Arguments: frame, already checked, number of bytes in frame,
+              pointer to pointer set to the block, or NULL if called
+              while sending, pointer to number of bytes in block, debug.
+   Return value is 1 if dataRx was set to the block, 0 if not, or
+   negative on error.  If the block could not be taken, it is left
+   as it was, held or to come again.  */
+int acceptBlock(LL_context *ll, byte *frameRx, int nFrame,
+                byte **dataRx, int *nRx, int debug)
+{
+    byte *view;  // where the data block is in the frame
+    int seqNum;  // sequence number of the frame
+    int nData;  // number of data bytes in block
+    int retVal;  // return value from other functions
+
+    if ((dataRx == NULL) && (ll->rxPendingSize >= 0))  // while sending
+        return 0;  // no room, will come again
+    nData = processFrame(ll, frameRx, nFrame, &view, &seqNum);
+    if (nData < 0)  // passed the check, but cannot be used
+    {
+        LOG(LOG_WARN, "LL: Block %d too large or could not be "
+            "expanded\n", seqNum);
+        COUNT(ll, rxBadOther, 1);
+        if (ll->rxHeldSize[seqNum] >= 0)  // not held, so it comes again
+        {
+            ll->rxHeldSize[seqNum] = -1;
+            ll->nHeld--;
+        }
+        return 0;
+    }
+    if ((ll->rxThread != NULL) && !rxPush(ll, view, nData))
+    {
+        LOG(LOG_WARN, "LL: Receive queue full, block %d\n", seqNum);
+        return 0;  // will come again
+    }
+    if (ll->compress) compAccept(&ll->rxComp, nData);  // in history
+    if (debug) printf("LL: Received block %d with %d data bytes\n",
+                      seqNum, nData);
+    COUNT(ll, rxData, nData);
+    if (ll->rxHeldSize[seqNum] >= 0)  // accepted, so no longer held
+    {
+        ll->rxHeldSize[seqNum] = -1;
+        ll->nHeld--;
+    }
+    ll->seqNumRx = next(ll->seqNumRx);  // ready for the next block
+    ll->nakSent = 0;
+    retVal = holdAck(ll);  // acknowledge it, now or later
+    if (retVal < 0) return retVal;
+    if (ll->rxThread != NULL) return 0;  // in the queue
+    if (dataRx == NULL)  // keep it until LL_receive is called
+    {
+        memcpy(ll->rxPending, view, nData);
+        ll->rxPendingSize = nData;
+        return 0;
+    }
+    *dataRx = view;
+    *nRx = nData;
+    return 1;
+}  // end of acceptBlock
+
+
+// ===========================================================================
+/* Function to check if a frame held after a gap is now the next in
+   sequence, so its block can be accepted without waiting for a frame.
+   Return value is 1 if so, 0 if not.  */
+int heldReady(LL_context *ll)
+{
+    return (ll->nHeld > 0) && (ll->rxHeldSize[ll->seqNumRx] >= 0);
+}
+
+
+// ===========================================================================
+/* Function to process an acknowledgement.
+   A positive ack gives the next sequence number the receiver expects,
+   so all frames before that have been received.  A negative ack also
+   says which frames have been received, and asks for the rest of the
+   frames in the window to be sent again - with selective repeat,
+   only those the receiver does not hold.
+   With selective repeat, an ack may also carry a bitmap of the
+   frames held after the sequence number:  bit i of the bitmap, low
+   bit first in each byte, is set if frame seq + 1 + i is held.
+   Arguments: type of acknowledgement, sequence number, bitmap of
+              SACK_SIZE bytes, or NULL if none, debug.
+   Return value is 0, or negative if re-transmission failed.  */
+int processAck(LL_context *ll, int type, int seq, byte *sack, int debug)
+{
+    // Find how many frames this acknowledges
+    int dist = (seq - ll->seqBase + MOD_SEQNUM) % MOD_SEQNUM;
+    long long rtt;  // round trip time, in microseconds
+    long long ms;  // round trip time, in ms, for histogram
+    int bin;  // histogram bin for round trip time
+    int i;  // for use in loop
+
+    if (dist > ll->nOutstanding)  // not in window, so must be old
+    {
+        if (debug) printf("LL: Ignoring ack %d, window starts %d\n",
+                          seq, ll->seqBase);
+        return 0;
+    }
+
+    /* Measure the round trip time, using the oldest frame acknowledged,
+       as its timer is the one running - the ack may have been held
+       for later frames, and that time must count.
+       Frames that were sent again are not used, as the ack could be
+       for either copy (Karn's algorithm).  */
+    if ((dist > 0) && (ll->txTries[ll->seqBase] == 1))
+    {
+        rtt = timeMicros() - ll->txSentAt[ll->seqBase];
+        if (rtt < 0) rtt = 0;  // line was faster than expected
+        updateRto(ll, (float) rtt / 1.0E6);
+        for (ms = rtt / 1000, bin = 0; (ms > 0) && (bin < LL_RTT_BINS-1);
+             ms >>= 1) bin++;  // bin from number of bits in ms
+        COUNT(ll, rttHist[bin], 1);
+    }
+
+    // Slide the window past the frames acknowledged, and free
+    // their buffers - once any sends in progress are finished
+    while (ll->seqBase != seq)
+    {
+        poolRelease(&ll->txPool, ll->txStore[ll->seqBase]);
+        ll->txStore[ll->seqBase] = NULL;
+        ll->seqBase = next(ll->seqBase);
+    }
+    ll->nOutstanding -= dist;
+    if (debug) printf("LL: Got %s %d, %d frames in flight\n",
+                      (type == GOOD) ? "ACK" : "NAK", seq, ll->nOutstanding);
+
+    // The receiver is waiting for the oldest frame, so it is not held,
+    // but the bitmap says which of the frames after it are
+    ll->txSacked[ll->seqBase] = 0;
+    if (sack != NULL)
+        for (i = 1; i < ll->nOutstanding; i++)
+            if (sack[(i-1) / 8] & (1 << ((i-1) % 8)))
+                ll->txSacked[(seq + i) % MOD_SEQNUM] = 1;
+
+    // If negative, send the rest of the window again
+    if ((type == BAD) && (ll->nOutstanding > 0))
+    {
+        ll->periodLosses++;  // for adaptLink
+        if (ll->selective) return resendLost(ll, debug);
+        return resendFrames(ll, debug);
+    }
+    return 0;
+}  // end of processAck
+
+
+// ===========================================================================
+/* Function to check the re-transmit timers, and send frames again if
+   the first timer due has expired - all the frames in the window for
+   Go-Back-N, or with selective repeat, each frame whose own timer has
+   expired, unless the receiver holds it.  The re-transmit time is
+   doubled once, however many frames are sent again.
+   Return value is 0, or negative if re-transmission failed.  */
+int checkTimers(LL_context *ll, int debug)
+{
+    int i;  // for use in loop
+    int seq = ll->seqBase;  // sequence number of frame to check
+    int first;  // frame whose timer is due first
+    int retVal;  // return value from other functions
+
+    if (ll->nOutstanding == 0) return 0;
+    first = firstTimer(ll);
+    if (!timeUp(ll->txTimer[first])) return 0;
+
+    // Back off, in case the round trip time has gone up
+    ll->rto *= 2.0;
+    if (ll->rto > ll->txWait) ll->rto = ll->txWait;
+    COUNT(ll, txTimeouts, 1);
+    if (debug) printf("LL: Timeout waiting for ack %d, now %.3f s\n",
+                      first, ll->rto);
+    if (!ll->selective) return resendFrames(ll, debug);
+
+    for (i = 0; i < ll->nOutstanding; i++, seq = next(seq))
+        if (!ll->txSacked[seq] && timeUp(ll->txTimer[seq]))
+        {
+            retVal = resendFrame(ll, seq, debug);
+            if (retVal < 0) return retVal;
+        }
+    return 0;
+}  // end of checkTimers
+
+
+// ===========================================================================
+/* Function to give the frame whose re-transmit timer is due first:
+   the oldest frame for Go-Back-N, as the whole window is sent again
+   when its timer expires, or with selective repeat, the frame with
+   the earliest timer of those the receiver does not hold.
+   Only for use with frames in the window.
+   Return value is the sequence number of the frame.  */
+int firstTimer(LL_context *ll)
+{
+    int i;  // for use in loop
+    int seq = ll->seqBase;  // sequence number of frame to check
+    int first = ll->seqBase;  // frame with the earliest timer so far
+
+    if (!ll->selective) return first;
+    for (i = 1; i < ll->nOutstanding; i++)
+    {
+        seq = next(seq);
+        if (!ll->txSacked[seq] && (ll->txTimer[seq] < ll->txTimer[first]))
+            first = seq;
+    }
+    return first;
+}  // end of firstTimer
+
+
+// ===========================================================================
+/* Function to send all the frames in the window again (Go-Back-N),
+   except any the receiver holds, with selective repeat - see
+   resendFrame().
+   Return value is 0 on success, negative on failure.  */
+int resendFrames(LL_context *ll, int debug)
+{
+    int i;  // for use in loop
+    int seq = ll->seqBase;  // sequence number of frame to send
+    int retVal;  // return value from resendFrame
+
+    for (i = 0; i < ll->nOutstanding; i++, seq = next(seq))
+    {
+        if (ll->txSacked[seq]) continue;  // the receiver has it
+        retVal = resendFrame(ll, seq, debug);
+        if (retVal < 0) return retVal;
+    }
+    return 0;
+}  // end of resendFrames
+
+
+// ===========================================================================
+/* Function to send again the frames lost, after a NAK, with selective
+   repeat:  the oldest frame, which the receiver asked for, and any
+   others it does not hold, before the last frame it holds.  Frames
+   after that may still be on their way, so they wait for their
+   timers instead.
+   Return value is 0 on success, negative on failure.  */
+int resendLost(LL_context *ll, int debug)
+{
+    int i;  // for use in loops
+    int seq = ll->seqBase;  // sequence number of frame to send
+    int last = 0;  // position in the window of the last frame held
+    int retVal;  // return value from resendFrame
+
+    for (i = 1; i < ll->nOutstanding; i++)
+        if (ll->txSacked[(ll->seqBase + i) % MOD_SEQNUM]) last = i;
+    for (i = 0; i <= last; i++, seq = next(seq))
+    {
+        if (ll->txSacked[seq]) continue;  // the receiver has it
+        retVal = resendFrame(ll, seq, debug);
+        if (retVal < 0) return retVal;
+    }
+    return 0;
+}  // end of resendLost
+
+
+// ===========================================================================
+/* Function to send one frame in the window again, with a new timer.
+   If it has already been sent as many times as triesAllowed() gives,
+   the link is assumed to have failed, and every frame in the window
+   is given up.
+   Argument: sequence number of the frame.
+   Return value is 0 on success, negative on failure.  */
+int resendFrame(LL_context *ll, int seq, int debug)
+{
+    int retVal;  // return value from startSend
+
+    if (ll->txTries[seq] >= triesAllowed(ll, ll->txSize[seq]))
+    {
+        printf("LL: Block %d not acknowledged after %d tries\n",
+               seq, ll->txTries[seq]);
+        while (ll->nOutstanding > 0)  // give up on all frames in the window
+        {
+            poolRelease(&ll->txPool, ll->txStore[ll->seqBase]);
+            ll->txStore[ll->seqBase] = NULL;
+            ll->seqBase = next(ll->seqBase);
+            ll->nOutstanding--;
+        }
+        return -13;  // error code
+    }
+
+    retVal = startSend(ll, seq);
+    if (retVal < 0)  // problem!
+    {
+        printf("LL: Block %d, failed to re-send frame\n", seq);
+        return retVal;  // error code
+    }
+    if (debug) printf("LL: Re-sent block %d\n", seq);
+    ll->txTimer[seq] = ll->txSentAt[seq]
+                       + (long long) (ll->rto * 1.0E6);  // restart it
+    ll->txTries[seq]++;
+    COUNT(ll, txResent, 1);
+    ll->periodResent++;  // for adaptLink
+    return 0;
+}  // end of resendFrame
+
+
+// ===========================================================================
+/* Function to give the number of times a frame may be sent before the
+   link is taken to have failed.  At the bit error estimate from
+   adaptLink(), or the simulated error probability if that is higher,
+   the frame is lost with probability F, so it is lost n times in a row
+   with probability F^n: n is chosen to make that below GIVEUP_PROB.
+   F is taken as at most GIVEUP_LOSS, so a link that has stopped is
+   still given up in a limited number of tries, and MAX_TRIES re-tries
+   are always allowed, as on a clean line.
+   Argument: number of bytes in the frame.
+   Return value is the number of tries allowed.  */
+int triesAllowed(LL_context *ll, int nFrame)
+{
+    double bitErr = ll->bitErr;  // bit error probability assumed
+    double lost;  // probability of losing the frame
+    int tries = MAX_TRIES + 1;  // tries allowed on a clean line
+
+    if (ll->probErr > bitErr) bitErr = ll->probErr;
+    lost = -expm1(8.0 * nFrame * log1p(-bitErr));
+    if (lost > GIVEUP_LOSS) lost = GIVEUP_LOSS;
+    if ((lost > 0.0) && (log(GIVEUP_PROB) / log(lost) > tries))
+        tries = (int) ceil(log(GIVEUP_PROB) / log(lost));
+    return tries;
+}  // end of triesAllowed
+
+
+// ===========================================================================
+/* Function to update the re-transmit time from a measured round trip
+   time, using the Jacobson/Karels estimator (as TCP, RFC 6298):
+   the re-transmit time is the smoothed round trip time plus four
+   times its mean deviation, kept between RTO_MIN and txWait.
+   The margin is at least the time an acknowledgement takes to
+   arrive, as RFC 6298 adds the clock granularity - otherwise, on a
+   steady line, the timer can expire with the ack half received.
+   If not adaptive, the re-transmit time is always txWait.
+   Argument: round trip time in seconds.  */
+void updateRto(LL_context *ll, float rtt)
+{
+    float err;  // difference from the smoothed value
+    float margin;  // time allowed beyond the smoothed round trip
+    float ackTime;  // time to receive an acknowledgement
+
+    if (!ll->rttValid)  // first measurement
+    {
+        ll->srtt = rtt;
+        ll->rttVar = rtt / 2.0;
+        ll->rttValid = 1;
+    }
+    else
+    {
+        err = rtt - ll->srtt;
+        if (err < 0.0) err = -err;
+        ll->rttVar += (err - ll->rttVar) / 4.0;  // gain 1/4
+        ll->srtt += (rtt - ll->srtt) / 8.0;      // gain 1/8
+    }
+
+    if (!ll->adaptive)
+    {
+        ll->rto = ll->txWait;
+        return;
+    }
+    margin = 4.0 * ll->rttVar;
+    ackTime = (float) (HEADERSIZE + trailerSize(ll, GOOD) + ll->fecParity)
+              * LINE_BITS / ll->rateNow;
+    if (margin < ackTime) margin = ackTime;
+    ll->rto = ll->srtt + margin;
+    if (ll->rto < RTO_MIN) ll->rto = RTO_MIN;
+    if (ll->rto > ll->txWait) ll->rto = ll->txWait;
+}  // end of updateRto
+
+
+// ===========================================================================
+/* Function to start sending a frame from the re-transmission store,
+   without waiting for the physical layer to finish sending it.
+   The time the frame will have left the line is kept, to start its
+   re-transmit timer and measure the round trip from then.
+   If blocks have been accepted since the frame was built, it is
+   built again, so the ack it carries is not out of date.
+   Argument: sequence number of frame.
+   Return value is 0 on success, negative on failure.  */
+int startSend(LL_context *ll, int seq)
+{
+    int retVal;  // return value from PHY functions
+
+    if (ll->txAck[seq] != ll->seqNumRx)
+    {
+        retVal = rebuildFrame(ll, seq);
+        if (retVal < 0) return retVal;
+    }
+
+    retVal = sendPooled(ll, ll->txStore[seq], ll->txSize[seq]);
+    if (retVal < 0) return retVal;
+    ll->txSentAt[seq] = lineDone(ll, ll->txSize[seq]);
+    COUNT(ll, txBytes, ll->txSize[seq]);
+    return 0;
+}  // end of startSend
+
+
+// ===========================================================================
+/* Function to start sending bytes from a buffer in the frame pool,
+   without waiting for the physical layer to finish sending them.
+   The buffer must not be freed until the send is done, so it is
+   held - the hold is released by sendDone(), which may be called
+   before PHY returns.
+   Arguments: buffer from the pool, number of bytes to send.
+   Return value is 0 on success, negative on failure.  */
+int sendPooled(LL_context *ll, byte *frameTx, int nBytes)
+{
+    int retVal;  // return value from PHY functions
+
+    poolHold(&ll->txPool, frameTx);
+    retVal = PHY_sendAsync(ll->phy, frameTx, nBytes);
+    if (retVal == 0)  // too many sends in progress - wait and try again
+    {
+        if (PHY_sendPoll(ll->phy, 1) < 0) retVal = -12;
+        else retVal = PHY_sendAsync(ll->phy, frameTx, nBytes);
+    }
+    if (retVal != nBytes)  // send did not start
+    {
+        poolRelease(&ll->txPool, frameTx);  // no send to wait for
+        return -12;  // error code
+    }
+    if (ll->trace != NULL) traceBytes(ll, TRACE_TX, frameTx, nBytes);
+    return 0;
+}  // end of sendPooled
+
+
+// ===========================================================================
+/* Function to build a stored frame again, with the ack as it is now.
+   The frame is recovered from the copy kept, by undoing the stuffing
+   and removing the parity, if any - there are no errors to correct.
+   The copy may still be waiting to be sent, so a new buffer is
+   taken from the pool, and the old one is freed once its send is
+   done.  If none is free, this waits until all sends are done, then
+   uses the old buffer.
+   Argument: sequence number of frame.
+   Return value is 0 on success, negative on failure.  */
+int rebuildFrame(LL_context *ll, int seq)
+{
+    byte frame[MAX_FRAME];  // the frame, before stuffing
+    byte *frameTx;  // buffer for new copy
+    int nBody;  // bytes between the markers, with parity
+    int nFixed;  // bytes corrected, none expected
+
+    // Recover the frame, before taking the buffer that may be the old one
+    nBody = unstuffBytes(frame + 1, ll->txStore[seq] + 1, ll->txSize[seq] - 2);
+    if (ll->txParity[seq] > 0)
+        fecDecode(frame + 1, nBody, ll->txParity[seq], &nFixed);
+
+    frameTx = poolAcquire(&ll->txPool);
+    if (frameTx == NULL)  // none free - old buffer must not be sending
+    {
+        if (PHY_sendPoll(ll->phy, 1) < 0) return -12;
+        frameTx = ll->txStore[seq];
+    }
+    else
+    {
+        poolRelease(&ll->txPool, ll->txStore[seq]);
+        ll->txStore[seq] = frameTx;
+    }
+    ll->txSize[seq] = finishFrame(ll, frameTx, frame, ll->txLen[seq], seq,
+                                  frame[TYPEPOS]);
+    ll->txAck[seq] = frame[ACKPOS];
+    ll->txParity[seq] = ll->fecParity;
+    return 0;
+}  // end of rebuildFrame
+
+
+// ===========================================================================
+/* Function to acknowledge a block just accepted.  The ack is held,
+   up to the ack delay, for a data frame to carry it, or to be
+   covered by the ack for a later block.  It is sent now if the ack
+   delay is 0, or once half a window of blocks is waiting for it,
+   so the sender is not kept waiting with the window full.
+   Return value is 0 on success, negative on failure.  */
+int holdAck(LL_context *ll)
+{
+    int limit = ll->winSize / 2;  // blocks waiting before ack is sent
+
+    if ((ll->ackDelay <= 0.0) || (limit < 1)) limit = 1;
+    if (ll->ackHeld == 0) ll->ackTimer = timeSet(ll->ackDelay);
+    ll->ackHeld++;
+    if (ll->ackHeld >= limit) return sendAck(ll, GOOD, ll->seqNumRx);
+    return 0;
+}  // end of holdAck
+
+
+// ===========================================================================
+/* Function to find when bytes given to the physical layer now will
+   have left the line, as they wait behind the bytes sent before.
+   Timing from then, rather than from when the frame was given to the
+   physical layer, means the time waiting to be sent does not count
+   as part of the round trip - that depends on how many frames are
+   in flight, and how long they are.
+   Argument: number of bytes just sent.
+   Return value is the time, as from timeMicros().  */
+long long lineDone(LL_context *ll, int nBytes)
+{
+    long long now = timeMicros();  // time now
+
+    if (ll->lineFree < now) ll->lineFree = now;  // line was idle
+    ll->lineFree += (long long) nBytes * LINE_BITS * 1000000LL / ll->rateNow;
+    return ll->lineFree;
+}  // end of lineDone
+
+
+// ===========================================================================
+/* Function called by the physical layer when a send is done.
+   If the bytes came from the frame pool, this releases the hold
+   taken by startSend(), so the buffer can be freed once the frame
+   has been acknowledged.  Other sends, such as acks, are ignored.
+   Every send is of whole frames, so one that does not end with an
+   end marker was cut short.  That is only logged, as the protocol
+   recovers the frames, as if lost on the line.
+   Arguments: pointer to link state, as given to PHY_setSendCallback,
+              pointer to bytes sent, number of bytes sent.  */
+void sendDone(void *link, byte *dataTx, int nBytesSent)
+{
+    LL_context *ll = (LL_context *) link;  // link the send was for
+
+    if ((nBytesSent <= 0) || (dataTx[nBytesSent - 1] != ENDBYTE))
+        LOG(LOG_WARN, "LL: Send cut short after %d bytes\n", nBytesSent);
+    poolRelease(&ll->txPool, dataTx);  // does nothing if not from pool
+}  // end of sendDone
+
+
+// ===========================================================================
+/* Function to build a frame of any type.
+   The data are copied into a local array, then finishFrame()
+   adds the header and trailer and does the byte stuffing.
+   Arguments: array to hold frame, room for MAX_STUFFED bytes,
+              array of data (may be NULL if no data),
+              number of data bytes to be sent,
+              sequence number to include in header,
+              frame type: DATA, ZDATA, GOOD, BAD or PARAM.
+   Return value is number of bytes in the frame, after stuffing.  */
+int buildFrame(LL_context *ll, byte *frameTx, byte *dataTx,
+               int nData, int seq, int type)
+{
+    byte frame[MAX_FRAME];  // frame before stuffing
+
+    if (nData > 0) memcpy(frame + HEADERSIZE, dataTx, nData);
+    return finishFrame(ll, frameTx, frame, nData, seq, type);
+}
+
+
+// ===========================================================================
+/* Function to finish a frame, with the data already in place after
+   the space for the header.  The header and trailer are added, then
+   parity if error correction is in use, except on parameter frames.
+   The frame is copied to the output array with byte stuffing, so
+   that the start and end markers can only appear at the start and end.
+   The byte count in the header does not include the parity.
+   Data and ack frames both acknowledge the blocks received, so once
+   one is built, any ack being held is no longer needed.
+   Arguments: array to hold frame, room for MAX_STUFFED bytes,
+              array holding the frame so far, room for MAX_FRAME bytes,
+              number of data bytes, starting at position HEADERSIZE,
+              sequence number to include in header,
+              frame type: DATA, ZDATA, GOOD, BAD or PARAM.
+   Return value is number of bytes in the frame, after stuffing.  */
+int finishFrame(LL_context *ll, byte *frameTx, byte *frame,
+                int nData, int seq, int type)
+{
+    int nFrame = HEADERSIZE + nData + trailerSize(ll, type);  // frame size
+    int fcsType = frameFcs(ll, type);  // check sequence for this frame
+    int nStuffed;  // size of frame after stuffing
+    byte coded[MAX_FRAME];  // frame with parity added, if used
+    byte *body = frame;  // frame to be stuffed
+    int nBody = nFrame - 2;  // bytes between the markers
+    uint32_t fcs;  // frame check sequence value
+    int isData = (type == DATA) || (type == ZDATA);  // carries an ack
+
+    // Build the header
+    frame[0] = STARTBYTE;  // start of frame marker
+    frame[BYTECOUNTPOS] = (byte) (nFrame >> 8);  // byte count, before
+    frame[BYTECOUNTPOS+1] = (byte) nFrame;        // stuffing, high first
+    frame[SEQNUMPOS] = (byte) seq;  // sequence number
+    frame[TYPEPOS] = (byte) type;  // frame type
+    frame[ACKPOS] = isData ? (byte) ll->seqNumRx : 0;
+
+    // Count the acks this frame saves sending
+    if (isData) COUNT(ll, txAcksSaved, ll->ackHeld);
+    else if ((type != PARAM) && (ll->ackHeld > 1))
+        COUNT(ll, txAcksSaved, ll->ackHeld - 1);
+    if (type != PARAM) ll->ackHeld = 0;
+
+    // Add the check sequence over header and data
+    fcs = fcsCompute(fcsType, frame, HEADERSIZE + nData);
+    fcsPut(fcsType, frame + HEADERSIZE + nData, fcs);
+
+    // Add parity to everything between the markers
+    if ((ll->fecParity > 0) && (type != PARAM))
+    {
+        nBody = fecEncode(coded + 1, frame + 1, nBody, ll->fecParity);
+        body = coded;
+    }
+
+    // Copy everything between the markers, with byte stuffing,
+    // then add the end of frame marker
+    frameTx[0] = STARTBYTE;
+    nStuffed = 1 + stuffBytes(frameTx + 1, body + 1, nBody);
+    frameTx[nStuffed++] = ENDBYTE; // end of frame marker byte
+
+    // Return the size of the frame
+    return nStuffed;
+}
+
+
+// ===========================================================================
+/* Function to get a frame from the received bytes.
+   Bytes are taken from the receive buffer, which is refilled from
+   the physical layer as needed.  Any bytes after the end of the frame
+   are left in the buffer, to be used for the next frame.
+   The frame runs from a start marker to the next end marker, and
+   is de-stuffed as it is copied.  If another start marker is found
+   first, or the frame is too big, the search starts again.
+   If the time limit is reached part way through a frame, the part
+   is kept in the link state, and the next call carries on from there,
+   so short time limits do not lose frames.
+   The byte count in the header, and the frame itself, are both held
+   to maxSize, whatever the bytes received say.
+   Arguments: pointer to array of bytes to hold frame, the same on
+              every call, maximum number of bytes to receive, above
+              HEADERSIZE, time limit for receiving those bytes.
+   Return value is number of bytes recovered, or negative if error. */
+int getFrame(LL_context *ll, byte *frameRx, int maxSize, float timeLimit)
+{
+    int nRx = ll->rxLen;  // bytes in frame so far, 0 if no start marker
+    int retVal = 0;  // return value from other functions
+    int nSeg;  // number of bytes waiting, before end of buffer array
+    int nRun;  // number of ordinary bytes before next protocol byte
+    int stuffed = ll->rxStuffed;  // 1 if last byte was STUFFBYTE
+    byte b;  // protocol byte
+
+    if (maxSize <= HEADERSIZE)  // no room for the smallest frame
+    {
+        printf("LLGF: Frame array of %d bytes is too small\n", maxSize);
+        return -1;
+    }
+    ll->timerRx = timeSet(timeLimit);  // set time limit to wait for frame
+
+    while (1)
+    {
+        // Deal with the bytes waiting in the buffer
+        while (ll->rxCount > 0)
+        {
+            // Find the next protocol byte, in the part of the
+            // buffer before the end of the array
+            nSeg = RXBUFSIZE - ll->rxHead;
+            if (nSeg > ll->rxCount) nSeg = ll->rxCount;
+            nRun = findSpecial(ll->rxBuf + ll->rxHead, nSeg);
+
+            if ((nRx > 0) && (nRun > 0))  // in a frame - keep these bytes
+            {
+                if (nRx + nRun >= maxSize)  // too big - start again
+                {
+                    LOG(LOG_WARN, "LLGF: Frame too big, %d bytes\n",
+                        nRx + nRun);
+                    COUNT(ll, rxBadOther, 1);
+                    COUNT(ll, rxResync, nRx + nRun);
+                    nRx = 0;
+                }
+                else
+                {
+                    memcpy(frameRx + nRx, ll->rxBuf + ll->rxHead, nRun);
+                    if (stuffed) frameRx[nRx] ^= STUFFXOR;  // restore byte
+                    nRx += nRun;
+
+                    // Once the header is complete, the byte count shows
+                    // if the frame is too big, without waiting for it
+                    if ((nRx >= HEADERSIZE) && (nRx - nRun < HEADERSIZE)
+                        && (frameLength(frameRx) > maxSize))
+                    {
+                        LOG(LOG_WARN, "LLGF: Frame too big, byte count %d\n",
+                            frameLength(frameRx));
+                        COUNT(ll, rxBadOther, 1);
+                        COUNT(ll, rxResync, nRx);
+                        nRx = 0;
+                    }
+                }
+                stuffed = 0;
+            }
+            // If not in a frame, these bytes are discarded
+            else if (nRx == 0) COUNT(ll, rxResync, nRun);
+            ll->rxHead = (ll->rxHead + nRun) % RXBUFSIZE;
+            ll->rxCount -= nRun;
+            if (nRun == nSeg) continue;  // no protocol byte yet
+
+            // Now deal with the protocol byte
+            b = ll->rxBuf[ll->rxHead];
+            ll->rxHead = (ll->rxHead + 1) % RXBUFSIZE;
+            ll->rxCount--;
+            stuffed = 0;
+            if (b == STARTBYTE)  // start of a new frame
+            {
+                if (nRx > 0) COUNT(ll, rxResync, nRx);  // last one cut short
+                frameRx[0] = STARTBYTE;
+                nRx = 1;
+            }
+            else if (nRx == 0)  // not in a frame, so ignore
+            {
+                COUNT(ll, rxResync, 1);
+                continue;
+            }
+            else if (b == STUFFBYTE)  // next byte must be restored
+            {
+                stuffed = 1;
+            }
+            else  // end marker - frame is complete
+            {
+                frameRx[nRx++] = ENDBYTE;
+                ll->rxLen = 0;  // next call starts a new frame
+                ll->rxStuffed = 0;
+                return nRx;  // return number of bytes in frame
+            }
+        }
+
+        // If we are out of time, return 0 - keeping any part frame
+        if (timeUp(ll->timerRx))
+        {
+            LOG(LOG_INFO, "LLGF: Time limit with %d bytes of frame\n", nRx);
+            ll->rxLen = nRx;
+            ll->rxStuffed = stuffed;
+            return 0;
+        }
+
+        // Still within time limit, so wait for more bytes to arrive,
+        // without going past the time limit, then get them
+        retVal = PHY_wait(ll->phy,
+                          (int) (timeLeft(ll->timerRx) * 1000.0) + 1);
+        if (retVal == 0) continue;  // nothing yet - check time again
+        if (retVal > 0) retVal = fillRxBuffer(ll, 1);
+        if (retVal < 0)  // check for error and give up
+        {
+            ll->rxLen = 0;
+            ll->rxStuffed = 0;
+            return retVal;
+        }
+    }
+}  // end of getFrame
+
+
+// ===========================================================================
+/* Function to fill the receive buffer from the physical layer.
+   It asks PHY_get() for as many bytes as will fit in the free space
+   after the last byte stored (up to the end of the array), so all
+   the bytes waiting can be collected in one call.  Without waiting,
+   it asks PHY_getWaiting() instead, which takes only the bytes that
+   have already arrived.
+   Argument: 1 to let PHY_get() wait for bytes, 0 not to wait.
+   Return value is number of bytes added, or negative if error. */
+int fillRxBuffer(LL_context *ll, int wait)
+{
+    int rxTail = (ll->rxHead + ll->rxCount) % RXBUFSIZE;  // first free position
+    int nFree;  // number of free positions that follow in the array
+    int retVal;  // return value from PHY_get or PHY_getWaiting
+
+    // Free space runs to the end of the array, or to the head
+    if (rxTail >= ll->rxHead) nFree = RXBUFSIZE - rxTail;
+    else nFree = ll->rxHead - rxTail;
+    if (ll->rxCount == RXBUFSIZE) nFree = 0;  // buffer is full
+
+    if (nFree == 0)  // no room - should not happen, as frames are smaller
+    {
+        LOG(LOG_WARN, "LLRB: Receive buffer full, discarding %d bytes\n",
+            ll->rxCount);
+        ll->rxHead = 0;  // start again with empty buffer
+        ll->rxCount = 0;
+        return 0;
+    }
+
+    if (wait) retVal = PHY_get(ll->phy, ll->rxBuf + rxTail, nFree);
+    else retVal = PHY_getWaiting(ll->phy, ll->rxBuf + rxTail, nFree);
+    // Return value is number of bytes received, or negative for error
+    if (retVal > 0)  // update the count
+    {
+        if (ll->trace != NULL)
+            traceBytes(ll, TRACE_RX, ll->rxBuf + rxTail, retVal);
+        ll->rxCount += retVal;
+        COUNT(ll, rxBytes, retVal);
+    }
+
+    return retVal;
+}  // end of fillRxBuffer
+
+
+// ===========================================================================
+/* Function to correct errors in a received frame, if error correction
+   is in use.  The parity is removed, leaving the frame as it was
+   before the parity was added, for checkFrame().  A frame with
+   PARAM in the type byte is left alone, as parameter frames have no
+   parity - if the type byte itself was hit, the frame fails its check.
+   Arguments: pointer to array of bytes holding frame,
+              number of bytes in frame, with parity.
+   Returns the number of bytes in the frame without parity,
+   or 0 if there are too many errors to correct.  */
+int decodeFrame(LL_context *ll, byte *frameRx, int nFrame)
+{
+    int nFixed;  // number of bytes corrected
+    int nBody;  // bytes between the markers, without parity
+
+    if ((ll->fecParity == 0) || (nFrame <= HEADERSIZE)
+        || (frameRx[TYPEPOS] == PARAM)) return nFrame;  // no parity
+
+    nBody = fecDecode(frameRx + 1, nFrame - 2, ll->fecParity, &nFixed);
+    if (nBody < 0)
+    {
+        LOG(LOG_WARN, "LLDF: Frame bad - too many errors to correct\n");
+        COUNT(ll, rxFecFailed, 1);
+        return 0;
+    }
+    if (nFixed > 0)
+    {
+        LOG(LOG_INFO, "LLDF: Corrected %d bytes\n", nFixed);
+        COUNT(ll, rxFecFixed, nFixed);
+        COUNT(ll, rxFecFrames, 1);
+    }
+    frameRx[nBody + 1] = frameRx[nFrame - 1];  // end marker, as received
+    return nBody + 2;
+}  // end of decodeFrame
+
+
+// ===========================================================================
+/* Function to check a received frame for errors.
+   Arguments: pointer to array of bytes holding frame,
+              number of bytes in frame.
+   As a minimum, should check error detecting code.
+   This example also checks start and end markers.
+   Returns 1 if frame is good, 0 otherwise.   */
+int checkFrame(LL_context *ll, byte *frameRx, int nFrame)
+{
+    int nData;  // number of data bytes, if frame is good
+    int fcsType;  // check sequence used for this type of frame
+    uint32_t fcs;  // check sequence calculated from frame
+
+    // Check there is room for header and trailer - the trailer
+    // size depends on the frame type, in the header
+    if (nFrame > HEADERSIZE)
+        nData = nFrame - (HEADERSIZE + trailerSize(ll, frameRx[TYPEPOS]));
+    else nData = -1;
+    if (nData < 0)
+    {
+        LOG(LOG_WARN, "LLCF: Frame bad - too short\n");
+        COUNT(ll, rxBadOther, 1);
+        return 0;
+    }
+
+    if (frameRx[0] != STARTBYTE)  // check start merker
+    {
+        LOG(LOG_WARN, "LLCF: Frame bad - start marker\n");
+        COUNT(ll, rxBadMarker, 1);
+        return 0;
+    }
+
+    // Check the end-of-frame marker
+    if (frameRx[nFrame-1] != ENDBYTE)
+    {
+        LOG(LOG_WARN, "LLCF: Frame bad - end marker\n");
+        COUNT(ll, rxBadMarker, 1);
+        return 0;
+    }
+
+    // Check the frame type
+    if ((frameRx[TYPEPOS] != DATA) && (frameRx[TYPEPOS] != ZDATA)
+        && (frameRx[TYPEPOS] != GOOD) && (frameRx[TYPEPOS] != BAD)
+        && (frameRx[TYPEPOS] != PARAM))
+    {
+        LOG(LOG_WARN, "LLCF: Frame bad - frame type\n");
+        COUNT(ll, rxBadOther, 1);
+        return 0;
+    }
+
+    // Check the frame check sequence, over header and data
+    fcsType = frameFcs(ll, frameRx[TYPEPOS]);
+    fcs = fcsCompute(fcsType, frameRx, HEADERSIZE + nData);
+    if (fcs != fcsGet(fcsType, frameRx + HEADERSIZE + nData))
+    {
+        LOG(LOG_WARN, "LLCF: Frame bad - checksum failed\n");
+        COUNT(ll, rxBadFcs, 1);
+        return 0;
+    }
+
+    // Check the byte count in the header matches the frame
+    if (nFrame != frameLength(frameRx))
+    {
+        LOG(LOG_WARN, "LLCF: Frame bad - byte count failed\n");
+        COUNT(ll, rxBadCount, 1);
+        return 0;
+    }
+
+    // If all tests passed, return 1
+    return 1;
+}  // end of checkFrame
+
+
+// ===========================================================================
+/* Function to process a received frame, to find the data.
+   Frame has already been checked for errors, so the header and
+   trailer are where they should be, but the block size is checked
+   again, as a frame with a good check sequence can still come from
+   an end that does not keep to the limits.
+   The data are not copied - the caller is given their location -
+   unless compression is in use: then the block is expanded, or
+   copied if sent as it is, to follow the history of blocks
+   accepted, and the caller must add it to the history with
+   compAccept(), once it is accepted.
+   Arguments: pointer to array holding frame,
+              number of bytes in the frame,
+              pointer to pointer which is set to the start of the data,
+              pointer to sequence number.
+   Return value is number of data bytes, or -1 if the block is too
+   large, or a compressed block is not valid, or compression is not
+   in use. */
+int processFrame(LL_context *ll, byte *frameRx, int nFrame,
+                 byte **dataRx, int *seqNum)
+{
+    int nData;  // number of data bytes in frame
+
+    // First get sequence number from its place in header
+    *seqNum = frameRx[SEQNUMPOS];
+
+    // Calculate number of data bytes, based on frame size
+    nData = nFrame - HEADERSIZE - trailerSize(ll, DATA);
+    if ((nData < 0) || (nData > MAX_BLK)) return -1;  // not a block
+
+    // The data bytes are in the middle of the frame
+    *dataRx = frameRx + HEADERSIZE;
+    if (ll->compress)
+        nData = compExpand(&ll->rxComp, dataRx, frameRx + HEADERSIZE,
+                           nData, frameRx[TYPEPOS] == ZDATA);
+    else if (frameRx[TYPEPOS] == ZDATA) nData = -1;
+
+    return nData;  // return size of block
+}  // end of processFrame
+
+
+// ===========================================================================
+/* Function to send an acknowledgement - positive or negative.
+   The ack frame has the same header and trailer as a data frame,
+   but no data.  The type is GOOD or BAD, and the sequence number
+   is the next one that the receiver expects.  It also acknowledges
+   any blocks whose ack was being held.
+   With selective repeat, while frames are held after a gap, the ack
+   carries a bitmap of them, SACK_SIZE data bytes - see processAck().
+   Return value is 0 on success, negative on failure.  */
+int sendAck(LL_context *ll, int type, int seq)
+{
+    byte ackFrame[2*ACK_SIZE];  // array to hold ack frame, after stuffing
+    byte sack[SACK_SIZE];  // bitmap of frames held after seq
+    int nSack = 0;  // bytes of bitmap in the frame
+    int nFrame;  // size of frame
+    int retVal;  // return value from PHY_send
+    int i;  // for use in loop
+
+    if (ll->selective && (ll->nHeld > 0))
+    {
+        memset(sack, 0, SACK_SIZE);
+        for (i = 1; i < MOD_SEQNUM/2; i++)
+            if (ll->rxHeldSize[(seq + i) % MOD_SEQNUM] >= 0)
+                sack[(i-1) / 8] |= (byte) (1 << ((i-1) % 8));
+        nSack = SACK_SIZE;
+    }
+    nFrame = buildFrame(ll, ackFrame, sack, nSack, seq, type);
+    lineDone(ll, nFrame);  // frames sent next wait behind it - found
+                           // first, as PHY_send returns once it has left
+    retVal = PHY_send(ll->phy, ackFrame, nFrame);  // send frame bytes
+    if (retVal != nFrame)  // problem!
+    {
+        printf("LL: Failed to send ack %d\n", seq);
+        return -12;  // error code
+    }
+    if (ll->trace != NULL) traceBytes(ll, TRACE_TX, ackFrame, nFrame);
+    COUNT(ll, txAcks, 1);
+    COUNT(ll, txBytes, nFrame);
+    return 0;
+}
+
+
+// ===========================================================================
+/* Function to send this end's parameters to the other end, in a
+   PARAM frame: the largest block, window and bit rate it will use,
+   the check sequence type it asks for, and the types it has, the
+   number of parity bytes it asks for, and if it asks for compression
+   and for selective repeat.
+   The frame also gives the bit rate it is sent at, the serial number
+   of these parameters, and of the other end's parameters heard at
+   this rate, so each end knows when the other has heard it.
+   Argument: 1 to ask the other end to reply with its parameters,
+             PARAM_DROP to ask it for a lower bit rate, or 0 -
+             sent in place of the sequence number.
+   Return value is 0 on success, negative on failure.  */
+int sendParam(LL_context *ll, int ask)
+{
+    byte param[PARAM_SIZE];  // parameters, as data bytes
+    byte paramFrame[2*(ACK_SIZE+PARAM_SIZE)];  // frame, after stuffing
+    int nFrame;  // size of frame
+    int mask = 0;  // check sequence types this end has
+    int type;  // for use in loop
+    int retVal;  // return value from PHY_send
+
+    for (type = 0; type < 8; type++)
+        if (fcsSize(type) > 0) mask |= 1 << type;
+
+    param[PARAM_BLK] = (byte) (ll->blkLimit >> 8);  // high byte first
+    param[PARAM_BLK+1] = (byte) ll->blkLimit;
+    param[PARAM_MAXRATE] = (byte) (ll->rateCap / 100 >> 8);
+    param[PARAM_MAXRATE+1] = (byte) (ll->rateCap / 100);
+    param[PARAM_RATE] = (byte) (ll->rateNow / 100 >> 8);
+    param[PARAM_RATE+1] = (byte) (ll->rateNow / 100);
+    param[PARAM_WIN] = (byte) ll->winLimit;
+    param[PARAM_FCS] = (byte) ll->fcsWanted;
+    param[PARAM_FCSMASK] = (byte) mask;
+    param[PARAM_SERIAL] = (byte) ll->paramSerial;
+    param[PARAM_HEARD] = (byte) ll->peerSerial;
+    param[PARAM_FEC] = (byte) ll->fecWanted;
+    param[PARAM_COMP] = (byte) ll->compWanted;
+    param[PARAM_SEL] = (byte) ll->selWanted;
+    nFrame = buildFrame(ll, paramFrame, param, PARAM_SIZE, ask, PARAM);
+    lineDone(ll, nFrame);  // frames sent next wait behind it - found
+                           // first, as PHY_send returns once it has left
+    retVal = PHY_send(ll->phy, paramFrame, nFrame);  // send frame bytes
+    if (retVal != nFrame)  // problem!
+    {
+        printf("LL: Failed to send parameters\n");
+        return -12;  // error code
+    }
+    if (ll->trace != NULL) traceBytes(ll, TRACE_TX, paramFrame, nFrame);
+    COUNT(ll, txBytes, nFrame);
+    return 0;
+}
+
+
+// ===========================================================================
+/* Function to process the other end's parameters, from a PARAM frame
+   that has already been checked.  Frames sent at another bit rate
+   are ignored, as they are left over from an earlier step.  While
+   the settings are being agreed, the other end's limits are kept,
+   to be used by agreeParams(); after that, they cannot change.
+   Replies with this end's parameters if the other end asked for
+   them, asking in turn if this end has not yet been heard.
+   If the other end asks for a lower bit rate, after the settings
+   were agreed, this end replies, then both agree them again.
+   Return value is 0 on success, negative on failure.  */
+int processParam(LL_context *ll, byte *frameRx, int nFrame, int debug)
+{
+    byte *param = frameRx + HEADERSIZE;  // parameters, as data bytes
+    int limit, rate, rateSent;  // other end's largest block and bit rates
+    int retVal;  // return value from other functions
+
+    if (nFrame - HEADERSIZE - trailerSize(ll, PARAM) < PARAM_SIZE) return 0;
+    limit = (param[PARAM_BLK] << 8) | param[PARAM_BLK+1];
+    rate = 100 * ((param[PARAM_MAXRATE] << 8) | param[PARAM_MAXRATE+1]);
+    rateSent = 100 * ((param[PARAM_RATE] << 8) | param[PARAM_RATE+1]);
+    if ((limit < 1) || (rate < BASE_RATE) || (param[PARAM_WIN] < 1)
+        || (param[PARAM_SERIAL] == 0) || (param[PARAM_FEC] > FEC_MAXPARITY)
+        || (param[PARAM_COMP] > 1) || (param[PARAM_SEL] > 1))
+        return 0;  // not valid - ignore it
+    if (rateSent != ll->rateNow)
+    {
+        if (debug) printf("LL: Ignoring parameters sent at %d bit/s\n",
+                          rateSent);
+        return 0;
+    }
+
+    if (ll->agreeing)
+    {
+        ll->peerBlk = limit;
+        ll->peerRate = rate;
+        ll->peerWin = param[PARAM_WIN];
+        ll->peerFcs = param[PARAM_FCS];
+        ll->peerFcsMask = param[PARAM_FCSMASK];
+        ll->peerFec = param[PARAM_FEC];
+        ll->peerComp = param[PARAM_COMP];
+        ll->peerSel = param[PARAM_SEL];
+        // Known at once, as the other end may finish first and send
+        // blocks, which must go in the history from the first, and
+        // be held if they come after a gap
+        ll->compress = ll->compWanted && ll->peerComp;
+        ll->selective = ll->selWanted && ll->peerSel;
+    }
+    ll->peerSerial = param[PARAM_SERIAL];
+    ll->peerHeard = param[PARAM_HEARD];
+    if (debug) printf("LL: Other end takes blocks of %d, window %d, "
+                      "up to %d bit/s, check type %d\n", limit,
+                      param[PARAM_WIN], rate, param[PARAM_FCS]);
+
+    if ((frameRx[SEQNUMPOS] == PARAM_DROP) && !ll->agreeing)
+    {
+        retVal = sendParam(ll, 0);  // tell the other end it was heard
+        if (retVal < 0) return retVal;
+        LOG(LOG_WARN, "LL: Other end asks for a lower bit rate than %d\n",
+            ll->rateNow);
+        return reagree(ll, debug);
+    }
+    if (frameRx[SEQNUMPOS] != 0)  // asked for ours
+        return sendParam(ll, !paramsHeard(ll));
+    return 0;
+}
+
+
+// ===========================================================================
+/* Function to agree the link settings with the other end, starting
+   at BASE_RATE.  The two ends exchange parameters until each has
+   heard the other - the other end has until the receiver waiting
+   time to connect.  Then the bit rate is doubled, up to the slower
+   end's limit, and parameters are exchanged again at each new rate.
+   If they are not heard within STEP_WAIT, the line cannot carry that
+   rate, so both ends go back to BASE_RATE, and this end offers only
+   the last rate that worked.  Every step that fails lowers the rate
+   offered, so the ends always come to an agreement.
+   When the fastest rate is reached, the largest block and window are
+   the smaller of the two ends' limits, the check sequence is the
+   stronger of the types both ends have - see chooseFcs() - the
+   parity is the larger of the two ends' requests.  Blocks are
+   compressed, and selective repeat used, only if both ends ask for
+   it - see processParam() - and the window is then at most
+   MOD_SEQNUM/2.
+   If the other end finishes first and starts sending, its frames are
+   dealt with by serviceLink(), as usual.  The fastest rate to offer,
+   and the serial number of this end's parameters, are set up by the
+   caller - LL_connect() or reagree().
+   Return value is 0 on success, negative on failure.  */
+int agreeParams(LL_context *ll, int debug)
+{
+    long long timerStep = timeSet(ll->rxWait);  // limit for this rate
+    int lastGood = BASE_RATE;  // fastest rate heard so far
+    int target;  // fastest rate both ends offer
+    int tryRate;  // next rate to try
+    int retVal;  // return value from other functions
+
+    ll->agreeing = 1;
+
+    while (1)
+    {
+        retVal = syncParams(ll, timerStep, debug);
+        if (retVal < 0) break;  // link has failed
+        if (retVal > 0)  // both ends heard at this rate
+        {
+            lastGood = ll->rateNow;
+            target = (ll->peerRate < ll->rateCap) ? ll->peerRate
+                                                  : ll->rateCap;
+            if (ll->rateNow >= target) break;  // as fast as both ends go
+            tryRate = (2*ll->rateNow < target) ? 2*ll->rateNow : target;
+            if (setRate(ll, tryRate, debug) == 0)
+            {
+                timerStep = timeSet(STEP_WAIT);
+                continue;
+            }
+            // This port cannot go faster - drop back, as if it failed
+        }
+        else if (ll->rateNow == BASE_RATE)  // nothing from the other end
+        {
+            printf("LL: No parameters from other end\n");
+            retVal = -6;  // error code
+            break;
+        }
+        else tryRate = ll->rateNow;  // the line did not carry this rate
+
+        // Go back and agree again, without the rate that failed
+        LOG(LOG_WARN, "LL: Could not use %d bit/s, offering %d bit/s\n",
+            tryRate, lastGood);
+        ll->rateCap = lastGood;
+        ll->paramSerial = ll->paramSerial % 255 + 1;  // others must hear it
+        retVal = setRate(ll, BASE_RATE, debug);
+        if (retVal < 0) break;
+        lastGood = BASE_RATE;
+        timerStep = timeSet(ll->rxWait);
+    }
+    ll->agreeing = 0;
+    if (retVal < 0) return retVal;
+
+    // Use settings within both ends' limits
+    ll->txMaxBlk = (ll->peerBlk < ll->blkLimit) ? ll->peerBlk : ll->blkLimit;
+    ll->winSize = (ll->peerWin < ll->winLimit) ? ll->peerWin : ll->winLimit;
+    if (ll->selective && (ll->winSize > MOD_SEQNUM/2))
+        ll->winSize = MOD_SEQNUM/2;  // so a frame re-sent is never new
+    ll->fcsType = chooseFcs(ll);
+    ll->fecParity = (ll->peerFec > ll->fecWanted) ? ll->peerFec
+                                                  : ll->fecWanted;
+    ll->nAgreed++;
+    return 0;
+}
+
+
+// ===========================================================================
+/* Function to exchange parameters at the present bit rate, until
+   both ends have heard each other or the time limit is reached.
+   Parameters are sent again every PARAM_RETRY, asking for a reply,
+   and other frames are processed as usual meanwhile.
+   Argument: time limit, from timeSet().
+   Return value is 1 if both ends have heard each other, 0 if the
+   time limit was reached, negative on failure.  */
+int syncParams(LL_context *ll, long long timeLimit, int debug)
+{
+    long long timerSend = timeMicros();  // time to send, at once
+    float wait;  // time to wait for a frame
+    int retVal;  // return value from other functions
+
+    while (!paramsHeard(ll))
+    {
+        if (timeUp(timeLimit)) return 0;
+        if (timeUp(timerSend))
+        {
+            retVal = sendParam(ll, 1);
+            if (retVal < 0) return retVal;
+            timerSend = timeSet(PARAM_RETRY);
+        }
+        wait = timeLeft(timerSend);
+        if (wait > timeLeft(timeLimit)) wait = timeLeft(timeLimit);
+        retVal = serviceLink(ll, NULL, NULL, wait, debug);
+        if (retVal < 0) return retVal;  // link has failed
+    }
+    return 1;
+}
+
+
+// ===========================================================================
+/* Function to change the bit rate of the link.  The last frame sent
+   must leave at the old rate first.  Nothing has been heard from
+   the other end at the new rate, so the exchange starts again.
+   Return value is 0 on success, negative if the physical layer
+   does not accept the rate.  */
+int setRate(LL_context *ll, int bitRate, int debug)
+{
+    int retCode;  // return value from PHY_setRate
+
+    if (PHY_sendPoll(ll->phy, 1) < 0) return -12;
+    retCode = PHY_setRate(ll->phy, bitRate);
+    if (retCode != 0)
+    {
+        printf("LL: Bit rate %d not accepted, PHY returned code %d\n",
+               bitRate, retCode);
+        return -15;  // error code
+    }
+    ll->rateNow = bitRate;
+    ll->peerSerial = 0;
+    ll->peerHeard = 0;
+    if (debug) printf("LL: Trying %d bit/s\n", bitRate);
+    return 0;
+}
+
+
+// ===========================================================================
+/* Function to choose the check sequence type: the stronger of the
+   types the two ends ask for, that both ends have.  If neither will
+   do, PARAM_CHECK is used, as every end has it.  Both ends make the
+   same choice, from the same two types.
+   Return value is the type to use.  */
+int chooseFcs(LL_context *ll)
+{
+    int choice[2] = {ll->fcsWanted, ll->peerFcs};  // types asked for
+    int best = -1;  // strongest type found so far
+    int i;  // for use in loop
+
+    for (i = 0; i < 2; i++)
+    {
+        if ((choice[i] < 0) || (choice[i] > 7) || (fcsSize(choice[i]) == 0)
+            || !(ll->peerFcsMask & (1 << choice[i]))) continue;  // not both
+        if ((best < 0) || (fcsSize(choice[i]) > fcsSize(best))
+            || ((fcsSize(choice[i]) == fcsSize(best)) && (choice[i] > best)))
+            best = choice[i];
+    }
+    return (best < 0) ? PARAM_CHECK : best;
+}
+
+
+// ===========================================================================
+/* Function to adapt the block size to the error rate, at the end of
+   each period of ADAPT_FRAMES data frames, or as soon as there have
+   been ADAPT_LOSSES NAKs, so the link does not fail before the
+   blocks get shorter.  A frame hit by errors
+   causes a NAK, so the NAKs give the fraction of frames lost in the
+   period.  Timeouts are not counted, as they also come when the round
+   trip time goes up, as it does when the blocks get longer.  The
+   fraction lost is turned into a bit error probability, as that does
+   not depend on the size of the frames sent:
+       p = -ln(1 - fraction lost) / bits per frame.
+   This is averaged over the first periods, then smoothed with gain
+   ADAPT_GAIN, and the
+   block size suggested is the one with the best goodput at that
+   probability - see bestBlock().  The block size grows by at most a
+   factor of 2 each period, so it does not jump to the largest size
+   after a lucky period, but it can fall at once.
+   If adaptive bit rate is on, and more than RATE_DROP frames were
+   re-sent for each new frame, and the block size is no longer
+   falling, the other end is asked for a lower bit rate - see
+   dropRate().
+   Return value is 0, or negative if the link failed while changing
+   the bit rate.  */
+int adaptLink(LL_context *ll, int debug)
+{
+    int nSent = ll->periodFrames + ll->periodResent;  // frames sent
+    double lost;  // fraction of frames lost in this period
+    double bitErr;  // bit error probability in this period
+    double gain = ADAPT_GAIN;  // weight given to this period
+    int best = ll->txBlk;  // block size with the best goodput
+    int drop;  // 1 to ask for a lower bit rate
+
+    if (ll->periodFrames == 0) return 0;  // only re-sent - nothing to measure
+    lost = (double) ll->periodLosses / nSent;
+    if (lost > 0.5) lost = 0.5;  // NAKs are lost too, so estimate is poor
+    bitErr = -log1p(-lost) * ll->periodFrames / (double) ll->periodBits;
+    if (ll->nPeriods++ * ADAPT_GAIN < 1.0) gain = 1.0 / ll->nPeriods;
+    ll->bitErr += gain * (bitErr - ll->bitErr);
+
+    if (ll->adaptBlocks)
+    {
+        best = bestBlock(ll, ll->bitErr);
+        if (best > 2 * ll->txBlk) best = 2 * ll->txBlk;
+        if ((best != ll->txBlk) && debug)
+            printf("LL: %d of %d frames lost, block size now %d\n",
+                   ll->periodLosses, nSent, best);
+    }
+
+    // Shorter blocks are tried first, as agreeing again takes time
+    drop = ll->adaptRate && (ll->rateNow > BASE_RATE)
+           && (ll->periodResent > RATE_DROP * ll->periodFrames)
+           && (best >= ll->txBlk);
+    if (ll->adaptBlocks) ll->txBlk = best;
+
+    ll->periodFrames = 0;  // start the next period
+    ll->periodResent = 0;
+    ll->periodLosses = 0;
+    ll->periodBits = 0;
+    if (drop) return dropRate(ll, debug);
+    return 0;
+}
+
+
+// ===========================================================================
+/* Function to find the block size with the best goodput, for a given
+   bit error probability p.  With h bytes of header and trailer, a
+   block of n bytes is in a frame that is lost with probability
+       F = 1 - (1 - p)^(8(n + h)),
+   and with Go-Back-N each loss also costs the rest of the window, W
+   frames in all, so the fraction of the line carrying new data is
+       n/(n + h) * (1 - F) / (1 + (W - 1)F).
+   With error correction, the frame also has parity, so n/(n + h) is
+   the data's share of the bytes on the line, and p is then the rate
+   of errors not corrected, as that is what the NAKs measure.
+   Sizes from ADAPT_MINBLK up are tried, each ADAPT_STEP times the
+   last.  The largest size tried is limited so that a full window can
+   be sent in ADAPT_TIME of the sender waiting time - otherwise frames
+   would time out while still waiting to be sent.
+   Return value is the best block size found.  */
+int bestBlock(LL_context *ll, double bitErr)
+{
+    int h = HEADERSIZE + trailerSize(ll, DATA);  // bytes added to a block
+    int w = ll->winSize;  // frames in flight
+    double coded = (double) FEC_CODEWORD / (FEC_CODEWORD - ll->fecParity);
+                          // line bytes per frame byte, with parity
+    int nLine;  // bytes on the line for a block, with parity
+    int maxBlk;  // largest block to try
+    double size;  // block size to try, before rounding
+    int n;  // block size to try
+    double lost;  // probability of losing a frame
+    double goodput;  // fraction of line carrying new data
+    double bestGoodput = -1.0;  // best found so far
+    int best = 1;  // block size that gave it
+
+    maxBlk = (int) (ADAPT_TIME * ll->txWait * ll->rateNow / LINE_BITS / w
+                    / coded) - h;
+    if (maxBlk < ADAPT_MINBLK) maxBlk = ADAPT_MINBLK;
+    if (maxBlk > ll->txMaxBlk) maxBlk = ll->txMaxBlk;
+    size = (ADAPT_MINBLK < maxBlk) ? ADAPT_MINBLK : maxBlk;
+    while (1)
+    {
+        n = (size < maxBlk) ? (int) size : maxBlk;
+        lost = -expm1(8.0 * (n + h) * log1p(-bitErr));
+        nLine = n + h;
+        if (ll->fecParity > 0) nLine = fecSize(n + h - 2, ll->fecParity) + 2;
+        goodput = (double) n / nLine * (1.0 - lost) / (1.0 + (w-1) * lost);
+        if (goodput > bestGoodput)
+        {
+            bestGoodput = goodput;
+            best = n;
+        }
+        if (n >= maxBlk) break;  // largest block has been tried
+        size *= ADAPT_STEP;
+    }
+    return best;
+}
+
+
+// ===========================================================================
+/* Function to ask the other end to move to a lower bit rate, as too
+   many frames are being re-sent at this one.  A PARAM frame with
+   PARAM_DROP in place of the sequence number offers half the present
+   rate, with a new serial number, so the reply shows it was heard.
+   It is sent every PARAM_RETRY, up to MAX_TRIES times.  When the
+   other end replies, both go back to BASE_RATE and agree the
+   settings again - see reagree().  If there is no reply, the rate
+   is not changed, as the other end would not follow.
+   Return value is 0, or negative if the link failed.  */
+int dropRate(LL_context *ll, int debug)
+{
+    int nAgreed = ll->nAgreed;  // to know if the other end asked too
+    long long timerSend;  // time to send the request again
+    int tries;  // number of times request sent
+    int retVal;  // return value from other functions
+
+    LOG(LOG_WARN, "LL: Too many frames re-sent, asking for %d bit/s\n",
+        ll->rateNow / 2);
+    ll->rateCap = ll->rateNow / 2;
+    if (ll->rateCap < BASE_RATE) ll->rateCap = BASE_RATE;
+    ll->paramSerial = ll->paramSerial % 255 + 1;  // new request
+
+    for (tries = 0; (tries < MAX_TRIES) && !paramsHeard(ll); tries++)
+    {
+        retVal = sendParam(ll, PARAM_DROP);
+        if (retVal < 0) return retVal;
+        timerSend = timeSet(PARAM_RETRY);
+        while (!paramsHeard(ll) && !timeUp(timerSend))
+        {
+            retVal = serviceLink(ll, NULL, NULL, timeLeft(timerSend), debug);
+            if (retVal < 0) return retVal;  // link has failed
+            if (ll->nAgreed != nAgreed) return 0;  // other end asked first
+        }
+    }
+    if (!paramsHeard(ll))
+    {
+        LOG(LOG_WARN, "LL: No reply, staying at %d bit/s\n", ll->rateNow);
+        ll->rateCap = ll->rateNow;
+        return 0;
+    }
+    return reagree(ll, debug);
+}
+
+
+// ===========================================================================
+/* Function to agree the link settings again, after one end has asked
+   for a lower bit rate.  Both ends go back to BASE_RATE, and agree as
+   if connecting, with the lower rate offered.  Frames in flight may
+   have been lost while the rate changed, so they are sent again, and
+   the round trip time is measured again, at the new rate.
+   Return value is 0, or negative if the link failed.  */
+int reagree(LL_context *ll, int debug)
+{
+    int retVal;  // return value from other functions
+
+    ll->paramSerial = ll->paramSerial % 255 + 1;  // others must hear it
+    retVal = setRate(ll, BASE_RATE, debug);
+    if (retVal >= 0) retVal = agreeParams(ll, debug);
+    if (retVal < 0)
     {
-        for (j=0; (j<10); j++)  // first 10 bytes
-            printf("%3d ", frame[j]);  // print as number
-        printf(":  ");  // separator
-        for (j=0; (j<10); j++)
-            printf("%c", frame[j]); // print as character
-        printf("\n - - -\n");   // new line, separator
-        for (j=nByte-10; (j<nByte); j++)  // last 10 bytes
-            printf("%3d ", frame[j]);  // print as number
-        printf(":  ");  // separator
-        for (j=nByte-10; (j<nByte); j++)
-            printf("%c", frame[j]); // print as character
-        printf("\n");   // new line
+        printf("LL: Failed to agree settings again\n");
+        return retVal;
     }
+    LOG(LOG_WARN, "LL: Settings agreed again, now %d bit/s\n", ll->rateNow);
+
+    ll->rttValid = 0;  // round trip is different at the new rate
+    ll->rto = ll->txWait;
+    if (ll->nOutstanding > 0) return resendFrames(ll, debug);
+    return 0;
+}
+
+// ===========================================================================
+/* Function to give the number of bytes in the frame trailer:
+   the frame check sequence, then the end marker.
+   Argument: frame type, which decides the check sequence.  */
+int trailerSize(LL_context *ll, int type)
+{
+    return fcsSize(frameFcs(ll, type)) + 1;
+}
+
+
+// ===========================================================================
+/* Function to give the check sequence type for a frame type.
+   Parameter frames always use PARAM_CHECK, so they can be checked
+   before the two ends have agreed a type.  */
+int frameFcs(LL_context *ll, int type)
+{
+    return (type == PARAM) ? PARAM_CHECK : ll->fcsType;
+}
+
+
+// ===========================================================================
+/* Function to give the largest a data frame can be, after stuffing,
+   for a block of nData bytes, with the parity in use - every byte
+   between the markers might need stuffing.  */
+int frameRoom(LL_context *ll, int nData)
+{
+    int nFrame = HEADERSIZE + nData + trailerSize(ll, DATA);  // unstuffed
+
+    if (ll->fecParity > 0) nFrame = fecSize(nFrame - 2, ll->fecParity) + 2;
+    return 2*nFrame - 2;
+}
+
+
+// ===========================================================================
+/* Function to check if both ends have heard each other's present
+   parameters, at the present bit rate.
+   Returns 1 if so, 0 if not.  */
+int paramsHeard(LL_context *ll)
+{
+    return (ll->peerSerial != 0) && (ll->peerHeard == ll->paramSerial);
+}
+
+
+// ===========================================================================
+/* Function to read the byte count from a frame header: the number
+   of bytes in the frame before stuffing, including the markers.  */
+int frameLength(byte *frame)
+{
+    return (frame[BYTECOUNTPOS] << 8) | frame[BYTECOUNTPOS+1];
+}
+
+
+// ===========================================================================
+/* Function to advance the sequence number,
+   wrapping around at maximum value.  */
+int next(int seq)
+{
+    return ((seq + 1) % MOD_SEQNUM);
+}
+
+
+// ===========================================================================
+/* Function to read the monotonic clock, in microseconds.
+   The clock belongs to the physical layer, so that a simulated
+   physical layer can run the link layer timers in virtual time.  */
+long long timeMicros(void)
+{
+    return PHY_time();
+}  // end of timeMicros
+
+
+// ===========================================================================
+/* Function to set time limit at a point in the future.
+   limit   is time limit in seconds (from now) - rounded to the
+           nearest microsecond, so a limit from timeLeft() is not
+           cut to zero, as it is only held to float precision  */
+long long timeSet(float limit)
+{
+    long long timeLimit = timeMicros() + (long long)(limit * 1.0E6 + 0.5);
+    return timeLimit;
+}  // end of timeSet
+
+
+// ===========================================================================
+/* Function to check if time limit has elapsed.
+   timer  is timer variable to check
+   returns 1 if time has reached or exceeded limit,
+           0 if time has not yet reached limit.   */
+int timeUp(long long timeLimit)
+{
+    if (timeMicros() < timeLimit) return 0;  // still within limit
+    else return 1;  // time limit has been reached or exceeded
+}  // end of timeUP
+
+
+// ===========================================================================
+/* Function to find the time remaining before a time limit.
+   timer  is timer variable to check
+   returns time remaining in seconds, 0 if limit has been reached.  */
+float timeLeft(long long timeLimit)
+{
+    long long now = timeMicros();
+    if (now >= timeLimit) return 0.0;  // time is up
+    return (float)(timeLimit - now) / 1.0E6;
+}  // end of timeLeft
 
+
+// ===========================================================================
+/* Function to check if byte is a protocol byte.
+   Returns 1 for start marker, end marker or stuff byte, 0 otherwise. */
+int special(byte b)
+{
+    return (b == STARTBYTE) || (b == ENDBYTE) || (b == STUFFBYTE);
+}
+
+
+// ===========================================================================
+/* Function to print bytes of a frame, in groups of 10.
+   For small frames, print all the bytes,
+   for larger frames, just the start and end.
+   Each line is put together first, then logged as one message.  */
+void printFrame(byte *frame, int nByte)
+{
+    char line[80];  // one line of output
+    int i, j, n;  // for use in loops, and length of line
+
+    for (i = 0; i < nByte; i += 10)  // step in groups of 10 bytes
+    {
+        if ((nByte > 50) && (i == 10))  // large frame - skip to the end
+        {
+            LOG(LOG_INFO, " - - -\n");  // separator
+            i = nByte - 10;
+        }
+        n = 0;
+        for (j = 0; (j < 10) && (i + j < nByte); j++)
+            n += sprintf(line + n, "%3d ", frame[i+j]);  // as number
+        n += sprintf(line + n, ":  ");  // separator
+        for (j = 0; (j < 10) && (i + j < nByte); j++)
+            line[n++] = (char) frame[i+j];  // as character
+        line[n] = '\0';
+        LOG(LOG_INFO, "%s\n", line);
+    }
 }  // end of printFrame
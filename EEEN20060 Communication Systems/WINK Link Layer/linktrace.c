@@ -0,0 +1,281 @@
+/*  Trace of a link - see linktrace.h.
+       LL_traceStart   starts writing the trace of a link to a file
+       LL_traceStop    writes what is left, and closes the file
+       LL_traceFlush   writes what is waiting, so the file is complete
+       traceRead       reads the next record
+       traceBytes      adds a record, called by the link layer
+    The link layer only calls traceBytes() when the link has a trace,
+    so a link without one pays for a test of a pointer, no more.
+    LL_traceStart and LL_traceStop take the lock of the receive
+    thread, if it runs, so the thread never sees half a trace.  */
+
+typedef unsigned char byte;
+
+#include <stdio.h>     // for printf and file functions
+#include <stdlib.h>    // for calloc and free
+#include <string.h>    // for memcpy and memcmp
+#include "physical.h"  // for PHY_time
+#include "linklayer.h" // link layer functions
+#include "rxthread.h"  // for the lock on the link state
+#include "linktrace.h" // these functions
+
+#define TRACE_MAXTIME 0xFFFFFFFFLL  // longest time in a record header
+
+//===================================================================
+/* Function to put a number into bytes, high byte first.
+   Arguments: where to put it, the number, number of bytes.  */
+static void putNumber(byte *p, long long x, int nBytes)
+{
+    int i;  // for use in loop
+
+    for (i = nBytes - 1; i >= 0; i--)
+    {
+        p[i] = (byte) x;
+        x >>= 8;
+    }
+}
+
+//===================================================================
+/* Function to get a number from bytes, high byte first.
+   Arguments: where it is, number of bytes.  */
+static long long getNumber(byte *p, int nBytes)
+{
+    long long x = 0;  // number so far
+    int i;  // for use in loop
+
+    for (i = 0; i < nBytes; i++) x = (x << 8) | p[i];
+    return x;
+}
+
+//===================================================================
+/* Function to give the settings of a link, as in a TRACE_SET record.
+   Arguments: link state, array of TRACE_SETSIZE bytes to fill.  */
+static void getSettings(LL_context *ll, byte *settings)
+{
+    settings[TRACE_SETFCS] = (byte) ll->fcsType;
+    settings[TRACE_SETFEC] = (byte) ll->fecParity;
+    settings[TRACE_SETCOMP] = (byte) ll->compress;
+    settings[TRACE_SETWIN] = (byte) ll->winSize;
+    putNumber(settings + TRACE_SETRATE, ll->rateNow, 4);
+    settings[TRACE_SETSEL] = (byte) ll->selective;
+}
+
+//===================================================================
+/* Function to write the records in the buffer to the file.
+   If that fails, the trace is stopped, and the file closed.
+   Return value is 0 on success, -16 if the file could not be written.  */
+static int writeBuffer(LL_context *ll)
+{
+    LL_trace *tr = ll->trace;  // state of the trace
+
+    if (fwrite(tr->buf, 1, tr->nBuf, tr->fp) != (size_t) tr->nBuf)
+    {
+        printf("LLT: Error writing trace file of port %d, trace stopped\n",
+               ll->portNum);
+        fclose(tr->fp);
+        ll->trace = NULL;
+        free(tr);
+        return -16;  // error code
+    }
+    tr->nBytes += tr->nBuf;
+    tr->nBuf = 0;
+    return 0;
+}
+
+//===================================================================
+/* Function to add a record to the buffer, writing the buffer first
+   if there is not room.  A gap too long for the record header goes
+   in a TRACE_GAP record before it.
+   Arguments: link state, kind of record, bytes, number of bytes.
+   Return value is 0 on success, negative if the trace has stopped.  */
+static int addRecord(LL_context *ll, int kind, byte *data, int nData)
+{
+    LL_trace *tr = ll->trace;  // state of the trace
+    long long now = PHY_time();  // time of this record
+    long long gap = now - tr->lastTime;  // time since the last record
+    byte *p;  // where the record goes
+
+    if (gap < 0) gap = 0;  // clock is monotonic, but be safe
+    if ((tr->nBuf + 2*TRACE_RECHDR + 8 + nData > TRACE_BUFSIZE)
+        && (writeBuffer(ll) < 0)) return -16;
+
+    if (gap > TRACE_MAXTIME)
+    {
+        p = tr->buf + tr->nBuf;
+        p[0] = TRACE_GAP;
+        putNumber(p + 1, 8, 2);
+        putNumber(p + 3, 0, 4);
+        putNumber(p + TRACE_RECHDR, gap, 8);
+        tr->nBuf += TRACE_RECHDR + 8;
+        gap = 0;
+    }
+    p = tr->buf + tr->nBuf;
+    p[0] = (byte) kind;
+    putNumber(p + 1, nData, 2);
+    putNumber(p + 3, gap, 4);
+    memcpy(p + TRACE_RECHDR, data, nData);
+    tr->nBuf += TRACE_RECHDR + nData;
+    tr->lastTime = now;
+    tr->nRecords++;
+    return 0;
+}
+
+//===================================================================
+/* Function to start writing the trace of a link to a file.
+   The file header and the settings now go in the buffer at once.
+   Return value is 0 on success, negative on failure.  */
+int LL_traceStart(LL_context *ll, const char *fileName, int debug)
+{
+    LL_trace *tr;  // state of the new trace
+
+    if (ll->trace != NULL)
+    {
+        printf("LLT: Trace already running on port %d\n", ll->portNum);
+        return -14;  // error code
+    }
+    tr = calloc(1, sizeof(LL_trace));  // buffer starts empty
+    if (tr == NULL)
+    {
+        printf("LLT: No memory for trace\n");
+        return -17;  // error code
+    }
+    tr->fp = fopen(fileName, "wb");  // open for binary write
+    if (tr->fp == NULL)
+    {
+        printf("LLT: Could not open trace file %s\n", fileName);
+        free(tr);
+        return -16;  // error code
+    }
+
+    tr->lastTime = PHY_time();
+    memcpy(tr->buf, TRACE_MAGIC, TRACE_MAGICSIZE);
+    putNumber(tr->buf + TRACE_MAGICSIZE, ll->portNum, 2);
+    putNumber(tr->buf + TRACE_MAGICSIZE + 2, tr->lastTime, 8);
+    tr->nBuf = TRACE_FILEHDR;
+
+    rxLock(ll);  // if the receive thread runs, it waits meanwhile
+    getSettings(ll, tr->settings);
+    ll->trace = tr;
+    addRecord(ll, TRACE_SET, tr->settings, TRACE_SETSIZE);
+    rxUnlock(ll);
+    if (debug) printf("LLT: Trace of port %d started, in %s\n",
+                      ll->portNum, fileName);
+    return 0;
+}
+
+//===================================================================
+/* Function to write the records still in the buffer, close the file
+   and stop the trace.
+   Return value is 0 on success, negative if the file could not be
+   written.  */
+int LL_traceStop(LL_context *ll, int debug)
+{
+    LL_trace *tr;  // state of the trace
+    int retVal = 0;  // return value
+
+    rxLock(ll);
+    if ((ll->trace != NULL) && (writeBuffer(ll) < 0)) retVal = -16;
+    tr = ll->trace;  // NULL if writing failed
+    ll->trace = NULL;
+    rxUnlock(ll);
+    if (tr == NULL) return retVal;
+
+    if (fclose(tr->fp) != 0)
+    {
+        printf("LLT: Error closing trace file of port %d\n", ll->portNum);
+        retVal = -16;  // error code
+    }
+    if (debug) printf("LLT: Trace of port %d stopped, %lld records, "
+                      "%lld bytes\n", ll->portNum, tr->nRecords, tr->nBytes);
+    free(tr);
+    return retVal;
+}
+
+//===================================================================
+/* Function to write the records still in the buffer, and pass them
+   on to the file.
+   Return value is 0 on success, negative if the file could not be
+   written, and the trace has stopped.  */
+int LL_traceFlush(LL_context *ll)
+{
+    int retVal = 0;  // return value
+
+    rxLock(ll);
+    if ((ll->trace != NULL) && ((writeBuffer(ll) < 0)
+                                || (fflush(ll->trace->fp) != 0)))
+        retVal = -16;
+    rxUnlock(ll);
+    return retVal;
+}
+
+//===================================================================
+/* Function to read the next record from a trace file.
+   Return value is 1 if a record was read, 0 at the end of the file,
+   negative if the file is not a trace, or is damaged.  */
+int traceRead(FILE *fp, TraceRecord *rec, int *portNum)
+{
+    byte hdr[TRACE_FILEHDR];  // file header, or record header
+    int kind, nData;  // from the record header
+
+    if (ftell(fp) == 0)  // first call - check the file header
+    {
+        if ((fread(hdr, 1, TRACE_FILEHDR, fp) != TRACE_FILEHDR)
+            || (memcmp(hdr, TRACE_MAGIC, TRACE_MAGICSIZE) != 0))
+        {
+            printf("LLT: Not a trace file\n");
+            return -1;
+        }
+        *portNum = (int) getNumber(hdr + TRACE_MAGICSIZE, 2);
+        rec->time = 0;
+    }
+
+    while (1)
+    {
+        nData = (int) fread(hdr, 1, TRACE_RECHDR, fp);
+        if (nData == 0) return 0;  // end of file
+        if (nData < TRACE_RECHDR)
+        {
+            printf("LLT: Trace file cut short\n");
+            return -1;
+        }
+        kind = hdr[0];
+        nData = (int) getNumber(hdr + 1, 2);
+        if ((kind < TRACE_TX) || (kind > TRACE_GAP)
+            || (nData > TRACE_MAXDATA)
+            || ((kind == TRACE_GAP) && (nData != 8)))
+        {
+            printf("LLT: Trace file damaged, record of kind %d, "
+                   "%d bytes\n", kind, nData);
+            return -1;
+        }
+        if (fread(rec->data, 1, nData, fp) != (size_t) nData)
+        {
+            printf("LLT: Trace file cut short\n");
+            return -1;
+        }
+        rec->time += getNumber(hdr + 3, 4);
+        if (kind != TRACE_GAP) break;
+        rec->time += getNumber(rec->data, 8);  // and read the next
+    }
+    rec->kind = kind;
+    rec->nData = nData;
+    return 1;
+}
+
+//===================================================================
+/* Function to add a record of bytes sent or received to the trace,
+   after a TRACE_SET record if the settings have changed since the
+   last one.  Only called if the link has a trace.
+   Arguments: link state, TRACE_TX or TRACE_RX, bytes, number of bytes.  */
+void traceBytes(LL_context *ll, int kind, byte *data, int nData)
+{
+    byte settings[TRACE_SETSIZE];  // settings now
+
+    getSettings(ll, settings);
+    if (memcmp(settings, ll->trace->settings, TRACE_SETSIZE) != 0)
+    {
+        memcpy(ll->trace->settings, settings, TRACE_SETSIZE);
+        if (addRecord(ll, TRACE_SET, settings, TRACE_SETSIZE) < 0) return;
+    }
+    addRecord(ll, kind, data, nData);
+}
@@ -0,0 +1,123 @@
+#ifndef LINKTRACE_H_INCLUDED
+#define LINKTRACE_H_INCLUDED
+
+/*  Trace of a link - a file of everything sent and received, for
+    finding out later why a link was slow.
+       LL_traceStart   starts writing the trace of a link to a file
+       LL_traceStop    writes what is left, and closes the file
+       LL_traceFlush   writes what is waiting, so the file is complete
+       traceRead       reads the next record, for a program that
+                       replays or examines a trace - see tracereplay.c
+    Each frame sent is recorded as it was given to the physical
+    layer, after stuffing, and the bytes received are recorded as
+    they came from the physical layer, before the link looks for
+    frames in them.  So bad frames, and bytes thrown away while
+    looking for a start marker, are all in the trace, and the
+    receiving functions can be run again on exactly the same bytes.
+    The settings needed to read the frames - check sequence type and
+    parity - are recorded once at the start, and again whenever they
+    change, before the next frame.
+    The file starts with TRACE_MAGIC, then the port number and the
+    time the trace started, then a record for each event.  Each record
+    has a kind, the number of bytes that follow, and the time since
+    the record before, in microseconds of PHY_time().  All numbers
+    are high byte first, as in the frames.  A gap too long for the
+    time field is recorded in a TRACE_GAP record first.
+    Records are collected in a buffer of TRACE_BUFSIZE bytes, and
+    written to the file when it is full, so recording one costs a
+    copy, and the file is written in large pieces.  The trace is
+    written by whichever thread holds the link, so it needs no lock
+    of its own.  If the file cannot be written, the trace stops, and
+    the link goes on as before.  */
+
+#include <stdio.h>  // for FILE
+#include "linklayer.h"  // for the link state
+
+#define TRACE_BUFSIZE 65536  // bytes of records collected before writing
+#define TRACE_MAGIC "WINKTRC1"  // first bytes of a trace file
+#define TRACE_MAGICSIZE 8       // bytes of TRACE_MAGIC, without the 0
+#define TRACE_FILEHDR (TRACE_MAGICSIZE + 10)  // magic, port and start time
+#define TRACE_RECHDR 7  // kind, byte count and time of each record
+
+// Kinds of record
+#define TRACE_TX 1      // frame sent, after stuffing
+#define TRACE_RX 2      // bytes received, as they came from the line
+#define TRACE_SET 3     // settings used for the frames that follow
+#define TRACE_GAP 4     // time to add to the next record, in 8 bytes
+
+// Bytes of a TRACE_SET record, after the record header
+#define TRACE_SETFCS 0  // check sequence type
+#define TRACE_SETFEC 1  // parity bytes per codeword
+#define TRACE_SETCOMP 2 // 1 if blocks are compressed
+#define TRACE_SETWIN 3  // window size
+#define TRACE_SETRATE 4 // bit rate, 4 bytes
+#define TRACE_SETSEL 8  // 1 if selective repeat, 0 if Go-Back-N
+#define TRACE_SETSIZE 9
+
+#define TRACE_MAXDATA RXBUFSIZE  // most bytes in any record
+
+#if TRACE_MAXDATA > 65535
+#error "Records of received bytes must fit the 16-bit byte count"
+#endif
+#if TRACE_BUFSIZE < TRACE_FILEHDR + 2*TRACE_RECHDR + 8 + TRACE_MAXDATA
+#error "TRACE_BUFSIZE must hold the largest record, with a gap before it"
+#endif
+
+/* State of the trace of one link.  */
+typedef struct LL_trace
+{
+    FILE *fp;               // trace file
+    byte buf[TRACE_BUFSIZE];    // records not yet written
+    int nBuf;               // bytes in buf
+    long long lastTime;     // time of the last record, microseconds
+    byte settings[TRACE_SETSIZE];  // settings last recorded
+    long long nRecords;     // records written, for the debug message
+    long long nBytes;       // bytes written to the file
+} LL_trace;
+
+/* One record read back from a trace file, by traceRead().  */
+typedef struct TraceRecord
+{
+    int kind;               // TRACE_TX, TRACE_RX or TRACE_SET
+    int nData;              // number of bytes in data
+    long long time;         // time since the trace started, microseconds
+    byte data[TRACE_MAXDATA];   // bytes of the record
+} TraceRecord;
+
+/* Function to start writing the trace of a link to a file.  It can
+   be started before or after LL_connect(), and goes on across
+   connections, until LL_traceStop().  An existing file is replaced.
+   Arguments: pointer to link state, name of the file, debug.
+   Return value is 0 on success, negative on failure.  */
+int LL_traceStart(LL_context *ll, const char *fileName, int debug);
+
+/* Function to write the records still in the buffer, close the file
+   and stop the trace.  Return value is 0 on success, negative if
+   the file could not be written.  */
+int LL_traceStop(LL_context *ll, int debug);
+
+/* Function to write the records still in the buffer, so the file
+   holds everything so far - LL_discon() calls this.
+   Return value is 0 on success, negative if the file could not be
+   written, and the trace has stopped.  */
+int LL_traceFlush(LL_context *ll);
+
+/* Function to read the next record from a trace file.  On the first
+   call, the file must be at the start, and the port number is read
+   from the file header.  TRACE_GAP records are added into the time
+   of the record after, so they are never returned.
+   Arguments: trace file opened for binary read, record to fill -
+              the same on every call, as each time is counted from
+              the record before - pointer to port number, set on
+              the first call.
+   Return value is 1 if a record was read, 0 at the end of the file,
+   negative if the file is not a trace, or is damaged.  */
+int traceRead(FILE *fp, TraceRecord *rec, int *portNum);
+
+// ==========================================================
+// Function used by the link layer functions
+
+// Function to add a record of bytes sent or received to the trace.
+void traceBytes(LL_context *ll, int kind, byte *data, int nData);
+
+#endif // LINKTRACE_H_INCLUDED
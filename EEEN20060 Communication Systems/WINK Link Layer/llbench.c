@@ -0,0 +1,211 @@
+/* EEEN20060 Communication Systems, link layer benchmark
+   This program sends blocks of data through the link layer and the
+   simulated physical layer, and measures goodput, frames per second,
+   per-block latency and re-transmission overhead, for a range of
+   block sizes, bit rates, error probabilities and window sizes.
+   It needs no input.  The link layer prints its error messages on
+   the screen, so the results are written to llbench.csv.  The messages
+   are printed by a background thread (see logging.h), so a slow
+   console does not slow down the link being measured.
+   Optional arguments: number of blocks to send for each measurement,
+   seed for the simulated errors - the same seed gives the same
+   errors in the same places, so results can be repeated.  Seed 0
+   takes the seed from the time.
+   The simulated physical layer sends and receives through the same
+   array, so the blocks are sent in bursts of one window, then all
+   received - the latency includes the time waiting in the burst. */
+
+typedef unsigned char byte;
+
+#include <stdio.h>  // standard input-output library
+#include <stdlib.h>  // for qsort, atoi and strtoul
+#include "linklayer.h"  // link layer functions
+#include "physical.h"  // to set the seed for simulated errors
+#include "logging.h"  // to print messages in the background
+
+#define BENCH_BLOCKS 40  // default number of blocks for each measurement
+#define MAX_BLOCKS 2000  // largest number of blocks for each measurement
+#define BENCH_SEED 1  // default seed for simulated errors
+
+// Function prototypes
+int runBench(FILE *fpo, int blockSize, int bitRate, double probErr,
+             int window, int nBlocks, unsigned long seed);
+void fillBlock(byte *block, int nByte, int blockNum);
+int compareTimes(const void *a, const void *b);
+
+
+int main(int argc, char *argv[])
+{
+    static const int sizes[] = {16, 64, 240};  // block sizes, bytes
+    static const int rates[] = {9600, 38400};  // bit rates, bit/s
+    static const double errs[] = {0.0, 1.0E-5, 1.0E-4};  // error probs
+    static const int windows[] = {1, 2, 4, 8};  // window sizes
+    int nSizes = sizeof(sizes) / sizeof(sizes[0]);
+    int nRates = sizeof(rates) / sizeof(rates[0]);
+    int nErrs = sizeof(errs) / sizeof(errs[0]);
+    int nWindows = sizeof(windows) / sizeof(windows[0]);
+    int s, r, e, w;  // for use in loops
+    int nBlocks = BENCH_BLOCKS;  // number of blocks to send each time
+    unsigned long seed = BENCH_SEED;  // seed for simulated errors
+    int run = 0, nRuns = nSizes * nRates * nErrs * nWindows;
+    FILE *fpo;  // file handle for results
+
+    printf("Link Layer Benchmark\n\n");
+
+    if (argc > 1) nBlocks = atoi(argv[1]);
+    if (argc > 2) seed = strtoul(argv[2], NULL, 10);
+    if ((nBlocks < 1) || (nBlocks > MAX_BLOCKS))
+    {
+        printf("Number of blocks must be 1 to %d\n", MAX_BLOCKS);
+        return 1;
+    }
+
+    fpo = fopen("llbench.csv", "w");
+    if (fpo == NULL)
+    {
+        perror("Bench: Error opening llbench.csv");
+        return 1;
+    }
+    fprintf(fpo, "block_bytes,bit_rate,prob_err,window,blocks,seconds,"
+                 "goodput_bit_s,frames_s,latency_p50_ms,latency_p99_ms,"
+                 "resent_pct,bad_frames,status\n");
+    logStart();  // if it fails, messages are printed at once
+
+    for (s = 0; s < nSizes; s++)
+        for (r = 0; r < nRates; r++)
+            for (e = 0; e < nErrs; e++)
+                for (w = 0; w < nWindows; w++)
+                {
+                    run++;
+                    printf("Bench: Run %d of %d: %d bytes, %d bit/s, "
+                           "error %g, window %d\n", run, nRuns, sizes[s],
+                           rates[r], errs[e], windows[w]);
+                    runBench(fpo, sizes[s], rates[r], errs[e], windows[w],
+                             nBlocks, seed);
+                    fflush(fpo);  // keep results so far, in case of crash
+                }
+
+    logStop();
+    fclose(fpo);
+    printf("\nBench: Results written to llbench.csv\n");
+    return 0;
+}
+
+
+/* Function to do one measurement, and write one line of results.
+   Arguments: file for results, block size, bit rate, probability of
+              error, window size, number of blocks to send,
+              seed for simulated errors.
+   Return value is 0 if all blocks were received correctly,
+   negative otherwise.  */
+int runBench(FILE *fpo, int blockSize, int bitRate, double probErr,
+             int window, int nBlocks, unsigned long seed)
+{
+    static LL_context link;  // state of the link - large, so not on stack
+    static long long sendTime[MAX_BLOCKS];  // time each block was sent
+    static long long latency[MAX_BLOCKS];   // time each block took, us
+    byte dataSend[MAX_BLK];  // block to send
+    byte dataReceive[MAX_BLK];  // block received
+    byte expected[MAX_BLK];  // block that should have been received
+    int burst = window;  // number of blocks to send before receiving
+    int nSent = 0, nGot = 0, nBad = 0;  // block counts
+    int i, n;  // for use in loops
+    int retVal = 0;  // return value from functions
+    long long start;  // time at start of measurement
+    double seconds;  // time taken
+    LL_stats st;  // counters from the link
+
+    if (burst > POOL_FRAMES) burst = POOL_FRAMES;  // so sending never waits
+
+    LL_init(&link, 1);
+    if ((LL_setLine(&link, bitRate, probErr, 0) < 0)
+        || (LL_setWindow(&link, window, 0) < 0)
+        || (LL_connect(&link, 0) < 0))
+    {
+        fprintf(fpo, "%d,%d,%g,%d,%d,,,,,,,,setup failed\n",
+                blockSize, bitRate, probErr, window, nBlocks);
+        return -1;
+    }
+    PHY_setSeed(link.phy, seed);  // same errors for every window size
+
+    start = timeMicros();
+    while ((nGot < nBlocks) && (retVal >= 0))
+    {
+        // Send a burst of blocks
+        for (n = 0; (n < burst) && (nSent < nBlocks); n++)
+        {
+            fillBlock(dataSend, blockSize, nSent);
+            sendTime[nSent] = timeMicros();
+            retVal = LL_send(&link, dataSend, blockSize, 0);
+            if (retVal < 0) break;  // link has failed
+            nSent++;
+        }
+
+        // Then receive them, checking each one
+        while ((nGot < nSent) && (retVal >= 0))
+        {
+            retVal = LL_receive(&link, dataReceive, MAX_BLK, 0);
+            if (retVal < 0) break;  // link has failed
+            latency[nGot] = timeMicros() - sendTime[nGot];
+            fillBlock(expected, blockSize, nGot);
+            if (retVal != blockSize) nBad++;
+            else
+            {
+                for (i = 0; i < blockSize; i++)
+                    if (dataReceive[i] != expected[i]) break;
+                if (i < blockSize) nBad++;  // block is not right
+            }
+            nGot++;
+        }
+    }
+    if (retVal >= 0) retVal = LL_flush(&link, 0);
+    seconds = (double) (timeMicros() - start) / 1.0E6;
+    if (seconds <= 0.0) seconds = 1.0E-6;
+    LL_getStats(&link, &st);
+
+    // Find the latency percentiles, from the blocks received
+    qsort(latency, nGot, sizeof(latency[0]), compareTimes);
+
+    fprintf(fpo, "%d,%d,%g,%d,%d,%.3f,%.0f,%.1f,", blockSize, bitRate,
+            probErr, window, nGot, seconds,
+            8.0 * nGot * blockSize / seconds,
+            (st.txFrames + st.txResent) / seconds);
+    if (nGot > 0)
+        fprintf(fpo, "%.2f,%.2f,", latency[nGot / 2] / 1000.0,
+                latency[(nGot * 99) / 100] / 1000.0);
+    else fprintf(fpo, ",,");
+    fprintf(fpo, "%.1f,%lld,%s\n",
+            (st.txFrames > 0) ? 100.0 * st.txResent / st.txFrames : 0.0,
+            st.rxBadFcs + st.rxBadMarker + st.rxBadCount + st.rxBadOther,
+            (retVal < 0) ? "link failed" :
+                            (nBad > 0) ? "data wrong" : "ok");
+
+    LL_discon(&link, 0);
+    if ((retVal < 0) || (nBad > 0)) return -1;
+    return 0;
+}
+
+
+/* Function to fill a block with bytes that depend on the block
+   number, so the receiver can check them.  Uses a simple linear
+   congruential generator, so every block is different.  */
+void fillBlock(byte *block, int nByte, int blockNum)
+{
+    unsigned long x = 12345UL + 2654435761UL * (unsigned long) blockNum;
+    int i;  // for use in loop
+
+    for (i = 0; i < nByte; i++)
+    {
+        x = (x * 1103515245UL + 12345UL) & 0xFFFFFFFFUL;
+        block[i] = (byte) (x >> 16);
+    }
+}
+
+
+/* Function to compare two times, for qsort.  */
+int compareTimes(const void *a, const void *b)
+{
+    long long ta = *(const long long *) a;
+    long long tb = *(const long long *) b;
+    return (ta > tb) - (ta < tb);
+}
@@ -0,0 +1,226 @@
+/*  Logging functions, for messages from the link and physical layers.
+       logPrint     prints or queues one message, within the rate limit
+       logSetLevel  sets the highest level to log, while running
+       logStart     starts a thread to print messages
+       logStop      prints any messages left, and stops the thread
+    The ring buffer can have many threads adding messages, and one
+    taking them out.  Each slot has a sequence number, which says
+    whether it is ready to be filled or to be printed, so a thread
+    adding a message only has to claim a slot, by moving the head on
+    with compare-and-swap (as in D. Vyukov's bounded queue).  */
+
+#include <stdio.h>    // for printf and vsnprintf
+#include <stdarg.h>   // for variable argument lists
+#include <time.h>     // for clock_gettime
+#ifdef _WIN32
+#include <windows.h>  // for thread, clock and Sleep functions
+#else
+#include <pthread.h>  // for thread functions
+#include <unistd.h>   // for usleep function
+#define Sleep(ms) usleep((ms) * 1000)  // same as Windows version
+#endif
+#include "logging.h"  // these functions
+
+#define LOG_RINGSIZE 256  // number of messages in ring, power of 2
+#define LOG_LINE 160      // max length of one message
+
+/* One slot in the ring buffer.  */
+typedef struct LogSlot
+{
+    atomic_uint seq;        // slot number when free, +1 when filled
+    char text[LOG_LINE];    // message
+} LogSlot;
+
+atomic_int logLevel = LOG_WARN;  // highest level to log, at run time
+
+static LogSlot ring[LOG_RINGSIZE];  // messages waiting to be printed
+static atomic_uint ringHead;    // next slot to fill, any thread
+static unsigned int ringTail;   // next slot to print, log thread only
+static atomic_int ringOn;       // 1 while the log thread is running
+static atomic_int ringDropped;  // messages dropped, as ring was full
+#ifdef _WIN32
+static HANDLE logThread;        // thread that prints messages
+#else
+static pthread_t logThread;     // thread that prints messages
+#endif
+
+//===================================================================
+/* Function to read the real clock, in ms, for the rate limit.
+   This is not PHY_time, as the limit is there to protect a real
+   console, and PHY_time may be virtual, or need a lock.  */
+static long long logTime(void)
+{
+#ifdef _WIN32
+    return (long long) GetTickCount64();
+#else
+    struct timespec t;  // seconds and nanoseconds
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (long long) t.tv_sec * 1000 + t.tv_nsec / 1000000;
+#endif
+}
+
+//===================================================================
+/* Function to add a message to the ring buffer.
+   Returns 0, or -1 if the ring is full.  */
+static int ringPut(const char *text)
+{
+    unsigned int pos = atomic_load(&ringHead);  // slot to try
+    LogSlot *slot;  // pointer to that slot
+    int diff;  // how far slot is from being free for this position
+
+    while (1)
+    {
+        slot = &ring[pos % LOG_RINGSIZE];
+        diff = (int) (atomic_load_explicit(&slot->seq, memory_order_acquire)
+                      - pos);
+        if (diff == 0)  // free - try to claim it
+        {
+            if (atomic_compare_exchange_weak(&ringHead, &pos, pos + 1))
+                break;  // claimed - pos is ours
+        }
+        else if (diff < 0) return -1;  // not yet printed - ring is full
+        else pos = atomic_load(&ringHead);  // another thread took it
+    }
+
+    snprintf(slot->text, LOG_LINE, "%s", text);
+    atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+    return 0;
+}
+
+//===================================================================
+/* Function to print all the messages in the ring buffer.
+   Only one thread may do this at a time.
+   Returns the number of messages printed.  */
+static int ringDrain(void)
+{
+    LogSlot *slot;  // slot to print
+    int n = 0;  // number printed
+
+    while (1)
+    {
+        slot = &ring[ringTail % LOG_RINGSIZE];
+        if (atomic_load_explicit(&slot->seq, memory_order_acquire)
+            != ringTail + 1) break;  // not filled yet - ring is empty
+        fputs(slot->text, stdout);
+        atomic_store_explicit(&slot->seq, ringTail + LOG_RINGSIZE,
+                              memory_order_release);  // free for next lap
+        ringTail++;
+        n++;
+    }
+    if (n > 0) fflush(stdout);
+    return n;
+}
+
+//===================================================================
+/* Function for the log thread - prints messages until stopped,
+   checking every 10 ms when there are none.
+   Argument: pointer to the flag that is cleared to stop it.  */
+#ifdef _WIN32
+static DWORD WINAPI logMain(void *arg)
+#else
+static void *logMain(void *arg)
+#endif
+{
+    atomic_int *on = arg;  // 1 while the thread is to keep running
+
+    while (atomic_load(on))
+        if (ringDrain() == 0) Sleep(10);
+    return 0;
+}
+
+//===================================================================
+/* Function to print or queue one message, if within the rate limit.
+   Arguments: rate limit state for this place, format and values
+              as for printf.  */
+void logPrint(LogSite *site, const char *format, ...)
+{
+    char text[LOG_LINE];  // message, formatted
+    long long now = logTime();  // time now, ms
+    long long period = (long long) (LOG_PERIOD * 1000.0);  // in ms
+    int nLeft;  // number of messages left out before this one
+    int len;  // length of message
+    va_list args;  // values to format
+
+    // Start a new period if this one is over, or count this message
+    if (now - atomic_load(&site->periodStart) >= period)
+    {
+        atomic_store(&site->periodStart, now);
+        atomic_store(&site->count, 1);
+    }
+    else if (atomic_fetch_add(&site->count, 1) >= LOG_BURST)
+    {
+        atomic_fetch_add(&site->suppressed, 1);  // over the limit
+        return;
+    }
+
+    va_start(args, format);
+    len = vsnprintf(text, LOG_LINE, format, args);
+    va_end(args);
+    if ((len < 0) || (len >= LOG_LINE)) len = LOG_LINE - 1;  // cut short
+
+    // Report messages left out, before the line end if there is one
+    nLeft = atomic_exchange(&site->suppressed, 0);
+    if (nLeft > 0)
+    {
+        if ((len > 0) && (text[len-1] == '\n')) len--;
+        snprintf(text + len, LOG_LINE - len, " (%d more like this)\n",
+                 nLeft);
+    }
+
+    if (!atomic_load(&ringOn)) fputs(text, stdout);  // print at once
+    else if (ringPut(text) < 0) atomic_fetch_add(&ringDropped, 1);
+}
+
+//===================================================================
+/* Function to set the highest level of message to log.
+   Argument: level, e.g. LOG_WARN, or 0 for none.  */
+void logSetLevel(int level)
+{
+    atomic_store(&logLevel, level);
+}
+
+//===================================================================
+/* Function to start a background thread to print messages.
+   Returns 0, or negative if the thread could not be started.  */
+int logStart(void)
+{
+    unsigned int i;  // for use in loop
+
+    if (atomic_load(&ringOn)) return 0;  // already running
+    for (i = 0; i < LOG_RINGSIZE; i++)
+        atomic_store(&ring[i].seq, ringTail + i);  // all slots free
+    atomic_store(&ringHead, ringTail);
+    atomic_store(&ringOn, 1);
+
+#ifdef _WIN32
+    logThread = CreateThread(NULL, 0, logMain, &ringOn, 0, NULL);
+    if (logThread == NULL)
+#else
+    if (pthread_create(&logThread, NULL, logMain, &ringOn) != 0)
+#endif
+    {
+        atomic_store(&ringOn, 0);
+        printf("LOG: Could not start log thread\n");
+        return -1;
+    }
+    return 0;
+}
+
+//===================================================================
+/* Function to print any messages still waiting, and stop the thread.
+   Messages logged after this are printed at once.  */
+void logStop(void)
+{
+    if (!atomic_load(&ringOn)) return;  // not running
+    atomic_store(&ringOn, 0);
+#ifdef _WIN32
+    WaitForSingleObject(logThread, INFINITE);
+    CloseHandle(logThread);
+#else
+    pthread_join(logThread, NULL);
+#endif
+    ringDrain();  // messages added while the thread was stopping
+    if (atomic_load(&ringDropped) > 0)
+        printf("LOG: %d messages dropped, as log buffer was full\n",
+               atomic_exchange(&ringDropped, 0));
+}
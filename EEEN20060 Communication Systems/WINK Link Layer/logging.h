@@ -0,0 +1,84 @@
+#ifndef LOGGING_H_INCLUDED
+#define LOGGING_H_INCLUDED
+
+/*  Logging functions, for messages from the link and physical layers.
+       LOG          macro to log a message at a given level
+       logEnabled   checks if a level would be logged, before doing
+                    work to prepare a message
+       logSetLevel  sets the highest level to log, while running
+       logStart     starts a thread to print messages, so the caller
+                    does not wait for a slow console
+       logStop      prints any messages left, and stops the thread
+    Messages above LOG_MAXLEVEL are removed by the compiler, so cost
+    nothing: compile with -DLOG_MAXLEVEL=LOG_ERROR for the fastest code.
+    Each place that logs a message is limited to LOG_BURST messages
+    in each LOG_PERIOD seconds - the number left out is reported with
+    the next message from that place.
+    Without logStart, messages are printed at once.  After logStart,
+    they go into a ring buffer, which needs no lock to add a message,
+    and a background thread prints them.  If the ring is full, the
+    message is counted and dropped, so the caller never waits.  */
+
+#include <stdatomic.h>  // for counters shared between threads
+
+// Levels of message, most important first
+#define LOG_ERROR 1     // the link or port has failed
+#define LOG_WARN 2      // something went wrong, and will be recovered
+#define LOG_INFO 3      // normal events, such as frame contents
+#define LOG_DEBUG 4     // details of every step
+
+#ifndef LOG_MAXLEVEL
+#define LOG_MAXLEVEL LOG_DEBUG  // highest level compiled in
+#endif
+
+#ifndef LOG_BURST
+#define LOG_BURST 5     // max messages from one place in each period
+#endif
+#ifndef LOG_PERIOD
+#define LOG_PERIOD 1.0  // period for rate limit, in seconds
+#endif
+
+/* Rate limit state for one place in the code that logs messages,
+   created by the LOG macro.  */
+typedef struct LogSite
+{
+    atomic_llong periodStart;   // time this period started, ms
+    atomic_int count;           // messages in this period
+    atomic_int suppressed;      // messages left out since last printed
+} LogSite;
+
+extern atomic_int logLevel;  // highest level to log, at run time
+
+/* Macro to log a message, with arguments as for printf.
+   The check on LOG_MAXLEVEL is done by the compiler.  */
+#define LOG(level, ...)                                                 \
+    do                                                                  \
+    {                                                                   \
+        static LogSite logSite_;  /* rate limit for this place */       \
+        if (((level) <= LOG_MAXLEVEL) && ((level) <= logLevel))         \
+            logPrint(&logSite_, __VA_ARGS__);                           \
+    } while (0)
+
+/* Macro to check if a level would be logged.  */
+#define logEnabled(level) \
+    (((level) <= LOG_MAXLEVEL) && ((level) <= logLevel))
+
+/* Function to print or queue one message, if within the rate limit.
+   Use the LOG macro, rather than calling this directly.
+   Arguments: rate limit state for this place, format and values
+              as for printf.  */
+void logPrint(LogSite *site, const char *format, ...);
+
+/* Function to set the highest level of message to log.
+   Argument: level, e.g. LOG_WARN, or 0 for none.  */
+void logSetLevel(int level);
+
+/* Function to start a background thread to print messages.
+   Returns 0, or negative if the thread could not be started.  */
+int logStart(void);
+
+/* Function to print any messages still waiting, and stop the thread.
+   Prints the number of messages dropped because the ring was full.  */
+void logStop(void);
+
+#endif // LOGGING_H_INCLUDED
@@ -0,0 +1,819 @@
+/*  Loopback Physical Layer functions, connecting pairs of ports.
+       PHY_open    connects the port to its partner: 1 with 2, 3 with 4...
+       PHY_close   disconnects the port
+       PHY_send    puts bytes on the line, and waits until they are sent
+       PHY_get     gets bytes that have arrived, adding random errors
+       PHY_sendAsync   puts bytes on the line, without waiting
+       PHY_sendPoll    waits until the line is idle, if asked
+       PHY_getWaiting  gets bytes that have arrived, without waiting
+       PHY_wait        waits until bytes have arrived
+       PHY_waitAny     waits until bytes have arrived at any of several
+       PHY_handle      gives no handle, as the clock is virtual
+       PHY_time        reads the virtual clock
+       PHY_share       lets a helper thread use a port as well
+       PHY_pause       says a thread waits for the other one using a port
+       PHY_setLatency  sets the one-way delay of the line from a port
+       PHY_setRate     changes the bit rate of an open port
+       PHY_expectPorts holds the clock until more ports are opened
+    Each direction has its own buffer, in the receiving port, so both
+    ends can send at the same time, as on a real full-duplex line.
+    Every byte is stamped with the time it will arrive: it waits for
+    the bytes already on the line, takes the byte time given by the
+    bit rate to send, then takes the latency to reach the other end.
+    This runs in virtual time.  The clock only moves when every thread
+    using a loop port is waiting in this layer - it then jumps to the
+    next arrival or time limit, so no real time is spent waiting.
+    A thread is using a port from the last time it called one of
+    these functions with that port, so ports can be opened by one
+    thread and handed to others.  A thread that waits for anything
+    else, while other threads wait here for it, stops the clock.
+    A helper, such as a receive thread, uses the port as well after
+    PHY_share(), so the clock waits for both.  Either can say, with
+    PHY_pause(), that it waits for the other, as for a lock, and it
+    then counts as waiting.  The receive thread in rxthread.c uses
+    these, through LL_setRxHooks().
+    All functions print explanatory messages if there is
+    a problem, and return values to indicate failure.  */
+
+#include <stdio.h>   // needed for printf
+#include <stdlib.h>  // for calloc and free
+#include <limits.h>  // for LLONG_MAX
+#ifdef _WIN32
+#include <windows.h>    // for locks and condition variables
+typedef DWORD ThreadId;  // identifies a thread
+static SRWLOCK simLock = SRWLOCK_INIT;  // protects all shared state
+static CONDITION_VARIABLE simCond = CONDITION_VARIABLE_INIT;  // for waits
+#define LOCK()    AcquireSRWLockExclusive(&simLock)
+#define UNLOCK()  ReleaseSRWLockExclusive(&simLock)
+#define SLEEP()   SleepConditionVariableSRW(&simCond, &simLock, INFINITE, 0)
+#define WAKE()    WakeAllConditionVariable(&simCond)
+#define THIS_THREAD()  GetCurrentThreadId()
+#define SAME_THREAD(a, b)  ((a) == (b))
+#else
+#include <pthread.h>    // for locks and condition variables
+typedef unsigned char byte;  // defined by windows.h on Windows
+typedef pthread_t ThreadId;  // identifies a thread
+static pthread_mutex_t simLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t simCond = PTHREAD_COND_INITIALIZER;
+#define LOCK()    pthread_mutex_lock(&simLock)
+#define UNLOCK()  pthread_mutex_unlock(&simLock)
+#define SLEEP()   pthread_cond_wait(&simCond, &simLock)
+#define WAKE()    pthread_cond_broadcast(&simCond)
+#define THIS_THREAD()  pthread_self()
+#define SAME_THREAD(a, b)  pthread_equal(a, b)
+#endif
+#include "physical.h"       // header file for these functions
+#include "loop-physical.h"  // functions only in this version
+#include "channel.h"        // for simulated errors
+#include "logging.h"        // for messages that could come often
+
+#define LOOP_BUFSIZE 65536  // bytes on the line or waiting, per direction
+#define LOOP_MAXPORTS 16    // max number of ports open at once
+#define FOREVER LLONG_MAX   // time limit that is never reached
+
+/* State of one port, with one copy for each port in use.
+   Times are virtual, in nanoseconds, so byte times are exact.  */
+struct PHY_context
+{
+    int portNum;            // port number, 0 if not open
+    byte buffer[LOOP_BUFSIZE];          // bytes sent to this port
+    long long arrival[LOOP_BUFSIZE];    // time each byte arrives
+    int sentRate[LOOP_BUFSIZE];         // byte time it was sent with
+    int head;               // position of oldest byte in buffer
+    int count;              // number of bytes in buffer
+    long long byteTime;     // time to send one byte from this port
+    long long oldByteTime;  // byte time before the last change
+    long long rateFrom;     // time the byte time last changed
+    int byteBits;           // bits on the line for each byte
+    long long latency;      // time to reach the other end
+    long long lineFree;     // time the line from this port is idle
+    int rxTimeLimit;        // time limit for PHY_get() in ms, 0 for none
+    ErrChannel rxChan;      // simulated errors, for PHY_get()
+    ErrChannel junkChan;    // rubbish for bytes sent at another rate
+    ThreadId user;          // thread that last used this port
+    ThreadId helper;        // thread sharing it, if shared
+    int shared;             // 1 if the helper is using it too
+    int userPaused;         // 1 while the user waits for the helper
+    int helperPaused;       // 1 while the helper waits for the user
+    void (*sendCallback)(void *arg, byte *dataTx, int nBytesSent);
+    void *sendArg;          // argument to pass to sendCallback
+};
+
+/* Shared by all ports - only used while holding simLock.  */
+static long long simNow = 0;                // virtual time now
+static PHY_context *ports[LOOP_MAXPORTS];   // ports open
+static struct
+{
+    ThreadId thread;        // thread that is waiting
+    PHY_context **phys;     // ports it waits for bytes on
+    int nPhys;              // number of them, 0 if waiting for time only
+    long long until;        // time limit for the wait
+} waiters[LOOP_MAXPORTS];   // threads waiting in this layer
+static int nWaiters = 0;    // number of threads waiting
+static int nExpected = 0;   // ports to be opened before the clock moves
+
+//===================================================================
+/* Function to find the other end of the line from a port.
+   Returns pointer to its state, or NULL if it is not open.  */
+static PHY_context *partner(PHY_context *phy)
+{
+    int other = ((phy->portNum - 1) ^ 1) + 1;  // 1 with 2, 3 with 4...
+    int i;  // for use in loop
+
+    for (i = 0; i < LOOP_MAXPORTS; i++)
+        if ((ports[i] != NULL) && (ports[i]->portNum == other))
+            return ports[i];
+    return NULL;
+}
+
+//===================================================================
+/* Function to count the bytes that have arrived at a port by now.  */
+static int nArrived(PHY_context *phy)
+{
+    int n = 0;  // number of bytes found
+
+    while ((n < phy->count)
+           && (phy->arrival[(phy->head + n) % LOOP_BUFSIZE] <= simNow))
+        n++;
+    return n;
+}
+
+//===================================================================
+/* Function to note the thread calling a function with a port as its
+   user, unless it is the port's helper, while holding simLock.  */
+static void setUser(PHY_context *phy)
+{
+    ThreadId self = THIS_THREAD();  // this thread
+
+    if (!phy->shared || !SAME_THREAD(phy->helper, self)) phy->user = self;
+}
+
+//===================================================================
+/* Function to check if a thread is waiting in this layer.
+   Returns 1 if so, 0 if not.  */
+static int isWaiting(ThreadId thread)
+{
+    int w;  // for use in loop
+
+    for (w = 0; w < nWaiters; w++)
+        if (SAME_THREAD(waiters[w].thread, thread)) return 1;
+    return 0;
+}
+
+//===================================================================
+/* Function to check if every thread using an open port is waiting,
+   here or for the other thread using the same port - though not both
+   for each other, as one of them must be running.
+   Returns 1 if so, 0 if any thread might still do something.  */
+static int allWaiting(void)
+{
+    PHY_context *phy;  // port to check
+    int i;  // for use in loop
+
+    for (i = 0; i < LOOP_MAXPORTS; i++)
+    {
+        phy = ports[i];
+        if (phy == NULL) continue;
+        if (!(phy->shared && phy->userPaused) && !isWaiting(phy->user))
+            return 0;  // user of this port is running
+        if (phy->shared && !phy->helperPaused && !isWaiting(phy->helper))
+            return 0;  // so is its helper
+        if (phy->shared && phy->userPaused && phy->helperPaused)
+            return 0;  // one has just got the lock, and has yet to say so
+    }
+    return 1;
+}
+
+//===================================================================
+/* Function to move the clock to the next thing a waiting thread
+   is waiting for - a byte arriving or a time limit.
+   Returns 1 if the clock moved, 0 if not.  */
+static int advanceClock(void)
+{
+    long long next = FOREVER;  // time of next event
+    long long t;  // time of event for one waiting thread
+    PHY_context *phy;  // port a thread is waiting on
+    int w, i;  // for use in loops
+
+    for (w = 0; w < nWaiters; w++)
+    {
+        t = waiters[w].until;
+        for (i = 0; i < waiters[w].nPhys; i++)
+        {
+            phy = waiters[w].phys[i];
+            if ((phy->count > 0) && (phy->arrival[phy->head] < t))
+                t = phy->arrival[phy->head];  // next byte comes sooner
+        }
+        if (t < next) next = t;
+    }
+    if ((next == FOREVER) || (next <= simNow)) return 0;
+    simNow = next;
+    WAKE();  // let every waiting thread check its own condition
+    return 1;
+}
+
+//===================================================================
+/* Function to check if bytes have arrived at any of a list of ports.
+   Returns the number of ports with bytes, each marked in ready[].  */
+static int anyArrived(PHY_context **phys, int nPhys, int *ready)
+{
+    int nReady = 0;  // number of ports with bytes
+    int i;  // for use in loop
+
+    for (i = 0; i < nPhys; i++)
+    {
+        ready[i] = (phys[i]->portNum != 0) && (nArrived(phys[i]) > 0);
+        nReady += ready[i];
+    }
+    return nReady;
+}
+
+//===================================================================
+/* Function to wait in virtual time, while holding simLock, until
+   bytes arrive at any of a list of ports, or a time limit.
+   Arguments: array of port states; number of ports, 0 to wait for
+              the time only; array to mark ports with bytes; time limit.
+   Returns number of ports with bytes, 0 if time limit reached.  */
+static int waitList(PHY_context **phys, int nPhys, int *ready,
+                    long long until)
+{
+    ThreadId self = THIS_THREAD();  // this thread
+    int w;  // position in list of waiting threads
+    int retVal;  // value to return
+
+    for (w = 0; w < nWaiters; w++)  // a thread waits once at a time
+        if (SAME_THREAD(waiters[w].thread, self)) break;
+    if (w == LOOP_MAXPORTS)
+    {
+        printf("PHY LOOP: Too many threads waiting\n");
+        return -8;
+    }
+    if (w == nWaiters) nWaiters++;
+    waiters[w].thread = self;
+    waiters[w].phys = phys;
+    waiters[w].nPhys = nPhys;
+    waiters[w].until = until;
+
+    while (1)
+    {
+        retVal = anyArrived(phys, nPhys, ready);
+        if (retVal > 0) break;
+        if (simNow >= until) break;
+        if ((nExpected > 0) || !allWaiting() || !advanceClock()) SLEEP();
+    }
+
+    // Take this thread off the list, moving the last one into its place
+    for (w = 0; w < nWaiters; w++)
+        if (SAME_THREAD(waiters[w].thread, self)) break;
+    waiters[w] = waiters[--nWaiters];
+    return retVal;
+}
+
+//===================================================================
+/* Function to wait in virtual time, while holding simLock.
+   Arguments: port state; time limit; 1 to stop when bytes arrive.
+   Returns 1 if bytes have arrived, 0 if time limit reached.  */
+static int waitUntil(PHY_context *phy, long long until, int forBytes)
+{
+    int ready;  // 1 if bytes have arrived
+
+    return waitList(&phy, forBytes ? 1 : 0, &ready, until);
+}
+
+//===================================================================
+/* Function to put bytes on the line to the partner port, while
+   holding simLock.  If the partner is not open, the bytes are lost,
+   as on a line with nothing connected - but while the clock is held
+   for ports still to be opened, this first waits for the partner, as
+   no time can pass before then, so it does not matter which end's
+   thread runs first.
+   Arguments: port state; pointer to bytes; number of bytes.  */
+static void putBytes(PHY_context *phy, byte *dataTx, int nBytes)
+{
+    PHY_context *other;  // port at other end
+    long long t;  // time the line is free
+    int nLost = 0;  // number of bytes that did not fit
+    int i, pos;  // position in data and in buffer
+
+    while ((nExpected > 0) && (partner(phy) == NULL)) SLEEP();
+    other = partner(phy);
+    t = (phy->lineFree > simNow) ? phy->lineFree : simNow;
+
+    for (i = 0; i < nBytes; i++)
+    {
+        t += phy->byteTime;  // time this byte has been sent
+        if (other == NULL) continue;  // nothing there to receive it
+        if (other->count == LOOP_BUFSIZE)  // receiver is not keeping up
+        {
+            nLost++;
+            continue;
+        }
+        pos = (other->head + other->count) % LOOP_BUFSIZE;
+        other->buffer[pos] = dataTx[i];
+        other->arrival[pos] = t + phy->latency;
+        other->sentRate[pos] = (int) phy->byteTime;
+        other->count++;
+    }
+    phy->lineFree = t;
+
+    if (nLost > 0)
+        LOG(LOG_WARN, "PHY LOOP: Port %d buffer full, %d bytes lost\n",
+            other->portNum, nLost);
+    if (other != NULL) WAKE();  // in case the partner waits for these
+}
+
+//===================================================================
+/* Function to take the bytes that have arrived at a port, up to a
+   limit, and add errors, while holding simLock.  A byte sent at a
+   bit rate other than the one this port had when it arrived is
+   rubbish - checked here, not when sent, so it does not matter which
+   end's thread changed its rate first, at the same virtual time.
+   Arguments: port state; array for bytes; max number of bytes.
+   Returns number of bytes taken.  */
+static int takeBytes(PHY_context *phy, byte *dataRx, int nBytesToGet)
+{
+    int nBytesGot = nArrived(phy);  // bytes to take
+    long long rate;  // byte time of this port when a byte arrived
+    int i;  // for use in loop
+
+    if (nBytesGot > nBytesToGet) nBytesGot = nBytesToGet;
+    for (i = 0; i < nBytesGot; i++)
+    {
+        rate = (phy->arrival[phy->head] >= phy->rateFrom) ? phy->byteTime
+                                                          : phy->oldByteTime;
+        if (phy->sentRate[phy->head] != rate)  // rubbish at wrong rate
+            dataRx[i] = (byte) chanRandom(&phy->junkChan);
+        else dataRx[i] = phy->buffer[phy->head];
+        phy->head = (phy->head + 1) % LOOP_BUFSIZE;
+    }
+    phy->count -= nBytesGot;
+    chanApply(&phy->rxChan, dataRx, nBytesGot);
+    return nBytesGot;
+}
+
+//===================================================================
+/* PHY_create function, to create the state for one port.
+   Returns pointer to the state, or NULL if no memory.  */
+PHY_context *PHY_create(void)
+{
+    PHY_context *phy = calloc(1, sizeof(PHY_context));  // all zero
+    if (phy == NULL) printf("PHY LOOP: No memory for port state\n");
+    return phy;
+}
+
+//===================================================================
+/* PHY_destroy function, to free the state for one port.
+   Closes the port if still open.  Argument: port state, may be NULL.  */
+void PHY_destroy(PHY_context *phy)
+{
+    if ((phy != NULL) && (phy->portNum != 0)) PHY_close(phy);
+    free(phy);
+}
+
+//===================================================================
+/* PHY_open function - connects the port to its partner.
+   Arguments are port state, port number, bit rate, number of data bits,
+   parity, receive timeout constant, rx timeout interval,
+   rx probability of error.
+   Ports 1 and 2 are connected, 3 and 4, and so on.  The receive
+   time limit is the sum of the timeouts, as in sim-physical.c.
+   Returns zero if it succeeds - anything non-zero is a problem.*/
+int PHY_open(PHY_context *phy, // port state, from PHY_create
+             int portNum,       // port number: 1 to LOOP_MAXPORTS
+             int bitRate,       // bit rate: e.g. 1200, 4800, etc.
+             int nDataBits,     // number of data bits: 7 or 8
+             int parity,        // parity: 0 = none, 1 = odd, 2 = even
+             int rxTimeConst,   // rx timeout constant in ms: 0 waits forever
+             int rxTimeIntv,    // rx timeout interval in ms: 0 waits forever
+             double probErr)    // rx probability of error: 0.0 for none
+{
+    int i, slot = -1;  // for use in loop, and free place in list
+
+    if ((portNum < 1) || (portNum > LOOP_MAXPORTS))
+    {
+        printf("PHY LOOP: Invalid port number %d\n", portNum);
+        return -1;
+    }
+    if (bitRate < 0)
+    {
+        printf("PHY LOOP: Invalid bit rate %d\n", bitRate);
+        return -1;
+    }
+
+    LOCK();
+    for (i = 0; i < LOOP_MAXPORTS; i++)
+    {
+        if (ports[i] == NULL) slot = i;
+        else if (ports[i]->portNum == portNum)
+        {
+            UNLOCK();
+            printf("PHY LOOP: Port %d already open\n", portNum);
+            return -2;
+        }
+    }
+
+    // Find the time to send each byte: start bit, data bits,
+    // parity bit if used, and one stop bit
+    phy->byteBits = 2 + nDataBits + (parity != 0);
+    if (bitRate > 0) phy->byteTime = phy->byteBits * 1000000000LL / bitRate;
+    else phy->byteTime = 0;  // no delay
+    phy->oldByteTime = phy->byteTime;
+    phy->rateFrom = simNow;
+
+    phy->portNum = portNum;
+    phy->head = 0;
+    phy->count = 0;
+    phy->lineFree = simNow;
+    phy->rxTimeLimit = rxTimeConst + rxTimeIntv;
+    phy->shared = 0;
+    phy->userPaused = 0;
+    phy->helperPaused = 0;
+    phy->user = THIS_THREAD();
+    chanInit(&phy->rxChan, probErr);  // seeded from the time
+    chanInit(&phy->junkChan, 0.0);
+    chanSeed(&phy->junkChan, portNum);  // same rubbish every run
+    ports[slot] = phy;  // there is always room, as port numbers differ
+    if (nExpected > 0)
+    {
+        nExpected--;
+        WAKE();  // clock can move again, or a partner is now open
+    }
+    UNLOCK();
+    return 0;
+}
+
+//===================================================================
+/* PHY_close function, to disconnect the port.
+   Bytes on the way to it are lost.
+   Argument: port state.  Returns 0 always.  */
+int PHY_close(PHY_context *phy)
+{
+    int i;  // for use in loop
+
+    LOCK();
+    if (phy->rxChan.nErrors > 0)
+        printf("PHY LOOP: Port %d had %ld bits changed by simulated errors\n",
+               phy->portNum, phy->rxChan.nErrors);
+    for (i = 0; i < LOOP_MAXPORTS; i++)
+        if (ports[i] == phy) ports[i] = NULL;
+    phy->portNum = 0;
+    phy->count = 0;
+    WAKE();  // others may now be the only threads using ports
+    UNLOCK();
+    return 0;
+}
+
+//===================================================================
+/* PHY_send function, to send bytes.
+   Returns when the last byte has left, in virtual time.
+   Arguments: port state; pointer to array holding bytes to be sent;
+              number of bytes to send.
+   Returns number of bytes sent, or negative value on error.  */
+int PHY_send(PHY_context *phy, byte *dataTx, int nBytesToSend)
+{
+    int retVal;  // return value from wait
+
+    LOCK();
+    if (phy->portNum == 0)
+    {
+        UNLOCK();
+        printf("PHY LOOP: Port not open\n");
+        return -9;
+    }
+    setUser(phy);
+    putBytes(phy, dataTx, nBytesToSend);
+    retVal = waitUntil(phy, phy->lineFree, 0);
+    UNLOCK();
+    if (retVal < 0) return retVal;
+    return nBytesToSend;
+}
+
+//===================================================================
+/* PHY_sendAsync function, to start sending bytes.
+   The bytes are copied to the other end at once, stamped with their
+   arrival times, so the send callback, if set, is called here.
+   Arguments: port state; pointer to array holding bytes to be sent;
+              number of bytes to send.
+   Returns number of bytes sent, or negative value on error.  */
+int PHY_sendAsync(PHY_context *phy, byte *dataTx, int nBytesToSend)
+{
+    LOCK();
+    if (phy->portNum == 0)
+    {
+        UNLOCK();
+        printf("PHY LOOP: Port not open\n");
+        return -9;
+    }
+    setUser(phy);
+    putBytes(phy, dataTx, nBytesToSend);
+    UNLOCK();
+
+    if (phy->sendCallback != NULL)
+        phy->sendCallback(phy->sendArg, dataTx, nBytesToSend);
+    return nBytesToSend;
+}
+
+//===================================================================
+/* PHY_sendPoll function, to check sends started by PHY_sendAsync.
+   The bytes are given to the other end at once, so there are never
+   any sends in progress, but this can wait until the line is idle.
+   Arguments: port state; 1 to wait, 0 to just check.
+   Returns 0, or negative value on error.  */
+int PHY_sendPoll(PHY_context *phy, int wait)
+{
+    int retVal = 0;  // return value from wait
+
+    LOCK();
+    setUser(phy);
+    if (wait) retVal = waitUntil(phy, phy->lineFree, 0);
+    UNLOCK();
+    return (retVal < 0) ? retVal : 0;
+}
+
+//===================================================================
+/* PHY_setSendCallback function, to set a function to be called
+   when a send is complete.
+   Arguments: port state; pointer to function, or NULL for none;
+              pointer to pass to the function.  */
+void PHY_setSendCallback(PHY_context *phy,
+                         void (*callback)(void *arg, byte *dataTx,
+                                          int nBytesSent),
+                         void *arg)
+{
+    phy->sendCallback = callback;
+    phy->sendArg = arg;
+}
+
+//===================================================================
+/* PHY_get function, to get received bytes.
+   Waits up to the receive time limit for the first byte, then
+   gets the bytes that have arrived, adding random errors.
+   Arguments: port state; pointer to array to hold received bytes;
+              maximum number of bytes to get.
+   Returns number of bytes actually got, or negative value on error.  */
+int PHY_get(PHY_context *phy, byte *dataRx, int nBytesToGet)
+{
+    int nBytesGot;      // number of bytes that have arrived
+    int retVal;         // return value from wait
+
+    LOCK();
+    if (phy->portNum == 0)
+    {
+        UNLOCK();
+        printf("PHY LOOP: Port not open\n");
+        return -9;
+    }
+    setUser(phy);
+
+    nBytesGot = nArrived(phy);
+    if (nBytesGot == 0)  // wait for the first byte
+    {
+        retVal = waitUntil(phy, (phy->rxTimeLimit == 0) ? FOREVER :
+                           simNow + phy->rxTimeLimit * 1000000LL, 1);
+        if (retVal < 0)
+        {
+            UNLOCK();
+            return retVal;
+        }
+    }
+    nBytesGot = takeBytes(phy, dataRx, nBytesToGet);
+    UNLOCK();
+    return nBytesGot;
+}
+
+//===================================================================
+/* PHY_getWaiting function, to get the bytes that have arrived,
+   without waiting for more, adding random errors.
+   Arguments: port state; pointer to array to hold received bytes;
+              maximum number of bytes to get.
+   Returns number of bytes got, 0 if none have arrived, or negative
+   value on error.  */
+int PHY_getWaiting(PHY_context *phy, byte *dataRx, int nBytesToGet)
+{
+    int nBytesGot;      // number of bytes actually got
+
+    LOCK();
+    if (phy->portNum == 0)
+    {
+        UNLOCK();
+        printf("PHY LOOP: Port not open\n");
+        return -9;
+    }
+    setUser(phy);
+    nBytesGot = takeBytes(phy, dataRx, nBytesToGet);
+    UNLOCK();
+    return nBytesGot;
+}
+
+//===================================================================
+/* PHY_wait function, to wait until received bytes are available.
+   Arguments: port state; max time to wait in ms, 0 to just check.
+   Returns 1 if bytes are available, 0 if time limit reached,
+   or negative value on error.  */
+int PHY_wait(PHY_context *phy, int timeLimit)
+{
+    int retVal;  // value to return
+
+    LOCK();
+    if (phy->portNum == 0)
+    {
+        UNLOCK();
+        printf("PHY LOOP: Port not open\n");
+        return -9;
+    }
+    setUser(phy);
+    if (nArrived(phy) > 0) retVal = 1;  // bytes available
+    else if (timeLimit <= 0) retVal = 0;  // just checking
+    else retVal = waitUntil(phy, simNow + timeLimit * 1000000LL, 1);
+    UNLOCK();
+    return retVal;
+}
+
+//===================================================================
+/* PHY_waitAny function, to wait until received bytes are available
+   on any of a list of ports.  The thread counts as waiting, so the
+   clock can move, as in PHY_wait().
+   Arguments: array of port states; number of ports; array set to 1
+              for each port with bytes available, 0 for the others;
+              max time to wait in ms, 0 to just check, -1 for no limit.
+   Returns number of ports with bytes available, 0 if time limit
+   reached, or negative value on error.  */
+int PHY_waitAny(PHY_context **phys, int nPorts, int *ready, int timeLimit)
+{
+    int retVal;  // value to return
+    int i;  // for use in loop
+
+    if ((nPorts < 1) || (nPorts > PHY_MAXWAIT))
+    {
+        printf("PHY LOOP: Cannot wait on %d ports\n", nPorts);
+        return -8;
+    }
+    LOCK();
+    for (i = 0; i < nPorts; i++)
+    {
+        if (phys[i]->portNum == 0)
+        {
+            UNLOCK();
+            printf("PHY LOOP: Port not open\n");
+            return -9;
+        }
+        setUser(phys[i]);
+    }
+    retVal = anyArrived(phys, nPorts, ready);
+    if ((retVal == 0) && (timeLimit != 0))
+        retVal = waitList(phys, nPorts, ready, (timeLimit < 0) ? FOREVER :
+                          simNow + timeLimit * 1000000LL);
+    UNLOCK();
+    return retVal;
+}
+
+//===================================================================
+/* PHY_handle function, to give a handle the operating system can
+   wait on.  The loopback runs in virtual time, so there is none -
+   use PHY_waitAny() instead.
+   Returns -1 always.  */
+int PHY_handle(PHY_context *phy)
+{
+    int portNum;  // port number, 0 if not open
+
+    LOCK();
+    portNum = phy->portNum;
+    UNLOCK();
+    if (portNum == 0) printf("PHY LOOP: Port not open\n");
+    return -1;
+}
+
+//===================================================================
+/* PHY_time function, to read the clock used by this layer.
+   Returns virtual time in microseconds.  */
+long long PHY_time(void)
+{
+    long long now;  // virtual time in ns
+
+    LOCK();
+    now = simNow;
+    UNLOCK();
+    return now / 1000;
+}
+
+//===================================================================
+/* PHY_share function, for a helper thread to use a port as well.
+   While it does, the clock only moves when both threads are waiting.
+   When it stops, the user no longer waits for it.
+   Arguments: port state; 1 to start sharing, 0 to stop.  */
+void PHY_share(PHY_context *phy, int on)
+{
+    LOCK();
+    phy->helper = THIS_THREAD();
+    phy->shared = on;
+    phy->helperPaused = 0;
+    phy->userPaused = 0;
+    WAKE();  // the clock may move now, or must wait for the helper
+    UNLOCK();
+}
+
+//===================================================================
+/* PHY_pause function, for the user or helper of a port to say that it
+   waits for the other, and does nothing with the port meanwhile.
+   This only counts while the port is shared, as the helper may have
+   stopped just before.
+   Arguments: port state; 1 when starting to wait, 0 when done.  */
+void PHY_pause(PHY_context *phy, int on)
+{
+    LOCK();
+    if (!phy->shared)
+        on = 0;  // nobody to wait for
+    if (phy->shared && SAME_THREAD(phy->helper, THIS_THREAD()))
+        phy->helperPaused = on;
+    else
+    {
+        setUser(phy);
+        phy->userPaused = on;
+    }
+    if (on) WAKE();  // this thread now counts as waiting
+    UNLOCK();
+}
+
+//===================================================================
+/* PHY_setLatency function, to set the one-way delay of the line
+   from a port to its partner.  Applies to bytes sent after this.
+   Arguments: port state; delay in microseconds.
+   Returns 0, or negative if the delay is not valid.  */
+int PHY_setLatency(PHY_context *phy, long latency)
+{
+    if (latency < 0)
+    {
+        printf("PHY LOOP: Invalid latency %ld us\n", latency);
+        return -1;
+    }
+    LOCK();
+    phy->latency = latency * 1000LL;
+    UNLOCK();
+    return 0;
+}
+
+//===================================================================
+/* PHY_setRate function, to change the bit rate of an open port.
+   Bytes already on the line keep their arrival times.
+   Arguments: port state; new bit rate, 0 for no delay.
+   Returns zero if it succeeds - anything non-zero is a problem.*/
+int PHY_setRate(PHY_context *phy, int bitRate)
+{
+    if (bitRate < 0)
+    {
+        printf("PHY LOOP: Invalid bit rate %d\n", bitRate);
+        return -1;
+    }
+    LOCK();
+    phy->oldByteTime = phy->byteTime;  // for bytes that arrived before
+    phy->rateFrom = simNow;
+    if (bitRate > 0) phy->byteTime = phy->byteBits * 1000000000LL / bitRate;
+    else phy->byteTime = 0;  // no delay
+    UNLOCK();
+    return 0;
+}
+
+//===================================================================
+/* PHY_expectPorts function, to hold the virtual clock until more
+   ports have been opened.
+   Argument: number of ports to wait for.  */
+void PHY_expectPorts(int nPorts)
+{
+    LOCK();
+    nExpected = (nPorts > 0) ? nPorts : 0;
+    if (nExpected == 0) WAKE();
+    UNLOCK();
+}
+
+//===================================================================
+/* PHY_setSeed function, to make the simulated errors repeatable.
+   Arguments: port state; seed, 0 to seed from the time.  */
+void PHY_setSeed(PHY_context *phy, unsigned long seed)
+{
+    LOCK();
+    chanSeed(&phy->rxChan, seed);
+    UNLOCK();
+}
+
+//===================================================================
+/* PHY_setBurst function, to simulate bursts of errors.
+   Arguments: port state; probability per bit of a burst starting,
+              and of it ending; probability of bit error in a burst.
+   Returns 0, or negative if any probability is not valid.  */
+int PHY_setBurst(PHY_context *phy, double probStart, double probEnd,
+                 double probErrBurst)
+{
+    int retVal;  // value to return
+
+    LOCK();
+    retVal = chanBurst(&phy->rxChan, probStart, probEnd, probErrBurst);
+    UNLOCK();
+    return retVal;
+}
+
+/* Function to print informative error messages
+   when something goes wrong...  - does nothing here*/
+void printError(void)
+{
+
+}
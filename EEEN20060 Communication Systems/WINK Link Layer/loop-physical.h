@@ -0,0 +1,33 @@
+#ifndef LOOP_PHYSICAL_H_INCLUDED
+#define LOOP_PHYSICAL_H_INCLUDED
+
+/*  Extra functions for the loopback physical layer (loop-physical.c),
+    which connects pairs of ports in one program: 1 with 2, 3 with 4...
+    The other functions are as in physical.h.  */
+
+/* PHY_setLatency function, to set the one-way delay of the line
+   from a port to its partner.  Applies to bytes sent after this.
+   Arguments: port state; delay in microseconds.
+   Returns 0, or negative if the delay is not valid.  */
+int PHY_setLatency(PHY_context *phy, long latency);
+
+/* PHY_expectPorts function, to hold the virtual clock until more
+   ports have been opened.  A thread that opens a port and then waits
+   for the other end, as LL_connect() does, could otherwise time out
+   in virtual time before the thread for the other end has started.
+   Argument: number of ports to wait for, 0 to stop holding.  */
+void PHY_expectPorts(int nPorts);
+
+/* PHY_share function, for a helper thread, such as a receive thread,
+   to use an open port as well as the thread using it.  While it does,
+   the clock only moves when both threads are waiting.
+   Arguments: port state; 1 to start sharing, 0 to stop.  */
+void PHY_share(PHY_context *phy, int on);
+
+/* PHY_pause function, for a thread using a shared port to say that it
+   waits for the other thread, as for a lock, and does nothing with the
+   port meanwhile - it then counts as waiting.
+   Arguments: port state; 1 when starting to wait, 0 when done.  */
+void PHY_pause(PHY_context *phy, int on);
+
+#endif // LOOP_PHYSICAL_H_INCLUDED
@@ -0,0 +1,339 @@
+/* EEEN20060 Communication Systems, full-duplex link layer test
+   This program connects two links through the loopback physical
+   layer (loop-physical.c), on ports 1 and 2.  One thread sends
+   blocks on link A while another receives them on link B, so a
+   window of frames can be on the line while acknowledgements come
+   back, as with two real computers.  It is repeated for a range of
+   window sizes.  The loopback runs in virtual time, so each transfer
+   takes only as long as the processing, but the times shown are
+   the times the transfer would take on the line.
+   Optional arguments: number of blocks, one-way latency in ms,
+   fastest bit rate, probability of bit error, seed for the simulated errors
+   (0 to use the time), probability per bit of a burst of errors,
+   block size - above BASE_BLK, the two ends agree larger frames, or
+   0 to send the same amount of data in blocks of the size suggested
+   by the link layer, as it adapts to the errors, parity bytes per
+   codeword for error correction, asked for by the sending end,
+   bytes to give to each call of LL_sendv(), in two pieces, or 0 to
+   send each block with LL_send() - the link layer then cuts the
+   blocks, so the block size must be 0.  */
+
+typedef unsigned char byte;
+
+#include <stdio.h>  // standard input-output library
+#include <stdlib.h>  // for atoi, atof and strtoul
+#include <time.h>  // for clock, to measure processor time
+#ifdef _WIN32
+#include <windows.h>  // for thread functions
+#define THREAD_RESULT DWORD WINAPI  // type of thread function
+#else
+#include <pthread.h>  // for thread functions
+#define THREAD_RESULT void *  // type of thread function
+#endif
+#include "linklayer.h"  // link layer functions
+#include "physical.h"  // physical layer functions
+#include "loop-physical.h"  // to set the latency
+
+#define BLOCK_SIZE 200  // default data bytes in each block
+#define TEST_BLOCKS 1000  // default number of blocks to send
+#define TEST_LATENCY 20  // default one-way latency, ms
+#define TEST_RATE 9600  // default bit rate, bit/s
+#define TEST_SEED 1  // default seed for simulated errors
+#define MAX_BATCH 65536  // most bytes given to LL_sendv at once
+#define BURST_END 1.0/64  // probability per bit of a burst ending
+#define BURST_ERR 0.25  // probability of bit error in a burst
+
+/* Settings and results for one transfer, shared by the two threads */
+typedef struct LoopTest
+{
+    int nBlocks;        // number of blocks to send
+    int blockSize;      // data bytes in each block, 0 for adaptive
+    long nBytes;        // data bytes to send
+    long gotBytes;      // data bytes received
+    int lastBlock;      // block size suggested at the end
+    long latency;       // one-way latency, us
+    int bitRate;        // bit rate, bit/s
+    double probErr;     // probability of bit error
+    unsigned long seed; // seed for simulated errors, 0 for time
+    double probBurst;   // probability per bit of a burst starting
+    int window;         // window size
+    int fecParity;      // parity bytes per codeword, 0 for none
+    int batch;          // bytes for each LL_sendv, 0 to use LL_send
+    volatile int sendDone;  // set when the sender has finished
+    int sendResult;     // 0 if all blocks were sent, negative otherwise
+    int nGot, nBad;     // blocks received, and received wrong
+    int nResent;        // frames re-sent by the sender
+    long nFixed;        // bytes corrected by the receiver
+    long long startTime;    // simulated time sending started, us
+    long long endTime;      // simulated time last block arrived, us
+    LL_context *linkA;  // sending end, port 1
+    LL_context *linkB;  // receiving end, port 2
+} LoopTest;
+
+// Function prototypes
+THREAD_RESULT sender(void *arg);
+THREAD_RESULT receiver(void *arg);
+int runTest(LoopTest *test);
+int setupLink(LoopTest *test, LL_context *link, unsigned long seed);
+void fillBlock(byte *block, int nByte, long offset);
+
+
+int main(int argc, char *argv[])
+{
+    static const int windows[] = {1, 2, 4, 8};  // window sizes to try
+    int nWindows = sizeof(windows) / sizeof(windows[0]);
+    LoopTest test;  // settings and results
+    double seconds;  // simulated time for transfer
+    clock_t cpuStart;  // processor time at start
+    int w, failed = 0;  // for use in loop, and count of failures
+
+    test.nBlocks = (argc > 1) ? atoi(argv[1]) : TEST_BLOCKS;
+    test.latency = 1000L * ((argc > 2) ? atoi(argv[2]) : TEST_LATENCY);
+    test.bitRate = (argc > 3) ? atoi(argv[3]) : TEST_RATE;
+    test.probErr = (argc > 4) ? atof(argv[4]) : 0.0;
+    test.seed = (argc > 5) ? strtoul(argv[5], NULL, 10) : TEST_SEED;
+    test.probBurst = (argc > 6) ? atof(argv[6]) : 0.0;
+    test.blockSize = (argc > 7) ? atoi(argv[7]) : BLOCK_SIZE;
+    test.fecParity = (argc > 8) ? atoi(argv[8]) : 0;
+    test.batch = (argc > 9) ? atoi(argv[9]) : 0;
+    if ((test.nBlocks < 1) || (test.latency < 0) || (test.bitRate < 1)
+        || (test.blockSize < 0) || (test.blockSize > MAX_BLK)
+        || (test.fecParity < 0) || (test.fecParity > FEC_MAXPARITY)
+        || (test.batch < 0) || (test.batch > MAX_BATCH)
+        || (test.batch && test.blockSize))
+    {
+        printf("Arguments: blocks, latency ms, bit rate, error prob, "
+               "seed, burst prob, block size, parity, batch\n");
+        return 1;
+    }
+
+    test.nBytes = (long) test.nBlocks
+                  * (test.blockSize ? test.blockSize : BLOCK_SIZE);
+    if (test.blockSize)
+        printf("Full-Duplex Link Layer Test: %d blocks of %d bytes, ",
+               test.nBlocks, test.blockSize);
+    else printf("Full-Duplex Link Layer Test: %ld bytes, adaptive blocks, ",
+                test.nBytes);
+    printf("latency %ld ms, %d bit/s, error %g, bursts %g, parity %d, "
+           "batch %d\n\n", test.latency / 1000, test.bitRate, test.probErr,
+           test.probBurst, test.fecParity, test.batch);
+    printf("window  line_s   goodput_bit_s  resent  fixed  block  cpu_s  "
+           "result\n");
+
+    for (w = 0; w < nWindows; w++)
+    {
+        test.window = windows[w];
+        cpuStart = clock();
+        if (runTest(&test) < 0) failed++;
+        seconds = (double) (test.endTime - test.startTime) / 1.0E6;
+        if (seconds <= 0.0) seconds = 1.0E-6;
+
+        printf("%6d %8.1f %15.0f %7d %6ld %6d %6.2f  %s\n", test.window,
+               seconds, 8.0 * test.gotBytes / seconds, test.nResent,
+               test.nFixed, test.lastBlock,
+               (double) (clock() - cpuStart) / CLOCKS_PER_SEC,
+               (test.sendResult < 0) ? "link failed" :
+               (test.nBad > 0) || (test.gotBytes < test.nBytes) ?
+                   "data wrong" : "ok");
+    }
+    return (failed > 0) ? 1 : 0;
+}
+
+
+/* Function to do one transfer, with a thread for each end.
+   Each thread connects its own link, as the two ends must agree
+   their settings.  The virtual clock is held until both ports are
+   open, so neither end can time out before the other is there.
+   Argument: settings, also used for results.
+   Return value is 0 if all blocks were received correctly,
+   negative otherwise.  */
+int runTest(LoopTest *test)
+{
+    static LL_context linkA, linkB;  // large, so not on stack
+#ifdef _WIN32
+    HANDLE threads[2];  // sender and receiver threads
+#else
+    pthread_t threads[2];  // sender and receiver threads
+#endif
+
+    test->sendDone = 0;
+    test->sendResult = 0;
+    test->nGot = 0;
+    test->gotBytes = 0;
+    test->nBad = 0;
+    test->nResent = 0;
+    test->nFixed = 0;
+    test->startTime = 0;
+    test->endTime = 0;
+    test->linkA = &linkA;
+    test->linkB = &linkB;
+
+    LL_init(&linkA, 1);
+    LL_init(&linkB, 2);
+    if ((LL_setLine(&linkA, test->bitRate, test->probErr, 0) < 0)
+        || (LL_setLine(&linkB, test->bitRate, test->probErr, 0) < 0)
+        || (LL_setWindow(&linkA, test->window, 0) < 0)
+        || (LL_setWindow(&linkB, test->window, 0) < 0)
+        || (LL_setFec(&linkA, test->fecParity, 0) < 0))
+    {
+        printf("Test: Could not set up links\n");
+        test->sendResult = -1;
+        return -1;
+    }
+    PHY_expectPorts(2);  // hold the clock until both ends connect
+
+#ifdef _WIN32
+    threads[0] = CreateThread(NULL, 0, sender, test, 0, NULL);
+    threads[1] = CreateThread(NULL, 0, receiver, test, 0, NULL);
+    if ((threads[0] == NULL) || (threads[1] == NULL))
+    {
+        printf("Test: Could not start threads\n");
+        return -1;
+    }
+    WaitForMultipleObjects(2, threads, TRUE, INFINITE);
+    CloseHandle(threads[0]);
+    CloseHandle(threads[1]);
+#else
+    if ((pthread_create(&threads[0], NULL, sender, test) != 0)
+        || (pthread_create(&threads[1], NULL, receiver, test) != 0))
+    {
+        printf("Test: Could not start threads\n");
+        return -1;
+    }
+    pthread_join(threads[0], NULL);
+    pthread_join(threads[1], NULL);
+#endif
+
+    if ((test->sendResult < 0) || (test->nBad > 0)
+        || (test->gotBytes < test->nBytes)) return -1;
+    return 0;
+}
+
+
+/* Thread function to send all the data on link A, port 1, in blocks
+   of the size given, or the size the link suggests, or in batches
+   given to LL_sendv().
+   Argument: pointer to the test settings.  */
+THREAD_RESULT sender(void *arg)
+{
+    LoopTest *test = arg;  // settings and results
+    LL_context *link = test->linkA;  // state of the link
+    static byte dataSend[MAX_BATCH];  // block or batch to send
+    LL_iovec iov[2];  // batch, in two pieces
+    long sent = 0;  // data bytes sent so far
+    int nByte;  // bytes in this block
+    int retVal = 0;  // return value from functions
+    LL_stats st;  // counters from the link
+
+    retVal = setupLink(test, link, test->seed);  // errors on acks
+    test->startTime = PHY_time();
+    while ((sent < test->nBytes) && (retVal >= 0))
+    {
+        if (test->batch) nByte = test->batch;
+        else nByte = test->blockSize ? test->blockSize : LL_blockSize(link);
+        if (nByte > test->nBytes - sent) nByte = test->nBytes - sent;
+        fillBlock(dataSend, nByte, sent);
+        if (test->batch)
+        {
+            iov[0].data = dataSend;  // pieces need not match blocks
+            iov[0].len = nByte / 3;
+            iov[1].data = dataSend + iov[0].len;
+            iov[1].len = nByte - iov[0].len;
+            retVal = LL_sendv(link, iov, 2, 0);
+        }
+        else retVal = LL_send(link, dataSend, nByte, 0);
+        sent += nByte;
+    }
+    if (retVal >= 0) retVal = LL_flush(link, 0);  // wait for last acks
+
+    test->sendResult = (retVal < 0) ? retVal : 0;
+    LL_getStats(link, &st);
+    test->nResent = (int) st.txResent;
+    test->lastBlock = LL_blockSize(link);
+    test->sendDone = 1;
+    LL_discon(link, 0);
+    return 0;
+}
+
+
+/* Thread function to receive and check the blocks on link B, port 2.
+   After the last block, it keeps the link going until the sender has
+   finished, so any acknowledgements that were lost can be repeated.
+   Argument: pointer to the test settings.  */
+THREAD_RESULT receiver(void *arg)
+{
+    LoopTest *test = arg;  // settings and results
+    LL_context *link = test->linkB;  // state of the link
+    byte dataReceive[MAX_BLK];  // block received
+    byte expected[MAX_BLK];  // block that should have been received
+    int i, retVal = 0;  // for use in loop, and return value from functions
+    LL_stats st;  // counters from the link
+
+    retVal = setupLink(test, link, test->seed ? test->seed + 1 : 0);
+    if (retVal < 0) test->sendResult = retVal;  // no link, nothing received
+    while ((retVal >= 0) && (test->gotBytes < test->nBytes))
+    {
+        retVal = LL_receive(link, dataReceive, MAX_BLK, 0);
+        if (retVal < 0) break;  // link has failed
+        fillBlock(expected, retVal, test->gotBytes);
+        if ((test->blockSize && (retVal != test->blockSize))
+            || (retVal > test->nBytes - test->gotBytes)) test->nBad++;
+        else
+        {
+            for (i = 0; i < retVal; i++)
+                if (dataReceive[i] != expected[i]) break;
+            if (i < retVal) test->nBad++;  // block is not right
+        }
+        test->nGot++;
+        test->gotBytes += retVal;
+    }
+    test->endTime = PHY_time();  // not counting the wait for the sender
+
+    if (retVal >= 0)
+        while (!test->sendDone)  // answer any repeated frames
+            LL_receive(link, dataReceive, MAX_BLK, 0);
+
+    LL_getStats(link, &st);
+    test->nFixed = (long) st.rxFecFixed;
+    LL_discon(link, 0);
+    return 0;
+}
+
+
+/* Function to connect one end, and set up the simulated line from
+   its port: latency, bursts of errors, and the seed for the errors,
+   so the same errors happen every run once the link is connected.
+   Arguments: settings, link to connect, seed for its errors.
+   Return value is 0 on success, negative on failure.  */
+int setupLink(LoopTest *test, LL_context *link, unsigned long seed)
+{
+    if ((LL_connect(link, 0) < 0)
+        || (PHY_setLatency(link->phy, test->latency) < 0)
+        || ((test->probBurst > 0.0)
+            && (PHY_setBurst(link->phy, test->probBurst, BURST_END,
+                             BURST_ERR) < 0)))
+    {
+        printf("Test: Could not set up link on port %d\n", link->portNum);
+        return -1;
+    }
+    PHY_setSeed(link->phy, seed);
+    return 0;
+}
+
+
+/* Function to fill a block with bytes that depend on their position
+   in the data sent, so the receiver can check them, whatever size
+   the blocks are.  Each byte is a hash of its position.
+   Arguments: block, number of bytes, position of first byte.  */
+void fillBlock(byte *block, int nByte, long offset)
+{
+    unsigned long x;  // hash of position
+    int i;  // for use in loop
+
+    for (i = 0; i < nByte; i++)
+    {
+        x = ((unsigned long) (offset + i) * 2654435761UL) & 0xFFFFFFFFUL;
+        x ^= x >> 15;
+        block[i] = (byte) (x >> 8);
+    }
+}
@@ -3,28 +3,82 @@
        PHY_close   closes the port
        PHY_send    sends bytes
        PHY_get     gets received bytes
+       PHY_getWaiting  gets the bytes already received, without waiting
+       PHY_sendAsync   starts sending bytes, without waiting
+       PHY_sendPoll    checks progress of sends started by PHY_sendAsync
+       PHY_wait        waits until received bytes are available
+       PHY_waitAny     waits until bytes are available on any of a list
+       PHY_handle      gives no handle - use PHY_waitAny
+       PHY_time        reads the performance counter clock
+       PHY_setRate     changes the bit rate of an open port
     All functions print explanatory messages if there is
     a problem, and return values to indicate failure.
-    This version uses standard C functions.  */
+    The port is opened for overlapped (asynchronous) operation, so
+    several sends can be queued while the caller gets on with other
+    work.  PHY_send and PHY_get start an operation and wait for it
+    to finish, so they behave as before.  */
 
 #include <stdio.h>   // needed for printf
+#include <string.h>  // for memset
 #include <windows.h>  // needed for port functions
-#include <stdlib.h>  // for random number functions
-#include <time.h>    // for time function, used to seed rand
+#include <stdlib.h>  // for calloc and free
 #include "physical.h"  // header file for these functions
+#include "channel.h"   // for simulated errors
 
 
-/* Creating a variable this way allows it to be shared
-   by the functions in this file only.  */
-static HANDLE serial = INVALID_HANDLE_VALUE;  // handle for serial port
-static double rxProbErr = 0.0; // probability of error, used in PHY_get()
+/* State of one port - shared by the functions in this file,
+   with one copy for each port in use.  */
+struct PHY_context
+{
+    HANDLE serial;      // handle for serial port
+    ErrChannel rxChan;  // simulated errors, used in PHY_get()
+
+    // Sends in progress - a circular queue of overlapped operations
+    OVERLAPPED txOverlap[PHY_MAXPENDING];  // one for each send
+    byte *txData[PHY_MAXPENDING];  // bytes being sent
+    int txSize[PHY_MAXPENDING];    // number of bytes being sent
+    int txFirst;        // position of oldest send in queue
+    int txPending;      // number of sends in progress
+    int txLastSent;     // number of bytes sent by last send completed
+    void (*sendCallback)(void *arg, byte *dataTx, int nBytesSent);
+    void *sendArg;      // argument to pass to sendCallback
+
+    OVERLAPPED rxOverlap;    // for receive operations
+    OVERLAPPED waitOverlap;  // for waiting for received bytes
+};
+
+//===================================================================
+/* PHY_create function, to create the state for one port.
+   Returns pointer to the state, or NULL if no memory.  */
+PHY_context *PHY_create(void)
+{
+    PHY_context *phy = calloc(1, sizeof(PHY_context));  // all zero
+    if (phy == NULL)
+    {
+        printf("PHY: No memory for port state\n");
+        return NULL;
+    }
+    phy->serial = INVALID_HANDLE_VALUE;  // port not open yet
+    return phy;
+}
+
+//===================================================================
+/* PHY_destroy function, to free the state for one port.
+   Argument: port state, may be NULL.  */
+void PHY_destroy(PHY_context *phy)
+{
+    free(phy);
+}
 
+//===================================================================
 /* PHY_open function - to open and configure the serial port.
-   Arguments are port number, bit rate, number of data bits, parity,
-   receive timeout constant, rx timeout interval, rx probability of error.
+   Arguments are port state, port number, bit rate, number of data bits,
+   parity, receive timeout constant, rx timeout interval,
+   rx probability of error.
    See comments below for more detail on timeouts.
    Returns zero if it succeeds - anything non-zero is a problem.*/
-int PHY_open(int portNum,       // port number: e.g. 1 for COM1, 5 for COM5
+int PHY_open(PHY_context *phy, // port state, from PHY_create
+             int portNum,       // port number: e.g. 1 for COM1, 5 for COM5
              int bitRate,       // bit rate: e.g. 1200, 4800, etc.
              int nDataBits,     // number of data bits: 7 or 8
              int parity,        // parity: 0 = none, 1 = odd, 2 = even
@@ -76,10 +130,10 @@ int PHY_open(int portNum,       // port number: e.g. 1 for COM1, 5 for COM5
     sprintf(portName, "COM%d", portNum);  // print to string
 
     // Try to open the port
-    serial = CreateFile(portName, GENERIC_READ | GENERIC_WRITE,
-                                0, 0, OPEN_EXISTING, 0, 0);
+    phy->serial = CreateFile(portName, GENERIC_READ | GENERIC_WRITE,
+                                0, 0, OPEN_EXISTING, FILE_FLAG_OVERLAPPED, 0);
     // Check for failure
-    if (serial == INVALID_HANDLE_VALUE)
+    if (phy->serial == INVALID_HANDLE_VALUE)
     {
         printf("PHY: Failed to open port\n");
         printError();  // give details of the error
@@ -90,11 +144,11 @@ int PHY_open(int portNum,       // port number: e.g. 1 for COM1, 5 for COM5
     serialParams.DCBlength = sizeof(serialParams);
 
     // Fill the DCB with the parameters of the port, and check for failure
-    if (!GetCommState(serial, &serialParams))
+    if (!GetCommState(phy->serial, &serialParams))
     {
         printf("PHY: Error getting port parameters\n");
         printError();  // give details of the error
-        CloseHandle(serial);
+        CloseHandle(phy->serial);
         return 2;
     }
 
@@ -114,11 +168,11 @@ int PHY_open(int portNum,       // port number: e.g. 1 for COM1, 5 for COM5
     serialParams.fNull = FALSE;   // do not discard null bytes on receive
 
     // Apply the new parameters to the port
-    if (!SetCommState(serial, &serialParams))
+    if (!SetCommState(phy->serial, &serialParams))
     {
         printf("PHY: Error setting port parameters\n");
         printError();  // give details of the error
-        CloseHandle(serial);
+        CloseHandle(phy->serial);
         return 4;
     }
 
@@ -155,29 +209,46 @@ int PHY_open(int portNum,       // port number: e.g. 1 for COM1, 5 for COM5
     serialTimeLimits.ReadIntervalTimeout = (DWORD)rxTimeIntv;
 
     // Apply the time limits to the port
-    if (!SetCommTimeouts(serial, &serialTimeLimits))
+    if (!SetCommTimeouts(phy->serial, &serialTimeLimits))
     {
         printf("PHY: Error setting timeouts\n");
         printError();  // give details of the error
-        CloseHandle(serial);
+        CloseHandle(phy->serial);
         return 5;
     }
 
+    // Create events to signal when overlapped operations finish
+    phy->txFirst = 0;
+    phy->txPending = 0;
+    for (i = 0; i < PHY_MAXPENDING; i++)
+    {
+        memset(&phy->txOverlap[i], 0, sizeof(OVERLAPPED));
+        phy->txOverlap[i].hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+    }
+    memset(&phy->rxOverlap, 0, sizeof(OVERLAPPED));
+    phy->rxOverlap.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+    memset(&phy->waitOverlap, 0, sizeof(OVERLAPPED));
+    phy->waitOverlap.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+    if ((phy->rxOverlap.hEvent == NULL) || (phy->waitOverlap.hEvent == NULL)
+        || !SetCommMask(phy->serial, EV_RXCHAR))  // to wait for bytes
+    {
+        printf("PHY: Error creating events\n");
+        printError();  // give details of the error
+        CloseHandle(phy->serial);
+        return 7;
+    }
+
     // Clear the receive buffer, in case there is rubbish waiting
-    if (!PurgeComm(serial, PURGE_RXCLEAR))
+    if (!PurgeComm(phy->serial, PURGE_RXCLEAR))
     {
         printf("PHY: Error purging receive buffer\n");
         printError();  // give details of the error
-        CloseHandle(serial);
+        CloseHandle(phy->serial);
         return 6;
     }
 
-    /* Set up simulated errors on receive path:
-       Set the seed for the random number generator,
-       and check the probability of error value. */
-    srand(time(NULL));  // get time and use as seed
-    if ((probErr>=0.0) && (probErr<=1.0))  // check valid
-        rxProbErr = probErr; // pass value to shared variable
+    // Set up simulated errors on receive path, seeded from the time
+    chanInit(&phy->rxChan, probErr);
 
     // If we get this far, the port is open and configured
     return 0;
@@ -185,96 +256,455 @@ int PHY_open(int portNum,       // port number: e.g. 1 for COM1, 5 for COM5
 
 //===================================================================
 /* PHY_close function, to close the serial port.
-   Takes no arguments, returns 0 always.  */
-int PHY_close()
+   Argument: port state.  Returns 0 always.  */
+int PHY_close(PHY_context *phy)
 {
-    CloseHandle(serial);
+    int i;  // for use in loop
+
+    PHY_sendPoll(phy, 1);  // let any sends in progress finish
+    if (phy->rxChan.nErrors > 0)
+        printf("PHY: %ld bits changed by simulated errors\n",
+               phy->rxChan.nErrors);
+    CloseHandle(phy->serial);
+    phy->serial = INVALID_HANDLE_VALUE;
+    for (i = 0; i < PHY_MAXPENDING; i++)
+        if (phy->txOverlap[i].hEvent != NULL)
+            CloseHandle(phy->txOverlap[i].hEvent);
+    if (phy->rxOverlap.hEvent != NULL) CloseHandle(phy->rxOverlap.hEvent);
+    if (phy->waitOverlap.hEvent != NULL) CloseHandle(phy->waitOverlap.hEvent);
     return 0;
 }
 
 //===================================================================
 /* PHY_send function, to send bytes.
-   Arguments: pointer to array holding bytes to be sent;
+   Arguments: port state; pointer to array holding bytes to be sent;
               number of bytes to send.
    Returns number of bytes sent, or negative value on error.  */
-int PHY_send(byte *dataTx, int nBytesToSend)
+int PHY_send(PHY_context *phy, byte *dataTx, int nBytesToSend)
 {
-     DWORD nBytesTx;  // double-word - number of bytes actually sent
-     int nBytesSent;    // integer version of the same
+    int retVal;  // return value from other functions
+
+    // Start the send, waiting for room in the queue if necessary
+    retVal = PHY_sendAsync(phy, dataTx, nBytesToSend);
+    if (retVal == 0)
+    {
+        if (PHY_sendPoll(phy, 1) < 0) return -5;
+        retVal = PHY_sendAsync(phy, dataTx, nBytesToSend);
+    }
+    if (retVal < 0) return retVal;
+
+    // This is the newest send, so wait for all sends to finish
+    retVal = PHY_sendPoll(phy, 1);
+    if (retVal < 0) return retVal;
+    return phy->txLastSent; // if no error, return number of bytes sent
+    // note that timeout is not regarded as error
+}
+
+//===================================================================
+/* PHY_sendAsync function, to start sending bytes.
+   Arguments: port state; pointer to array holding bytes to be sent;
+              number of bytes to send.
+   Returns number of bytes accepted for sending, 0 if there are
+   already PHY_MAXPENDING sends in progress, or negative on error.  */
+int PHY_sendAsync(PHY_context *phy, byte *dataTx, int nBytesToSend)
+{
+    int slot;  // position in queue for this send
+    OVERLAPPED *overlap;  // overlapped structure for this send
 
     // First check if the port is open
-    if (serial == INVALID_HANDLE_VALUE)
+    if (phy->serial == INVALID_HANDLE_VALUE)
     {
         printf("PHY: Port not valid\n");
         return -9;  // negative return value indicates error
     }
 
-    // Try to send the bytes as requested
-    if (!WriteFile(serial, dataTx, nBytesToSend, &nBytesTx, NULL ))
+    // Check for room in the queue, collecting any finished sends
+    if (phy->txPending == PHY_MAXPENDING)
+    {
+        if (PHY_sendPoll(phy, 0) < 0) return -5;
+        if (phy->txPending == PHY_MAXPENDING) return 0;  // still full
+    }
+    slot = (phy->txFirst + phy->txPending) % PHY_MAXPENDING;
+    overlap = &phy->txOverlap[slot];
+    overlap->Offset = 0;
+    overlap->OffsetHigh = 0;
+    ResetEvent(overlap->hEvent);
+
+    // Try to start sending the bytes as requested
+    if (!WriteFile(phy->serial, dataTx, nBytesToSend, NULL, overlap)
+        && (GetLastError() != ERROR_IO_PENDING))
     {
         printf("PHY: Error sending data\n");
         printError();  // give details of the error
-        CloseHandle(serial);
         return -5;
     }
-    else if ((nBytesSent = (int)nBytesTx) != nBytesToSend)  // check for timeout
+
+    // Add to the queue - finished or not, PHY_sendPoll will collect it
+    phy->txData[slot] = dataTx;
+    phy->txSize[slot] = nBytesToSend;
+    phy->txPending++;
+    return nBytesToSend;
+}
+
+//===================================================================
+/* PHY_sendPoll function, to check sends started by PHY_sendAsync.
+   Arguments: port state;
+              1 to wait until all sends are complete, 0 to just check.
+   Returns number of sends still in progress, or negative on error.  */
+int PHY_sendPoll(PHY_context *phy, int wait)
+{
+    DWORD nBytesTx;  // double-word - number of bytes actually sent
+    int slot;  // position in queue of oldest send
+
+    while (phy->txPending > 0)
     {
-        printf("PHY: Timeout in transmission, sent %d of %d bytes\n",
-               nBytesSent, nBytesToSend);
+        slot = phy->txFirst;
+        if (!GetOverlappedResult(phy->serial, &phy->txOverlap[slot],
+                                 &nBytesTx, wait))
+        {
+            if (GetLastError() == ERROR_IO_INCOMPLETE)  // not finished
+                break;
+            printf("PHY: Error sending data\n");
+            printError();  // give details of the error
+            phy->txPending = 0;  // abandon all sends in progress
+            return -5;
+        }
+
+        // This send is finished - check for timeout
+        phy->txLastSent = (int) nBytesTx;
+        if (phy->txLastSent != phy->txSize[slot])
+        {
+            printf("PHY: Timeout in transmission, sent %d of %d bytes\n",
+                   phy->txLastSent, phy->txSize[slot]);
+        }
+        phy->txFirst = (phy->txFirst + 1) % PHY_MAXPENDING;
+        phy->txPending--;
+        if (phy->sendCallback != NULL)
+            phy->sendCallback(phy->sendArg, phy->txData[slot], phy->txLastSent);
     }
-    return nBytesSent; // if no error, return number of bytes sent
-    // note that timeout is not regarded as error
+    return phy->txPending;
+}
+
+//===================================================================
+/* PHY_setSendCallback function, to set a function to be called
+   when a send is complete.
+   Arguments: port state; pointer to function, or NULL for none;
+              pointer to pass to the function.  */
+void PHY_setSendCallback(PHY_context *phy,
+                         void (*callback)(void *arg, byte *dataTx,
+                                          int nBytesSent),
+                         void *arg)
+{
+    phy->sendCallback = callback;
+    phy->sendArg = arg;
 }
 
 //===================================================================
 /* PHY_get function, to get received bytes.
-   Arguments: pointer to array to hold received bytes;
+   Arguments: port state; pointer to array to hold received bytes;
               maximum number of bytes to get.
    Returns number of bytes actually got, or negative value on error.  */
-int PHY_get(byte *dataRx, int nBytesToGet)
+int PHY_get(PHY_context *phy, byte *dataRx, int nBytesToGet)
 {
      DWORD nBytesRx;  // double-word - number of bytes actually got
      int nBytesGot;      // integer version of above
-     int threshold = 0;  // threshold for error simulation
-     int i;             // for use in loop
-     int flip;          // bits to change in simulating error
 
     // First check if the port is open
-    if (serial == INVALID_HANDLE_VALUE)
+    if (phy->serial == INVALID_HANDLE_VALUE)
     {
         printf("PHY: Port not valid\n");
         return -9;  // negative return value indicates error
     }
-    // Try to get bytes as requested
-    if (!ReadFile(serial, dataRx, nBytesToGet, &nBytesRx, NULL ))
+    // Try to get bytes as requested, and wait for the result
+    ResetEvent(phy->rxOverlap.hEvent);
+    if ((!ReadFile(phy->serial, dataRx, nBytesToGet, NULL, &phy->rxOverlap)
+         && (GetLastError() != ERROR_IO_PENDING))
+        || !GetOverlappedResult(phy->serial, &phy->rxOverlap, &nBytesRx, TRUE))
     {
         printf("PHY: Error receiving data\n");
         printError();  // give details of the error
-        CloseHandle(serial);
+        CloseHandle(phy->serial);
         return -4;
     }
     // No need to complain about timeout here - will happen regularly
 
     nBytesGot = (int) nBytesRx;  // convert to integer
 
-    // Add an error, with specified probability
-    if (rxProbErr != 0.0)
+    // Add errors, with specified probability
+    if (nBytesGot > 0) chanApply(&phy->rxChan, dataRx, nBytesGot);
+
+    return nBytesGot; // if no problem, return number of bytes we got
+}
+
+//===================================================================
+/* PHY_getWaiting function, to get the bytes already received,
+   without waiting for more.  Asks PHY_get for no more than the bytes
+   in the input queue of the port, so the read finishes at once.
+   Arguments: port state; pointer to array to hold received bytes;
+              maximum number of bytes to get.
+   Returns number of bytes got, 0 if none are waiting,
+   or negative value on error.  */
+int PHY_getWaiting(PHY_context *phy, byte *dataRx, int nBytesToGet)
+{
+    COMSTAT status;  // port status, including bytes waiting
+    DWORD errors;  // port error flags
+
+    // First check if the port is open
+    if (phy->serial == INVALID_HANDLE_VALUE)
     {
-        // set threshold as fraction of max, scaling for 8 bit bytes
-        threshold = 1 + (int)(8.0 * (double)RAND_MAX * rxProbErr);
-        for (i = 0; i < nBytesGot; i++)
+        printf("PHY: Port not valid\n");
+        return -9;  // negative return value indicates error
+    }
+
+    if (!ClearCommError(phy->serial, &errors, &status))
+    {
+        printf("PHY: Error checking port\n");
+        printError();  // give details of the error
+        return -4;
+    }
+    if (status.cbInQue == 0) return 0;  // nothing waiting
+    if ((DWORD) nBytesToGet > status.cbInQue)
+        nBytesToGet = (int) status.cbInQue;
+    return PHY_get(phy, dataRx, nBytesToGet);
+}
+
+//===================================================================
+/* PHY_wait function, to wait until received bytes are available.
+   Uses WaitCommEvent to wait for a byte to arrive, if none waiting.
+   Arguments: port state; max time to wait in ms, 0 to just check.
+   Returns 1 if bytes are available, 0 if time limit reached,
+   or negative value on error. */
+int PHY_wait(PHY_context *phy, int timeLimit)
+{
+    COMSTAT status;  // port status, including bytes waiting
+    DWORD errors;  // port error flags
+    DWORD eventMask;  // events that happened
+    DWORD waitResult;  // result of waiting for event
+
+    // First check if the port is open
+    if (phy->serial == INVALID_HANDLE_VALUE)
+    {
+        printf("PHY: Port not valid\n");
+        return -9;  // negative return value indicates error
+    }
+
+    // Check if bytes are already waiting
+    if (!ClearCommError(phy->serial, &errors, &status))
+    {
+        printf("PHY: Error checking port\n");
+        printError();  // give details of the error
+        return -4;
+    }
+    if (status.cbInQue > 0) return 1;
+    if (timeLimit <= 0) return 0;
+
+    // Start waiting for a byte to arrive
+    ResetEvent(phy->waitOverlap.hEvent);
+    if (WaitCommEvent(phy->serial, &eventMask, &phy->waitOverlap)) return 1;
+    if (GetLastError() != ERROR_IO_PENDING)
+    {
+        printf("PHY: Error waiting for data\n");
+        printError();  // give details of the error
+        return -4;
+    }
+
+    // A byte may have arrived just before the wait started
+    ClearCommError(phy->serial, &errors, &status);
+    if (status.cbInQue > 0) waitResult = WAIT_OBJECT_0;
+    else waitResult = WaitForSingleObject(phy->waitOverlap.hEvent,
+                                          (DWORD)timeLimit);
+
+    // Setting the mask again ends a wait that is still in progress
+    SetCommMask(phy->serial, EV_RXCHAR);
+    GetOverlappedResult(phy->serial, &phy->waitOverlap, &eventMask, TRUE);
+    return (waitResult == WAIT_OBJECT_0) ? 1 : 0;
+}
+
+//===================================================================
+/* Function to mark the ports of a list that have bytes waiting.
+   Returns number of ports with bytes, or negative value on error.  */
+static int checkWaiting(PHY_context **phys, int nPorts, int *ready)
+{
+    COMSTAT status;  // port status, including bytes waiting
+    DWORD errors;  // port error flags
+    int nReady = 0;  // number of ports with bytes
+    int i;  // for use in loop
+
+    for (i = 0; i < nPorts; i++)
+    {
+        if (!ClearCommError(phys[i]->serial, &errors, &status))
         {
-            if (rand() < threshold)  // we want to cause an error
-            {
-                flip = rand() % 8;  // random integer 0 to 7
-                flip = 1 << flip; // bit pattern: single 1 in random place
-                dataRx[i] ^= (byte) flip;  // invert one bit
-                printf("PHY_get:  ####  Simulated error...  ####\n");
-            }
+            printf("PHY: Error checking port\n");
+            printError();  // give details of the error
+            return -4;
         }
+        ready[i] = (status.cbInQue > 0);
+        nReady += ready[i];
     }
+    return nReady;
+}
 
-    return nBytesGot; // if no problem, return number of bytes we got
+//===================================================================
+/* PHY_waitAny function, to wait until received bytes are available
+   on any of a list of ports.  Starts WaitCommEvent on every port,
+   as in PHY_wait, then waits for the first of the events, so the
+   processor is free while waiting.
+   Arguments: array of port states; number of ports; array set to 1
+              for each port with bytes available, 0 for the others;
+              max time to wait in ms, 0 to just check, -1 for no limit.
+   Returns number of ports with bytes available, 0 if time limit
+   reached, or negative value on error.  */
+int PHY_waitAny(PHY_context **phys, int nPorts, int *ready, int timeLimit)
+{
+    HANDLE events[PHY_MAXWAIT];  // events to wait for, one per port
+    DWORD eventMask[PHY_MAXWAIT];  // events that happened on each port
+    int nStarted = 0;  // number of ports with a wait in progress
+    int retVal;  // return value from other functions
+    int i;  // for use in loop
+
+    if ((nPorts < 1) || (nPorts > PHY_MAXWAIT))
+    {
+        printf("PHY: Cannot wait on %d ports\n", nPorts);
+        return -8;
+    }
+    for (i = 0; i < nPorts; i++)
+        if (phys[i]->serial == INVALID_HANDLE_VALUE)
+        {
+            printf("PHY: Port not valid\n");
+            return -9;  // negative return value indicates error
+        }
+
+    // Check if bytes are already waiting
+    retVal = checkWaiting(phys, nPorts, ready);
+    if ((retVal != 0) || (timeLimit == 0)) return retVal;
+
+    // Start waiting for a byte to arrive on every port
+    for (i = 0; i < nPorts; i++)
+    {
+        ResetEvent(phys[i]->waitOverlap.hEvent);
+        events[i] = phys[i]->waitOverlap.hEvent;
+        if (!WaitCommEvent(phys[i]->serial, &eventMask[i],
+                           &phys[i]->waitOverlap)
+            && (GetLastError() != ERROR_IO_PENDING))
+        {
+            printf("PHY: Error waiting for data\n");
+            printError();  // give details of the error
+            retVal = -4;
+            break;
+        }
+        nStarted++;
+    }
+
+    // A byte may have arrived just before the waits started
+    if (retVal == 0) retVal = checkWaiting(phys, nPorts, ready);
+    if (retVal == 0)
+        WaitForMultipleObjects((DWORD) nPorts, events, FALSE,
+                               (timeLimit < 0) ? INFINITE : (DWORD) timeLimit);
+
+    // Setting the mask again ends the waits still in progress
+    for (i = 0; i < nStarted; i++)
+    {
+        SetCommMask(phys[i]->serial, EV_RXCHAR);
+        GetOverlappedResult(phys[i]->serial, &phys[i]->waitOverlap,
+                            &eventMask[i], TRUE);
+    }
+    if (retVal != 0) return retVal;
+    return checkWaiting(phys, nPorts, ready);
+}
+
+//===================================================================
+/* PHY_handle function, to give a handle the operating system can
+   wait on.  A serial port on Windows only signals bytes arriving
+   while WaitCommEvent is in progress, so there is no such handle -
+   use PHY_waitAny instead.
+   Returns -1 always.  */
+int PHY_handle(PHY_context *phy)
+{
+    return -1;
+}
+
+//===================================================================
+/* PHY_time function, to read the clock used by this layer.
+   This is wall-clock time, which does not jump if the date is changed,
+   unlike clock(), which gives processor time on some systems.
+   Returns time in microseconds.  */
+long long PHY_time(void)
+{
+    LARGE_INTEGER count, freq;  // counter value and counts per second
+    QueryPerformanceCounter(&count);
+    QueryPerformanceFrequency(&freq);
+    // split the division, to avoid overflow
+    return (count.QuadPart / freq.QuadPart) * 1000000
+           + (count.QuadPart % freq.QuadPart) * 1000000 / freq.QuadPart;
+}
+
+//===================================================================
+/* PHY_setSeed function, to make the simulated errors repeatable.
+   Arguments: port state; seed, 0 to seed from the time.  */
+void PHY_setSeed(PHY_context *phy, unsigned long seed)
+{
+    chanSeed(&phy->rxChan, seed);
+}
+
+//===================================================================
+/* PHY_setBurst function, to simulate bursts of errors.
+   Arguments: port state; probability per bit of a burst starting,
+              and of it ending; probability of bit error in a burst.
+   Returns 0, or negative if any probability is not valid.  */
+int PHY_setBurst(PHY_context *phy, double probStart, double probEnd,
+                 double probErrBurst)
+{
+    return chanBurst(&phy->rxChan, probStart, probEnd, probErrBurst);
+}
+
+//===================================================================
+/* PHY_setRate function, to change the bit rate of an open port.
+   Waits for bytes already sent to leave, then changes the rate and
+   the time limits that are derived from it.
+   Arguments: port state; new bit rate.
+   Returns zero if it succeeds - anything non-zero is a problem.*/
+int PHY_setRate(PHY_context *phy, int bitRate)
+{
+    DCB serialParams = {0};  // Device Control Block (DCB) for serial port
+    COMMTIMEOUTS serialTimeLimits = {0};  // COMMTIMEOUTS structure for port
+    int bitRatio = bitRate/1200;  // valid rates are 1200 * power of 2
+    DWORD timeMult;   // for calculating time limits
+
+    if ((bitRatio < 1) || (bitRatio > 32) || (bitRate != bitRatio*1200)
+        || ((bitRatio & (bitRatio - 1)) != 0))
+    {
+        printf("PHY: Invalid bit rate requested: %d\n", bitRate);
+        return 3;
+    }
+
+    // Bytes still in the transmit buffer must go at the old rate
+    FlushFileBuffers(phy->serial);
+
+    // Get the present settings, so only the rate is changed
+    serialParams.DCBlength = sizeof(serialParams);
+    if (!GetCommState(phy->serial, &serialParams)
+        || !GetCommTimeouts(phy->serial, &serialTimeLimits))
+    {
+        printf("PHY: Error getting port parameters\n");
+        printError();  // give details of the error
+        return 2;
+    }
+
+    // New rate, and multipliers as in PHY_open
+    serialParams.BaudRate = bitRate;
+    timeMult = 1 + 11000/bitRate;  // 10 ms at 1200, 1 ms above 9600 bit/s
+    serialTimeLimits.WriteTotalTimeoutMultiplier = timeMult;
+    if (serialTimeLimits.ReadTotalTimeoutConstant != 0)  // 0 waits forever
+        serialTimeLimits.ReadTotalTimeoutMultiplier = timeMult;
+
+    if (!SetCommState(phy->serial, &serialParams)
+        || !SetCommTimeouts(phy->serial, &serialTimeLimits))
+    {
+        printf("PHY: Error setting port parameters\n");
+        printError();  // give details of the error
+        return 4;
+    }
+    return 0;
 }
 
 /* Function to print informative error messages
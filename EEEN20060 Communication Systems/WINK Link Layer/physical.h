@@ -2,19 +2,56 @@
 #define PHYSICAL_H_INCLUDED
 
 /*  Physical Layer functions using serial port.
+       PHY_create      creates the state for one port
+       PHY_destroy     frees that state
        PHY_open        opens and configures the port
        PHY_close       closes the port
        PHY_send        sends bytes
        PHY_receive     gets received bytes
+       PHY_getWaiting  gets the bytes already received, without waiting
+       PHY_sendAsync   starts sending bytes, without waiting
+       PHY_sendPoll    checks progress of sends started by PHY_sendAsync
+       PHY_wait        waits until received bytes are available
+       PHY_waitAny     waits until bytes are available on any of a list
+       PHY_handle      gives a handle for the system to wait on
+       PHY_time        gives the time, for all timing above this layer
+       PHY_setSeed     makes the simulated errors repeatable
+       PHY_setBurst    simulates bursts of errors
+       PHY_setRate     changes the bit rate of an open port
+    There are versions for Windows (physical.c), POSIX systems such as
+    Linux (posix-physical.c), a simulation (sim-physical.c), and a
+    full-duplex loopback between pairs of ports (loop-physical.c).
+    Each port has its own state, created by PHY_create, and passed
+    as the first argument to every other function, so several ports
+    can be used at once.
+    Every version can add simulated errors to the bytes received, using
+    the functions in channel.c - independent bit errors by default.
     All functions print explanatory messages if there is
     a problem, and return values to indicate failure. */
 
+#define PHY_MAXPENDING 8  // max number of sends in progress at once
+#define PHY_MAXWAIT 64    // max number of ports for PHY_waitAny
+
+/* State of one port - contents depend on the version in use,
+   so only a pointer to it is used outside the physical layer.  */
+typedef struct PHY_context PHY_context;
+
+/* PHY_create function, to create the state for one port.
+   Returns pointer to the state, or NULL if no memory.  */
+PHY_context *PHY_create(void);
+
+/* PHY_destroy function, to free the state for one port.
+   The port should be closed first.  Argument may be NULL.  */
+void PHY_destroy(PHY_context *phy);
+
 /* PHY_open function - to open and configure the serial port.
-   Arguments are port number, bit rate, number of data bits, parity,
-   receive timeout constant, rx timeout interval, rx probability of error.
+   Arguments are port state, port number, bit rate, number of data bits,
+   parity, receive timeout constant, rx timeout interval,
+   rx probability of error.
    See comments in function for more details of timeouts.
    Returns zero if it succeeds - anything non-zero is a problem.*/
-int PHY_open(int portNum,       // port number: e.g. 1 for COM1, 5 for COM5
+int PHY_open(PHY_context *phy, // port state, from PHY_create
+             int portNum,       // port number: e.g. 1 for COM1, 5 for COM5
              int bitRate,       // bit rate: e.g. 1200, 4800, etc.
              int nDataBits,     // number of data bits: 7 or 8
              int parity,        // parity: 0 = none, 1 = odd, 2 = even
@@ -23,20 +60,113 @@ int PHY_open(int portNum,       // port number: e.g. 1 for COM1, 5 for COM5
              double probErr);   // rx probability of error: 0.0 for none
 
 /* PHY_close function, to close the serial port.
-   Takes no arguments, returns 0 always.  */
-int PHY_close();
+   Argument: port state.  Returns 0 always.  */
+int PHY_close(PHY_context *phy);
 
 /* PHY_send function, to send bytes.
    Arguments: pointer to array holding bytes to be sent;
               number of bytes to send.
    Returns number of bytes sent, or negative value on error.  */
-int PHY_send(byte *dataTx, int nBytesToSend);
+int PHY_send(PHY_context *phy, byte *dataTx, int nBytesToSend);
+
+/* PHY_sendAsync function, to start sending bytes.
+   Returns as soon as the send has started, so the caller can do
+   other work while the bytes are sent.  The bytes must not be
+   changed until PHY_sendPoll shows the send is complete.
+   Arguments: pointer to array holding bytes to be sent;
+              number of bytes to send.
+   Returns number of bytes accepted for sending, 0 if there are
+   already PHY_MAXPENDING sends in progress, or negative on error.  */
+int PHY_sendAsync(PHY_context *phy, byte *dataTx, int nBytesToSend);
+
+/* PHY_sendPoll function, to check sends started by PHY_sendAsync.
+   Sends complete in the order they were started.  The send
+   callback, if set, is called for each send found to be complete.
+   Arguments: port state;
+              1 to wait until all sends are complete, 0 to just check.
+   Returns number of sends still in progress, or negative on error.  */
+int PHY_sendPoll(PHY_context *phy, int wait);
+
+/* PHY_setSendCallback function, to set a function to be called when
+   a send is complete, with the argument given here, the pointer given
+   to PHY_sendAsync or PHY_send and the number of bytes actually sent.
+   Arguments: port state; pointer to function, or NULL for none;
+              pointer to pass to the function, e.g. link layer state.  */
+void PHY_setSendCallback(PHY_context *phy,
+                         void (*callback)(void *arg, byte *dataTx,
+                                          int nBytesSent),
+                         void *arg);
 
 /* PHY_get function, to get received bytes.
    Arguments: pointer to array to hold received bytes;
               maximum number of bytes to get.
    Returns number of bytes actually got, or negative value on error. */
-int PHY_get(byte *dataRx, int nBytesToGet);
+int PHY_get(PHY_context *phy, byte *dataRx, int nBytesToGet);
+
+/* PHY_getWaiting function, to get the bytes already received,
+   without waiting for more, so it never blocks - for a program
+   that waits for bytes itself, with PHY_waitAny or PHY_handle.
+   Arguments: pointer to array to hold received bytes;
+              maximum number of bytes to get.
+   Returns number of bytes got, 0 if none are waiting,
+   or negative value on error. */
+int PHY_getWaiting(PHY_context *phy, byte *dataRx, int nBytesToGet);
+
+/* PHY_wait function, to wait until received bytes are available,
+   without using the processor while waiting.
+   Arguments: port state; max time to wait in ms, 0 to just check.
+   Returns 1 if bytes are available, 0 if time limit reached,
+   or negative value on error. */
+int PHY_wait(PHY_context *phy, int timeLimit);
+
+/* PHY_waitAny function, to wait until received bytes are available
+   on any of a list of ports, without using the processor while
+   waiting, so one thread can serve many ports.
+   Arguments: array of port states; number of ports, up to
+              PHY_MAXWAIT; array set to 1 for each port with bytes
+              available, 0 for the others; max time to wait in ms,
+              0 to just check, -1 to wait with no limit.
+   Returns number of ports with bytes available, 0 if time limit
+   reached, or negative value on error. */
+int PHY_waitAny(PHY_context **phys, int nPorts, int *ready, int timeLimit);
+
+/* PHY_handle function, to give a handle the operating system can
+   wait on, for a program with its own event loop.  On POSIX systems
+   this is the file descriptor of the port, readable when bytes
+   arrive, for poll(), select() or epoll - it must only be waited on,
+   as the bytes must go through PHY_get or PHY_getWaiting.
+   Returns the handle, or -1 if the port is not open, or the version
+   in use has no such handle - use PHY_waitAny then.  */
+int PHY_handle(PHY_context *phy);
+
+/* PHY_time function, to read the clock used by this layer.
+   The link layer uses this for all its timers, so a simulation
+   can run in virtual time, faster than the real clock.
+   Returns time in microseconds, from a monotonic clock.  */
+long long PHY_time(void);
+
+/* PHY_setSeed function, to make the simulated errors repeatable.
+   PHY_open seeds them from the time, so call this after PHY_open.
+   Arguments: port state; seed, 0 to seed from the time.  */
+void PHY_setSeed(PHY_context *phy, unsigned long seed);
+
+/* PHY_setBurst function, to simulate bursts of errors, using the
+   Gilbert-Elliott model: the probability of error given to PHY_open
+   applies between bursts, and the lengths of bursts and of the gaps
+   between them are random.  Call this after PHY_open.
+   Arguments: port state; probability per bit of a burst starting,
+              and of it ending; probability of bit error in a burst.
+   Returns 0, or negative if any probability is not valid.  */
+int PHY_setBurst(PHY_context *phy, double probStart, double probEnd,
+                 double probErrBurst);
+
+/* PHY_setRate function, to change the bit rate of an open port,
+   keeping its other settings.  Bytes already sent leave at the old
+   rate first.  Both ends must change, as bytes sent at one rate are
+   rubbish when received at another.
+   Arguments: port state; new bit rate.
+   Returns zero if it succeeds - anything non-zero is a problem.  */
+int PHY_setRate(PHY_context *phy, int bitRate);
 
 /* Function to print informative error messages
    when something goes wrong...  */
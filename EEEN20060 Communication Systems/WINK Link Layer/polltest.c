@@ -0,0 +1,327 @@
+/* EEEN20060 Communication Systems, event loop test
+   This program serves several links from one thread at each end,
+   through the loopback physical layer (loop-physical.c): the sending
+   end uses ports 1, 3, 5..., and the receiving end 2, 4, 6...
+   Each thread connects its links, one pair at a time, then runs an
+   event loop:  it waits in LL_waitAny() until a link has bytes or a
+   timer due, and serves only those links with LL_onReadable(), which
+   never waits.  The sender puts a block on each busy link whenever
+   LL_canSend() says there is room.
+   Only some of the links are busy - the others are connected but
+   idle, and should never need serving, so they cost nothing.
+   The table shows how many times each link was served at each end.
+   The loopback runs in virtual time, so the times shown are the
+   times the transfer would take on the lines, and the processor
+   time shows the work done for it.
+   Optional arguments: number of links, number of them busy, blocks
+   for each busy link, block size, bit rate, one-way latency in ms. */
+
+typedef unsigned char byte;
+
+#include <stdio.h>  // standard input-output library
+#include <stdlib.h>  // for atoi
+#include <time.h>  // for clock, to measure processor time
+#ifdef _WIN32
+#include <windows.h>  // for thread functions
+#define THREAD_RESULT DWORD WINAPI  // type of thread function
+#else
+#include <pthread.h>  // for thread functions
+#define THREAD_RESULT void *  // type of thread function
+#endif
+#include "linklayer.h"  // link layer functions
+#include "physical.h"  // physical layer functions
+#include "loop-physical.h"  // to set the latency
+
+#define TEST_MAXLINKS 8  // pairs of ports the loopback can open
+#define TEST_LINKS 8  // default number of links
+#define TEST_BUSY 4  // default number of links that send blocks
+#define TEST_BLOCKS 100  // default blocks on each busy link
+#define BLOCK_SIZE 200  // default data bytes in each block
+#define TEST_RATE 9600  // default bit rate, bit/s
+#define TEST_LATENCY 20  // default one-way latency, ms
+#define TEST_SEED 1  // seed for simulated errors
+#define TEST_STEP 100  // longest wait once all blocks are in, ms
+
+/* Settings and results, shared by the two threads */
+typedef struct PollTest
+{
+    int nLinks;         // links at each end
+    int nBusy;          // links that send blocks, the first ones
+    int nBlocks;        // blocks to send on each busy link
+    int blockSize;      // data bytes in each block
+    int bitRate;        // bit rate, bit/s
+    long latency;       // one-way latency, us
+    volatile int sendDone;  // set when the sender has finished
+    int sendResult;     // 0 if all blocks were sent, negative otherwise
+    int nGot, nBad;     // blocks received, and received wrong
+    long servedA[TEST_MAXLINKS];  // times each link was served, sender
+    long servedB[TEST_MAXLINKS];  // and receiver
+    long passesA, passesB;  // times round each event loop
+    long long startTime;    // simulated time sending started, us
+    long long endTime;      // simulated time last block arrived, us
+} PollTest;
+
+// Function prototypes
+THREAD_RESULT sender(void *arg);
+THREAD_RESULT receiver(void *arg);
+int setupLinks(PollTest *test, LL_context **links, unsigned long seed);
+int checkBlock(PollTest *test, byte *block, int nData, int link, int n);
+void fillBlock(byte *block, int nByte, long offset);
+
+static LL_context linksA[TEST_MAXLINKS], linksB[TEST_MAXLINKS];  // large
+
+
+int main(int argc, char *argv[])
+{
+    PollTest test = {0};  // settings and results
+    double seconds;  // simulated time for transfer
+    clock_t cpuStart;  // processor time at start
+    double cpuTime;  // processor time used, s
+    int i;  // for use in loop
+#ifdef _WIN32
+    HANDLE threads[2];  // sender and receiver threads
+#else
+    pthread_t threads[2];  // sender and receiver threads
+#endif
+
+    test.nLinks = (argc > 1) ? atoi(argv[1]) : TEST_LINKS;
+    test.nBusy = (argc > 2) ? atoi(argv[2]) : TEST_BUSY;
+    test.nBlocks = (argc > 3) ? atoi(argv[3]) : TEST_BLOCKS;
+    test.blockSize = (argc > 4) ? atoi(argv[4]) : BLOCK_SIZE;
+    test.bitRate = (argc > 5) ? atoi(argv[5]) : TEST_RATE;
+    test.latency = 1000L * ((argc > 6) ? atoi(argv[6]) : TEST_LATENCY);
+    if (test.nBusy > test.nLinks) test.nBusy = test.nLinks;
+    if ((test.nLinks < 1) || (test.nLinks > TEST_MAXLINKS)
+        || (test.nBusy < 1) || (test.nBlocks < 1) || (test.blockSize < 1)
+        || (test.blockSize > MAX_BLK) || (test.bitRate < 1)
+        || (test.latency < 0))
+    {
+        printf("Arguments: links 1 to %d, busy links, blocks on each, "
+               "block size up to %d, bit rate, latency ms\n",
+               TEST_MAXLINKS, MAX_BLK);
+        return 1;
+    }
+    printf("Event Loop Test: %d links, %d busy, %d blocks of %d bytes "
+           "each, %d bit/s, latency %ld ms\n", test.nLinks, test.nBusy,
+           test.nBlocks, test.blockSize, test.bitRate,
+           test.latency / 1000);
+
+    for (i = 0; i < test.nLinks; i++)
+    {
+        LL_init(&linksA[i], 2*i + 1);
+        LL_init(&linksB[i], 2*i + 2);
+        if ((LL_setLine(&linksA[i], test.bitRate, 0.0, 0) < 0)
+            || (LL_setLine(&linksB[i], test.bitRate, 0.0, 0) < 0))
+        {
+            printf("Test: Could not set up links\n");
+            return 1;
+        }
+    }
+    PHY_expectPorts(2);  // hold the clock until the first pair is open
+    cpuStart = clock();
+
+#ifdef _WIN32
+    threads[0] = CreateThread(NULL, 0, sender, &test, 0, NULL);
+    threads[1] = CreateThread(NULL, 0, receiver, &test, 0, NULL);
+    if ((threads[0] == NULL) || (threads[1] == NULL))
+    {
+        printf("Test: Could not start threads\n");
+        return 1;
+    }
+    WaitForMultipleObjects(2, threads, TRUE, INFINITE);
+    CloseHandle(threads[0]);
+    CloseHandle(threads[1]);
+#else
+    if ((pthread_create(&threads[0], NULL, sender, &test) != 0)
+        || (pthread_create(&threads[1], NULL, receiver, &test) != 0))
+    {
+        printf("Test: Could not start threads\n");
+        return 1;
+    }
+    pthread_join(threads[0], NULL);
+    pthread_join(threads[1], NULL);
+#endif
+    cpuTime = (double) (clock() - cpuStart) / CLOCKS_PER_SEC;
+
+    printf("\nlink  ports  blocks  served_tx  served_rx\n");
+    for (i = 0; i < test.nLinks; i++)
+        printf("%4d  %2d/%-2d  %6d  %9ld  %9ld\n", i + 1, 2*i + 1, 2*i + 2,
+               (i < test.nBusy) ? test.nBlocks : 0, test.servedA[i],
+               test.servedB[i]);
+
+    seconds = (double) (test.endTime - test.startTime) / 1.0E6;
+    if (seconds <= 0.0) seconds = 1.0E-6;
+    printf("\n%d blocks in %.1f s on the lines, %.0f bit/s in all, "
+           "%ld and %ld passes of the event loops, %.3f s of "
+           "processor time\n", test.nGot, seconds,
+           8.0 * test.nGot * test.blockSize / seconds, test.passesA,
+           test.passesB, cpuTime);
+    if ((test.sendResult < 0) || (test.nBad > 0)
+        || (test.nGot < test.nBusy * test.nBlocks))
+    {
+        printf("Test: Transfer failed, %d blocks received, %d wrong\n",
+               test.nGot, test.nBad);
+        return 1;
+    }
+    return 0;
+}
+
+
+/* Thread function to send the blocks on the busy links, from one
+   event loop, until every block has been acknowledged.
+   Argument: pointer to the test settings.  */
+THREAD_RESULT sender(void *arg)
+{
+    PollTest *test = arg;  // settings and results
+    LL_context *links[TEST_MAXLINKS];  // links to serve
+    int ready[TEST_MAXLINKS];  // 1 for each link to serve
+    int sent[TEST_MAXLINKS] = {0};  // blocks sent on each link
+    byte dataSend[MAX_BLK];  // block to send
+    byte *view;  // block received - none are expected
+    int nData;  // size of block received
+    int busy;  // 1 while blocks are being sent, or not acknowledged
+    int i, retVal;  // for use in loop, and return value from functions
+
+    for (i = 0; i < test->nLinks; i++) links[i] = &linksA[i];
+    retVal = setupLinks(test, links, TEST_SEED);
+    test->startTime = PHY_time();
+    while (retVal >= 0)
+    {
+        // Put blocks on each busy link while it has room
+        busy = 0;
+        for (i = 0; (i < test->nBusy) && (retVal >= 0); i++)
+        {
+            while ((sent[i] < test->nBlocks) && LL_canSend(links[i]))
+            {
+                fillBlock(dataSend, test->blockSize,
+                          (long) sent[i] * test->blockSize + i);
+                retVal = LL_send(links[i], dataSend, test->blockSize, 0);
+                if (retVal < 0) break;
+                sent[i]++;
+            }
+            if ((sent[i] < test->nBlocks) || (links[i]->nOutstanding > 0))
+                busy = 1;
+        }
+        if ((retVal < 0) || !busy) break;
+
+        // Wait for acks, or a timer, then serve only the links ready
+        retVal = LL_waitAny(links, test->nLinks, ready, -1);
+        test->passesA++;
+        for (i = 0; (i < test->nLinks) && (retVal >= 0); i++)
+        {
+            if (!ready[i]) continue;
+            test->servedA[i]++;
+            do retVal = LL_onReadable(links[i], &view, &nData, 0);
+            while (retVal > 0);
+        }
+    }
+
+    test->sendResult = (retVal < 0) ? retVal : 0;
+    test->sendDone = 1;
+    for (i = 0; i < test->nLinks; i++)
+        if (links[i]->connected) LL_discon(links[i], 0);
+    return 0;
+}
+
+
+/* Thread function to receive and check the blocks on every link,
+   from one event loop.  After the last block, it keeps the links
+   going until the sender has finished, so any acknowledgements that
+   were lost can be repeated.
+   Argument: pointer to the test settings.  */
+THREAD_RESULT receiver(void *arg)
+{
+    PollTest *test = arg;  // settings and results
+    LL_context *links[TEST_MAXLINKS];  // links to serve
+    int ready[TEST_MAXLINKS];  // 1 for each link to serve
+    int got[TEST_MAXLINKS] = {0};  // blocks received on each link
+    byte *view;  // block received
+    int nData;  // size of block received
+    int nTotal = test->nBusy * test->nBlocks;  // blocks to receive
+    int i, retVal;  // for use in loop, and return value from functions
+
+    for (i = 0; i < test->nLinks; i++) links[i] = &linksB[i];
+    retVal = setupLinks(test, links, TEST_SEED + TEST_MAXLINKS);
+    if (retVal < 0) test->sendResult = retVal;  // nothing received
+    while ((retVal >= 0) && !test->sendDone)
+    {
+        retVal = LL_waitAny(links, test->nLinks, ready,
+                            (test->nGot < nTotal) ? -1 : TEST_STEP);
+        test->passesB++;
+        for (i = 0; (i < test->nLinks) && (retVal >= 0); i++)
+        {
+            if (!ready[i]) continue;
+            test->servedB[i]++;
+            while ((retVal = LL_onReadable(links[i], &view, &nData, 0)) > 0)
+            {
+                if (!checkBlock(test, view, nData, i, got[i])) test->nBad++;
+                got[i]++;
+                if (++test->nGot == nTotal)
+                    test->endTime = PHY_time();  // not counting the wait
+            }
+        }
+    }
+
+    for (i = 0; i < test->nLinks; i++)
+        if (links[i]->connected) LL_discon(links[i], 0);
+    return 0;
+}
+
+
+/* Function to connect the links at one end, in turn, and set up the
+   simulated line from each port: latency, and the seed for the errors.
+   Arguments: settings, links to connect, seed for their errors.
+   Return value is 0 on success, negative on failure.  */
+int setupLinks(PollTest *test, LL_context **links, unsigned long seed)
+{
+    int i;  // for use in loop
+
+    for (i = 0; i < test->nLinks; i++)
+    {
+        if ((LL_connect(links[i], 0) < 0)
+            || (PHY_setLatency(links[i]->phy, test->latency) < 0))
+        {
+            printf("Test: Could not set up link on port %d\n",
+                   links[i]->portNum);
+            return -1;
+        }
+        PHY_setSeed(links[i]->phy, seed + i);
+    }
+    return 0;
+}
+
+
+/* Function to check a block received, against the one sent.
+   Arguments: settings, block, number of bytes, link number from 0,
+              number of blocks received on that link before this.
+   Returns 1 if the block is right, 0 if not.  */
+int checkBlock(PollTest *test, byte *block, int nData, int link, int n)
+{
+    byte expected[MAX_BLK];  // block that should have been received
+    int i;  // for use in loop
+
+    if ((nData != test->blockSize) || (link >= test->nBusy)
+        || (n >= test->nBlocks)) return 0;
+    fillBlock(expected, nData, (long) n * test->blockSize + link);
+    for (i = 0; i < nData; i++)
+        if (block[i] != expected[i]) return 0;
+    return 1;
+}
+
+
+/* Function to fill a block with bytes that depend on their position
+   in the data sent, so the receiver can check them.  Each byte is a
+   hash of its position.
+   Arguments: block, number of bytes, position of first byte.  */
+void fillBlock(byte *block, int nByte, long offset)
+{
+    unsigned long x;  // hash of position
+    int i;  // for use in loop
+
+    for (i = 0; i < nByte; i++)
+    {
+        x = ((unsigned long) (offset + i) * 2654435761UL) & 0xFFFFFFFFUL;
+        x ^= x >> 15;
+        block[i] = (byte) (x >> 8);
+    }
+}
@@ -0,0 +1,646 @@
+/*  Physical Layer functions using serial port, for POSIX systems
+    such as Linux.
+       PHY_open    opens and configures the port
+       PHY_close   closes the port
+       PHY_send    sends bytes
+       PHY_get     gets received bytes
+       PHY_getWaiting  gets the bytes already received, without waiting
+       PHY_sendAsync   starts sending bytes, without waiting
+       PHY_sendPoll    checks progress of sends started by PHY_sendAsync
+       PHY_wait        waits until received bytes are available
+       PHY_waitAny     waits until bytes are available on any of a list
+       PHY_handle      gives the file descriptor of the port
+       PHY_time        reads the monotonic clock
+       PHY_setRate     changes the bit rate of an open port
+    All functions print explanatory messages if there is
+    a problem, and return values to indicate failure.
+    This version uses termios to configure the port, and epoll to
+    wait for bytes, so waiting does not use the processor.  Waiting on
+    several ports uses poll(), as the list may change on every call.
+    Port numbers 1 to 99 are /dev/ttyS0 to /dev/ttyS98,
+    port numbers 101 upwards are /dev/ttyUSB0 upwards.  */
+
+#include <stdio.h>   // needed for printf
+#include <string.h>  // for strerror
+#include <stdlib.h>  // for calloc and free
+#include <time.h>    // for clock_gettime
+#include <errno.h>   // for error codes
+#include <fcntl.h>   // for open function
+#include <unistd.h>  // for read, write and close functions
+#include <termios.h>  // for serial port settings
+#include <sys/epoll.h>  // for waiting for bytes
+#include <poll.h>    // for waiting for bytes on several ports
+
+typedef unsigned char byte;  // defined by windows.h on Windows
+
+#include "physical.h"  // header file for these functions
+#include "channel.h"   // for simulated errors
+
+
+/* State of one port - shared by the functions in this file,
+   with one copy for each port in use.  */
+struct PHY_context
+{
+    int serial;         // file descriptor for serial port
+    int pollFd;         // epoll descriptor, to wait for bytes
+    ErrChannel rxChan;  // simulated errors, used in PHY_get()
+    int rxTimeConst;    // rx timeout constant in ms
+    int rxTimeIntv;     // rx timeout interval in ms
+    int timeMult;       // rx and tx timeout multiplier in ms/byte
+    void (*sendCallback)(void *arg, byte *dataTx, int nBytesSent);
+    void *sendArg;      // argument to pass to sendCallback
+};
+
+// Function to find time in ms, for timeouts
+static long timeNow(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (long) t.tv_sec * 1000 + t.tv_nsec / 1000000;
+}
+
+// Function to find the termios code for a valid bit rate
+static speed_t speedCode(int bitRate)
+{
+    switch (bitRate)
+    {
+        case 1200:  return B1200;
+        case 2400:  return B2400;
+        case 4800:  return B4800;
+        case 9600:  return B9600;
+        case 19200: return B19200;
+        default:    return B38400;
+    }
+}
+
+// Function to wait for the port to be ready, up to time limit in ms
+static int waitPort(PHY_context *phy, int events, int timeLimit)
+{
+    struct epoll_event ev;  // event to wait for
+    int retVal;  // return value from epoll_wait
+
+    ev.events = events;
+    ev.data.fd = phy->serial;
+    epoll_ctl(phy->pollFd, EPOLL_CTL_MOD, phy->serial, &ev);  // direction
+    do
+    {
+        retVal = epoll_wait(phy->pollFd, &ev, 1, timeLimit);
+    }
+    while ((retVal < 0) && (errno == EINTR));  // retry if interrupted
+    return retVal;
+}
+
+//===================================================================
+/* PHY_create function, to create the state for one port.
+   Returns pointer to the state, or NULL if no memory.  */
+PHY_context *PHY_create(void)
+{
+    PHY_context *phy = calloc(1, sizeof(PHY_context));  // all zero
+    if (phy == NULL)
+    {
+        printf("PHY: No memory for port state\n");
+        return NULL;
+    }
+    phy->serial = -1;   // port not open yet
+    phy->pollFd = -1;
+    return phy;
+}
+
+//===================================================================
+/* PHY_destroy function, to free the state for one port.
+   Argument: port state, may be NULL.  */
+void PHY_destroy(PHY_context *phy)
+{
+    free(phy);
+}
+
+//===================================================================
+/* PHY_open function - to open and configure the serial port.
+   Arguments are port state, port number, bit rate, number of data bits,
+   parity, receive timeout constant, rx timeout interval,
+   rx probability of error.
+   See comments below for more detail on timeouts.
+   Returns zero if it succeeds - anything non-zero is a problem.*/
+int PHY_open(PHY_context *phy, // port state, from PHY_create
+             int portNum,       // port number: e.g. 1 for /dev/ttyS0
+             int bitRate,       // bit rate: e.g. 1200, 4800, etc.
+             int nDataBits,     // number of data bits: 7 or 8
+             int parity,        // parity: 0 = none, 1 = odd, 2 = even
+             int rxTimeConstant,  // rx timeout constant in ms: 0 waits forever
+             int rxTimeInterval,  // rx timeout interval in ms: 0 waits forever
+             double probErr)    // rx probability of error: 0.0 for none
+{
+    // Define variables
+    int bitRatio, bitRatioValid, i;  // for bit rate checking
+    struct termios serialParams;  // settings for serial port
+    struct epoll_event ev;  // event to wait for
+    speed_t speed;  // bit rate code for termios
+    char portName[32];  // string to hold port name
+
+    // First check that parameters given are valid - first bit rate
+    bitRatio = bitRate/1200;  // all valid rates are multiples of 1200
+    if (bitRate != bitRatio*1200) // bit rate is not multiple of 1200
+    {
+        printf("PHY: Invalid bit rate requested: %d\n", bitRate);
+        return 3;
+    }
+    bitRatioValid = 0;
+    for (i=1; i<=32; i*=2)
+    {
+        if (bitRatio == i)   // restrict to ratios that are powers of 2
+            bitRatioValid = 1;
+    }
+    if (bitRatioValid==0)
+    {
+        printf("PHY: Invalid bit rate requested: %d\n", bitRate);
+        return 3;
+    }
+    speed = speedCode(bitRate);  // termios uses codes for bit rates
+
+    // now check number of data bits
+    if ((nDataBits!=7) && (nDataBits!= 8))
+    {
+        printf("PHY: Invalid number of data bits: %d\n", nDataBits);
+        return 3;
+    }
+
+    // now check parity
+    if ((parity<0) || (parity>2))
+    {
+        printf("PHY: Invalid parity requested: %d\n", parity);
+        return 3;
+    }
+
+    // Make port name string, from port number
+    if (portNum > 100) sprintf(portName, "/dev/ttyUSB%d", portNum - 101);
+    else sprintf(portName, "/dev/ttyS%d", portNum - 1);
+
+    // Try to open the port, without waiting on reads or writes
+    phy->serial = open(portName, O_RDWR | O_NOCTTY | O_NONBLOCK);
+    // Check for failure
+    if (phy->serial < 0)
+    {
+        printf("PHY: Failed to open port %s\n", portName);
+        printError();  // give details of the error
+        return 1;  // non-zero return value indicates error
+    }
+
+    // Get the parameters of the port, and check for failure
+    if (tcgetattr(phy->serial, &serialParams) != 0)
+    {
+        printf("PHY: Error getting port parameters\n");
+        printError();  // give details of the error
+        close(phy->serial);
+        phy->serial = -1;
+        return 2;
+    }
+
+    /* Change the parameters to configure the port as required,
+       without interpreting or substituting any characters,
+       and with no added flow control.  */
+    cfmakeraw(&serialParams);  // no processing of bytes
+    cfsetispeed(&serialParams, speed);  // bit rate
+    cfsetospeed(&serialParams, speed);
+    serialParams.c_cflag &= ~(CSIZE | PARENB | PARODD | CSTOPB | CRTSCTS);
+    serialParams.c_cflag |= (nDataBits == 7) ? CS7 : CS8;  // data bits
+    if (parity == 1) serialParams.c_cflag |= PARENB | PARODD;  // odd
+    if (parity == 2) serialParams.c_cflag |= PARENB;  // even
+    serialParams.c_cflag |= CLOCAL | CREAD;  // ignore modem signals
+    serialParams.c_iflag &= ~(IXON | IXOFF | IXANY | INPCK);  // no XON/XOFF
+    serialParams.c_cc[VMIN] = 0;   // reads return at once - the time
+    serialParams.c_cc[VTIME] = 0;  // limits are handled in PHY_get
+
+    // Apply the new parameters to the port
+    if (tcsetattr(phy->serial, TCSANOW, &serialParams) != 0)
+    {
+        printf("PHY: Error setting port parameters\n");
+        printError();  // give details of the error
+        close(phy->serial);
+        phy->serial = -1;
+        return 4;
+    }
+
+/*  Time limits work as in the Windows version.  A read returns when
+    the requested number of bytes has arrived, or when the total time
+    allowed has passed:  rxTimeConst + multiplier * no. bytes requested,
+    or when the time interval between bytes exceeds rxTimeIntv.
+    A time constant of 0 waits forever, and forces the multiplier to 0.
+    The multiplier is derived from the bit rate, allowing 11 bits per
+    byte.  Writes are allowed 100 ms + multiplier * no. bytes.
+    These are the same limits as VMIN and VTIME would give, but with
+    ms resolution rather than 0.1 s, and with a total time limit.  */
+    phy->timeMult = 1 + 11000/bitRate;  // 10 ms at 1200, 1 ms above 9600 bit/s
+    phy->rxTimeConst = rxTimeConstant;
+    phy->rxTimeIntv = rxTimeInterval;
+
+    // Set up epoll, to wait for bytes without using the processor
+    phy->pollFd = epoll_create(1);
+    ev.events = EPOLLIN;
+    ev.data.fd = phy->serial;
+    if ((phy->pollFd < 0)
+        || (epoll_ctl(phy->pollFd, EPOLL_CTL_ADD, phy->serial, &ev) != 0))
+    {
+        printf("PHY: Error setting up epoll\n");
+        printError();  // give details of the error
+        close(phy->serial);
+        phy->serial = -1;
+        return 5;
+    }
+
+    // Clear the receive buffer, in case there is rubbish waiting
+    if (tcflush(phy->serial, TCIFLUSH) != 0)
+    {
+        printf("PHY: Error purging receive buffer\n");
+        printError();  // give details of the error
+        PHY_close(phy);
+        return 6;
+    }
+
+    // Set up simulated errors on receive path, seeded from the time
+    chanInit(&phy->rxChan, probErr);
+
+    // If we get this far, the port is open and configured
+    return 0;
+}
+
+//===================================================================
+/* PHY_close function, to close the serial port.
+   Argument: port state.  Returns 0 always.  */
+int PHY_close(PHY_context *phy)
+{
+    if (phy->serial >= 0)
+    {
+        tcdrain(phy->serial);  // let any bytes waiting be sent
+        close(phy->serial);
+    }
+    if (phy->rxChan.nErrors > 0)
+        printf("PHY: %ld bits changed by simulated errors\n",
+               phy->rxChan.nErrors);
+    if (phy->pollFd >= 0) close(phy->pollFd);
+    phy->serial = -1;
+    phy->pollFd = -1;
+    return 0;
+}
+
+//===================================================================
+/* PHY_send function, to send bytes.
+   Arguments: port state; pointer to array holding bytes to be sent;
+              number of bytes to send.
+   Returns number of bytes sent, or negative value on error.  */
+int PHY_send(PHY_context *phy, byte *dataTx, int nBytesToSend)
+{
+    int nBytesSent = 0;  // number of bytes sent so far
+    int retVal;  // return value from write
+    long timeLimit;  // time limit for sending, in ms
+
+    // First check if the port is open
+    if (phy->serial < 0)
+    {
+        printf("PHY: Port not valid\n");
+        return -9;  // negative return value indicates error
+    }
+
+    // Keep writing until all bytes are taken, or time is up
+    timeLimit = timeNow() + 100 + phy->timeMult * nBytesToSend;
+    while (nBytesSent < nBytesToSend)
+    {
+        retVal = write(phy->serial, dataTx + nBytesSent,
+                       nBytesToSend - nBytesSent);
+        if (retVal > 0)
+        {
+            nBytesSent += retVal;
+            continue;
+        }
+        if ((retVal < 0) && (errno != EAGAIN) && (errno != EINTR))
+        {
+            printf("PHY: Error sending data\n");
+            printError();  // give details of the error
+            return -5;
+        }
+
+        // Output buffer is full - wait for room
+        if (timeNow() >= timeLimit) break;  // timeout
+        if (waitPort(phy, EPOLLOUT, (int) (timeLimit - timeNow())) < 0)
+        {
+            printf("PHY: Error sending data\n");
+            printError();  // give details of the error
+            return -5;
+        }
+    }
+
+    if (nBytesSent != nBytesToSend)  // check for timeout
+    {
+        printf("PHY: Timeout in transmission, sent %d of %d bytes\n",
+               nBytesSent, nBytesToSend);
+    }
+    return nBytesSent; // if no error, return number of bytes sent
+    // note that timeout is not regarded as error
+}
+
+//===================================================================
+/* PHY_sendAsync function, to start sending bytes.
+   The bytes are copied to the output buffer of the port, and then
+   sent while the caller does other work, so the send is finished
+   as far as the caller is concerned.  This calls PHY_send, and then
+   the send callback, if set.
+   Arguments: port state; pointer to array holding bytes to be sent;
+              number of bytes to send.
+   Returns number of bytes sent, or negative value on error.  */
+int PHY_sendAsync(PHY_context *phy, byte *dataTx, int nBytesToSend)
+{
+    int nBytesSent = PHY_send(phy, dataTx, nBytesToSend);
+    if ((nBytesSent >= 0) && (phy->sendCallback != NULL))
+        phy->sendCallback(phy->sendArg, dataTx, nBytesSent);
+    return nBytesSent;
+}
+
+//===================================================================
+/* PHY_sendPoll function, to check sends started by PHY_sendAsync.
+   Sends are finished when PHY_sendAsync returns, so there are never
+   any in progress.  If asked to wait, waits until the output buffer
+   of the port is empty.
+   Returns 0 always.  */
+int PHY_sendPoll(PHY_context *phy, int wait)
+{
+    if (wait && (phy->serial >= 0)) tcdrain(phy->serial);
+    return 0;
+}
+
+//===================================================================
+/* PHY_setSendCallback function, to set a function to be called
+   when a send is complete.
+   Arguments: port state; pointer to function, or NULL for none;
+              pointer to pass to the function.  */
+void PHY_setSendCallback(PHY_context *phy,
+                         void (*callback)(void *arg, byte *dataTx,
+                                          int nBytesSent),
+                         void *arg)
+{
+    phy->sendCallback = callback;
+    phy->sendArg = arg;
+}
+
+//===================================================================
+/* PHY_get function, to get received bytes.
+   Arguments: port state; pointer to array to hold received bytes;
+              maximum number of bytes to get.
+   Returns number of bytes actually got, or negative value on error.  */
+int PHY_get(PHY_context *phy, byte *dataRx, int nBytesToGet)
+{
+     int nBytesGot = 0;  // number of bytes got so far
+     int retVal;        // return value from other functions
+     long timeTotal;    // time limit for whole read, in ms
+     long timeLimit;    // time limit for next byte, in ms
+
+    // First check if the port is open
+    if (phy->serial < 0)
+    {
+        printf("PHY: Port not valid\n");
+        return -9;  // negative return value indicates error
+    }
+
+    // Work out the total time limit, -1 if none
+    if (phy->rxTimeConst == 0) timeTotal = -1;
+    else timeTotal = timeNow() + phy->rxTimeConst + phy->timeMult * nBytesToGet;
+
+    // Try to get bytes as requested
+    while (nBytesGot < nBytesToGet)
+    {
+        retVal = read(phy->serial, dataRx + nBytesGot, nBytesToGet - nBytesGot);
+        if (retVal > 0)
+        {
+            nBytesGot += retVal;
+            continue;
+        }
+        if ((retVal < 0) && (errno != EAGAIN) && (errno != EINTR))
+        {
+            printf("PHY: Error receiving data\n");
+            printError();  // give details of the error
+            return -4;
+        }
+
+        // Nothing waiting - find how long to wait for the next byte
+        timeLimit = timeTotal;
+        if ((nBytesGot > 0) && (phy->rxTimeIntv > 0))  // interval limit
+        {
+            if ((timeLimit < 0) || (timeNow() + phy->rxTimeIntv < timeLimit))
+                timeLimit = timeNow() + phy->rxTimeIntv;
+        }
+        if ((timeLimit >= 0) && (timeNow() >= timeLimit)) break;  // timeout
+
+        retVal = waitPort(phy, EPOLLIN,
+                          (timeLimit < 0) ? -1 : (int) (timeLimit - timeNow()));
+        if (retVal < 0)
+        {
+            printf("PHY: Error receiving data\n");
+            printError();  // give details of the error
+            return -4;
+        }
+        if (retVal == 0) break;  // timeout
+    }
+    // No need to complain about timeout here - will happen regularly
+
+    // Add errors, with specified probability
+    if (nBytesGot > 0) chanApply(&phy->rxChan, dataRx, nBytesGot);
+
+    return nBytesGot; // if no problem, return number of bytes we got
+}
+
+//===================================================================
+/* PHY_getWaiting function, to get the bytes already received,
+   without waiting for more.
+   Arguments: port state; pointer to array to hold received bytes;
+              maximum number of bytes to get.
+   Returns number of bytes got, 0 if none are waiting,
+   or negative value on error.  */
+int PHY_getWaiting(PHY_context *phy, byte *dataRx, int nBytesToGet)
+{
+    int nBytesGot = 0;  // number of bytes got so far
+    int retVal;        // return value from read
+
+    // First check if the port is open
+    if (phy->serial < 0)
+    {
+        printf("PHY: Port not valid\n");
+        return -9;  // negative return value indicates error
+    }
+
+    // The port does not block, so read until nothing is left
+    while (nBytesGot < nBytesToGet)
+    {
+        retVal = read(phy->serial, dataRx + nBytesGot, nBytesToGet - nBytesGot);
+        if (retVal > 0) nBytesGot += retVal;
+        else if ((retVal < 0) && (errno == EINTR)) continue;  // try again
+        else if ((retVal < 0) && (errno != EAGAIN))
+        {
+            printf("PHY: Error receiving data\n");
+            printError();  // give details of the error
+            return -4;
+        }
+        else break;  // no more bytes waiting
+    }
+
+    // Add errors, with specified probability
+    if (nBytesGot > 0) chanApply(&phy->rxChan, dataRx, nBytesGot);
+    return nBytesGot;
+}
+
+//===================================================================
+/* PHY_wait function, to wait until received bytes are available.
+   Uses epoll, so the processor is free while waiting.
+   Arguments: port state; max time to wait in ms, 0 to just check.
+   Returns 1 if bytes are available, 0 if time limit reached,
+   or negative value on error. */
+int PHY_wait(PHY_context *phy, int timeLimit)
+{
+    int retVal;  // return value from waitPort
+
+    // First check if the port is open
+    if (phy->serial < 0)
+    {
+        printf("PHY: Port not valid\n");
+        return -9;  // negative return value indicates error
+    }
+
+    retVal = waitPort(phy, EPOLLIN, (timeLimit < 0) ? 0 : timeLimit);
+    if (retVal < 0)
+    {
+        printf("PHY: Error waiting for data\n");
+        printError();  // give details of the error
+        return -4;
+    }
+    return (retVal > 0) ? 1 : 0;
+}
+
+//===================================================================
+/* PHY_waitAny function, to wait until received bytes are available
+   on any of a list of ports.  Uses poll(), so the processor is free
+   while waiting.
+   Arguments: array of port states; number of ports; array set to 1
+              for each port with bytes available, 0 for the others;
+              max time to wait in ms, 0 to just check, -1 for no limit.
+   Returns number of ports with bytes available, 0 if time limit
+   reached, or negative value on error.  */
+int PHY_waitAny(PHY_context **phys, int nPorts, int *ready, int timeLimit)
+{
+    struct pollfd fds[PHY_MAXWAIT];  // ports to wait on
+    int retVal;  // return value from poll
+    int i;  // for use in loop
+
+    if ((nPorts < 1) || (nPorts > PHY_MAXWAIT))
+    {
+        printf("PHY: Cannot wait on %d ports\n", nPorts);
+        return -8;
+    }
+    for (i = 0; i < nPorts; i++)
+    {
+        if (phys[i]->serial < 0)
+        {
+            printf("PHY: Port not valid\n");
+            return -9;  // negative return value indicates error
+        }
+        fds[i].fd = phys[i]->serial;
+        fds[i].events = POLLIN;
+        fds[i].revents = 0;
+    }
+
+    do
+    {
+        retVal = poll(fds, nPorts, (timeLimit < 0) ? -1 : timeLimit);
+    }
+    while ((retVal < 0) && (errno == EINTR));  // retry if interrupted
+    if (retVal < 0)
+    {
+        printf("PHY: Error waiting for data\n");
+        printError();  // give details of the error
+        return -4;
+    }
+
+    // A port with an error is marked too, so the next read reports it
+    for (i = 0; i < nPorts; i++) ready[i] = (fds[i].revents != 0);
+    return retVal;
+}
+
+//===================================================================
+/* PHY_handle function, to give the file descriptor of the port,
+   for poll(), select() or epoll in the caller's event loop.
+   Argument: port state.
+   Returns the file descriptor, or -1 if the port is not open.  */
+int PHY_handle(PHY_context *phy)
+{
+    return phy->serial;
+}
+
+//===================================================================
+/* PHY_time function, to read the clock used by this layer.
+   This is wall-clock time, which does not jump if the date is changed.
+   Returns time in microseconds.  */
+long long PHY_time(void)
+{
+    struct timespec t;  // seconds and nanoseconds
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (long long) t.tv_sec * 1000000 + t.tv_nsec / 1000;
+}
+
+//===================================================================
+/* PHY_setSeed function, to make the simulated errors repeatable.
+   Arguments: port state; seed, 0 to seed from the time.  */
+void PHY_setSeed(PHY_context *phy, unsigned long seed)
+{
+    chanSeed(&phy->rxChan, seed);
+}
+
+//===================================================================
+/* PHY_setBurst function, to simulate bursts of errors.
+   Arguments: port state; probability per bit of a burst starting,
+              and of it ending; probability of bit error in a burst.
+   Returns 0, or negative if any probability is not valid.  */
+int PHY_setBurst(PHY_context *phy, double probStart, double probEnd,
+                 double probErrBurst)
+{
+    return chanBurst(&phy->rxChan, probStart, probEnd, probErrBurst);
+}
+
+//===================================================================
+/* PHY_setRate function, to change the bit rate of an open port.
+   The change waits for bytes already sent to leave (TCSADRAIN),
+   and the time limit multiplier follows the new rate.
+   Arguments: port state; new bit rate.
+   Returns zero if it succeeds - anything non-zero is a problem.*/
+int PHY_setRate(PHY_context *phy, int bitRate)
+{
+    struct termios serialParams;  // settings for serial port
+    int bitRatio = bitRate/1200;  // valid rates are 1200 * power of 2
+
+    if ((bitRatio < 1) || (bitRatio > 32) || (bitRate != bitRatio*1200)
+        || ((bitRatio & (bitRatio - 1)) != 0))
+    {
+        printf("PHY: Invalid bit rate requested: %d\n", bitRate);
+        return 3;
+    }
+
+    if (tcgetattr(phy->serial, &serialParams) != 0)
+    {
+        printf("PHY: Error getting port parameters\n");
+        printError();  // give details of the error
+        return 2;
+    }
+    cfsetispeed(&serialParams, speedCode(bitRate));
+    cfsetospeed(&serialParams, speedCode(bitRate));
+    if (tcsetattr(phy->serial, TCSADRAIN, &serialParams) != 0)
+    {
+        printf("PHY: Error setting port parameters\n");
+        printError();  // give details of the error
+        return 4;
+    }
+    phy->timeMult = 1 + 11000/bitRate;
+    return 0;
+}
+
+/* Function to print informative error messages
+   when something goes wrong...  */
+void printError(void)
+{
+    int errCode = errno;  // get the error code for the last error
+    printf("PHY: Code %d = %s\n", errCode, strerror(errCode));
+}
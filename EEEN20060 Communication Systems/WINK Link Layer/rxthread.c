@@ -0,0 +1,319 @@
+/*  Receive thread for the link layer - see rxthread.h.
+       LL_startRxThread  starts a thread that serves the link
+       LL_stopRxThread   stops it again
+       LL_rxWaiting      gives the number of blocks waiting
+       LL_setRxHooks     sets hooks for a virtual clock, as in the loopback
+    The lock is recursive, as link layer functions call each other,
+    and each takes the lock.  A thread that wants the lock counts
+    itself in wanted while it waits, and the receive thread does not
+    take the lock again while that is above zero, so the program
+    gets the lock as soon as the receive thread's poll is over.
+    A physical layer with a virtual clock can be told, through the
+    hooks set by LL_setRxHooks(), when the thread starts and stops,
+    and when either thread waits for the lock.
+    The queue is a ring of slots, as in logging.c: head is moved on
+    with release order once a slot is filled, and tail once the
+    program has finished with a block, so neither side needs the
+    lock to see the other's slots.  The block at the tail stays in
+    its slot until the next call to rxPop, so LL_receiveView can
+    give its location, as it does for a block in a received frame.  */
+
+typedef unsigned char byte;
+
+#include <stdio.h>     // for printf
+#include <stdlib.h>    // for calloc and free
+#include <string.h>    // for memcpy
+#ifdef _WIN32
+#include <windows.h>   // for thread, lock and Sleep functions
+#else
+#include <pthread.h>   // for thread and lock functions
+#include <unistd.h>    // for usleep function
+#define Sleep(ms) usleep((ms) * 1000)  // same as Windows version
+#endif
+#include "linklayer.h" // link layer functions
+#include "rxthread.h"  // these functions
+
+/* Hooks for a physical layer with a virtual clock, or NULL.  */
+static void (*shareHook)(struct PHY_context *phy, int on) = NULL;
+static void (*pauseHook)(struct PHY_context *phy, int on) = NULL;
+
+/* State of the receive thread and its queue, for one link.  */
+typedef struct RxThread
+{
+    byte data[RXQ_BLOCKS][MAX_BLK];  // blocks waiting for LL_receive
+    int size[RXQ_BLOCKS];   // size of each block
+    atomic_uint head;       // number of blocks added, by the lock holder
+    atomic_uint tail;       // number of blocks taken, by the program
+    int held;               // 1 if the program has the block at tail
+    atomic_int wanted;      // threads waiting for the lock
+    atomic_int stop;        // set to stop the thread
+    atomic_int failed;      // error code, if the link failed
+    int debug;              // debug argument for the thread's calls
+#ifdef _WIN32
+    CRITICAL_SECTION lock;  // lock on the link state - recursive
+    HANDLE thread;          // the receive thread
+#else
+    pthread_mutex_t lock;   // lock on the link state - recursive
+    pthread_t thread;       // the receive thread
+#endif
+} RxThread;
+
+//===================================================================
+/* Function for the receive thread - serves the link while nobody
+   else wants it, until told to stop or the link fails.  */
+#ifdef _WIN32
+static DWORD WINAPI rxMain(void *arg)
+#else
+static void *rxMain(void *arg)
+#endif
+{
+    LL_context *ll = arg;  // link to serve
+    RxThread *rt = ll->rxThread;  // state of this thread
+    int retVal = 0;  // return value from serviceLink
+
+    if (shareHook != NULL) shareHook(ll->phy, 1);
+    while (!atomic_load(&rt->stop))
+    {
+        if (atomic_load(&rt->wanted) > 0)  // let the program have it
+        {
+            Sleep(1);
+            continue;
+        }
+        rxLock(ll);
+        retVal = serviceLink(ll, NULL, NULL, RXT_POLL, rt->debug);
+        rxUnlock(ll);
+        if (retVal < 0) break;
+    }
+    if (shareHook != NULL) shareHook(ll->phy, 0);
+    if (retVal < 0)
+    {
+        printf("LLRT: Link failed, receive thread stopped\n");
+        atomic_store(&rt->failed, retVal);
+    }
+    return 0;
+}
+
+//===================================================================
+/* Function to start the receive thread for a link, once connected.
+   Any block waiting for LL_receive is moved to the queue.
+   Return value is 0 on success, negative on failure.  */
+int LL_startRxThread(LL_context *ll, int debug)
+{
+    RxThread *rt;  // state of the new thread
+#ifndef _WIN32
+    pthread_mutexattr_t attr;  // to make the lock recursive
+#endif
+
+    if (ll->connected == 0)
+    {
+        printf("LLRT: Attempt to start receive thread while not connected\n");
+        return -10;  // error code
+    }
+    if (ll->rxThread != NULL)
+    {
+        printf("LLRT: Receive thread already running\n");
+        return -14;  // error code
+    }
+    rt = calloc(1, sizeof(RxThread));  // queue starts empty
+    if (rt == NULL)
+    {
+        printf("LLRT: No memory for receive thread\n");
+        return -17;  // error code
+    }
+    rt->debug = debug;
+#ifdef _WIN32
+    InitializeCriticalSection(&rt->lock);
+#else
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&rt->lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+#endif
+
+    // Block that arrived while sending goes first in the queue
+    ll->rxThread = rt;
+    if (ll->rxPendingSize >= 0)
+    {
+        rxPush(ll, ll->rxPending, ll->rxPendingSize);
+        ll->rxPendingSize = -1;
+    }
+
+#ifdef _WIN32
+    rt->thread = CreateThread(NULL, 0, rxMain, ll, 0, NULL);
+    if (rt->thread == NULL)
+#else
+    if (pthread_create(&rt->thread, NULL, rxMain, ll) != 0)
+#endif
+    {
+        printf("LLRT: Could not start receive thread\n");
+        ll->rxThread = NULL;
+        if (atomic_load(&rt->head) > 0)  // put the block back
+        {
+            memcpy(ll->rxPending, rt->data[0], rt->size[0]);
+            ll->rxPendingSize = rt->size[0];
+        }
+#ifdef _WIN32
+        DeleteCriticalSection(&rt->lock);
+#else
+        pthread_mutex_destroy(&rt->lock);
+#endif
+        free(rt);
+        return -17;  // error code
+    }
+    if (debug) printf("LLRT: Receive thread started on port %d\n",
+                      ll->portNum);
+    return 0;
+}
+
+//===================================================================
+/* Function to stop the receive thread.  Blocks still in the queue
+   are lost.  Must not be called while holding the lock.
+   Return value is 0, or the error code if the thread had stopped
+   because the link failed.  */
+int LL_stopRxThread(LL_context *ll, int debug)
+{
+    RxThread *rt = ll->rxThread;  // state of the thread
+    int nLeft;  // blocks not taken by the program
+    int failed;  // error code, if the link failed
+
+    if (rt == NULL) return 0;  // not running
+    atomic_store(&rt->stop, 1);
+    if (pauseHook != NULL) pauseHook(ll->phy, 1);  // it may be waiting
+#ifdef _WIN32
+    WaitForSingleObject(rt->thread, INFINITE);
+    CloseHandle(rt->thread);
+    DeleteCriticalSection(&rt->lock);
+#else
+    pthread_join(rt->thread, NULL);
+    pthread_mutex_destroy(&rt->lock);
+#endif
+    if (pauseHook != NULL) pauseHook(ll->phy, 0);
+    nLeft = LL_rxWaiting(ll);
+    if (nLeft > 0) printf("LLRT: %d blocks received were not used\n", nLeft);
+    failed = atomic_load(&rt->failed);
+    ll->rxThread = NULL;
+    free(rt);
+    if (debug) printf("LLRT: Receive thread stopped\n");
+    return failed;
+}
+
+//===================================================================
+/* Function to give the number of blocks that LL_receive can return
+   without waiting.  Only for the program's thread, as it counts the
+   block it holds.
+   Return value is the number of blocks, or negative if the receive
+   thread has stopped because the link failed and none are left.  */
+int LL_rxWaiting(LL_context *ll)
+{
+    RxThread *rt = ll->rxThread;  // state of the thread
+    int n;  // blocks waiting
+
+    if (rt == NULL) return (ll->rxPendingSize >= 0) ? 1 : 0;
+    n = (int) (atomic_load_explicit(&rt->head, memory_order_acquire)
+               - atomic_load_explicit(&rt->tail, memory_order_relaxed))
+        - rt->held;
+    if (n == 0) return atomic_load(&rt->failed);
+    return n;
+}
+
+//===================================================================
+/* Function to set the hooks for a physical layer with a virtual
+   clock - see rxthread.h.  */
+void LL_setRxHooks(void (*share)(struct PHY_context *phy, int on),
+                   void (*pause)(struct PHY_context *phy, int on))
+{
+    shareHook = share;
+    pauseHook = pause;
+}
+
+//===================================================================
+/* Function to take the lock on the link state, if the receive thread
+   is running - otherwise there is only one thread, and nothing to do.
+   Can be taken again by the thread holding it, with one rxUnlock()
+   for each rxLock().  */
+void rxLock(LL_context *ll)
+{
+    RxThread *rt = ll->rxThread;  // state of the thread
+
+    if (rt == NULL) return;
+    atomic_fetch_add(&rt->wanted, 1);
+    if (pauseHook != NULL) pauseHook(ll->phy, 1);
+#ifdef _WIN32
+    EnterCriticalSection(&rt->lock);
+#else
+    pthread_mutex_lock(&rt->lock);
+#endif
+    if (pauseHook != NULL) pauseHook(ll->phy, 0);
+    atomic_fetch_sub(&rt->wanted, 1);
+}
+
+//===================================================================
+/* Function to give up the lock on the link state.  */
+void rxUnlock(LL_context *ll)
+{
+    RxThread *rt = ll->rxThread;  // state of the thread
+
+    if (rt == NULL) return;
+#ifdef _WIN32
+    LeaveCriticalSection(&rt->lock);
+#else
+    pthread_mutex_unlock(&rt->lock);
+#endif
+}
+
+//===================================================================
+/* Function to give the error code if the receive thread stopped
+   because the link failed, so the program hears of it.
+   Returns 0 if the thread is running, or not used.  */
+int rxFailed(LL_context *ll)
+{
+    if (ll->rxThread == NULL) return 0;
+    return atomic_load(&ll->rxThread->failed);
+}
+
+//===================================================================
+/* Function to add a block to the queue, while holding the lock.
+   Arguments: pointer to link state, block, number of bytes.
+   Returns 1 if added, 0 if the queue is full.  */
+int rxPush(LL_context *ll, byte *data, int nData)
+{
+    RxThread *rt = ll->rxThread;  // state of the thread
+    unsigned int head = atomic_load_explicit(&rt->head,
+                                             memory_order_relaxed);
+    int slot = head % RXQ_BLOCKS;  // slot to fill
+
+    if (head - atomic_load_explicit(&rt->tail, memory_order_acquire)
+        >= RXQ_BLOCKS) return 0;  // full - program is behind
+    memcpy(rt->data[slot], data, nData);
+    rt->size[slot] = nData;
+    atomic_store_explicit(&rt->head, head + 1, memory_order_release);
+    return 1;
+}
+
+//===================================================================
+/* Function to take the next block from the queue, in the program's
+   thread.  The block taken last time is given back first.
+   Arguments: pointer to link state, pointer to pointer which is set
+              to the start of the block.
+   Returns the number of bytes in the block, or -1 if there is none,
+   or the receive thread is not running.  */
+int rxPop(LL_context *ll, byte **data)
+{
+    RxThread *rt = ll->rxThread;  // state of the thread
+    unsigned int tail;  // number of blocks taken
+    int slot;  // slot of next block
+
+    if (rt == NULL) return -1;
+    tail = atomic_load_explicit(&rt->tail, memory_order_relaxed);
+    if (rt->held)  // program has finished with the last one
+    {
+        atomic_store_explicit(&rt->tail, ++tail, memory_order_release);
+        rt->held = 0;
+    }
+    if (tail == atomic_load_explicit(&rt->head, memory_order_acquire))
+        return -1;  // empty
+    slot = tail % RXQ_BLOCKS;
+    *data = rt->data[slot];
+    rt->held = 1;
+    return rt->size[slot];
+}
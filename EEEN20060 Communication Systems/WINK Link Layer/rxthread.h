@@ -0,0 +1,77 @@
+#ifndef RXTHREAD_H_INCLUDED
+#define RXTHREAD_H_INCLUDED
+
+/*  Receive thread for the link layer, so the line is still served
+    while the program is busy with other work.
+       LL_startRxThread  starts a thread that serves the link
+       LL_stopRxThread   stops it again
+       LL_rxWaiting      gives the number of blocks waiting
+       LL_setRxHooks     sets hooks for a virtual clock, as in the loopback
+    While the thread runs, it takes bytes from the physical layer,
+    checks and acknowledges frames and processes acknowledgements,
+    exactly as serviceLink() does when called by LL_receive, and
+    puts each block received into a queue of RXQ_BLOCKS blocks.
+    LL_receive then takes the next block from the queue, and only
+    waits, up to the receiver waiting time, if the queue is empty.
+    The link state is shared using a lock: the thread holds it for
+    up to RXT_POLL at a time, and gives it up as soon as the program
+    calls a link layer function, which then serves the link itself
+    until it returns.  So the thread only runs while the program is
+    busy elsewhere, and the program can block for no longer than
+    RXT_POLL, waiting for the lock.
+    The queue has one consumer, the program's thread, which takes
+    blocks without the lock.  Blocks are only added by the thread
+    holding the lock, so there is one producer at a time.  */
+
+#include "linklayer.h"  // for the link state
+
+#define RXQ_BLOCKS MOD_SEQNUM  // blocks the queue can hold
+#define RXT_POLL 0.005         // longest time the thread holds the lock
+
+/* Function to start the receive thread for a link, once connected.
+   Any block waiting for LL_receive is moved to the queue.
+   Return value is 0 on success, negative on failure.  */
+int LL_startRxThread(LL_context *ll, int debug);
+
+/* Function to stop the receive thread.  Blocks still in the queue
+   are lost.  LL_discon() calls this, if the thread is running.
+   Return value is 0, or the error code if the thread had stopped
+   because the link failed.  */
+int LL_stopRxThread(LL_context *ll, int debug);
+
+/* Function to give the number of blocks that LL_receive can return
+   without waiting, so the program can check without blocking.
+   Return value is the number of blocks, or negative if the receive
+   thread has stopped because the link failed and none are left.  */
+int LL_rxWaiting(LL_context *ll);
+
+/* Function to set hooks for a physical layer with a virtual clock,
+   which must know when each thread using a port is waiting.  The
+   receive thread calls share(phy, 1) as it starts to serve the link,
+   and share(phy, 0) as it stops, and either thread calls pause(phy, 1)
+   and pause(phy, 0) around waiting for the lock, or for the receive
+   thread to stop.  The loopback has PHY_share() and PHY_pause() for
+   this - see loop-physical.h.  Both are NULL at first, for none.
+   The hooks serve every link, so set them before starting a thread.  */
+void LL_setRxHooks(void (*share)(struct PHY_context *phy, int on),
+                   void (*pause)(struct PHY_context *phy, int on));
+
+// ==========================================================
+// Functions used by the link layer functions
+
+// Function to take the lock on the link state, if the thread runs.
+void rxLock(LL_context *ll);
+
+// Function to give up the lock on the link state.
+void rxUnlock(LL_context *ll);
+
+// Function to give the error code if the thread stopped, 0 if not.
+int rxFailed(LL_context *ll);
+
+// Function to add a block to the queue - returns 0 if it is full.
+int rxPush(LL_context *ll, byte *data, int nData);
+
+// Function to take the next block from the queue, -1 if none.
+int rxPop(LL_context *ll, byte **data);
+
+#endif // RXTHREAD_H_INCLUDED
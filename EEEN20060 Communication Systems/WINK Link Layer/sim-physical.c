@@ -1,34 +1,81 @@
 /*  Simulated Physical Layer functions for serial port communication.
        PHY_open    initialises
        PHY_close   does nothing
-       PHY_send    puts bytes into an array, with random bytes at start
+       PHY_send    puts bytes into an array, with random bytes at start,
+                   taking the time the bytes would take on the line
        PHY_get     gets bytes from the array, adding random errors
+       PHY_sendAsync   same as PHY_send, as the array is filled at once
+       PHY_sendPoll    nothing to check, as sends finish at once
+       PHY_getWaiting  gets bytes from the array, without waiting
+       PHY_wait        waits until bytes are in the array
+       PHY_waitAny     waits until bytes are in the array of any port
+       PHY_handle      gives no handle, as there is no device
+       PHY_time        reads the real clock
+       PHY_setRate     changes the time each byte takes
     All functions print explanatory messages if there is
     a problem, and return values to indicate failure. */
 
 
 #include <stdio.h>   // needed for printf
-#include <stdlib.h>  // for random number functions
-#include <time.h>    // for time function, used to seed rand
+#include <stdlib.h>  // for calloc and free
+#include <time.h>    // for clock_gettime
+#ifdef _WIN32
 #include <windows.h>    // for Sleep function
+#define SleepMicros(us) Sleep((us) / 1000)  // Windows sleeps in ms
+#else
+#include <unistd.h>     // for usleep function
+#define Sleep(ms) usleep((ms) * 1000)  // same as Windows version
+#define SleepMicros(us) usleep(us)
+typedef unsigned char byte;  // defined by windows.h on Windows
+#endif
 #include "physical.h"  // header file for these functions
+#include "channel.h"   // for simulated errors
+#include "logging.h"   // for messages that could come often
 
-#define BUFSIZE 2000    // size of array to hold bytes
+#define BUFSIZE 32768   // size of array to hold bytes, a window of frames
 
-/* Creating a variable this way allows it to be shared
-   by the functions in this file only.  */
-static byte buffer[BUFSIZE];    // array to hold bytes
-static int nBytesWritten = 0;   // number of bytes written to buffer
-static int nBytesUsed = 0;      // number of bytes read from buffer
-static int rxTimeLimit = 0;     // time limit for PHY_get()
-static double rxProbErr = 0.0;  // probability of error for PHY_get()
+/* State of one port - shared by the functions in this file,
+   with one copy for each port in use.  */
+struct PHY_context
+{
+    byte buffer[BUFSIZE];   // array to hold bytes
+    int nBytesWritten;      // number of bytes written to buffer
+    int nBytesUsed;         // number of bytes read from buffer
+    int rxTimeLimit;        // time limit for PHY_get()
+    ErrChannel rxChan;      // simulated errors, and random bytes
+    int byteTime;           // time to send one byte in us, 0 for none
+    int byteBits;           // bits on the line for each byte
+    void (*sendCallback)(void *arg, byte *dataTx, int nBytesSent);
+    void *sendArg;          // argument to pass to sendCallback
+};
+
+//===================================================================
+/* PHY_create function, to create the state for one port.
+   Returns pointer to the state, or NULL if no memory.  */
+PHY_context *PHY_create(void)
+{
+    PHY_context *phy = calloc(1, sizeof(PHY_context));  // all zero
+    if (phy == NULL) printf("PHY SIM: No memory for port state\n");
+    return phy;
+}
 
+//===================================================================
+/* PHY_destroy function, to free the state for one port.
+   Argument: port state, may be NULL.  */
+void PHY_destroy(PHY_context *phy)
+{
+    free(phy);
+}
+
+//===================================================================
 /* PHY_open function - would open and configure the serial port.
-   Arguments are port number, bit rate, number of data bits, parity,
-   receive timeout constant, rx timeout interval, rx probability of error.
+   Arguments are port state, port number, bit rate, number of data bits,
+   parity, receive timeout constant, rx timeout interval,
+   rx probability of error.
    See comments below for more detail on timeouts.
    Returns zero if it succeeds - anything non-zero is a problem.*/
-int PHY_open(int portNum,       // port number: e.g. 1 for COM1, 5 for COM5
+int PHY_open(PHY_context *phy, // port state, from PHY_create
+             int portNum,       // port number: e.g. 1 for COM1, 5 for COM5
              int bitRate,       // bit rate: e.g. 1200, 4800, etc.
              int nDataBits,     // number of data bits: 7 or 8
              int parity,        // parity: 0 = none, 1 = odd, 2 = even
@@ -36,19 +83,24 @@ int PHY_open(int portNum,       // port number: e.g. 1 for COM1, 5 for COM5
              int rxTimeIntv,    // rx timeout interval in ms: 0 waits forever
              double probErr)    // rx probability of error: 0.0 for none
 {
+    (void) portNum;  // not needed here
+
     // Set the byte counters to 0
-    nBytesWritten = 0;
-    nBytesUsed = 0;
+    phy->nBytesWritten = 0;
+    phy->nBytesUsed = 0;
 
     // Set up receive time limit - very rough approximation!
-    rxTimeLimit = rxTimeConst + rxTimeIntv;
+    phy->rxTimeLimit = rxTimeConst + rxTimeIntv;
+
+    // Find the time to send each byte: start bit, data bits,
+    // parity bit if used, and one stop bit
+    phy->byteBits = 2 + nDataBits + (parity != 0);
+    if (bitRate > 0)
+        phy->byteTime = (int) (phy->byteBits * 1000000L / bitRate);
+    else phy->byteTime = 0;  // no delay
 
-    /* Set up simulated errors on receive path:
-       Set the seed for the random number generator,
-       and check the probability of error value. */
-    srand(time(NULL));  // get time and use as seed
-    if ((probErr>=0.0) && (probErr<=1.0))  // check valid
-        rxProbErr = probErr; // pass value to shared variable
+    // Set up simulated errors, seeded from the time
+    chanInit(&phy->rxChan, probErr);
 
     // In simulation, this always succeeds
     return 0;
@@ -56,93 +108,121 @@ int PHY_open(int portNum,       // port number: e.g. 1 for COM1, 5 for COM5
 
 //===================================================================
 /* PHY_close function, would close the serial port,
-    but does nothing in simulation.
-   Takes no arguments, returns 0 always.  */
-int PHY_close()
+    but only reports the simulated errors in simulation.
+   Argument: port state.  Returns 0 always.  */
+int PHY_close(PHY_context *phy)
 {
+    if (phy->rxChan.nErrors > 0)
+        printf("PHY SIM: %ld bits changed by simulated errors\n",
+               phy->rxChan.nErrors);
     return 0;
 }
 
 //===================================================================
 /* PHY_send function, to send bytes.
-   Arguments: pointer to array holding bytes to be sent;
+   Arguments: port state; pointer to array holding bytes to be sent;
               number of bytes to send.
    Returns number of bytes sent, or negative value on error.  */
-int PHY_send(byte *dataTx, int nBytesToSend)
+int PHY_send(PHY_context *phy, byte *dataTx, int nBytesToSend)
 {
      int nBytesSent;    // number of bytes actually sent
      int i;             // used in for loops
-     int threshold = 0;  // threshold for error simulation
-     int flip;          // bits to change in simulating error
-     byte byteTx;
 
     // If this is start of frame, put some random bytes in array
-    if (nBytesWritten == 0)
+    if (phy->nBytesWritten == 0)
     {
-        nBytesWritten = 4 + (rand() % 16);  // number of bytes to add
-        for (i=0; i<nBytesWritten; i++)
+        phy->nBytesWritten = 4 + chanRandom(&phy->rxChan) % 16;  // how many
+        for (i=0; i<phy->nBytesWritten; i++)
         {
-            buffer[i] = rand() % 200;  // put random bytes in buffer
+            phy->buffer[i] = chanRandom(&phy->rxChan) % 200;  // random bytes
         }
     }
 
     // Check if there is room in the array
-    if (nBytesWritten + nBytesToSend > BUFSIZE) // not enough room
+    if (phy->nBytesWritten + nBytesToSend > BUFSIZE) // not enough room
     {
-        nBytesSent = BUFSIZE - nBytesWritten;  // send what we can
-        printf("PHY SIM: Buffer full\n");
+        nBytesSent = BUFSIZE - phy->nBytesWritten;  // send what we can
+        LOG(LOG_WARN, "PHY SIM: Buffer full\n");
     }
     else
     {
         nBytesSent = nBytesToSend;  // will send all the bytes
     }
 
-    // Set threshold for adding errors
-    if (rxProbErr != 0.0)
-        // set threshold as fraction of max, scaling for 8 bit bytes
-        threshold = 1 + (int)(8.0 * (double)RAND_MAX * rxProbErr);
-    else
-        threshold = 0;
-
-
     // Now copy the bytes into the storage array, adding errors
     for (i=0; i<nBytesSent; i++)
     {
-        byteTx = dataTx[i];
-        if (rand() < threshold)  // want to cause an error
-        {
-            flip = rand() % 8;  // random integer 0 to 7
-            flip = 1 << flip; // bit pattern: single 1 in random place
-            byteTx ^= (byte) flip;  // invert one bit
-            printf("PHY_send: #### Simulated error... ####\n");
-        }
-        buffer[nBytesWritten+i] = byteTx;
+        phy->buffer[phy->nBytesWritten+i] = dataTx[i];
     }
+    chanApply(&phy->rxChan, phy->buffer + phy->nBytesWritten, nBytesSent);
+
+    phy->nBytesWritten += nBytesSent; // update nBytesWritten
 
-    nBytesWritten += nBytesSent; // update nBytesWritten
+    // Take as long as the bytes would take to send on a real line
+    if (phy->byteTime > 0) SleepMicros(nBytesSent * phy->byteTime);
 
     return nBytesSent; // return number of bytes sent
 }
 
+//===================================================================
+/* PHY_sendAsync function, to start sending bytes.
+   In simulation, the send is finished at once, so this calls
+   PHY_send and then the send callback, if set.
+   Arguments: port state; pointer to array holding bytes to be sent;
+              number of bytes to send.
+   Returns number of bytes sent, or negative value on error.  */
+int PHY_sendAsync(PHY_context *phy, byte *dataTx, int nBytesToSend)
+{
+    int nBytesSent = PHY_send(phy, dataTx, nBytesToSend);
+    if (phy->sendCallback != NULL)
+        phy->sendCallback(phy->sendArg, dataTx, nBytesSent);
+    return nBytesSent;
+}
+
+//===================================================================
+/* PHY_sendPoll function, to check sends started by PHY_sendAsync.
+   In simulation, there are never any sends in progress.
+   Returns 0 always.  */
+int PHY_sendPoll(PHY_context *phy, int wait)
+{
+    (void) phy;  // not needed here
+    (void) wait;
+    return 0;
+}
+
+//===================================================================
+/* PHY_setSendCallback function, to set a function to be called
+   when a send is complete.
+   Arguments: port state; pointer to function, or NULL for none;
+              pointer to pass to the function.  */
+void PHY_setSendCallback(PHY_context *phy,
+                         void (*callback)(void *arg, byte *dataTx,
+                                          int nBytesSent),
+                         void *arg)
+{
+    phy->sendCallback = callback;
+    phy->sendArg = arg;
+}
+
 //===================================================================
 /* PHY_get function, to get received bytes.
-   Arguments: pointer to array to hold received bytes;
+   Arguments: port state; pointer to array to hold received bytes;
               maximum number of bytes to get.
    Returns number of bytes actually got, or negative value on error.  */
-int PHY_get(byte *dataRx, int nBytesToGet)
+int PHY_get(PHY_context *phy, byte *dataRx, int nBytesToGet)
 {
      int nBytesGot;      // number of bytes actually got
      int i;             // for use in loop
      int nBytesAvailable;
 
     // Check if there are bytes available
-    nBytesAvailable = nBytesWritten - nBytesUsed;
+    nBytesAvailable = phy->nBytesWritten - phy->nBytesUsed;
     if (nBytesAvailable == 0)  // no bytes available
     {
-        dataRx[0] = rand() % 256;   // get one random byte
-        if (rxTimeLimit == 0) // no time limit set
+        dataRx[0] = (byte) chanRandom(&phy->rxChan);  // one random byte
+        if (phy->rxTimeLimit == 0) // no time limit set
             Sleep(10000);   // should wait forever!
-        else Sleep(rxTimeLimit);  // if limit set, wait that long
+        else Sleep(phy->rxTimeLimit);  // if limit set, wait that long
         return 1;   // and return with just one byte
     }
 
@@ -156,21 +236,141 @@ int PHY_get(byte *dataRx, int nBytesToGet)
     // Copy bytes from storage array to receive data array
     for (i = 0; i < nBytesGot; i++)
     {
-        dataRx[i] = buffer[nBytesUsed+i]; // copy byte
+        dataRx[i] = phy->buffer[phy->nBytesUsed+i]; // copy byte
     }
 
-    nBytesUsed += nBytesGot;    // update the used byte counter
+    phy->nBytesUsed += nBytesGot;    // update the used byte counter
 
     // If we have used all the bytes, reset counters
-    if (nBytesUsed == nBytesWritten)
+    if (phy->nBytesUsed == phy->nBytesWritten)
     {
-        nBytesWritten = 0;
-        nBytesUsed = 0;
+        phy->nBytesWritten = 0;
+        phy->nBytesUsed = 0;
     }
 
     return nBytesGot; // if no problem, return number of bytes we got
 }
 
+//===================================================================
+/* PHY_getWaiting function, to get the bytes in the array, without
+   waiting - so no random byte is made up if there are none.
+   Arguments: port state; pointer to array to hold received bytes;
+              maximum number of bytes to get.
+   Returns number of bytes got, 0 if none are waiting.  */
+int PHY_getWaiting(PHY_context *phy, byte *dataRx, int nBytesToGet)
+{
+    if (phy->nBytesWritten == phy->nBytesUsed) return 0;  // none waiting
+    return PHY_get(phy, dataRx, nBytesToGet);
+}
+
+//===================================================================
+/* PHY_wait function, to wait until received bytes are available.
+   Arguments: port state; max time to wait in ms, 0 to just check.
+   Returns 1 if bytes are available, 0 if time limit reached.  */
+int PHY_wait(PHY_context *phy, int timeLimit)
+{
+    if (phy->nBytesWritten > phy->nBytesUsed) return 1;  // bytes available
+    if (timeLimit > 0) Sleep(timeLimit);  // nothing else can send bytes
+    return 0;
+}
+
+//===================================================================
+/* PHY_waitAny function, to wait until received bytes are available
+   on any of a list of ports.  Bytes only come from each port's own
+   sends, so nothing can arrive while waiting, as in PHY_wait.
+   Arguments: array of port states; number of ports; array set to 1
+              for each port with bytes available, 0 for the others;
+              max time to wait in ms, 0 to just check, -1 for no limit.
+   Returns number of ports with bytes available, 0 if time limit
+   reached, or negative value on error.  */
+int PHY_waitAny(PHY_context **phys, int nPorts, int *ready, int timeLimit)
+{
+    int nReady = 0;  // number of ports with bytes
+    int i;  // for use in loop
+
+    if ((nPorts < 1) || (nPorts > PHY_MAXWAIT))
+    {
+        printf("PHY SIM: Cannot wait on %d ports\n", nPorts);
+        return -8;
+    }
+    for (i = 0; i < nPorts; i++)
+    {
+        ready[i] = (phys[i]->nBytesWritten > phys[i]->nBytesUsed);
+        nReady += ready[i];
+    }
+    if (nReady > 0) return nReady;
+    if (timeLimit < 0) Sleep(10000);  // should wait forever!
+    else if (timeLimit > 0) Sleep(timeLimit);
+    return 0;
+}
+
+//===================================================================
+/* PHY_handle function, to give a handle the operating system can
+   wait on.  This is a simulation, so there is none.
+   Returns -1 always.  */
+int PHY_handle(PHY_context *phy)
+{
+    (void) phy;  // not needed here
+    return -1;
+}
+
+//===================================================================
+/* PHY_time function, to read the clock used by this layer.
+   This simulation runs in real time, so this is the real clock.
+   Returns time in microseconds.  */
+long long PHY_time(void)
+{
+#ifdef _WIN32
+    LARGE_INTEGER count, freq;  // counter value and counts per second
+    QueryPerformanceCounter(&count);
+    QueryPerformanceFrequency(&freq);
+    // split the division, to avoid overflow
+    return (count.QuadPart / freq.QuadPart) * 1000000
+           + (count.QuadPart % freq.QuadPart) * 1000000 / freq.QuadPart;
+#else
+    struct timespec t;  // seconds and nanoseconds
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (long long) t.tv_sec * 1000000 + t.tv_nsec / 1000;
+#endif
+}
+
+//===================================================================
+/* PHY_setSeed function, to make the simulated errors repeatable.
+   Arguments: port state; seed, 0 to seed from the time.  */
+void PHY_setSeed(PHY_context *phy, unsigned long seed)
+{
+    chanSeed(&phy->rxChan, seed);
+}
+
+//===================================================================
+/* PHY_setBurst function, to simulate bursts of errors.
+   Arguments: port state; probability per bit of a burst starting,
+              and of it ending; probability of bit error in a burst.
+   Returns 0, or negative if any probability is not valid.  */
+int PHY_setBurst(PHY_context *phy, double probStart, double probEnd,
+                 double probErrBurst)
+{
+    return chanBurst(&phy->rxChan, probStart, probEnd, probErrBurst);
+}
+
+//===================================================================
+/* PHY_setRate function, to change the bit rate of an open port.
+   Only the time taken by each byte changes in simulation.
+   Arguments: port state; new bit rate, 0 for no delay.
+   Returns zero if it succeeds - anything non-zero is a problem.*/
+int PHY_setRate(PHY_context *phy, int bitRate)
+{
+    if (bitRate < 0)
+    {
+        printf("PHY SIM: Invalid bit rate %d\n", bitRate);
+        return 3;
+    }
+    if (bitRate > 0)
+        phy->byteTime = (int) (phy->byteBits * 1000000L / bitRate);
+    else phy->byteTime = 0;  // no delay
+    return 0;
+}
+
 /* Function to print informative error messages
    when something goes wrong...  - does nothing here*/
 void printError(void)
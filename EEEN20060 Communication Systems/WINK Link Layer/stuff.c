@@ -0,0 +1,137 @@
+/*  Byte stuffing functions for the link layer.
+       findSpecial   finds the first protocol byte in a block
+       stuffBytes    copies a block, replacing each protocol byte
+                     by STUFFBYTE and the byte with STUFFXOR inverted
+       unstuffBytes  copies a block, undoing the byte stuffing
+    The search is on the path of every byte sent and received, so it
+    uses SSE2 (x86) or NEON (64-bit ARM) instructions where the
+    compiler supports them, comparing 16 bytes at a time against
+    each of the protocol byte values.  Other processors, and the
+    last few bytes of a block, use a simple loop.  */
+
+typedef unsigned char byte;
+
+#include <string.h>     // for memcpy
+#include "linklayer.h"  // protocol byte values
+#include "stuff.h"      // these functions
+
+#if defined(__SSE2__)
+#include <emmintrin.h>  // SSE2 instructions
+#define STUFF_SSE2
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>   // NEON instructions
+#define STUFF_NEON
+#endif
+
+// Test for protocol byte, for use in the simple loops
+#define IS_SPECIAL(b) (((b) == STARTBYTE) || ((b) == ENDBYTE) || ((b) == STUFFBYTE))
+
+//===================================================================
+/* Function to find the first protocol byte (STARTBYTE, ENDBYTE
+   or STUFFBYTE) in a block of bytes.
+   Arguments: pointer to bytes, number of bytes.
+   Returns position of first protocol byte, or nBytes if none.  */
+int findSpecial(const byte *data, int nBytes)
+{
+    int i = 0;  // position in block
+
+#if defined(STUFF_SSE2)
+    const __m128i vStart = _mm_set1_epi8((char) STARTBYTE);
+    const __m128i vEnd = _mm_set1_epi8((char) ENDBYTE);
+    const __m128i vStuff = _mm_set1_epi8((char) STUFFBYTE);
+    __m128i v, match;  // 16 bytes, and result of comparisons
+    int mask;  // one bit for each byte that matched
+
+    for (; i + 16 <= nBytes; i += 16)
+    {
+        v = _mm_loadu_si128((const __m128i *) (data + i));
+        match = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, vStart),
+                                          _mm_cmpeq_epi8(v, vEnd)),
+                             _mm_cmpeq_epi8(v, vStuff));
+        mask = _mm_movemask_epi8(match);
+        if (mask != 0) return i + __builtin_ctz(mask);  // first match
+    }
+#elif defined(STUFF_NEON)
+    const uint8x16_t vStart = vdupq_n_u8(STARTBYTE);
+    const uint8x16_t vEnd = vdupq_n_u8(ENDBYTE);
+    const uint8x16_t vStuff = vdupq_n_u8(STUFFBYTE);
+    uint8x16_t v, match;  // 16 bytes, and result of comparisons
+
+    for (; i + 16 <= nBytes; i += 16)
+    {
+        v = vld1q_u8(data + i);
+        match = vorrq_u8(vorrq_u8(vceqq_u8(v, vStart), vceqq_u8(v, vEnd)),
+                         vceqq_u8(v, vStuff));
+        if (vmaxvq_u8(match) != 0) break;  // found - loop below finds where
+    }
+#endif
+
+    // Simple loop for the remaining bytes
+    for (; i < nBytes; i++)
+    {
+        if (IS_SPECIAL(data[i])) break;
+    }
+    return i;
+}
+
+//===================================================================
+/* Function to copy a block of bytes, with byte stuffing.
+   Runs of ordinary bytes are found by findSpecial() and copied in
+   one step.  Each protocol byte becomes two bytes: STUFFBYTE, then
+   the byte with the STUFFXOR bits inverted, which is never itself
+   a protocol byte.
+   Arguments: array to hold stuffed bytes, bytes to copy, number of bytes.
+   Returns number of bytes put in the output array.  */
+int stuffBytes(byte *dataOut, const byte *dataIn, int nBytes)
+{
+    int nOut = 0;  // number of bytes in output
+    int nRun;  // number of ordinary bytes before next protocol byte
+
+    while (nBytes > 0)
+    {
+        nRun = findSpecial(dataIn, nBytes);
+        memcpy(dataOut + nOut, dataIn, nRun);  // copy ordinary bytes
+        nOut += nRun;
+        dataIn += nRun;
+        nBytes -= nRun;
+
+        if (nBytes > 0)  // protocol byte - replace by two bytes
+        {
+            dataOut[nOut++] = STUFFBYTE;
+            dataOut[nOut++] = (byte) (*dataIn++ ^ STUFFXOR);
+            nBytes--;
+        }
+    }
+    return nOut;
+}
+
+//===================================================================
+/* Function to copy a block of bytes made by stuffBytes(), undoing
+   the byte stuffing.  Runs of ordinary bytes are copied in one step,
+   as above.  Each STUFFBYTE is dropped, and the byte after it has
+   the STUFFXOR bits inverted again.
+   Arguments: array to hold bytes, stuffed bytes, number of bytes.
+   Returns number of bytes put in the output array.  */
+int unstuffBytes(byte *dataOut, const byte *dataIn, int nBytes)
+{
+    int nOut = 0;  // number of bytes in output
+    int nRun;  // number of ordinary bytes before next protocol byte
+
+    while (nBytes > 0)
+    {
+        nRun = findSpecial(dataIn, nBytes);
+        memcpy(dataOut + nOut, dataIn, nRun);  // copy ordinary bytes
+        nOut += nRun;
+        dataIn += nRun;
+        nBytes -= nRun;
+
+        if (nBytes > 1)  // stuff byte - the next byte is the one sent
+        {
+            dataOut[nOut++] = (byte) (dataIn[1] ^ STUFFXOR);
+            dataIn += 2;
+            nBytes -= 2;
+        }
+        else nBytes = 0;  // stuff byte at the end, with nothing after it
+    }
+    return nOut;
+}
@@ -0,0 +1,31 @@
+#ifndef STUFF_H_INCLUDED
+#define STUFF_H_INCLUDED
+
+/*  Byte stuffing functions for the link layer.
+       findSpecial   finds the first protocol byte in a block
+       stuffBytes    copies a block, replacing each protocol byte
+                     by STUFFBYTE and the byte with STUFFXOR inverted
+       unstuffBytes  copies a block, undoing the byte stuffing
+    The search uses SSE2 or NEON instructions where available,
+    checking 16 bytes per step, with a simple loop for other
+    processors and for the last few bytes.  */
+
+/* Function to find the first protocol byte (STARTBYTE, ENDBYTE
+   or STUFFBYTE) in a block of bytes.
+   Arguments: pointer to bytes, number of bytes.
+   Returns position of first protocol byte, or nBytes if none.  */
+int findSpecial(const byte *data, int nBytes);
+
+/* Function to copy a block of bytes, with byte stuffing.
+   The output array needs room for up to 2*nBytes bytes.
+   Arguments: array to hold stuffed bytes, bytes to copy, number of bytes.
+   Returns number of bytes put in the output array.  */
+int stuffBytes(byte *dataOut, const byte *dataIn, int nBytes);
+
+/* Function to copy a block of bytes made by stuffBytes(), undoing
+   the byte stuffing.  The output array needs room for nBytes bytes.
+   Arguments: array to hold bytes, stuffed bytes, number of bytes.
+   Returns number of bytes put in the output array.  */
+int unstuffBytes(byte *dataOut, const byte *dataIn, int nBytes);
+
+#endif // STUFF_H_INCLUDED
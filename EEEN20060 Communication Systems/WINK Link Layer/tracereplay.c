@@ -0,0 +1,324 @@
+/* EEEN20060 Communication Systems, trace replay
+   This program reads a trace file written by LL_traceStart() - see
+   linktrace.h - and feeds the bytes in it back through the receiving
+   functions of the link layer: getFrame(), decodeFrame() and
+   checkFrame(), with the settings recorded in the trace.  Bytes
+   received go through them just as they came from the line, so
+   bad frames and bytes thrown away while looking for a start marker
+   are found again, exactly as the link found them.  Frames sent are
+   read back the same way, to find their type and sequence number.
+   There is no physical layer in use and no waiting, so a trace of
+   a slow line is replayed at full speed.
+   It prints a line for each period of the trace - bytes on the line
+   each way, data frames sent and sent again, NAKs sent, new blocks
+   received, duplicates, bad frames and bytes thrown away - then the
+   totals, with the reasons frames were rejected, and the time the
+   replay took.  A block counts as new if it has the next sequence
+   number, starting from 0, so the trace should start before
+   LL_connect() - or with selective repeat, if it comes after a gap
+   and is not already held, as the receiver keeps it.
+   Optional arguments: name of the trace file, length of each
+   period in seconds, 1 to print every frame.
+   Returns 0 if the whole trace was read, 1 otherwise.  */
+
+typedef unsigned char byte;
+
+#include <stdio.h>  // standard input-output library
+#include <stdlib.h>  // for atoi and atof
+#include <string.h>  // for memset and memcpy
+#include <time.h>  // for clock
+#include "linklayer.h"  // link layer functions
+#include "linktrace.h"  // to read the trace
+#include "logging.h"  // to turn off messages about bad frames
+
+#define REPLAY_FILE "trace1.trc"  // default trace file
+#define REPLAY_PERIOD 1.0  // default period for each line, seconds
+
+// Counts for one period, or for the whole trace
+typedef struct Period
+{
+    long long txBytes, rxBytes;  // bytes each way, as on the line
+    long txData, txResent;  // data frames sent, and of those sent again
+    long txAcks, txNaks, txParams;  // other frames sent
+    long rxData, rxDup;  // new blocks received, and others
+    long rxAcks, rxNaks, rxParams;  // other frames received
+    long long rxBad;  // frames rejected, as the link counts them
+    long long rxResync;  // bytes thrown away, looking for a start marker
+    long long rxDataBytes;  // bytes in the new blocks, as sent
+} Period;
+
+// Function prototypes
+int readFrames(LL_context *ll, byte *bytes, int nBytes, int tx);
+long long badFrames(LL_context *ll, long long *resync);
+void countFrame(int tx, byte *frame, int nFrame, int good);
+void useSettings(byte *settings, double seconds);
+void printPeriod(Period *p, double start, double length);
+void printTotals(Period *p, double seconds);
+
+static LL_context txLink, rxLink;  // large, so not on stack
+static TraceRecord rec;  // record from the trace
+static Period now, total;  // counts for this period, and all
+static int nextTx = 0, nextRx = 0;  // next new sequence number each way
+static int heldTx[MOD_SEQNUM], heldRx[MOD_SEQNUM];  // 1 for each block
+                            // seen after a gap, until the gap fills
+static int selective = 0;  // 1 if the receiver holds blocks after a gap
+static int verbose = 0;  // 1 to print every frame
+static double recTime;  // time of this record, seconds
+
+
+int main(int argc, char *argv[])
+{
+    const char *fName = (argc > 1) ? argv[1] : REPLAY_FILE;
+    double period = (argc > 2) ? atof(argv[2]) : REPLAY_PERIOD;
+    FILE *fp;  // trace file
+    int portNum = 0;  // port of the link traced
+    double periodStart = 0.0;  // time this period started, seconds
+    long long nRecords = 0;  // records read
+    clock_t start;  // processor time at start of replay
+    double cpu;  // processor time for the replay, seconds
+    int retVal;  // return value from traceRead
+
+    verbose = (argc > 3) ? atoi(argv[3]) : 0;
+    if (period <= 0.0) period = REPLAY_PERIOD;
+    fp = fopen(fName, "rb");  // open for binary read
+    if (fp == NULL)
+    {
+        perror("Replay: Error opening trace file");
+        return 1;
+    }
+    logSetLevel(LOG_ERROR);  // bad frames are expected here
+    LL_init(&txLink, 0);
+    LL_init(&rxLink, 0);
+    printf("Trace Replay: %s\n", fName);
+
+    start = clock();
+    while ((retVal = traceRead(fp, &rec, &portNum)) > 0)
+    {
+        if (nRecords++ == 0)
+        {
+            printf("Port %d, periods of %g s\n\n", portNum, period);
+            printf("time_s  tx_bytes  rx_bytes  tx_data  resent  naks  "
+                   "rx_data  dup  bad  resync  goodput_bit_s\n");
+        }
+        recTime = rec.time / 1.0E6;
+        while (recTime >= periodStart + period)  // one line per period
+        {
+            printPeriod(&now, periodStart, period);
+            memset(&now, 0, sizeof(now));
+            periodStart += period;
+        }
+
+        if (rec.kind == TRACE_SET) useSettings(rec.data, recTime);
+        else if (rec.kind == TRACE_TX)
+        {
+            now.txBytes += rec.nData;
+            total.txBytes += rec.nData;
+            readFrames(&txLink, rec.data, rec.nData, 1);
+        }
+        else
+        {
+            now.rxBytes += rec.nData;
+            total.rxBytes += rec.nData;
+            readFrames(&rxLink, rec.data, rec.nData, 0);
+        }
+    }
+    cpu = (double) (clock() - start) / CLOCKS_PER_SEC;
+    fclose(fp);
+    if (nRecords == 0) return 1;  // not a trace, or nothing in it
+    printPeriod(&now, periodStart, recTime - periodStart);
+
+    printTotals(&total, recTime);
+    printf("Replayed %lld records in %.3f s of processor time, "
+           "%.0f times as fast as the line\n", nRecords, cpu,
+           (cpu > 0.0) ? recTime / cpu : 0.0);
+    return (retVal < 0) ? 1 : 0;
+}
+
+
+/* Function to take bytes through the receiving functions, as
+   serviceLink() does, and count each frame found.  The bytes are
+   put in the receive buffer, which getFrame() always empties when
+   it has no time to wait, and any part frame at the end is kept
+   for the bytes of the next record.
+   Arguments: link to use, bytes, number of bytes, 1 if sent.
+   Returns the number of frames found.  */
+int readFrames(LL_context *ll, byte *bytes, int nBytes, int tx)
+{
+    long long nBad, nResync;  // counts before, from the link's counters
+    long long nBadNow, nResyncNow;  // and after
+    int nFrame, nPlain;  // bytes in frame, and after correction
+    int nFound = 0;  // frames found
+
+    nBad = badFrames(ll, &nResync);
+    memcpy(ll->rxBuf, bytes, nBytes);
+    ll->rxHead = 0;
+    ll->rxCount = nBytes;
+    while ((nFrame = getFrame(ll, ll->rxFrame, MAX_FRAME, 0.0)) > 0)
+    {
+        nPlain = decodeFrame(ll, ll->rxFrame, nFrame);
+        if ((nPlain == 0) || (checkFrame(ll, ll->rxFrame, nPlain) == 0))
+            countFrame(tx, ll->rxFrame, nFrame, 0);
+        else countFrame(tx, ll->rxFrame, nPlain, 1);
+        nFound++;
+    }
+    if (!tx)
+    {
+        nBadNow = badFrames(ll, &nResyncNow);
+        now.rxBad += nBadNow - nBad;
+        total.rxBad += nBadNow - nBad;
+        now.rxResync += nResyncNow - nResync;
+        total.rxResync += nResyncNow - nResync;
+    }
+    return nFound;
+}
+
+
+/* Function to give the number of frames a link has rejected, from
+   its counters - including frames getFrame() cut off as too big,
+   which never reach the checks.
+   Arguments: link, pointer set to the bytes thrown away, looking for
+              a start marker.  */
+long long badFrames(LL_context *ll, long long *resync)
+{
+    LL_stats st;  // counters of the link
+
+    LL_getStats(ll, &st);
+    *resync = st.rxResync;
+    return st.rxBadFcs + st.rxBadMarker + st.rxBadCount + st.rxBadOther;
+}
+
+
+/* Function to count a frame found, in this period and the totals,
+   and print it if asked for.
+   Arguments: 1 if sent, 0 if received, the frame after correction,
+              number of bytes, 1 if it passed the checks.  */
+void countFrame(int tx, byte *frame, int nFrame, int good)
+{
+    LL_context *ll = tx ? &txLink : &rxLink;  // link that read it
+    int type = frame[TYPEPOS];  // type of frame
+    int seq = frame[SEQNUMPOS];  // sequence number
+    int nData = nFrame - HEADERSIZE - trailerSize(ll, DATA);  // block
+    int *next = tx ? &nextTx : &nextRx;  // next new sequence number
+    int *held = tx ? heldTx : heldRx;  // blocks seen after a gap
+    int dist = (seq - *next + MOD_SEQNUM) % MOD_SEQNUM;  // from next
+    int isNew = 0;  // 1 for a data frame with a block not seen before
+    Period *p;  // counts to add to
+    int i;  // for use in loop
+
+    if (good && ((type == DATA) || (type == ZDATA)))
+    {
+        // With selective repeat, a block after a gap is kept, so it is
+        // new too, and the next number moves past it once the gap fills
+        if (tx || !selective) isNew = (dist == 0);
+        else isNew = (dist < MOD_SEQNUM/2) && !held[seq];
+        if (isNew) held[seq] = 1;
+        while (held[*next])
+        {
+            held[*next] = 0;
+            *next = (*next + 1) % MOD_SEQNUM;
+        }
+    }
+    // Bad frames are counted from the link's counters, in readFrames()
+    for (i = 0; good && (i < 2); i++)
+    {
+        p = i ? &total : &now;
+        if ((type == DATA) || (type == ZDATA))
+        {
+            if (tx)
+            {
+                p->txData++;
+                if (!isNew) p->txResent++;
+            }
+            else if (isNew)
+            {
+                p->rxData++;
+                p->rxDataBytes += nData;
+            }
+            else p->rxDup++;
+        }
+        else if (type == GOOD)
+        {
+            if (tx) p->txAcks++;
+            else p->rxAcks++;
+        }
+        else if (type == BAD)
+        {
+            if (tx) p->txNaks++;
+            else p->rxNaks++;
+        }
+        else if (type == PARAM)
+        {
+            if (tx) p->txParams++;
+            else p->rxParams++;
+        }
+    }
+
+    if (!verbose) return;
+    if (!good) printf("%10.6f %s bad frame, %d bytes\n", recTime,
+                      tx ? "tx" : "rx", nFrame);
+    else if ((type == DATA) || (type == ZDATA))
+        printf("%10.6f %s %s seq %d, ack %d, %d bytes%s\n", recTime,
+               tx ? "tx" : "rx", (type == DATA) ? "DATA" : "ZDATA", seq,
+               frame[ACKPOS], nData, isNew ? "" : ", again");
+    else printf("%10.6f %s %s %d\n", recTime, tx ? "tx" : "rx",
+                (type == GOOD) ? "ACK" : (type == BAD) ? "NAK"
+                : (type == PARAM) ? "PARAM" : "type", seq);
+}
+
+
+/* Function to use the settings from a TRACE_SET record for the
+   frames that follow, each way, and print them.
+   Arguments: bytes of the record, time of the record, seconds.  */
+void useSettings(byte *settings, double seconds)
+{
+    long rate = ((long) settings[TRACE_SETRATE] << 24)
+                | ((long) settings[TRACE_SETRATE + 1] << 16)
+                | ((long) settings[TRACE_SETRATE + 2] << 8)
+                | settings[TRACE_SETRATE + 3];  // high byte first
+
+    txLink.fcsType = rxLink.fcsType = settings[TRACE_SETFCS];
+    txLink.fecParity = rxLink.fecParity = settings[TRACE_SETFEC];
+    selective = settings[TRACE_SETSEL];
+    printf("At %.3f s: check type %d, parity %d, compression %s, "
+           "window %d, %ld bit/s, %s\n", seconds, settings[TRACE_SETFCS],
+           settings[TRACE_SETFEC], settings[TRACE_SETCOMP] ? "on" : "off",
+           settings[TRACE_SETWIN], rate,
+           selective ? "selective repeat" : "Go-Back-N");
+}
+
+
+/* Function to print the counts for one period.
+   Arguments: counts, start and length of the period, seconds.  */
+void printPeriod(Period *p, double start, double length)
+{
+    printf("%6.1f  %8lld  %8lld  %7ld  %6ld  %4ld  %7ld  %3ld  %3lld  "
+           "%6lld  %13.0f\n", start, p->txBytes, p->rxBytes, p->txData,
+           p->txResent, p->txNaks, p->rxData, p->rxDup, p->rxBad,
+           p->rxResync, (length > 0.0) ? 8.0 * p->rxDataBytes / length
+                                       : 0.0);
+}
+
+
+/* Function to print the totals, and the reasons frames received
+   were rejected, from the counters of the receiving link.
+   Arguments: counts for the whole trace, its length in seconds.  */
+void printTotals(Period *p, double seconds)
+{
+    LL_stats st;  // counters of the receiving link
+
+    LL_getStats(&rxLink, &st);
+    printf("\nTrace of %.3f s\n", seconds);
+    printf("Sent: %lld bytes, %ld data frames, %ld of them again, "
+           "%ld acks, %ld NAKs, %ld parameters\n", p->txBytes, p->txData,
+           p->txResent, p->txAcks, p->txNaks, p->txParams);
+    printf("Received: %lld bytes, %ld new blocks of %lld bytes, "
+           "%ld duplicates, %ld acks, %ld NAKs, %ld parameters\n",
+           p->rxBytes, p->rxData, p->rxDataBytes, p->rxDup, p->rxAcks,
+           p->rxNaks, p->rxParams);
+    printf("Rejected: %lld frames - %lld check sequence, %lld marker, "
+           "%lld byte count, %lld other; %lld bytes thrown away\n",
+           p->rxBad, st.rxBadFcs, st.rxBadMarker, st.rxBadCount,
+           st.rxBadOther, p->rxResync);
+    printf("Corrected: %lld bytes in %lld frames, %lld frames could not "
+           "be corrected\n", st.rxFecFixed, st.rxFecFrames, st.rxFecFailed);
+}